@@ -27,6 +27,26 @@ public enum ErrorCode {
      */
     INVALID_USER_NAME(2),
 
+    /*!
+     * The room name was invalid (e.g. empty).
+     */
+    INVALID_ROOM_NAME(3),
+
+    /*!
+     * The client is not a member of the room it addressed.
+     */
+    NOT_IN_ROOM(4),
+
+    /*!
+     * The recipient of a direct message is not logged in.
+     */
+    UNKNOWN_RECIPIENT(5),
+
+    /*!
+     * The client sent faster than the server allows and is being disconnected.
+     */
+    RATE_LIMITED(6),
+
     MALFORMED_REQUEST_UNKNWN(200),
 
     MALFORMED_REQUEST_NO_TYPE(201),
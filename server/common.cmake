@@ -10,4 +10,45 @@ set(system_LIBRARIES ${CMAKE_THREAD_LIBS_INIT} ${Boost_LIBRARIES})
 if(UNIX AND NOT APPLE)
     # Add librt if on Linux 
     list(APPEND system_LIBRARIES rt)
-endif()
\ No newline at end of file
+endif()
+
+# Least severe log level compiled in, calls below it are elided
+set(LOG_LEVEL "INFO" CACHE STRING "TRACE, DEBUG, INFO, WARN or ERROR")
+add_definitions(-DSE3313_LOG_MIN_LEVEL=${LOG_LEVEL})
+
+# Profile-guided optimization, driven end to end by tools/pgo.sh: GENERATE builds binaries that write
+# their profile to PGO_PROFILE_DIR when they exit, USE then rebuilds them from it with LTO. Both have
+# to build in the same directory, the profile is matched to the object files by their paths.
+set(PGO "OFF" CACHE STRING "OFF, GENERATE or USE")
+set(PGO_PROFILE_DIR "${CMAKE_BINARY_DIR}/pgo-profile" CACHE PATH "Profile written and read by PGO builds")
+option(LTO "Optimize across translation units at link time" OFF)
+
+# tools/pgo.sh configures its builds with cmake -S/-B, new in CMake 3.13, and USE covers the code the
+# training missed with -fprofile-partial-training, new in GCC 10
+set(PGO_UNSUPPORTED "")
+if(CMAKE_VERSION VERSION_LESS 3.13)
+    set(PGO_UNSUPPORTED "PGO builds need CMake 3.13 or later, this is CMake ${CMAKE_VERSION}")
+elseif(NOT CMAKE_CXX_COMPILER_ID STREQUAL "GNU" OR CMAKE_CXX_COMPILER_VERSION VERSION_LESS 10)
+    set(PGO_UNSUPPORTED "PGO builds need GCC 10 or later, this is ${CMAKE_CXX_COMPILER_ID} ${CMAKE_CXX_COMPILER_VERSION}")
+endif()
+if(PGO_UNSUPPORTED AND NOT PGO STREQUAL "OFF")
+    message(FATAL_ERROR "${PGO_UNSUPPORTED}")
+endif()
+
+if(PGO STREQUAL "GENERATE")
+    # the server counts on several threads at once
+    add_compile_options(-fprofile-generate=${PGO_PROFILE_DIR} -fprofile-update=atomic)
+    set(CMAKE_EXE_LINKER_FLAGS "${CMAKE_EXE_LINKER_FLAGS} -fprofile-generate=${PGO_PROFILE_DIR}")
+elseif(PGO STREQUAL "USE")
+    # code the training never reached is still optimized for speed, not size
+    add_compile_options(-fprofile-use=${PGO_PROFILE_DIR} -fprofile-correction -fprofile-partial-training -Wno-missing-profile)
+    set(LTO ON)
+elseif(NOT PGO STREQUAL "OFF")
+    message(FATAL_ERROR "PGO must be OFF, GENERATE or USE, not ${PGO}")
+endif()
+
+if(LTO)
+    include(CheckIPOSupported)
+    check_ipo_supported()
+    set(CMAKE_INTERPROCEDURAL_OPTIMIZATION ON)
+endif()
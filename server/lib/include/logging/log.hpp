@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+#ifndef SE3313_LOGGING_LOG_HPP
+#define SE3313_LOGGING_LOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace se3313
+{
+
+namespace logging
+{
+
+/// Severity of a record
+enum class level : uint8_t {
+    TRACE = 0,
+    DEBUG = 1,
+    INFO  = 2,
+    WARN  = 3,
+    ERROR = 4,
+    
+    /// Disables logging altogether
+    OFF   = 5
+};
+
+/// Least severe level compiled in, set with `-DSE3313_LOG_MIN_LEVEL=DEBUG` (the `LOG_LEVEL` cmake cache variable)
+#ifndef SE3313_LOG_MIN_LEVEL
+#define SE3313_LOG_MIN_LEVEL INFO
+#endif
+
+#define SE3313_LOG_STRINGIZE_(x) #x
+#define SE3313_LOG_STRINGIZE(x) SE3313_LOG_STRINGIZE_(x)
+
+/// Name of @c SE3313_LOG_MIN_LEVEL, for usage messages
+#define SE3313_LOG_MIN_LEVEL_NAME SE3313_LOG_STRINGIZE(SE3313_LOG_MIN_LEVEL)
+
+/// `true` if records of level @p l exist in this build, calls below it compile to nothing.
+constexpr 
+bool compiled(const level l) 
+{ 
+    return static_cast<uint8_t>(l) >= static_cast<uint8_t>(level::SE3313_LOG_MIN_LEVEL); 
+}
+
+/// Tunables of the logger, see `configure()`
+struct config
+{
+    /// Least severe level written
+    level threshold = level::INFO;
+    
+    /// File records are appended to, standard output while empty
+    std::string path;
+    
+    /// Longest a record waits before the writer picks it up
+    std::chrono::milliseconds flushInterval = std::chrono::milliseconds(10);
+};
+
+/**
+ * Applies @p conf, opening its file. Throws a @c std::runtime_error if the file can not be opened, 
+ * the previous output is kept then.
+ */
+void configure(const config& conf);
+
+/// Writes everything logged so far before returning.
+void flush();
+
+/// Records dropped because their thread's buffer was full
+uint64_t dropped();
+
+namespace detail
+{
+
+/// Threshold of `configure()`, read on every call site that is compiled in
+extern std::atomic<uint8_t> g_threshold;
+
+} // end namespace detail
+
+/// `true` if records of level @p l are written.
+inline
+bool enabled(const level l)
+{
+    return compiled(l) && static_cast<uint8_t>(l) >= detail::g_threshold.load(std::memory_order_relaxed);
+}
+
+/**
+ * One record being formatted, handed to the logger when it is destroyed. 
+ * 
+ * Formatting happens on the caller's thread into a fixed buffer, without allocating. The record is then
+ * copied into a buffer owned by the calling thread, which only a background writer reads from, so
+ * logging never takes a lock or waits for the disk. When that buffer is full the record is dropped 
+ * and counted. Longer records are truncated.
+ * 
+ * Use the `SE3313_LOG_*` macros rather than this type directly.
+ */
+class line final
+{
+    
+public:
+    
+    /// Bytes of text kept per record
+    static constexpr size_t MAX_TEXT = 240;
+    
+    line(const level l, const char* const file, const int lineNo)
+        : _level(l)
+        , _file(file)
+        , _line(lineNo)
+        , _length(0)
+    { }
+    
+    line(const line&) = delete;
+    line& operator=(const line&) = delete;
+    
+    /// Queues the record.
+    ~line();
+    
+    line& operator<<(const boost::string_ref s)
+    {
+        const size_t n = std::min(s.size(), MAX_TEXT - _length);
+        std::memcpy(_text + _length, s.data(), n);
+        _length += n;
+        return *this;
+    }
+    
+    line& operator<<(const char* const s) { return *this << boost::string_ref(s ? s : "(null)"); }
+    
+    line& operator<<(const std::string& s) { return *this << boost::string_ref(s); }
+    
+    line& operator<<(const char c) { return *this << boost::string_ref(&c, 1); }
+    
+    line& operator<<(const bool b) { return *this << (b ? "true" : "false"); }
+    
+    line& operator<<(const double d);
+    
+    line& operator<<(const void* const p);
+    
+    template <typename I>
+    typename std::enable_if<std::is_integral<I>::value, line&>::type operator<<(const I i)
+    {
+        return std::is_signed<I>::value ? formatSigned(static_cast<long long>(i)) 
+                                        : formatUnsigned(static_cast<unsigned long long>(i));
+    }
+    
+    template <typename E>
+    typename std::enable_if<std::is_enum<E>::value, line&>::type operator<<(const E e)
+    {
+        return *this << static_cast<typename std::underlying_type<E>::type>(e);
+    }
+    
+    template <typename R, typename P>
+    line& operator<<(const std::chrono::duration<R, P> d)
+    {
+        return *this << std::chrono::duration_cast<std::chrono::microseconds>(d).count() << "us";
+    }
+    
+private:
+    
+    line& formatSigned(const long long v);
+    
+    line& formatUnsigned(const unsigned long long v);
+    
+    const level _level;
+    const char* const _file;
+    const int _line;
+    
+    size_t _length;
+    char _text[MAX_TEXT];
+};
+
+} // end namespace logging
+
+} // end namespace se3313
+
+/**
+ * Logs the `<<` separated @p expr at @p lvl, e.g. `SE3313_LOG(INFO, "accepted " << fd)`. Nothing is 
+ * evaluated when the level is disabled, and nothing is compiled below @c SE3313_LOG_MIN_LEVEL.
+ */
+#define SE3313_LOG(lvl, expr) \
+    do { \
+        if (::se3313::logging::enabled(::se3313::logging::level::lvl)) \
+        { \
+            ::se3313::logging::line se3313_log_line_(::se3313::logging::level::lvl, __FILE__, __LINE__); \
+            se3313_log_line_ << expr; \
+        } \
+    } while (false)
+
+#define SE3313_LOG_TRACE(expr) SE3313_LOG(TRACE, expr)
+#define SE3313_LOG_DEBUG(expr) SE3313_LOG(DEBUG, expr)
+#define SE3313_LOG_INFO(expr)  SE3313_LOG(INFO, expr)
+#define SE3313_LOG_WARN(expr)  SE3313_LOG(WARN, expr)
+#define SE3313_LOG_ERROR(expr) SE3313_LOG(ERROR, expr)
+
+#endif // SE3313_LOGGING_LOG_HPP
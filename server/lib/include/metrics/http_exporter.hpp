@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+#ifndef SE3313_METRICS_HTTPEXPORTER_HPP
+#define SE3313_METRICS_HTTPEXPORTER_HPP
+
+#include "networking/socket.hpp"
+
+#include <thread>
+
+namespace se3313
+{
+
+namespace metrics
+{
+
+/**
+ * Serves `registry::exposition()` as `GET /metrics` on a loopback port, for Prometheus to scrape.
+ * 
+ * Requests are answered one at a time on a thread of their own, so a scrape never stalls the
+ * thread serving clients.
+ */
+class http_exporter final
+{
+    
+public:
+    
+    /// Starts serving on 127.0.0.1:@p port. Throws a @c std::runtime_error if the port can not be bound.
+    explicit http_exporter(const networking::port_t port);
+    
+    /// Stops serving and joins the thread.
+    ~http_exporter();
+    
+    http_exporter(const http_exporter&) = delete;
+    http_exporter& operator=(const http_exporter&) = delete;
+    
+private:
+    
+    /// Body of the serving thread
+    void run();
+    
+    /// Answers the connection on @p fd and closes it.
+    void answer(const int fd);
+    
+    int _listenFD;
+    
+    /// Written to by the destructor to stop the thread
+    int _stopEventFD;
+    
+    std::thread _thread;
+};
+
+} // end namespace metrics
+
+} // end namespace se3313
+
+#endif // SE3313_METRICS_HTTPEXPORTER_HPP
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+#ifndef SE3313_METRICS_REGISTRY_HPP
+#define SE3313_METRICS_REGISTRY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace se3313
+{
+
+namespace metrics
+{
+
+namespace detail
+{
+
+/// Cells available to all metrics together, each thread has this many
+constexpr uint32_t MAX_CELLS = 8192;
+
+/// Sub-buckets per power of two in a @c latency, bounding its relative error to 1/16
+constexpr uint32_t LATENCY_SUB_BUCKETS = 16;
+
+/// Powers of two covered by a @c latency past the exact values, up to about 68 seconds in nanoseconds
+constexpr uint32_t LATENCY_OCTAVES = 32;
+
+/// Buckets of a @c latency
+constexpr uint32_t LATENCY_BUCKETS = LATENCY_SUB_BUCKETS * (LATENCY_OCTAVES + 1);
+
+/**
+ * Bucket of @p v: values below @c LATENCY_SUB_BUCKETS have one each, above that every power of two 
+ * is split into @c LATENCY_SUB_BUCKETS linear buckets (the HdrHistogram layout).
+ */
+inline
+uint32_t latencyBucket(const uint64_t v)
+{
+    if (v < LATENCY_SUB_BUCKETS)
+    {
+        return static_cast<uint32_t>(v);
+    }
+    
+    const uint32_t msb = 63 - static_cast<uint32_t>(__builtin_clzll(v));
+    const uint32_t octave = msb - 3;
+    if (octave > LATENCY_OCTAVES)
+    {
+        return LATENCY_BUCKETS - 1;
+    }
+    return octave * LATENCY_SUB_BUCKETS + static_cast<uint32_t>((v >> (msb - 4)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/// Largest value falling in bucket @p b.
+uint64_t latencyBucketMax(const uint32_t b);
+
+/// The calling thread's cells, `nullptr` until it first records something
+extern thread_local std::atomic<uint64_t>* t_cells;
+
+/// Allocates the calling thread's cells.
+std::atomic<uint64_t>* attach();
+
+inline
+std::atomic<uint64_t>* cells()
+{
+    std::atomic<uint64_t>* const c = t_cells;
+    return c ? c : attach();
+}
+
+/**
+ * Adds @p n to @p cell. Only the owning thread writes its cells, so a plain load and store is enough,
+ * the atomics only keep the exporter's reads well defined.
+ */
+inline
+void add(std::atomic<uint64_t>& cell, const uint64_t n)
+{
+    cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/// Sum of @p cell over every thread, past and present.
+uint64_t sum(const uint32_t cell);
+
+} // end namespace detail
+
+/// Monotonic count of events, e.g. requests received
+class counter final
+{
+    
+public:
+    
+    void inc(const uint64_t n = 1) const
+    {
+        detail::add(detail::cells()[_cell], n);
+    }
+    
+    /// Total over all threads
+    uint64_t value() const { return detail::sum(_cell); }
+    
+private:
+    
+    friend class registry;
+    
+    explicit counter(const uint32_t cell) : _cell(cell) { }
+    
+    uint32_t _cell;
+};
+
+/// Level that goes up and down, e.g. open sessions. Threads may add and subtract independently.
+class gauge final
+{
+    
+public:
+    
+    void add(const int64_t n) const
+    {
+        detail::add(detail::cells()[_cell], static_cast<uint64_t>(n));
+    }
+    
+    void inc() const { add(1); }
+    
+    void dec() const { add(-1); }
+    
+    /// Sum over all threads
+    int64_t value() const { return static_cast<int64_t>(detail::sum(_cell)); }
+    
+private:
+    
+    friend class registry;
+    
+    explicit gauge(const uint32_t cell) : _cell(cell) { }
+    
+    uint32_t _cell;
+};
+
+/// Distribution of observed values in fixed buckets, e.g. request sizes
+class histogram final
+{
+    
+public:
+    
+    void observe(const double v) const
+    {
+        std::atomic<uint64_t>* const c = detail::cells() + _first;
+        
+        // bounds are few and sorted, a linear scan beats a binary search on them
+        size_t b = 0;
+        while (b < _bounds->size() && v > (*_bounds)[b])
+        {
+            ++b;
+        }
+        detail::add(c[b], 1);
+        
+        // the sum is kept as the bits of a double, which only this thread writes
+        std::atomic<uint64_t>& sumCell = c[_bounds->size() + 1];
+        double sum;
+        const uint64_t bits = sumCell.load(std::memory_order_relaxed);
+        std::memcpy(&sum, &bits, sizeof(sum));
+        sum += v;
+        uint64_t updated;
+        std::memcpy(&updated, &sum, sizeof(sum));
+        sumCell.store(updated, std::memory_order_relaxed);
+    }
+    
+private:
+    
+    friend class registry;
+    
+    histogram(const uint32_t first, const std::vector<double>* const bounds) : _first(first), _bounds(bounds) { }
+    
+    /// Cells of the buckets, the last one unbounded, followed by the sum
+    uint32_t _first;
+    
+    /// Upper bounds of the buckets, owned by the registry
+    const std::vector<double>* _bounds;
+};
+
+/// Percentiles of a @c latency, in nanoseconds
+struct latency_snapshot
+{
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+/**
+ * Distribution of durations with percentiles, e.g. how long parsing takes. Values are bucketed with 
+ * bounded relative error over the whole range, so percentiles need no configured bounds.
+ */
+class latency final
+{
+    
+public:
+    
+    void record(const uint64_t ns) const
+    {
+        std::atomic<uint64_t>* const c = detail::cells() + _first;
+        detail::add(c[detail::latencyBucket(ns)], 1);
+        detail::add(c[detail::LATENCY_BUCKETS], ns);
+        
+        std::atomic<uint64_t>& max = c[detail::LATENCY_BUCKETS + 1];
+        if (ns > max.load(std::memory_order_relaxed))
+        {
+            max.store(ns, std::memory_order_relaxed);
+        }
+    }
+    
+    /// Percentiles over all threads since start
+    latency_snapshot snapshot() const;
+    
+private:
+    
+    friend class registry;
+    
+    explicit latency(const uint32_t first) : _first(first) { }
+    
+    /// Cells of the buckets, followed by the sum and the maximum
+    uint32_t _first;
+};
+
+/**
+ * Process wide set of metrics.
+ * 
+ * Every thread records into its own array of cells, so recording never contends with other threads:
+ * it is a thread local lookup, a load and a store. Only exporting sums the cells over the threads.
+ * When a thread exits its cells are folded into a shared total.
+ * 
+ * Registering the same name and labels twice returns the same metric, so call sites may register
+ * from function local statics. Metrics are never removed.
+ */
+class registry final
+{
+    
+public:
+    
+    /**
+     * Registers a counter.
+     * @param name Prometheus name, e.g. `chat_requests_total`
+     * @param help One line description
+     * @param labels Constant labels without braces, e.g. `type="login"`, empty for none
+     */
+    static counter makeCounter(const std::string& name, const std::string& help, const std::string& labels = std::string());
+    
+    /// Registers a gauge, see `makeCounter()`.
+    static gauge makeGauge(const std::string& name, const std::string& help, const std::string& labels = std::string());
+    
+    /// Registers a histogram with buckets up to each of @p bounds (ascending) and one unbounded.
+    static histogram makeHistogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                                   const std::string& labels = std::string());
+    
+    /// Registers a latency, exported as a summary of its percentiles in seconds, see `makeCounter()`.
+    static latency makeLatency(const std::string& name, const std::string& help, const std::string& labels = std::string());
+    
+    /// Every metric in the Prometheus text exposition format (version 0.0.4).
+    static std::string exposition();
+    
+    /// Bounds growing by @p factor from @p first, @p count of them.
+    static std::vector<double> exponentialBounds(const double first, const double factor, const size_t count);
+};
+
+} // end namespace metrics
+
+} // end namespace se3313
+
+#endif // SE3313_METRICS_REGISTRY_HPP
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+#ifndef SE3313_MSG_DIRECT_HPP_
+#define SE3313_MSG_DIRECT_HPP_
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+
+#include "instance.hpp"
+
+namespace se3313 {
+
+namespace msg {
+
+namespace request {
+
+/**
+ * A private message from a client to a single user.
+ */
+class direct: public abstract_instance<direct> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.request.DirectMessageRequest";
+    
+    /// Property for who receives the message
+    constexpr static const char PROPERTY_RECIPIENT[] = "recipient";
+    
+    /// Property for the payload
+    constexpr static const char PROPERTY_CONTENT[] = "content";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_RECIPIENT, &direct::recipient),
+                                              schema::make_field(PROPERTY_CONTENT, &direct::content)));
+    }
+    
+    /// Dispatches to \c V::visitDirect.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const direct& req) { return visitor.visitDirect(req); }
+    
+    /**
+     * Creates a direct message.
+     * @param dateTime When the message was sent
+     * @param from Who sent the message
+     * @param recipient Who receives the message
+     * @param content The payload
+     */
+    direct(const time_point_t dateTime, const std::string& from, const std::string& recipient, const std::string& content)
+        : abstract_instance(dateTime, from)
+        , _recipient(recipient)
+        , _content(content) {}
+    
+    /// Delegate constructor, sets the time to `now()`.
+    direct(const std::string& from, const std::string& recipient, const std::string& content)
+        : direct(clock_t::now(), from, recipient, content) {}
+    
+    /// Default destructor
+    virtual ~direct() = default;
+    
+    /// Who receives the message
+    const std::string recipient() const { return _recipient; }
+
+    /// The payload
+    const std::string content() const { return _content; }
+
+private:
+
+    /// Who receives the message
+    const std::string _recipient;
+    
+    /// The payload
+    const std::string _content;
+
+};
+
+} // end namespace request
+
+namespace response {
+
+/**
+ * A private message delivered by the server to its recipient.
+ */
+class direct: public abstract_instance<direct> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.response.DirectMessageResponse";
+    
+    /// Property for who sent the message
+    constexpr static const char PROPERTY_ORIGINATOR[] = "originator";
+    
+    /// Property for who receives the message
+    constexpr static const char PROPERTY_RECIPIENT[] = "recipient";
+    
+    /// Property for the payload
+    constexpr static const char PROPERTY_CONTENT[] = "content";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_ORIGINATOR, &direct::originator),
+                                              schema::make_field(PROPERTY_RECIPIENT, &direct::recipient),
+                                              schema::make_field(PROPERTY_CONTENT, &direct::content)));
+    }
+    
+    /// Dispatches to \c V::visitDirect.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const direct& res) { return visitor.visitDirect(res); }
+    
+    /**
+     * Creates a direct message response.
+     * @param dateTime When the server sent the message
+     * @param sender Who sent the response, usually the server
+     * @param originator Who sent the original message
+     * @param recipient Who receives the message
+     * @param content The payload
+     */
+    direct(const time_point_t dateTime, const std::string& sender, const std::string& originator, 
+           const std::string& recipient, const std::string& content)
+        : abstract_instance(dateTime, sender)
+        , _originator(originator)
+        , _recipient(recipient)
+        , _content(content) {}
+    
+    /// Delegate constructor, the server sends the message `now()`.
+    direct(const std::string& originator, const std::string& recipient, const std::string& content)
+        : direct(clock_t::now(), instance::SERVER_SENDER, originator, recipient, content) {}
+    
+    /// Default destructor
+    virtual ~direct() = default;
+    
+    /// Who sent the original message
+    const std::string originator() const { return _originator; }
+    
+    /// Who receives the message
+    const std::string recipient() const { return _recipient; }
+
+    /// The payload
+    const std::string content() const { return _content; }
+
+private:
+
+    /// Who sent the original message
+    const std::string _originator;
+    
+    /// Who receives the message
+    const std::string _recipient;
+    
+    /// The payload
+    const std::string _content;
+
+};
+
+} // end namespace response
+
+} // end namespace msg
+
+} // end namespace se3313
+
+#endif // SE3313_MSG_DIRECT_HPP_
@@ -58,6 +58,26 @@ enum class ErrorCode: uint16_t {
      * The User Name was invalid (e.g. empty).
      */
     INVALID_USER_NAME       = 2,
+    
+    /*!
+     * The room name was invalid (e.g. empty).
+     */
+    INVALID_ROOM_NAME       = 3,
+    
+    /*!
+     * The client is not a member of the room it addressed.
+     */
+    NOT_IN_ROOM             = 4,
+    
+    /*!
+     * The recipient of a direct message is not logged in.
+     */
+    UNKNOWN_RECIPIENT       = 5,
+    
+    /*!
+     * The client sent faster than the server allows and is being disconnected.
+     */
+    RATE_LIMITED            = 6,
 
     MALFORMED_REQUEST_UNKNWN    = 200,
 
@@ -87,11 +107,23 @@ public:
     /// Who sent the error originally
     constexpr static const char PROPERTY_ORIGINATOR[] = "originator";
     
-    /**
-     * Converts a json tree to an instance.
-     */
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_ORIGINATOR, &error::originator),
+                                              schema::make_field(PROPERTY_CODE, &error::code),
+                                              schema::make_field(PROPERTY_MESSAGE, &error::message)));
+    }
+    
+    /// Dispatches to \c V::error with the decoded properties.
+    template <typename V>
     static 
-    std::shared_ptr<error> fromJson(boost::property_tree::ptree& json);
+    typename V::return_t accept(V& visitor, const error& res) 
+    { 
+        return visitor.error(res.originator(), res.code(), res.message()); 
+    }
 
     /**
      * Delegate constructor defaulting time to now and sender to the server.
@@ -133,12 +165,6 @@ public:
     /// Get the error code
     const ErrorCode code() const { return _errorCode; }
 
-protected:
-    
-    /// Get the subtree for the error
-    virtual
-    boost::property_tree::ptree subToJson() const;
-
 private:
 
     const std::string _originator;
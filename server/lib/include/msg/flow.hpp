@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+#ifndef SE3313_MSG_FLOW_HPP_
+#define SE3313_MSG_FLOW_HPP_
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+
+#include "instance.hpp"
+
+namespace se3313 {
+
+namespace msg {
+
+namespace response {
+
+/**
+ * Tells a client that advertised \c request::login::CAPABILITY_FLOW_CONTROL to hold off sending, or
+ * that it may send again. The server stops reading from the client either way, the message only 
+ * spares it from filling its own buffers.
+ */
+class flow_control: public abstract_instance<flow_control> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.response.FlowControlResponse";
+    
+    /// Property for what the client should do
+    constexpr static const char PROPERTY_ACTION[] = "action";
+    
+    /// Stop sending until told to resume
+    constexpr static const char ACTION_PAUSE[] = "pause";
+    
+    /// Sending is welcome again
+    constexpr static const char ACTION_RESUME[] = "resume";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_ACTION, &flow_control::action)));
+    }
+    
+    /// Dispatches to \c V::visitFlowControl.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const flow_control& res) { return visitor.visitFlowControl(res); }
+    
+    /**
+     * Creates a flow control message.
+     * @param dateTime When the server sent it
+     * @param sender Who sent it, usually the server
+     * @param action \c ACTION_PAUSE or \c ACTION_RESUME
+     */
+    flow_control(const time_point_t dateTime, const std::string& sender, const std::string& action)
+        : abstract_instance(dateTime, sender)
+        , _action(action) {}
+    
+    /// Delegate constructor, the server sends the message `now()`.
+    flow_control(const std::string& action)
+        : flow_control(clock_t::now(), instance::SERVER_SENDER, action) {}
+    
+    /// Default destructor
+    virtual ~flow_control() = default;
+    
+    /// What the client should do
+    const std::string action() const { return _action; }
+
+private:
+
+    /// What the client should do
+    const std::string _action;
+
+};
+
+} // end namespace response
+
+} // end namespace msg
+
+} // end namespace se3313
+
+#endif // SE3313_MSG_FLOW_HPP_
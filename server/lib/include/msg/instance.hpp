@@ -26,14 +26,18 @@
 
 #include <chrono>
 #include <chrono_io>
+#include <iostream>
 #include <sstream>
 #include <string>
+#include <tuple>
 
 #include <boost/optional.hpp>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include "schema.hpp"
+
 namespace se3313
 {
 
@@ -72,6 +76,9 @@ public:
     /// Unknown sender
     constexpr static const char UNKNOWN_SENDER[] = "@unknown";
     
+    /// Room every client joins on login, and the room of messages that do not name one
+    constexpr static const char DEFAULT_ROOM[] = "lobby";
+    
     /**
      * Converts a json tree to the type <T>
      */
@@ -90,6 +97,9 @@ public:
      */
     virtual const time_point_t dateTime() const = 0;
     
+    /// The `type` property written for this message
+    virtual const char* type() const = 0;
+    
     /// Default destructor
     virtual ~instance() = default;
     
@@ -129,6 +139,10 @@ std::ostream& operator<<(std::ostream& os, const instance& inst)
  * Base abstract implementation of most of the methods in \c instance. This is the ideal
  * class to inherit from when working with instance types. 
  * 
+ * Subtypes describe their properties with a `constexpr static fields()` function (see 
+ * \c schema), usually `std::tuple_cat(baseFields(), ...)`, and the JSON and binary 
+ * conversions are generated from it.
+ * 
  * @param S The type that inherits this type, this is an example of the 
  *          <a href="https://en.wikipedia.org/wiki/Curiously_recurring_template_pattern">Curiously recurring template pattern</a>
  *          which makes the subtypes easier to work with. Always make sure S is the subtype. 
@@ -158,16 +172,61 @@ public:
     virtual 
     const time_point_t dateTime() const override { return _dateTime; }
     
+    /// The `type` property written for this message
+    virtual
+    const char* type() const override { return S::TYPE; }
+    
     /**
      * Converts the current instance into a JSON tree.
      */
     boost::property_tree::ptree toJson() const final;
     
+    /**
+     * Converts an object tree into an \c S.
+     * 
+     * @return `nullptr` if a property is missing or malformed.
+     */
+    static 
+    std::shared_ptr<S> fromJson(const boost::property_tree::ptree& json)
+    {
+        return schema::from_json<S>(json);
+    }
+    
+    /**
+     * Appends the compact binary form of this instance to @p out. 
+     */
+    void toBinary(std::string* const out) const
+    {
+        schema::encode(static_cast<const S&>(*this), out);
+    }
+    
+    /**
+     * Reads an \c S written by \m toBinary, advancing @p first.
+     * 
+     * @return `nullptr` if the buffer is truncated.
+     */
+    static 
+    std::shared_ptr<S> fromBinary(const char** first, const char* last)
+    {
+        return schema::decode<S>(first, last);
+    }
+    
 protected:
     
-    // Converts the underlying fields into a Json tree
+    /// Converts the underlying fields into a Json tree
     virtual
-    boost::property_tree::ptree subToJson() const override = 0;
+    boost::property_tree::ptree subToJson() const override
+    {
+        return schema::to_json(static_cast<const S&>(*this));
+    }
+    
+    /// Fields shared by every instance, these are the first two constructor parameters.
+    constexpr static 
+    auto baseFields()
+    {
+        return std::make_tuple(schema::make_field(instance::PROPERTY_DATETIME, &abstract_instance::dateTime),
+                               schema::make_field(instance::PROPERTY_SENDER, &abstract_instance::sender));
+    }
     
     /// The sender of the message
     const std::string _sender;
@@ -175,13 +234,6 @@ protected:
     /// When the message was sent
     const time_point_t _dateTime;
     
-    /// Puts the common parameters in this type into a ptree.
-    boost::property_tree::ptree baseJson() const;
-    
-    /// Does the converse of \m baseJson, gets the params from a tree. 
-    static 
-    void extractCommonParams(boost::property_tree::ptree& json, time_point_t* const time, std::string* const sender);
-    
 };
 
 template <typename T>
@@ -209,45 +261,6 @@ boost::property_tree::ptree abstract_instance<S>::toJson() const
 }
 
 
-template <typename S>
-void abstract_instance<S>::extractCommonParams(boost::property_tree::ptree& json, instance::time_point_t* const time, std::string* const sender)
-{
-    BOOST_ASSERT(!!sender && !!time);
-    // make sure the time and sender are valid
-    
-    const auto timeIt = json.find(PROPERTY_DATETIME);
-    if (timeIt == json.not_found())
-    {
-        boost::property_tree::write_json(std::cerr, json, true);
-        throw std::runtime_error("Could not get datetime property.");
-    }
-    
-    const auto senderIt = json.find(PROPERTY_SENDER);
-    if (senderIt == json.not_found())
-    {
-        boost::property_tree::write_json(std::cerr, json, true);
-        throw std::runtime_error("Could not get sender property.");
-    }
-    
-    std::istringstream time_ss(timeIt->second.get_value<std::string>());
-    time_ss >> *time;
-    
-    *sender = json.get<std::string>(PROPERTY_SENDER);
-}
-
-template <typename S>
-boost::property_tree::ptree abstract_instance<S>::baseJson() const
-{
-
-    boost::property_tree::ptree json;
-    
-    json.put(instance::PROPERTY_DATETIME, this->dateTime());
-    json.put(instance::PROPERTY_SENDER, this->sender());
-    
-    return json;
-}
-
-
 } // end namespace msg
 
 } // end namespace se3313
@@ -27,6 +27,8 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include "metrics/registry.hpp"
+
 
 namespace se3313
 {
@@ -61,9 +63,21 @@ boost::property_tree::ptree from(const std::string& input) {
     std::istringstream ss;
     ss.str(cpy);
     
+    static const metrics::counter parsed = metrics::registry::makeCounter("msg_json_parsed_total", "JSON documents parsed");
+    static const metrics::counter parsedBytes = metrics::registry::makeCounter("msg_json_parsed_bytes_total", "Bytes of JSON parsed");
+    static const metrics::counter errors = metrics::registry::makeCounter("msg_json_parse_errors_total", "JSON documents that failed to parse");
+    try 
+    {
+        boost::property_tree::read_json(ss, ptree);
+    }
+    catch (const boost::property_tree::json_parser_error&)
+    {
+        errors.inc();
+        throw;
+    }
     
-    boost::property_tree::read_json(ss, ptree);
-
+    parsed.inc();
+    parsedBytes.inc(input.size());
     return ptree;
 }
 
@@ -75,9 +89,15 @@ boost::property_tree::ptree from(const std::string& input) {
 static inline
 const std::string to(boost::property_tree::ptree ptree, const bool pretty = false)
 {
+    static const metrics::counter written = metrics::registry::makeCounter("msg_json_written_total", "JSON documents written");
+    static const metrics::counter writtenBytes = metrics::registry::makeCounter("msg_json_written_bytes_total", "Bytes of JSON written");
+    
     std::ostringstream ss;
     boost::property_tree::write_json(ss, ptree, pretty);
-    return ss.str();
+    std::string out = ss.str();
+    written.inc();
+    writtenBytes.inc(out.size());
+    return out;
 }
     
 }
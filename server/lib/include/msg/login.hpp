@@ -47,31 +47,67 @@ public:
    
     /// Java-land type
     constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.request.LoginRequest";
-
-    /// Converts a ptree to a \c login.
-    static
-    std::shared_ptr<login> fromJson(boost::property_tree::ptree& json);
+    
+    /// Property listing optional protocol features the client understands, comma separated
+    constexpr static const char PROPERTY_CAPABILITIES[] = "capabilities";
+    
+    /// Capability of clients that honour \c response::flow_control
+    constexpr static const char CAPABILITY_FLOW_CONTROL[] = "flow-control";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    { 
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_optional_field(PROPERTY_CAPABILITIES, &login::capabilities, "")));
+    }
+    
+    /// Dispatches to \c V::visitLogin.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const login& req) { return visitor.visitLogin(req); }
     
     /**
      * Creates an instance of \c login
      * 
      * @param datetime When the request occurred
      * @param username Who is requesting to connect 
+     * @param capabilities Optional features the client understands, comma separated
      */
-    login(const time_point_t datetime, const std::string& username)
-        : abstract_instance(datetime, username) {}
+    login(const time_point_t datetime, const std::string& username, const std::string& capabilities = "")
+        : abstract_instance(datetime, username)
+        , _capabilities(capabilities) {}
       
     /// Delegate constructor defaulting the time to `now()`.  
-    login(const std::string& username)
-        : login(clock_t::now(), username) {}
+    login(const std::string& username, const std::string& capabilities = "")
+        : login(clock_t::now(), username, capabilities) {}
     
     /// Default destructor
     virtual ~login() = default;
-
-protected: 
     
-    virtual
-    boost::property_tree::ptree subToJson() const override;
+    /// Optional features the client understands, comma separated
+    const std::string capabilities() const { return _capabilities; }
+    
+    /// `true` if @p capability is one of \c capabilities().
+    bool supports(const std::string& capability) const
+    {
+        std::istringstream ss(_capabilities);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item == capability)
+            {
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+private:
+    
+    /// Optional features the client understands
+    const std::string _capabilities;
 
 };
 
@@ -92,11 +128,18 @@ public:
     /// States who just joined
     constexpr static const char PROPERTY_JOINING_USERNAME[] = "joiningUsername";
 
-    /**
-     * Converts a ptree into a \c login.
-     */
-    static
-    std::shared_ptr<login> fromJson(boost::property_tree::ptree& json);
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_JOINING_USERNAME, &login::joiningUsername)));
+    }
+    
+    /// Dispatches to \c V::visitLogin.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const login& res) { return visitor.visitLogin(res); }
     
     /**
      * Creates a login response.
@@ -130,11 +173,6 @@ public:
      * The username who joined
      */
     const std::string joiningUsername() const { return _username; }
-    
-protected:
-    
-    virtual
-    boost::property_tree::ptree subToJson() const override;
 
 private:
 
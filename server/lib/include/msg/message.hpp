@@ -50,26 +50,42 @@ public:
     
     /// Property for the payload
     constexpr static const char PROPERTY_CONTENT[] = "content";
-
-    /// Converts a Json tree into a \c message. 
-    static
-    std::shared_ptr<message> fromJson(boost::property_tree::ptree& json);
+    
+    /// Property for the destination room, optional 
+    constexpr static const char PROPERTY_ROOM[] = "room";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_CONTENT, &message::content),
+                                              schema::make_optional_field(PROPERTY_ROOM, &message::room, instance::DEFAULT_ROOM)));
+    }
+    
+    /// Dispatches to \c V::visitMessage.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const message& req) { return visitor.visitMessage(req); }
     
     /**
      * Constructs a new instance of a message
      * @param dateTime When the message was sent
      * @param from Who sent the mssage
      * @param content The payload
+     * @param room Room the message is sent to
      */
-    message(const time_point_t dateTime, const std::string& from, const std::string& content)
+    message(const time_point_t dateTime, const std::string& from, const std::string& content, 
+            const std::string& room = instance::DEFAULT_ROOM)
         : abstract_instance(dateTime, from)
-        , _content(content) {}
+        , _content(content) 
+        , _room(room) {}
     
     /**
      * Delegate constructor, sets @p dateTime to the current server time. 
      */
-    message(const std::string& from, const std::string& content)
-        : message(clock_t::now(), from, content) 
+    message(const std::string& from, const std::string& content, const std::string& room = instance::DEFAULT_ROOM)
+        : message(clock_t::now(), from, content, room) 
         {}
     
     /// Defaulted constructor
@@ -79,19 +95,19 @@ public:
      * Get the payload
      */
     const std::string content() const { return _content; }
-
-protected:
     
     /**
-     * Returns `this` instance's properties as a Json tree to be nested with other calls.
+     * Get the destination room
      */
-    virtual
-    boost::property_tree::ptree subToJson() const override;
+    const std::string room() const { return _room; }
 
 private:
 
     /// Payload
     const std::string _content;
+    
+    /// Destination room
+    const std::string _room;
 
 };
 
@@ -114,10 +130,24 @@ public:
     
     /// Property for the originator
     constexpr static const char PROPERTY_ORIGINATOR[] = "originator";
-
-    /// Converts a Json tree into a \c message. 
-    static
-    std::shared_ptr<message> fromJson(boost::property_tree::ptree& json);
+    
+    /// Property for the room the message was sent to
+    constexpr static const char PROPERTY_ROOM[] = "room";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_ORIGINATOR, &message::originator),
+                                              schema::make_field(PROPERTY_CONTENT, &message::content),
+                                              schema::make_optional_field(PROPERTY_ROOM, &message::room, instance::DEFAULT_ROOM)));
+    }
+    
+    /// Dispatches to \c V::visitMessage.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const message& res) { return visitor.visitMessage(res); }
     
     /**
      * Creates a new response.
@@ -125,20 +155,23 @@ public:
      * @param sender Who is sending the message (almost always the server)
      * @param originator Who sent the original message
      * @param content The message payload
+     * @param room Room the message was sent to
      */
     message(const time_point_t dateTime, const std::string& sender, 
-            const std::string& originator, const std::string& content)
+            const std::string& originator, const std::string& content,
+            const std::string& room = instance::DEFAULT_ROOM)
         : abstract_instance(dateTime, sender)
         , _originator(originator)
         , _content(content) 
+        , _room(room)
         {}
        
     /**
      * Delegate constructor which defaults the time to the current server time and
      * the sender to the server.
      */
-    message(const std::string& originator, const std::string& content)
-        : message(clock_t::now(), instance::SERVER_SENDER, originator, content)
+    message(const std::string& originator, const std::string& content, const std::string& room = instance::DEFAULT_ROOM)
+        : message(clock_t::now(), instance::SERVER_SENDER, originator, content, room)
         {}
     
     /// Default destructor
@@ -150,10 +183,8 @@ public:
     /// The payload of the message
     const std::string content() const { return _content; }
     
-protected:
-
-    virtual
-    boost::property_tree::ptree subToJson() const override;
+    /// Room the message was sent to
+    const std::string room() const { return _room; }
 
 private:
 
@@ -162,6 +193,9 @@ private:
     
     /// Payload of the message
     const std::string _content;
+    
+    /// Room the message was sent to
+    const std::string _room;
 
 };
 
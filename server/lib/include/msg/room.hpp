@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+#ifndef SE3313_MSG_ROOM_HPP_
+#define SE3313_MSG_ROOM_HPP_
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <string>
+
+#include "instance.hpp"
+
+namespace se3313 {
+
+namespace msg {
+
+namespace request {
+
+/**
+ * Asks the server to subscribe the sender to a room.
+ */
+class join: public abstract_instance<join> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.request.JoinRoomRequest";
+    
+    /// Property for the room name
+    constexpr static const char PROPERTY_ROOM[] = "room";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_ROOM, &join::room)));
+    }
+    
+    /// Dispatches to \c V::visitJoin.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const join& req) { return visitor.visitJoin(req); }
+    
+    /**
+     * Creates a join request.
+     * @param dateTime When the request was sent
+     * @param from Who is joining
+     * @param room The room to join
+     */
+    join(const time_point_t dateTime, const std::string& from, const std::string& room)
+        : abstract_instance(dateTime, from)
+        , _room(room) {}
+    
+    /// Delegate constructor, sets the time to `now()`.
+    join(const std::string& from, const std::string& room)
+        : join(clock_t::now(), from, room) {}
+    
+    /// Default destructor
+    virtual ~join() = default;
+
+    /// The room to join
+    const std::string room() const { return _room; }
+
+private:
+
+    /// The room to join
+    const std::string _room;
+
+};
+
+/**
+ * Asks the server to unsubscribe the sender from a room.
+ */
+class leave: public abstract_instance<leave> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.request.LeaveRoomRequest";
+    
+    /// Property for the room name
+    constexpr static const char PROPERTY_ROOM[] = "room";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_ROOM, &leave::room)));
+    }
+    
+    /// Dispatches to \c V::visitLeave.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const leave& req) { return visitor.visitLeave(req); }
+    
+    /**
+     * Creates a leave request.
+     * @param dateTime When the request was sent
+     * @param from Who is leaving
+     * @param room The room to leave
+     */
+    leave(const time_point_t dateTime, const std::string& from, const std::string& room)
+        : abstract_instance(dateTime, from)
+        , _room(room) {}
+    
+    /// Delegate constructor, sets the time to `now()`.
+    leave(const std::string& from, const std::string& room)
+        : leave(clock_t::now(), from, room) {}
+    
+    /// Default destructor
+    virtual ~leave() = default;
+
+    /// The room to leave
+    const std::string room() const { return _room; }
+
+private:
+
+    /// The room to leave
+    const std::string _room;
+
+};
+
+} // end namespace request
+
+namespace response {
+
+/**
+ * Tells the members of a room that a user joined it.
+ */
+class join: public abstract_instance<join> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.response.JoinRoomResponse";
+    
+    /// Property for who joined
+    constexpr static const char PROPERTY_USERNAME[] = "username";
+    
+    /// Property for the room name
+    constexpr static const char PROPERTY_ROOM[] = "room";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_USERNAME, &join::username),
+                                              schema::make_field(PROPERTY_ROOM, &join::room)));
+    }
+    
+    /// Dispatches to \c V::visitJoin.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const join& res) { return visitor.visitJoin(res); }
+    
+    /**
+     * Creates a join response.
+     * @param dateTime When the response was sent
+     * @param sender Who sent the response, usually the server
+     * @param username Who joined
+     * @param room The room joined
+     */
+    join(const time_point_t dateTime, const std::string& sender, const std::string& username, const std::string& room)
+        : abstract_instance(dateTime, sender)
+        , _username(username)
+        , _room(room) {}
+    
+    /// Delegate constructor, the server sends the response `now()`.
+    join(const std::string& username, const std::string& room)
+        : join(clock_t::now(), instance::SERVER_SENDER, username, room) {}
+    
+    /// Default destructor
+    virtual ~join() = default;
+    
+    /// Who joined
+    const std::string username() const { return _username; }
+
+    /// The room joined
+    const std::string room() const { return _room; }
+
+private:
+
+    /// Who joined
+    const std::string _username;
+    
+    /// The room joined
+    const std::string _room;
+
+};
+
+/**
+ * Tells the members of a room, and the leaving user, that a user left it.
+ */
+class leave: public abstract_instance<leave> {
+
+public:
+    
+    /// The type from Java-land
+    constexpr static const char TYPE[] = "ca.uwo.eng.se3313.lab4.network.response.LeaveRoomResponse";
+    
+    /// Property for who left
+    constexpr static const char PROPERTY_USERNAME[] = "username";
+    
+    /// Property for the room name
+    constexpr static const char PROPERTY_ROOM[] = "room";
+
+    /// Properties in constructor order
+    constexpr static 
+    auto fields() 
+    {
+        return std::tuple_cat(baseFields(), 
+                              std::make_tuple(schema::make_field(PROPERTY_USERNAME, &leave::username),
+                                              schema::make_field(PROPERTY_ROOM, &leave::room)));
+    }
+    
+    /// Dispatches to \c V::visitLeave.
+    template <typename V>
+    static 
+    typename V::return_t accept(V& visitor, const leave& res) { return visitor.visitLeave(res); }
+    
+    /**
+     * Creates a leave response.
+     * @param dateTime When the response was sent
+     * @param sender Who sent the response, usually the server
+     * @param username Who left
+     * @param room The room left
+     */
+    leave(const time_point_t dateTime, const std::string& sender, const std::string& username, const std::string& room)
+        : abstract_instance(dateTime, sender)
+        , _username(username)
+        , _room(room) {}
+    
+    /// Delegate constructor, the server sends the response `now()`.
+    leave(const std::string& username, const std::string& room)
+        : leave(clock_t::now(), instance::SERVER_SENDER, username, room) {}
+    
+    /// Default destructor
+    virtual ~leave() = default;
+    
+    /// Who left
+    const std::string username() const { return _username; }
+
+    /// The room left
+    const std::string room() const { return _room; }
+
+private:
+
+    /// Who left
+    const std::string _username;
+    
+    /// The room left
+    const std::string _room;
+
+};
+
+} // end namespace response
+
+} // end namespace msg
+
+} // end namespace se3313
+
+#endif // SE3313_MSG_ROOM_HPP_
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+#ifndef SE3313_MSG_SCHEMA_HPP_
+#define SE3313_MSG_SCHEMA_HPP_
+
+#include <chrono>
+#include <chrono_io>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace se3313
+{
+
+namespace msg
+{
+
+/**
+ * Compile-time description of message types. 
+ * 
+ * Every message type lists its properties once, as a tuple of @c field descriptors returned from a 
+ * `constexpr static fields()` function. The order of the tuple is the order of the type's constructor 
+ * arguments. From that list the templates below generate:
+ * 
+ *  - the JSON parser (`from_json`), which walks the object once and matches each key against the fixed
+ *    list of field names,
+ *  - the JSON serializer (`to_json`),
+ *  - a compact binary codec (`encode`/`decode`) used where JSON text is not required.
+ */
+namespace schema
+{
+
+/**
+ * Describes a single property of a message type.
+ * 
+ * @param C Type that owns the accessor
+ * @param T Value type stored in the property
+ * @param R Return type of the accessor (usually `const T`)
+ * @param D Type of the fallback used when the property is absent, `std::nullptr_t` if it is required
+ */
+template <typename C, typename T, typename R, typename D = std::nullptr_t>
+struct field {
+    
+    /// The stored value type
+    typedef T value_t;
+    
+    /// `true` if parsing fails when the property is absent
+    constexpr static bool required = std::is_same<D, std::nullptr_t>::value;
+    
+    /// JSON key
+    const char* name;
+    
+    /// Length of @c name, without the terminator
+    std::size_t length;
+    
+    /// Accessor used when serializing
+    R (C::*get)() const;
+    
+    /// Value used when an optional property is absent
+    D fallback;
+    
+    /// `true` if @p key is this field's name
+    bool matches(const std::string& key) const 
+    {
+        return key.size() == length && std::memcmp(key.data(), name, length) == 0;
+    }
+};
+
+/**
+ * Creates a @c field from a property name constant and a const accessor.
+ */
+template <typename C, typename R, std::size_t N>
+constexpr 
+field<C, typename std::decay<R>::type, R> make_field(const char (&name)[N], R (C::*get)() const)
+{
+    return field<C, typename std::decay<R>::type, R>{ name, N - 1, get, nullptr };
+}
+
+/**
+ * Creates an optional @c field, @p fallback is used when the property is absent so older 
+ * clients remain compatible.
+ */
+template <typename C, typename R, std::size_t N, typename D>
+constexpr 
+field<C, typename std::decay<R>::type, R, D> make_optional_field(const char (&name)[N], R (C::*get)() const, D fallback)
+{
+    return field<C, typename std::decay<R>::type, R, D>{ name, N - 1, get, fallback };
+}
+
+/**
+ * Compile-time list of message types, used to register every type with a visitor at once.
+ */
+template <typename... Ts>
+struct type_list {};
+
+/**
+ * Conversion of a single value to and from a JSON node and a binary buffer. Specialized for
+ * every value type used in a field.
+ */
+template <typename T, typename Enable = void>
+struct value_traits;
+
+/// Helpers for the binary representation.
+namespace binary
+{
+
+/// Appends @p v as a little-endian fixed width integer.
+template <typename U>
+inline
+void put_fixed(std::string* out, U v)
+{
+    char raw[sizeof(U)];
+    for (std::size_t i = 0; i < sizeof(U); ++i)
+    {
+        raw[i] = static_cast<char>((static_cast<typename std::make_unsigned<U>::type>(v) >> (8 * i)) & 0xFF);
+    }
+    out->append(raw, sizeof(U));
+}
+
+/// Reads a little-endian fixed width integer, returns `false` if the buffer is too short.
+template <typename U>
+inline
+bool get_fixed(const char** first, const char* last, U* v)
+{
+    if (last - *first < static_cast<std::ptrdiff_t>(sizeof(U)))
+    {
+        return false;
+    }
+    
+    typename std::make_unsigned<U>::type raw = 0;
+    for (std::size_t i = 0; i < sizeof(U); ++i)
+    {
+        raw |= static_cast<typename std::make_unsigned<U>::type>(static_cast<unsigned char>((*first)[i])) << (8 * i);
+    }
+    *first += sizeof(U);
+    *v = static_cast<U>(raw);
+    return true;
+}
+
+/// Appends @p v as a LEB128 varint.
+inline
+void put_varint(std::string* out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out->push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out->push_back(static_cast<char>(v));
+}
+
+/// Reads a LEB128 varint, returns `false` if it is truncated or too long.
+inline
+bool get_varint(const char** first, const char* last, uint64_t* v)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64 && *first != last; shift += 7)
+    {
+        const uint8_t byte = static_cast<uint8_t>(**first);
+        ++(*first);
+        
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *v = result;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+} // end namespace binary
+
+template <>
+struct value_traits<std::string> {
+    
+    static boost::property_tree::ptree to_json(const std::string& v) 
+    { 
+        return boost::property_tree::ptree(v); 
+    }
+    
+    static bool from_json(const boost::property_tree::ptree& node, std::string* v)
+    {
+        *v = node.data();
+        return true;
+    }
+    
+    static void encode(const std::string& v, std::string* out)
+    {
+        binary::put_varint(out, v.size());
+        out->append(v);
+    }
+    
+    static bool decode(const char** first, const char* last, std::string* v)
+    {
+        uint64_t size;
+        if (!binary::get_varint(first, last, &size) || static_cast<uint64_t>(last - *first) < size)
+        {
+            return false;
+        }
+        
+        v->assign(*first, size);
+        *first += size;
+        return true;
+    }
+};
+
+/// Enumerations are stored as their underlying integer.
+template <typename E>
+struct value_traits<E, typename std::enable_if<std::is_enum<E>::value>::type> {
+    
+    typedef typename std::underlying_type<E>::type int_t;
+    
+    static boost::property_tree::ptree to_json(const E v) 
+    { 
+        boost::property_tree::ptree node;
+        node.put_value(static_cast<int_t>(v));
+        return node;
+    }
+    
+    static bool from_json(const boost::property_tree::ptree& node, E* v)
+    {
+        const auto raw = node.get_value_optional<int_t>();
+        if (!raw)
+        {
+            return false;
+        }
+        
+        *v = static_cast<E>(*raw);
+        return true;
+    }
+    
+    static void encode(const E v, std::string* out)
+    {
+        binary::put_fixed(out, static_cast<int_t>(v));
+    }
+    
+    static bool decode(const char** first, const char* last, E* v)
+    {
+        int_t raw;
+        if (!binary::get_fixed(first, last, &raw))
+        {
+            return false;
+        }
+        
+        *v = static_cast<E>(raw);
+        return true;
+    }
+};
+
+/// Time points use the `chrono_io` text format in JSON and the raw tick count in binary.
+template <typename Clock, typename Duration>
+struct value_traits<std::chrono::time_point<Clock, Duration>> {
+    
+    typedef std::chrono::time_point<Clock, Duration> time_point_t;
+    
+    static boost::property_tree::ptree to_json(const time_point_t v) 
+    { 
+        std::ostringstream ss;
+        ss << v;
+        return boost::property_tree::ptree(ss.str());
+    }
+    
+    static bool from_json(const boost::property_tree::ptree& node, time_point_t* v)
+    {
+        std::istringstream ss(node.data());
+        ss >> *v;
+        return !ss.fail();
+    }
+    
+    static void encode(const time_point_t v, std::string* out)
+    {
+        binary::put_fixed<int64_t>(out, v.time_since_epoch().count());
+    }
+    
+    static bool decode(const char** first, const char* last, time_point_t* v)
+    {
+        int64_t ticks;
+        if (!binary::get_fixed(first, last, &ticks))
+        {
+            return false;
+        }
+        
+        *v = time_point_t(Duration(ticks));
+        return true;
+    }
+};
+
+namespace detail
+{
+
+/// Tuple of the value types described by a field tuple.
+template <typename Fields>
+struct values_of;
+
+template <typename... Fs>
+struct values_of<std::tuple<Fs...>> {
+    typedef std::tuple<typename Fs::value_t...> type;
+};
+
+/// Type of the field tuple for @p T.
+template <typename T>
+using fields_t = decltype(T::fields());
+
+/// Index sequence over the fields of @p T.
+template <typename T>
+using field_indices_t = std::make_index_sequence<std::tuple_size<fields_t<T>>::value>;
+
+/// Expands a pack expression for its side effects, in order.
+typedef std::initializer_list<int> expand_t;
+
+/// Assigns the fallback of an optional field, required fields are left alone.
+template <typename T>
+inline
+void assign_fallback(T*, std::nullptr_t) {}
+
+template <typename T, typename D>
+inline
+void assign_fallback(T* value, const D& fallback) { *value = fallback; }
+
+/// Bit mask of the required fields in @p Fields.
+template <typename Fields, std::size_t... I>
+constexpr 
+uint64_t required_mask(std::index_sequence<I...>)
+{
+    uint64_t mask = 0;
+    (void) expand_t{ (mask |= (std::tuple_element<I, Fields>::type::required ? uint64_t(1) << I : 0), 0)... };
+    return mask;
+}
+
+template <typename Fields, typename Values, std::size_t... I>
+bool parse_fields(const boost::property_tree::ptree& json, const Fields& fields, Values* values, std::index_sequence<I...>)
+{
+    static_assert(sizeof...(I) <= 64, "Too many fields in message schema.");
+    constexpr uint64_t required = required_mask<Fields>(std::index_sequence<I...>());
+    
+    (void) expand_t{ (assign_fallback(&std::get<I>(*values), std::get<I>(fields).fallback), 0)... };
+    
+    uint64_t found = 0;
+    bool ok = true;
+    
+    for (const auto& child : json)
+    {
+        // Compare the key against each field in declaration order, stopping at the first match
+        bool matched = false;
+        (void) expand_t{ (matched = matched || (std::get<I>(fields).matches(child.first)
+            && (found |= uint64_t(1) << I, 
+                ok = ok && value_traits<typename std::tuple_element<I, Fields>::type::value_t>::from_json(
+                    child.second, &std::get<I>(*values)), 
+                true)), 0)... };
+    }
+    
+    return ok && (found & required) == required;
+}
+
+template <typename T, typename Fields, std::size_t... I>
+void write_fields(const T& inst, const Fields& fields, boost::property_tree::ptree* json, std::index_sequence<I...>)
+{
+    (void) expand_t{ (json->push_back(std::make_pair(std::get<I>(fields).name, 
+        value_traits<typename std::tuple_element<I, Fields>::type::value_t>::to_json(
+            (inst.*(std::get<I>(fields).get))()))), 0)... };
+}
+
+template <typename T, typename Fields, std::size_t... I>
+void encode_fields(const T& inst, const Fields& fields, std::string* out, std::index_sequence<I...>)
+{
+    (void) expand_t{ (value_traits<typename std::tuple_element<I, Fields>::type::value_t>::encode(
+            (inst.*(std::get<I>(fields).get))(), out), 0)... };
+}
+
+template <typename Values, std::size_t... I>
+bool decode_fields(const char** first, const char* last, Values* values, std::index_sequence<I...>)
+{
+    bool ok = true;
+    (void) expand_t{ (ok = ok && value_traits<typename std::tuple_element<I, Values>::type>::decode(
+            first, last, &std::get<I>(*values)), 0)... };
+    return ok;
+}
+
+template <typename T, typename Values, std::size_t... I>
+std::shared_ptr<T> construct(Values& values, std::index_sequence<I...>)
+{
+    return std::make_shared<T>(std::move(std::get<I>(values))...);
+}
+
+} // end namespace detail
+
+/**
+ * Parses the object tree of a @p T. 
+ * 
+ * @return `nullptr` if a field is missing or could not be converted.
+ */
+template <typename T>
+std::shared_ptr<T> from_json(const boost::property_tree::ptree& json)
+{
+    constexpr auto fields = T::fields();
+    typename detail::values_of<detail::fields_t<T>>::type values;
+    
+    if (!detail::parse_fields(json, fields, &values, detail::field_indices_t<T>()))
+    {
+        return nullptr;
+    }
+    
+    return detail::construct<T>(values, detail::field_indices_t<T>());
+}
+
+/**
+ * Serializes the fields of @p inst into an object tree.
+ */
+template <typename T>
+boost::property_tree::ptree to_json(const T& inst)
+{
+    constexpr auto fields = T::fields();
+    boost::property_tree::ptree json;
+    
+    detail::write_fields(inst, fields, &json, detail::field_indices_t<T>());
+    
+    return json;
+}
+
+/**
+ * Appends the binary form of @p inst to @p out. Fields are written in schema order without keys.
+ */
+template <typename T>
+void encode(const T& inst, std::string* out)
+{
+    constexpr auto fields = T::fields();
+    detail::encode_fields(inst, fields, out, detail::field_indices_t<T>());
+}
+
+/**
+ * Reads a @p T written by @c encode, advancing @p first past it.
+ * 
+ * @return `nullptr` if the buffer is truncated or malformed.
+ */
+template <typename T>
+std::shared_ptr<T> decode(const char** first, const char* last)
+{
+    typename detail::values_of<detail::fields_t<T>>::type values;
+    
+    if (!detail::decode_fields(first, last, &values, detail::field_indices_t<T>()))
+    {
+        return nullptr;
+    }
+    
+    return detail::construct<T>(values, detail::field_indices_t<T>());
+}
+
+} // end namespace schema
+
+} // end namespace msg
+
+} // end namespace se3313
+
+#endif // SE3313_MSG_SCHEMA_HPP_
@@ -25,11 +25,17 @@
 #ifndef SE3313_MSG_VISITOR_HPP_
 #define SE3313_MSG_VISITOR_HPP_
 
+#include "direct.hpp"
 #include "error.hpp"
+#include "flow.hpp"
 #include "instance.hpp"
 #include "json.hpp"
 #include "login.hpp"
 #include "message.hpp"
+#include "room.hpp"
+#include "schema.hpp"
+
+#include "metrics/registry.hpp"
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/optional.hpp>
@@ -48,6 +54,13 @@ namespace msg
 
 namespace request {
 
+/**
+ * Every request type dispatched by \c abstract_message_visitor. Each type provides `TYPE`, 
+ * `fromJson()` and a static `accept()` naming its visit method, so adding a request type 
+ * only needs an entry here and a matching `visit*` method.
+ */
+typedef schema::type_list<login, message, join, leave, direct> types_t;
+
 /**
  * Represents a base type that "accepts" a json tree and calls a method based on what
  * type the tree represents. 
@@ -80,6 +93,24 @@ public:
         return return_t();
     }
     
+    /// Called when a client asks to join a room
+    virtual 
+    return_t visitJoin(const request::join& /* request */ ) {
+        return return_t();
+    }
+    
+    /// Called when a client asks to leave a room
+    virtual 
+    return_t visitLeave(const request::leave& /* request */ ) {
+        return return_t();
+    }
+    
+    /// Called when a client sends a private message
+    virtual 
+    return_t visitDirect(const request::direct& /* request */ ) {
+        return return_t();
+    }
+    
     /// Called when an error occurs
     virtual 
     return_t error(const std::string& /*originator*/,const ErrorCode /*code*/, const std::string& /*message*/)
@@ -119,6 +150,14 @@ public:
 
 private: 
 
+    /// Registers every type in the list with \m registerType.
+    template <typename... Ts>
+    void registerTypes(schema::type_list<Ts...>);
+    
+    /// Maps \c T::TYPE to a function parsing a \c T and calling its visit method.
+    template <typename T>
+    void registerType();
+
     /// Stores a mapping between TYPE and json tree extraction.
     std::unordered_map<std::string, std::function<return_t(boost::property_tree::ptree&)>> _propMap;
 
@@ -127,41 +166,44 @@ private:
 
 template <typename R>
 abstract_message_visitor<R>::abstract_message_visitor()
+{
+    registerTypes(types_t());
+}
+
+template <typename R>
+template <typename... Ts>
+void abstract_message_visitor<R>::registerTypes(schema::type_list<Ts...>)
+{
+    (void) schema::detail::expand_t{ (registerType<Ts>(), 0)... };
+}
+
+template <typename R>
+template <typename T>
+void abstract_message_visitor<R>::registerType()
 {
     namespace pt = boost::property_tree;
     
-    auto onError = [this](const std::string& type, pt::ptree& json) -> R
-    {
-        std::ostringstream ss;
-        ss <<  "Object was incorrectly defined for " << type << ", json=" << msg::json::to(json);
-        return this->error(instance::UNKNOWN_SENDER, ErrorCode::MALFORMED_REQUEST_BAD_OBJECT_DEF, ss.str());
-    };
+    // counted per type, labelled with the class name without its package
+    const std::string type = T::TYPE;
+    const std::string label = "type=\"" + type.substr(type.rfind('.') + 1) + "\"";
+    const metrics::counter decoded = metrics::registry::makeCounter("msg_decoded_total", "Messages decoded and visited, by type", label);
+    const metrics::counter invalid = metrics::registry::makeCounter("msg_decode_errors_total", "Messages whose object did not decode, by type", label);
     
-    _propMap[request::login::TYPE] =
-        [this, onError](pt::ptree& json) {
-            const std::shared_ptr<request::login> oVal = request::login::fromJson(json);
+    _propMap[T::TYPE] =
+        [this, decoded, invalid](pt::ptree& json) -> R {
+            const std::shared_ptr<T> oVal = T::fromJson(json);
             
             if (oVal)
             {
-                return this->visitLogin(*oVal);
+                decoded.inc();
+                return T::accept(*this, *oVal);
             }
             else
             {
-                return onError("login", json);
-            }
-        };
-        
-    _propMap[request::message::TYPE] =
-        [this, onError](pt::ptree& json) {
-            const std::shared_ptr<request::message> oVal = request::message::fromJson(json);
-            
-            if (oVal)
-            {
-                return this->visitMessage(*oVal);
-            }
-            else
-            {
-                return onError("message", json);
+                invalid.inc();
+                std::ostringstream ss;
+                ss <<  "Object was incorrectly defined for " << T::TYPE << ", json=" << msg::json::to(json);
+                return this->error(instance::UNKNOWN_SENDER, ErrorCode::MALFORMED_REQUEST_BAD_OBJECT_DEF, ss.str());
             }
         };
 }
@@ -169,6 +211,11 @@ abstract_message_visitor<R>::abstract_message_visitor()
 } // end request 
 
 namespace response {
+
+/**
+ * Every response type dispatched by \c abstract_message_visitor, see \c request::types_t.
+ */
+typedef schema::type_list<login, message, join, leave, direct, flow_control, error> types_t;
     
 /**
  * Represents a base type that "accepts" a json tree and calls a method based on what
@@ -201,6 +248,30 @@ public:
     return_t visitMessage(const response::message& /* request */ ) {
         return return_t();
     }
+    
+    /// Called when a user joined a room
+    virtual 
+    return_t visitJoin(const response::join& /* response */ ) {
+        return return_t();
+    }
+    
+    /// Called when a user left a room
+    virtual 
+    return_t visitLeave(const response::leave& /* response */ ) {
+        return return_t();
+    }
+    
+    /// Called when a private message arrives
+    virtual 
+    return_t visitDirect(const response::direct& /* response */ ) {
+        return return_t();
+    }
+    
+    /// Called when the server asks to pause or resume sending
+    virtual 
+    return_t visitFlowControl(const response::flow_control& /* response */ ) {
+        return return_t();
+    }
 
     /// Called when an error message is required
     virtual 
@@ -241,6 +312,14 @@ public:
 
 private: 
 
+    /// Registers every type in the list with \m registerType.
+    template <typename... Ts>
+    void registerTypes(schema::type_list<Ts...>);
+    
+    /// Maps \c T::TYPE to a function parsing a \c T and calling its visit method.
+    template <typename T>
+    void registerType();
+
     /// Stores mapping between a TYPE and a parsing function
     std::unordered_map<std::string, std::function<return_t(boost::property_tree::ptree&)>> _propMap;
 
@@ -248,41 +327,44 @@ private:
     
 template <typename R>
 abstract_message_visitor<R>::abstract_message_visitor()
+{
+    registerTypes(types_t());
+}
+
+template <typename R>
+template <typename... Ts>
+void abstract_message_visitor<R>::registerTypes(schema::type_list<Ts...>)
+{
+    (void) schema::detail::expand_t{ (registerType<Ts>(), 0)... };
+}
+
+template <typename R>
+template <typename T>
+void abstract_message_visitor<R>::registerType()
 {
     namespace pt = boost::property_tree;
     
-    auto onError = [this](const std::string& type, pt::ptree& json) -> R
-    {
-        std::ostringstream ss;
-        ss <<  "Object was incorrectly defined for " << type << ", json=" << msg::json::to(json);
-        return this->error(instance::UNKNOWN_SENDER, ErrorCode::MALFORMED_REQUEST_BAD_OBJECT_DEF, ss.str());
-    };
+    // counted per type, labelled with the class name without its package
+    const std::string type = T::TYPE;
+    const std::string label = "type=\"" + type.substr(type.rfind('.') + 1) + "\"";
+    const metrics::counter decoded = metrics::registry::makeCounter("msg_decoded_total", "Messages decoded and visited, by type", label);
+    const metrics::counter invalid = metrics::registry::makeCounter("msg_decode_errors_total", "Messages whose object did not decode, by type", label);
     
-    _propMap[response::login::TYPE] =
-        [this, onError](pt::ptree& json) {
-            const std::shared_ptr<response::login> oVal = response::login::fromJson(json);
-            
-            if (oVal)
-            {
-                return this->visitLogin(*oVal);
-            }
-            else
-            {
-                return onError("login", json);
-            }
-        };
-        
-    _propMap[response::message::TYPE] =
-        [this, onError](pt::ptree& json) {
-            const std::shared_ptr<response::message> oVal = response::message::fromJson(json);
+    _propMap[T::TYPE] =
+        [this, decoded, invalid](pt::ptree& json) -> R {
+            const std::shared_ptr<T> oVal = T::fromJson(json);
             
             if (oVal)
             {
-                return this->visitMessage(*oVal);
+                decoded.inc();
+                return T::accept(*this, *oVal);
             }
             else
             {
-                return onError("message", json);
+                invalid.inc();
+                std::ostringstream ss;
+                ss <<  "Object was incorrectly defined for " << T::TYPE << ", json=" << msg::json::to(json);
+                return this->error(instance::UNKNOWN_SENDER, ErrorCode::MALFORMED_REQUEST_BAD_OBJECT_DEF, ss.str());
             }
         };
 }
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#pragma once
+#ifndef SE3313_NETWORKING_CHAT_CLIENT_HPP
+#define SE3313_NETWORKING_CHAT_CLIENT_HPP
+
+#include "flex_waiter.hpp"
+#include "socket.hpp"
+
+#include "msg/instance.hpp"
+#include "msg/visitor.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace se3313 {
+
+namespace networking {
+
+/**
+ * One session with a chat server, driven by a @c chat_client::pool on the caller's event loop.
+ * 
+ * Connecting never blocks, an attempt that takes longer than the connect timeout fails. Requests can be
+ * sent at any time and are pipelined: they are written as soon as the socket takes them, without waiting
+ * for the responses to earlier ones, and queued while the client is not connected. Every response is
+ * handed to the client's @c msg::response::abstract_message_visitor as it arrives.
+ * 
+ * A lost connection, or an attempt that failed, is retried after a backoff that starts at
+ * `config::backoffMin` and doubles with every failure up to `config::backoffMax`, drawn at random from
+ * its upper half so that many clients dropped at once do not all come back at once. The backoff resets
+ * once a connection stays up for longer than the backoff reached, a server accepting connections only
+ * to drop them is not hammered either. The server forgets a session with its connection, so the listener's
+ * `onConnected()` is where a client logs in and joins its rooms again; whatever it sends there goes out
+ * ahead of the requests queued while disconnected. A request cut off halfway by a lost connection is
+ * dropped, the ones queued behind it are sent once reconnected.
+ * 
+ * None of this is thread-safe, a client is only used on the thread processing its pool.
+ */
+class chat_client final
+{
+    
+public:
+    
+    class pool;
+    
+    enum class state 
+    { 
+        /// Waiting for the connection to be accepted
+        CONNECTING, 
+        
+        CONNECTED, 
+        
+        /// Backing off before connecting again
+        WAITING, 
+        
+        /// Closed with `close()`, or lost without reconnecting, the client is not used again
+        CLOSED 
+    };
+    
+    /// The visitor responses are dispatched to
+    typedef msg::response::abstract_message_visitor<> visitor_t;
+    
+    /// Timeouts and limits of a client
+    struct config
+    {
+        /// Longest a connection may take to be accepted
+        std::chrono::milliseconds connectTimeout = std::chrono::seconds(5);
+        
+        /// Whether a lost connection is made again
+        bool reconnect = true;
+        
+        /// Backoff after the first failure
+        std::chrono::milliseconds backoffMin = std::chrono::milliseconds(100);
+        
+        /// Longest backoff
+        std::chrono::milliseconds backoffMax = std::chrono::seconds(30);
+        
+        /// Bytes of requests queued before `send()` refuses more
+        size_t maxQueuedBytes = 1024 * 1024;
+    };
+    
+    /// Told when a client connects and loses its connection, on the thread processing its pool.
+    class listener
+    {
+        
+    public:
+        
+        virtual ~listener() = default;
+        
+        /// Called once a connection was made, before the requests queued meanwhile are sent.
+        virtual
+        void onConnected(chat_client& /* client */) {}
+        
+        /**
+         * Called when a connection is lost or an attempt failed, @p reconnecting tells whether another
+         * attempt follows after the backoff.
+         */
+        virtual
+        void onDisconnected(chat_client& /* client */, const std::string& /* reason */, const bool /* reconnecting */) {}
+    };
+    
+    chat_client(const chat_client&) = delete;
+    chat_client& operator=(const chat_client&) = delete;
+    
+    ~chat_client();
+    
+    /**
+     * Queues @p request to be sent, writing it right away if connected.
+     * @return `false` if the client is closed or has `config::maxQueuedBytes` queued already
+     */
+    bool send(const msg::instance& request);
+    
+    /// Queues one frame, see `send(const msg::instance&)`. Its newline is added if it has none.
+    bool send(const std::string& frame);
+    
+    /// Closes the connection and stops reconnecting, requests still queued are dropped.
+    void close();
+    
+    state status() const { return _state; }
+    
+    /// Bytes of requests not written yet
+    size_t queuedBytes() const { return _outbound.size(); }
+    
+    /// Connections made so far, more than one once it reconnected
+    uint64_t connections() const { return _connections; }
+    
+    const std::string& host() const { return _host; }
+    
+    port_t port() const { return _port; }
+    
+private:
+    
+    friend class pool;
+    
+    chat_client(pool* const owner, const uint64_t id, const std::string& host, const port_t port, const config& conf,
+                const std::shared_ptr<visitor_t> visitor, const std::shared_ptr<listener> events);
+    
+    /// Writes what the socket takes of the queued requests, watching for room for the rest.
+    void flush();
+    
+    /// Hands every complete response received to the visitor.
+    void dispatch();
+    
+    pool* _pool;
+    const uint64_t _id;
+    const std::string _host;
+    const port_t _port;
+    const config _config;
+    const std::shared_ptr<visitor_t> _visitor;
+    const std::shared_ptr<listener> _listener;
+    
+    state _state;
+    std::shared_ptr<socket> _socket;
+    
+    /// Requests not written yet, and received bytes not forming a complete response yet
+    std::string _outbound;
+    std::string _inbound;
+    
+    /// Leading bytes of @c _inbound known to hold no end of a response
+    size_t _scanned;
+    
+    /// The last write ended inside a request
+    bool _cut;
+    
+    /// Set while the socket is watched for room for output
+    bool _watchingWritable;
+    
+    std::chrono::milliseconds _backoff;
+    
+    /// When the current connection was made
+    std::chrono::steady_clock::time_point _connectedAt;
+    
+    /// Identifies the client's current deadline, older ones left in the pool's queue are ignored
+    uint64_t _deadline;
+    
+    uint64_t _connections;
+};
+
+/**
+ * Drives any number of @c chat_client sessions with one epoll set, whose descriptor joins the caller's
+ * event loop: `attach()` watches it from a @c flex_waiter, any other loop waits for `fd()` to be 
+ * readable and calls `process()`. Connect timeouts and backoffs share one timer descriptor in the set,
+ * so the loop needs no timeouts of its own for them.
+ * 
+ * `process()` handles what is ready without blocking: connections being made, responses, which are
+ * dispatched to the clients' visitors on the calling thread, room for queued requests, lost connections
+ * and due timers. Each call reads a bounded amount from each client, the descriptor stays readable while
+ * more is waiting, so a flood on a few connections does not hold up the loop. A pool is not thread-safe,
+ * everything happens on the thread calling `process()`.
+ */
+class chat_client::pool final
+{
+    
+public:
+    
+    /// Creates the epoll set, throws a @c std::runtime_error if it can not.
+    pool();
+    
+    /// Closes every client left.
+    ~pool();
+    
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+    
+    /**
+     * Starts connecting a client to @p host (an IPv4 address) and @p port, its responses go to @p visitor.
+     * One visitor may serve many clients, `dispatching()` then tells them apart.
+     * 
+     * Throws a @c std::runtime_error if @p host is not an address, failing to connect is only reported
+     * to @p events, and retried.
+     */
+    std::shared_ptr<chat_client> connect(const std::string& host, const port_t port, const std::shared_ptr<visitor_t> visitor,
+                                         const std::shared_ptr<listener> events = nullptr, const config& conf = config());
+    
+    /// Has @p waiter call `process()` whenever a client has something to do.
+    void attach(flex_waiter& waiter);
+    
+    /// Stops @p waiter calling `process()`.
+    void detach(flex_waiter& waiter);
+    
+    /// Readable whenever `process()` has something to do
+    int fd() const { return _epollFD; }
+    
+    /// Handles whatever the clients have to do now, without blocking.
+    void process();
+    
+    /// The client whose response is being visited, `nullptr` outside of a visit
+    chat_client* dispatching() const { return _dispatching; }
+    
+    /// Clients not closed yet
+    size_t size() const { return _clients.size(); }
+    
+private:
+    
+    friend class chat_client;
+    
+    /// A connect timeout or the end of a backoff
+    struct deadline
+    {
+        std::chrono::steady_clock::time_point at;
+        uint64_t client;
+        uint64_t id;
+        
+        bool operator>(const deadline& other) const { return at > other.at; }
+    };
+    
+    /// Opens a connection for @p c, which is made or failed later.
+    void open(chat_client& c);
+    
+    /// Finishes the connection of @p c once its socket became writable.
+    void opened(chat_client& c);
+    
+    /// Drops the connection of @p c, reconnecting later if it is configured to.
+    void lost(chat_client& c, const std::string& reason);
+    
+    /// Forgets @p c, which was closed.
+    void remove(chat_client& c);
+    
+    /// The reference to @p c, which keeps it alive while its handlers run
+    std::shared_ptr<chat_client> find(const chat_client& c) const;
+    
+    /// Waits on the events of @p c's socket, reading always and writing if @p writable.
+    void control(chat_client& c, const bool writable);
+    
+    /// Schedules the next deadline of @p c.
+    void schedule(chat_client& c, const std::chrono::steady_clock::time_point at);
+    
+    /// Runs the deadlines due and arms the timer for the next one.
+    void expire();
+    
+    /// Sets the timer to go off at the first deadline.
+    void arm();
+    
+    const int _epollFD;
+    const int _timerFD;
+    std::vector<epoll_event> _events;
+    
+    std::unordered_map<uint64_t, std::shared_ptr<chat_client>> _clients;
+    uint64_t _nextClient;
+    
+    std::priority_queue<deadline, std::vector<deadline>, std::greater<deadline>> _deadlines;
+    uint64_t _nextDeadline;
+    
+    /// When the timer goes off next, the epoch while it is not armed
+    std::chrono::steady_clock::time_point _armed;
+    
+    std::mt19937_64 _random;
+    chat_client* _dispatching;
+};
+
+} // end namespace networking
+
+} // end namespace se3313
+
+#endif // SE3313_NETWORKING_CHAT_CLIENT_HPP
@@ -24,29 +24,37 @@
 #ifndef SE3313_NETWORKING_FLEXWAIT_HPP_
 #define SE3313_NETWORKING_FLEXWAIT_HPP_
 
+#include "loop_watchdog.hpp"
 #include "socket.hpp"
 #include "socket_server.hpp"
 
+#include <sys/epoll.h>
 #include <sys/signal.h>
 
+#include <functional>
+#include <initializer_list>
+#include <map>
 #include <mutex>
 #include <memory>
-#include <unordered_set>
+#include <unordered_map>
+#include <vector>
 
 namespace se3313 {
     
 namespace networking {
 
 /**
- * The flex_waiter utilizes the <a href="http://man7.org/linux/man-pages/man2/select.2.html">select()</a>
- * system call. Users will register sockets by calling `addSocket()` and passing the @c socket_server into the 
+ * The flex_waiter utilizes <a href="http://man7.org/linux/man-pages/man7/epoll.7.html">epoll</a>, so the 
+ * number of sockets is only bounded by the descriptor limit and a wait costs the same however many are 
+ * idle. Users will register sockets by calling `addSocket()` and passing the @c socket_server into the 
  * constructor. 
  * 
  * When calling `wait()` if there is any activity on any of the @c socket, the @c socket_server or @c std::cin, 
- * the `wait()` returns and calls the appropriate visit method on the @c flex_waiter::activity_visitor implementation
- * passed. 
+ * the `wait()` calls the appropriate visit method on the @c flex_waiter::activity_visitor implementation
+ * passed, once for every descriptor found ready, and returns. 
  * 
- * This allows a single thread to multiplex against many different input functions. 
+ * This allows a single thread to multiplex against many different input functions. Other threads hand 
+ * work back to that thread with `post()`.
  */
 class flex_waiter final
 {
@@ -78,12 +86,19 @@ public:
         virtual
         void onSocket(const socket_ptr_t) = 0;
         
+        /// Called when a @c socket watched with `watchWritable()` can be written to.
+        virtual
+        void onWritable(const socket_ptr_t) {}
+        
         /// Called from activity on `stdin`, passing the line of input received. 
         virtual
         void onSTDIN(const std::string& line) = 0;
     };
     
-    /// The signal used to tell `select()` call internally to sto break out.
+    /// A function run by `wait()` on behalf of another thread
+    typedef std::function<void()> task_t;
+    
+    /// The signal used to tell `epoll_wait()` call internally to sto break out.
     constexpr static const uint64_t KILL_SIGNAL = SIGKILL;
     
     /// Buffer size used as needed. 
@@ -99,7 +114,7 @@ public:
     flex_waiter(std::shared_ptr<networking::socket_server> master, Args... sockets)
         : flex_waiter(master)
     {
-        _sockets = std::unordered_set<socket_ptr_t>({ sockets... });
+        (void) std::initializer_list<int>{ (addSocket(sockets), 0)... };
     }
     
     /// Creates an instance with just a @c socket_server and STDIN
@@ -125,6 +140,26 @@ public:
      */
     void kill();
     
+    /**
+     * Queues @p task to be run by the thread calling `wait()`, waking it up if it is blocked. Tasks run in 
+     * the order they were posted. 
+     * 
+     * This method is thread-safe.
+     */
+    void post(task_t task);
+    
+    /// Runs the tasks posted so far on the calling thread, which must be the one calling `wait()`.
+    void runPosted();
+    
+    /**
+     * Calls @p onReadable from `wait()` whenever @p fd is readable, for descriptors that are not
+     * sockets of the chat protocol (e.g. an admin or control socket). 
+     */
+    void watch(const int fd, task_t onReadable);
+    
+    /// Stops waiting on a descriptor passed to `watch()`.
+    void unwatch(const int fd);
+    
     /**
      * Adds a socket to calls to `wait()`. 
      * @param newSock socket to wait on
@@ -138,23 +173,92 @@ public:
      */
     void removeSocket(const socket_ptr_t sock);
     
+    /**
+     * Stops waiting for input on @p sock until `resumeSocket()` is called. Anything the peer sends
+     * meanwhile stays in the kernel's buffers, which eventually pushes back on the peer through TCP.
+     */
+    void pauseSocket(const socket_ptr_t sock);
+    
+    /// Waits for input on a socket paused by `pauseSocket()` again.
+    void resumeSocket(const socket_ptr_t sock);
+    
+    /// Starts or stops calling `activity_visitor::onWritable()` when @p sock has room for output.
+    void watchWritable(const socket_ptr_t sock, const bool watch);
+    
     /// Sets the server to be a new value. 
-    void setServer(const socket_server_ptr_t server) {
-        _master = server;
-    }
+    void setServer(const socket_server_ptr_t server);
+    
+    /// Stops or resumes reading commands from `stdin`.
+    void watchSTDIN(const bool watch);
+    
+    /// Times every handler and iteration of `wait()` from now on, reporting the slow ones (see @c loop_watchdog).
+    void supervise(const loop_watchdog::config& conf);
     
 
 private:
     
+    /// What an epoll event was registered for, kept in the upper half of its data
+    enum class source : uint32_t { SOCKET, MASTER, STDIN, KILL, POST, WATCHED };
+    
+    /// A socket waited on
+    struct registration
+    {
+        socket_ptr_t socket;
+        
+        /// Input is not waited on
+        bool paused;
+        
+        /// Output is waited on
+        bool writable;
+        
+        /// The descriptor is in the epoll set, it leaves it while neither is waited on
+        bool registered;
+    };
+    
+    /// Adds @p fd to the epoll set for @p events, or changes its events if it is there.
+    void control(const int fd, const source src, const uint32_t events);
+    
+    /// Brings the epoll set in line with @p reg.
+    void update(const int fd, registration& reg);
+    
+    /// The registration of @p sock, `nullptr` if it is not waited on
+    registration* find(const socket_ptr_t& sock);
+    
+    /// Reads a line from `stdin` and hands it to @p handler.
+    void readSTDIN(activity_visitor& handler);
+    
+    int _epollFD;
+    
+    /// Events returned by one wait
+    std::vector<epoll_event> _events;
+    
     /// Mutex for the killEvent so it can be accessed from multiple threads
     std::mutex _mut_killEvent;
     int _killEventFD;
     
-    /// Set of Socket pointers
-    std::unordered_set<socket_ptr_t> _sockets;
+    /// Tasks from `post()` and the event signalling them
+    std::mutex _mut_posted;
+    int _postEventFD;
+    std::vector<task_t> _posted;
+    
+    /// Descriptors from `watch()` and their handlers
+    std::map<int, task_t> _watched;
+    
+    /// Cleared once `stdin` reaches end of file, it is not waited on after that
+    bool _watchSTDIN;
+    
+    /// `false` if `stdin` can not be waited on (a regular file), it is then read on every wait as 
+    /// `select()` would report it ready
+    bool _pollSTDIN;
+    
+    /// Sockets by descriptor
+    std::unordered_map<int, registration> _sockets;
     
     /// Pointer to a @c networking::socket_server instance
     socket_server_ptr_t _master;
+    
+    /// Times the handlers, `nullptr` until `supervise()` is called
+    std::unique_ptr<loop_watchdog> _watchdog;
 };
 
 } // end namespace networking
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+#ifndef SE3313_NETWORKING_LOOP_WATCHDOG_HPP
+#define SE3313_NETWORKING_LOOP_WATCHDOG_HPP
+
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace se3313 {
+
+namespace networking {
+
+/**
+ * Notices when the event loop of a @c flex_waiter falls behind.
+ * 
+ * The loop reports every handler it calls and every iteration (from waking up to waiting again) to the
+ * watchdog, which logs those over their budget as warnings naming the handler, its descriptor and what
+ * it was working on (see `annotate()`). At most one warning goes out per report interval, the ones in
+ * between are only counted. The time the last iteration took is the `flex_waiter_loop_lag_microseconds`
+ * gauge, how long a descriptor that just became ready may wait before being looked at.
+ * 
+ * A loop stuck in one handler reports nothing until the handler returns, so a separate thread checks 
+ * on the loop too. Once it has been busy for longer than the stall timeout, the thread interrupts the
+ * loop's thread with a signal whose handler records its stack, and logs the stack as an error, once 
+ * per stall. Link with `-rdynamic` to get function names in it.
+ */
+class loop_watchdog final
+{
+    
+public:
+    
+    /// Budgets and rates of the watchdog
+    struct config
+    {
+        /// Longest one handler may run before it is reported
+        std::chrono::milliseconds handlerBudget = std::chrono::milliseconds(50);
+        
+        /// Longest one iteration of the loop may take before it is reported
+        std::chrono::milliseconds iterationBudget = std::chrono::milliseconds(100);
+        
+        /// Least time between two warnings
+        std::chrono::milliseconds reportInterval = std::chrono::seconds(1);
+        
+        /// Time busy after which the loop's stack is sampled, 0 for no watchdog thread
+        std::chrono::milliseconds stallTimeout = std::chrono::seconds(1);
+    };
+    
+    /// Times one handler call from its construction to its destruction, does nothing without a watchdog.
+    class handler_timer final
+    {
+        
+    public:
+        
+        handler_timer(loop_watchdog* const watchdog, const char* const handler, const int fd)
+            : _watchdog(watchdog)
+            , _handler(handler)
+            , _fd(fd)
+        {
+            if (_watchdog)
+            {
+                annotate(nullptr);
+                _started = std::chrono::steady_clock::now();
+            }
+        }
+        
+        ~handler_timer()
+        {
+            if (_watchdog)
+            {
+                _watchdog->handled(_handler, _fd, std::chrono::steady_clock::now() - _started);
+            }
+        }
+        
+        handler_timer(const handler_timer&) = delete;
+        handler_timer& operator=(const handler_timer&) = delete;
+        
+    private:
+        
+        loop_watchdog* const _watchdog;
+        const char* const _handler;
+        const int _fd;
+        std::chrono::steady_clock::time_point _started;
+    };
+    
+    /// Starts the watchdog thread unless @c config::stallTimeout is 0.
+    explicit loop_watchdog(const config& conf);
+    
+    /// Stops the watchdog thread.
+    ~loop_watchdog();
+    
+    loop_watchdog(const loop_watchdog&) = delete;
+    loop_watchdog& operator=(const loop_watchdog&) = delete;
+    
+    /// Called by the loop when it wakes up with work, the iteration starts.
+    void busy();
+    
+    /// Called by the loop before it waits again, the iteration ends.
+    void idle();
+    
+    /**
+     * Names what the handler running on this thread works on, e.g. the type of the message, for a
+     * report about it. @p what must outlive the handler, a string literal or a type name.
+     */
+    static void annotate(const char* const what);
+    
+private:
+    
+    /// Accounts for a handler call that took @p took.
+    void handled(const char* const handler, const int fd, const std::chrono::steady_clock::duration took);
+    
+    /// `true` if a warning may go out now, otherwise the warning is counted as suppressed
+    bool mayReport(const std::chrono::steady_clock::time_point now);
+    
+    /// Body of the watchdog thread
+    void run();
+    
+    /**
+     * Interrupts the loop's thread and logs its stack, unless the iteration that started at @p since
+     * (as in @c _busySince) ended before the stack was taken.
+     */
+    void sampleStack(const int64_t since, const std::chrono::steady_clock::duration busyFor);
+    
+    const config _config;
+    
+    /// State of the current iteration, only touched by the loop's thread
+    std::chrono::steady_clock::time_point _iterationStarted;
+    size_t _handlers;
+    std::chrono::steady_clock::duration _slowest;
+    const char* _slowestHandler;
+    int _slowestFD;
+    const char* _slowestWhat;
+    int64_t _lagMicros;
+    
+    /// Rate limit of the warnings, only touched by the loop's thread
+    std::chrono::steady_clock::time_point _lastReport;
+    uint64_t _suppressed;
+    
+    /// When the current iteration started as nanoseconds of the steady clock, 0 while waiting
+    std::atomic<int64_t> _busySince;
+    
+    /// The loop's thread, set by the first `busy()`
+    std::atomic<bool> _knowsLoop;
+    pthread_t _loop;
+    
+    std::mutex _mut_stop;
+    std::condition_variable _cv_stop;
+    bool _stop;
+    std::thread _thread;
+};
+
+} // end namespace networking
+
+} // end namespace se3313
+
+#endif // SE3313_NETWORKING_LOOP_WATCHDOG_HPP
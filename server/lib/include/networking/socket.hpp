@@ -60,8 +60,6 @@ public:
 
 private:
 
-    ssize_t write(const char* const buff, const size_t length);
-
     sockaddr_in _socketDescriptor;
     socket_desc_t _socketFD;
     bool _open;
@@ -98,6 +96,20 @@ public:
     
     /// Closes a socket, closing the underlying file descriptor
     void close();
+    
+    /**
+     * Switches the socket between blocking and non-blocking mode. A non-blocking socket returns 0 
+     * from `write()` and -1 from `read()` without closing when the call would block.
+     */
+    void setBlocking(const bool blocking);
+    
+    /**
+     * Writes up to @p length bytes of @p buff, fewer if the socket is non-blocking and its buffer fills.
+     * 
+     * @return -1 if an error, 0 if nothing could be written without blocking and the amount of bytes 
+     *         written otherwise.
+     */
+    ssize_t write(const char* const buff, const size_t length);
 
     /*!
      * \brief Writes the value in `buff` to the socket if open. 
@@ -47,6 +47,9 @@ public:
     /// Creates a new "server" waiting on @p port. 
     socket_server(const port_t port);
     
+    /// Adopts @p fd, a socket already listening, e.g. one handed over by another process.
+    explicit socket_server(const socket_desc_t fd);
+    
     /// Destructs the server, closing sockets.
     ~socket_server();
 
@@ -59,6 +62,12 @@ public:
     /// Closes the socket_server, it will unblock `accept()` calls.
     void close();
     
+    /**
+     * Closes this process' descriptor without shutting the socket down, for when another process
+     * holds a copy and goes on accepting from it. 
+     */
+    void release();
+    
     /// Get the underlying socket descriptor. 
     socket_desc_t fd() const { return _socketFD; }
     
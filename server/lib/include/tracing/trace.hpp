@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+#ifndef SE3313_TRACING_TRACE_HPP
+#define SE3313_TRACING_TRACE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace se3313
+{
+
+/**
+ * Sampled tracing of single messages.
+ * 
+ * A fraction of messages is given a trace id when they arrive, see `sample()`. Every span recorded for
+ * that id (decoding, visiting, each recipient's write...) goes into one process wide ring buffer, the
+ * oldest spans are overwritten once it is full. `exportChrome()` turns the buffer into Chrome 
+ * trace-event JSON, which Perfetto (ui.perfetto.dev) and chrome://tracing open, with a flow arrow 
+ * linking the spans of each message.
+ * 
+ * Messages not sampled carry the id 0, recording a span for them costs a branch.
+ */
+namespace tracing
+{
+
+/// Tunables of the tracer, see `configure()`
+struct config
+{
+    /// Fraction of messages traced, 0 for none
+    double sampleRate = 0;
+    
+    /// Spans kept, the oldest are overwritten past this
+    size_t capacity = 65536;
+};
+
+/// Applies @p conf, dropping every span recorded so far. Call it before any span is recorded.
+void configure(const config& conf);
+
+/// A new trace id for the fraction of calls given by the sample rate, 0 for the others.
+uint64_t sample();
+
+/// Nanoseconds on the tracing clock, read only when @p trace is not 0.
+inline
+int64_t now(const uint64_t trace)
+{
+    return trace ? std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() : 0;
+}
+
+/**
+ * Records the span @p name of @p trace from @p start until now.
+ * @param name Static string naming the span
+ * @param fd Descriptor the span concerns, -1 for none
+ * @param detail Count shown with the span, e.g. bytes or recipients
+ * @return The end of the span, to start the next one at, 0 if @p trace is 0
+ */
+int64_t span(const uint64_t trace, const char* const name, const int64_t start, const int fd = -1, const uint64_t detail = 0);
+
+/// The spans in the buffer as a Chrome trace-event JSON document.
+std::string exportChrome();
+
+} // end namespace tracing
+
+} // end namespace se3313
+
+#endif // SE3313_TRACING_TRACE_HPP
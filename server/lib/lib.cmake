@@ -6,25 +6,50 @@ if(NOT TARGET se3313)
 
     set(lib_INCLUDES    
                         lib/include/msg/instance.hpp
+                        lib/include/msg/direct.hpp
                         lib/include/msg/error.hpp
+                        lib/include/msg/flow.hpp
                         lib/include/msg/login.hpp
                         lib/include/msg/message.hpp
+                        lib/include/msg/room.hpp
+                        lib/include/msg/schema.hpp
 
                         lib/include/msg/visitor.hpp
 
                         lib/include/msg/json.hpp
 
+                        lib/include/logging/log.hpp
+
+                        lib/include/metrics/http_exporter.hpp
+                        lib/include/metrics/registry.hpp
+
+                        lib/include/tracing/trace.hpp
+
+                        lib/include/networking/chat_client.hpp
                         lib/include/networking/flex_waiter.hpp
+                        lib/include/networking/loop_watchdog.hpp
                         lib/include/networking/socket.hpp
                         lib/include/networking/socket_server.hpp)
 
     set(lib_SOURCES     lib/src/msg/instance.cpp
     
+                        lib/src/msg/direct.cpp
                         lib/src/msg/error.cpp
+                        lib/src/msg/flow.cpp
                         lib/src/msg/login.cpp
                         lib/src/msg/message.cpp
+                        lib/src/msg/room.cpp
+
+                        lib/src/logging/log.cpp
+
+                        lib/src/metrics/http_exporter.cpp
+                        lib/src/metrics/registry.cpp
+
+                        lib/src/tracing/trace.cpp
 
+                        lib/src/networking/chat_client.cpp
                         lib/src/networking/flex_waiter.cpp
+                        lib/src/networking/loop_watchdog.cpp
                         lib/src/networking/socket.cpp
                         lib/src/networking/socket_server.cpp)
 
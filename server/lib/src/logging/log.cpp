@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "logging/log.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace se3313;
+using namespace logging;
+
+constexpr size_t line::MAX_TEXT;
+
+std::atomic<uint8_t> detail::g_threshold(static_cast<uint8_t>(level::INFO));
+
+namespace
+{
+
+/// A formatted record waiting for the writer
+struct entry
+{
+    /// Nanoseconds since the epoch
+    int64_t timestamp;
+    
+    const char* file;
+    int line;
+    
+    /// Id of the ring, which names the thread
+    uint32_t thread;
+    level severity;
+    uint16_t length;
+    char text[line::MAX_TEXT];
+};
+
+/// Records buffered per thread, a power of two
+constexpr size_t RING_CAPACITY = 1024;
+
+/**
+ * Single producer, single consumer ring of records. The owning thread only writes @c head, the writer
+ * only writes @c tail.
+ */
+struct ring
+{
+    explicit ring(const uint32_t id)
+        : id(id)
+        , slots(RING_CAPACITY)
+        , head(0)
+        , tail(0)
+        , abandoned(false)
+    { }
+    
+    /// Small number naming the owning thread in the output
+    const uint32_t id;
+    
+    std::vector<entry> slots;
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    
+    /// Set when the owning thread exits, the writer forgets the ring once it is drained
+    std::atomic<bool> abandoned;
+};
+
+const char* name(const level l)
+{
+    switch (l)
+    {
+        case level::TRACE: return "TRACE";
+        case level::DEBUG: return "DEBUG";
+        case level::INFO:  return "INFO ";
+        case level::WARN:  return "WARN ";
+        case level::ERROR: return "ERROR";
+        default:           return "?????";
+    }
+}
+
+/// Drains every thread's ring to the output on a background thread.
+class writer final
+{
+    
+public:
+    
+    writer()
+        : _interval(config().flushInterval)
+        , _stop(false)
+        , _flushRequested(0)
+        , _flushed(0)
+        , _nextID(0)
+        , _fd(STDOUT_FILENO)
+        , _reportedDrops(0)
+        , dropped(0)
+    {
+        _thread = std::thread(&writer::run, this);
+    }
+    
+    ~writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mut);
+            _stop = true;
+        }
+        _cv.notify_one();
+        _thread.join();
+        
+        if (_fd != STDOUT_FILENO)
+        {
+            ::close(_fd);
+        }
+    }
+    
+    /// Registers a ring for the calling thread.
+    std::shared_ptr<ring> attach()
+    {
+        std::lock_guard<std::mutex> lock(_mut);
+        _rings.push_back(std::make_shared<ring>(_nextID++));
+        return _rings.back();
+    }
+    
+    void configure(const config& conf)
+    {
+        int fd = STDOUT_FILENO;
+        if (!conf.path.empty())
+        {
+            fd = ::open(conf.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                std::ostringstream ss; ss << "Unable to open log file " << conf.path << ", err: " << errno;
+                throw std::runtime_error(ss.str());
+            }
+        }
+        
+        // records already buffered go to the previous output
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(_mut_output);
+            if (_fd != STDOUT_FILENO)
+            {
+                ::close(_fd);
+            }
+            _fd = fd;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mut);
+            _interval = conf.flushInterval;
+        }
+        detail::g_threshold.store(static_cast<uint8_t>(conf.threshold), std::memory_order_relaxed);
+    }
+    
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(_mut);
+        const uint64_t ticket = ++_flushRequested;
+        _cv.notify_one();
+        _cv_flushed.wait(lock, [this, ticket]() { return _flushed >= ticket || _stop; });
+    }
+    
+private:
+    
+    void run()
+    {
+        std::vector<std::shared_ptr<ring>> rings;
+        std::vector<const entry*> batch;
+        std::string out;
+        
+        std::unique_lock<std::mutex> lock(_mut);
+        for (;;)
+        {
+            _cv.wait_for(lock, _interval, [this]() { return _stop || _flushRequested != _flushed; });
+            const uint64_t requested = _flushRequested;
+            const bool stop = _stop;
+            rings = _rings;
+            lock.unlock();
+            
+            // collect first and release after writing, producers can not reuse a slot before that
+            std::vector<uint64_t> ends(rings.size());
+            batch.clear();
+            for (size_t i = 0; i < rings.size(); ++i)
+            {
+                ring& r = *rings[i];
+                const uint64_t tail = r.tail.load(std::memory_order_relaxed);
+                ends[i] = r.head.load(std::memory_order_acquire);
+                for (uint64_t n = tail; n != ends[i]; ++n)
+                {
+                    batch.push_back(&r.slots[n & (RING_CAPACITY - 1)]);
+                }
+            }
+            
+            // threads fill their rings independently, so records are merged back into time order
+            std::stable_sort(batch.begin(), batch.end(), [](const entry* a, const entry* b) { return a->timestamp < b->timestamp; });
+            
+            out.clear();
+            for (const entry* e : batch)
+            {
+                format(&out, *e);
+            }
+            
+            const uint64_t drops = dropped.load(std::memory_order_relaxed);
+            if (drops != _reportedDrops)
+            {
+                out.append("logger: ").append(std::to_string(drops - _reportedDrops)).append(" records dropped\n");
+                _reportedDrops = drops;
+            }
+            
+            write(out);
+            for (size_t i = 0; i < rings.size(); ++i)
+            {
+                rings[i]->tail.store(ends[i], std::memory_order_release);
+            }
+            
+            lock.lock();
+            for (size_t i = 0; i < _rings.size(); )
+            {
+                ring& r = *_rings[i];
+                if (r.abandoned.load(std::memory_order_acquire) 
+                    && r.head.load(std::memory_order_acquire) == r.tail.load(std::memory_order_relaxed))
+                {
+                    _rings[i] = _rings.back();
+                    _rings.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            
+            _flushed = requested;
+            _cv_flushed.notify_all();
+            if (stop)
+            {
+                return;
+            }
+        }
+    }
+    
+    /// Appends @p e as one line of text.
+    static void format(std::string* const out, const entry& e)
+    {
+        const std::time_t seconds = static_cast<std::time_t>(e.timestamp / 1000000000);
+        std::tm tm;
+        ::localtime_r(&seconds, &tm);
+        
+        const char* const slash = std::strrchr(e.file, '/');
+        char prefix[128];
+        const size_t date = std::strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm);
+        std::snprintf(prefix + date, sizeof(prefix) - date, ".%06ld %s [t%u] %s:%d ", 
+                      static_cast<long>((e.timestamp / 1000) % 1000000), name(e.severity), e.thread, slash ? slash + 1 : e.file, e.line);
+        
+        out->append(prefix);
+        out->append(e.text, e.length);
+        out->push_back('\n');
+    }
+    
+    void write(const std::string& out)
+    {
+        std::lock_guard<std::mutex> lock(_mut_output);
+        size_t done = 0;
+        while (done < out.size())
+        {
+            const ssize_t n = ::write(_fd, out.data() + done, out.size() - done);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (n <= 0)
+            {
+                // nowhere to report it, the records are lost
+                return;
+            }
+            done += static_cast<size_t>(n);
+        }
+    }
+    
+    /// Protects everything up to @c _mut_output
+    std::mutex _mut;
+    std::condition_variable _cv;
+    std::condition_variable _cv_flushed;
+    std::vector<std::shared_ptr<ring>> _rings;
+    std::chrono::milliseconds _interval;
+    bool _stop;
+    uint64_t _flushRequested;
+    uint64_t _flushed;
+    uint32_t _nextID;
+    
+    /// Protects @c _fd while it is written to or replaced
+    std::mutex _mut_output;
+    int _fd;
+    
+    /// Only used by the writer thread
+    uint64_t _reportedDrops;
+    
+    std::thread _thread;
+    
+public:
+    
+    std::atomic<uint64_t> dropped;
+};
+
+writer& instance()
+{
+    static writer w;
+    return w;
+}
+
+/// The calling thread's ring, abandoned when the thread exits
+struct thread_ring
+{
+    thread_ring()
+        : r(instance().attach())
+    { }
+    
+    ~thread_ring()
+    {
+        r->abandoned.store(true, std::memory_order_release);
+    }
+    
+    std::shared_ptr<ring> r;
+};
+
+thread_local thread_ring t_ring;
+
+} // end anonymous namespace
+
+void logging::configure(const config& conf)
+{
+    instance().configure(conf);
+}
+
+void logging::flush()
+{
+    instance().flush();
+}
+
+uint64_t logging::dropped()
+{
+    return instance().dropped.load(std::memory_order_relaxed);
+}
+
+line::~line()
+{
+    ring& r = *t_ring.r;
+    const uint64_t head = r.head.load(std::memory_order_relaxed);
+    if (head - r.tail.load(std::memory_order_acquire) >= RING_CAPACITY)
+    {
+        instance().dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    entry& e = r.slots[head & (RING_CAPACITY - 1)];
+    e.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    e.file = _file;
+    e.line = _line;
+    e.thread = r.id;
+    e.severity = _level;
+    e.length = static_cast<uint16_t>(_length);
+    std::memcpy(e.text, _text, _length);
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+line& line::operator<<(const double d)
+{
+    char buff[32];
+    const int n = std::snprintf(buff, sizeof(buff), "%g", d);
+    return *this << boost::string_ref(buff, static_cast<size_t>(std::max(n, 0)));
+}
+
+line& line::operator<<(const void* const p)
+{
+    char buff[32];
+    const int n = std::snprintf(buff, sizeof(buff), "%p", p);
+    return *this << boost::string_ref(buff, static_cast<size_t>(std::max(n, 0)));
+}
+
+line& line::formatSigned(const long long v)
+{
+    if (v < 0)
+    {
+        *this << '-';
+        return formatUnsigned(0ULL - static_cast<unsigned long long>(v));
+    }
+    return formatUnsigned(static_cast<unsigned long long>(v));
+}
+
+line& line::formatUnsigned(unsigned long long v)
+{
+    char buff[24];
+    char* p = buff + sizeof(buff);
+    do
+    {
+        *--p = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    return *this << boost::string_ref(p, static_cast<size_t>(buff + sizeof(buff) - p));
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "metrics/http_exporter.hpp"
+#include "metrics/registry.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace se3313;
+using namespace metrics;
+
+namespace
+{
+
+/// Longest a client may take to send its request
+constexpr int REQUEST_TIMEOUT_MS = 1000;
+
+/// Largest request read, anything longer is not a scrape
+constexpr size_t MAX_REQUEST = 8192;
+
+} // end anonymous namespace
+
+http_exporter::http_exporter(const networking::port_t port)
+    : _listenFD(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))
+    , _stopEventFD(::eventfd(0, EFD_CLOEXEC))
+{
+    if (_listenFD < 0 || _stopEventFD < 0)
+    {
+        throw std::runtime_error("Unable to open the metrics exporter");
+    }
+    
+    const int one = 1;
+    ::setsockopt(_listenFD, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    
+    // metrics are not for the outside world
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(_listenFD, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(_listenFD, 8) < 0)
+    {
+        std::ostringstream ss; ss << "Unable to bind metrics exporter to port " << port << ", err: " << errno;
+        ::close(_listenFD);
+        ::close(_stopEventFD);
+        throw std::runtime_error(ss.str());
+    }
+    
+    _thread = std::thread(&http_exporter::run, this);
+}
+
+http_exporter::~http_exporter()
+{
+    const uint64_t one = 1;
+    ::write(_stopEventFD, &one, sizeof(one));
+    _thread.join();
+    
+    ::close(_listenFD);
+    ::close(_stopEventFD);
+}
+
+void http_exporter::run()
+{
+    for (;;)
+    {
+        pollfd fds[2];
+        fds[0].fd = _listenFD;
+        fds[0].events = POLLIN;
+        fds[1].fd = _stopEventFD;
+        fds[1].events = POLLIN;
+        
+        if (::poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        
+        if (fds[1].revents)
+        {
+            return;
+        }
+        
+        if (fds[0].revents & POLLIN)
+        {
+            const int fd = ::accept4(_listenFD, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                answer(fd);
+            }
+        }
+    }
+}
+
+void http_exporter::answer(const int fd)
+{
+    timeval tv;
+    tv.tv_sec = REQUEST_TIMEOUT_MS / 1000;
+    tv.tv_usec = (REQUEST_TIMEOUT_MS % 1000) * 1000;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    
+    // only the request line matters, the headers are read so the client sees a clean close
+    std::string request;
+    char buff[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST)
+    {
+        const ssize_t n = ::recv(fd, buff, sizeof(buff), 0);
+        if (n <= 0)
+        {
+            ::close(fd);
+            return;
+        }
+        request.append(buff, static_cast<size_t>(n));
+    }
+    
+    std::string status = "200 OK";
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics?") == 0)
+    {
+        body = registry::exposition();
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "Only /metrics is served.\n";
+    }
+    
+    std::ostringstream ss;
+    ss << "HTTP/1.1 " << status << "\r\n"
+       << "Content-Type: text/plain; version=0.0.4\r\n"
+       << "Content-Length: " << body.size() << "\r\n"
+       << "Connection: close\r\n\r\n" << body;
+    const std::string response = ss.str();
+    
+    size_t done = 0;
+    while (done < response.size())
+    {
+        const ssize_t n = ::send(fd, response.data() + done, response.size() - done, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+}
@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "metrics/registry.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+using namespace se3313;
+using namespace metrics;
+
+thread_local std::atomic<uint64_t>* detail::t_cells = nullptr;
+
+namespace
+{
+
+enum class kind { COUNTER, GAUGE, HISTOGRAM, LATENCY };
+
+/// How the values of a cell over several threads combine
+enum class combine : uint8_t { 
+    SUM,
+    
+    /// The cell holds the bits of a double, which are summed as doubles
+    SUM_DOUBLE,
+    
+    MAX
+};
+
+/// A registered metric and the cells it owns
+struct metric
+{
+    std::string name;
+    std::string help;
+    std::string labels;
+    kind type;
+    uint32_t first;
+    
+    /// Histogram bucket bounds, empty otherwise
+    std::vector<double> bounds;
+};
+
+/// Everything behind the registry, guarded by @c mut
+struct state
+{
+    std::mutex mut;
+    
+    /// In registration order, which is the export order within a name
+    std::vector<std::unique_ptr<metric>> metrics;
+    std::map<std::pair<std::string, std::string>, metric*> byKey;
+    uint32_t nextCell = 0;
+    
+    /// Cells of each live thread
+    std::vector<std::atomic<uint64_t>*> live;
+    
+    /// Cells of threads that exited, added up
+    std::vector<uint64_t> retired = std::vector<uint64_t>(detail::MAX_CELLS, 0);
+    
+    /// How each cell combines, most are counts
+    std::vector<combine> combining = std::vector<combine>(detail::MAX_CELLS, combine::SUM);
+};
+
+state& global()
+{
+    static state s;
+    return s;
+}
+
+double toDouble(const uint64_t bits)
+{
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+uint64_t fromDouble(const double d)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(d));
+    return bits;
+}
+
+/// Adds @p v to the running total @p total of a cell, respecting its representation.
+void accumulate(const state& s, const uint32_t cell, uint64_t* const total, const uint64_t v)
+{
+    if (s.combining[cell] == combine::SUM_DOUBLE)
+    {
+        *total = fromDouble(toDouble(*total) + toDouble(v));
+    }
+    else if (s.combining[cell] == combine::MAX)
+    {
+        *total = std::max(*total, v);
+    }
+    else
+    {
+        *total += v;
+    }
+}
+
+/// Sum of @p cell over live and exited threads, called with the lock held.
+uint64_t total(const state& s, const uint32_t cell)
+{
+    uint64_t t = s.retired[cell];
+    for (const std::atomic<uint64_t>* const cells : s.live)
+    {
+        accumulate(s, cell, &t, cells[cell].load(std::memory_order_relaxed));
+    }
+    return t;
+}
+
+/// Owns the calling thread's cells and folds them into the retired totals when the thread exits.
+struct thread_cells
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> cells;
+    
+    ~thread_cells()
+    {
+        if (!cells)
+        {
+            return;
+        }
+        
+        state& s = global();
+        std::lock_guard<std::mutex> lock(s.mut);
+        for (uint32_t i = 0; i < s.nextCell; ++i)
+        {
+            accumulate(s, i, &s.retired[i], cells[i].load(std::memory_order_relaxed));
+        }
+        s.live.erase(std::find(s.live.begin(), s.live.end(), cells.get()));
+        detail::t_cells = nullptr;
+    }
+};
+
+thread_local thread_cells t_owner;
+
+/// Finds or adds a metric, reserving its cells if it is new.
+metric& reserve(const std::string& name, const std::string& help, const std::string& labels, const kind type, 
+                const std::vector<double>& bounds = std::vector<double>())
+{
+    // histograms have their buckets, the unbounded bucket and the sum
+    // latencies have their buckets, the sum and the maximum
+    const uint32_t cells = type == kind::HISTOGRAM ? static_cast<uint32_t>(bounds.size() + 2) 
+                         : type == kind::LATENCY ? detail::LATENCY_BUCKETS + 2 
+                         : 1;
+    
+    state& s = global();
+    std::lock_guard<std::mutex> lock(s.mut);
+    
+    const auto it = s.byKey.find(std::make_pair(name, labels));
+    if (it != s.byKey.end())
+    {
+        if (it->second->type != type)
+        {
+            throw std::runtime_error("Metric " + name + " registered with two types.");
+        }
+        return *it->second;
+    }
+    
+    if (s.nextCell + cells > detail::MAX_CELLS)
+    {
+        throw std::runtime_error("Out of metric cells registering " + name);
+    }
+    
+    std::unique_ptr<metric> m(new metric());
+    m->name = name;
+    m->help = help;
+    m->labels = labels;
+    m->type = type;
+    m->first = s.nextCell;
+    m->bounds = bounds;
+    s.nextCell += cells;
+    if (type == kind::HISTOGRAM)
+    {
+        s.combining[m->first + cells - 1] = combine::SUM_DOUBLE;
+    }
+    else if (type == kind::LATENCY)
+    {
+        s.combining[m->first + cells - 1] = combine::MAX;
+    }
+    
+    metric& ref = *m;
+    s.byKey[std::make_pair(name, labels)] = m.get();
+    s.metrics.push_back(std::move(m));
+    return ref;
+}
+
+/// Percentiles of the latency whose cells start at @p first, called with the lock held.
+latency_snapshot snapshotOf(const state& s, const uint32_t first)
+{
+    std::vector<uint64_t> buckets(detail::LATENCY_BUCKETS);
+    latency_snapshot snap;
+    snap.count = 0;
+    for (uint32_t b = 0; b < detail::LATENCY_BUCKETS; ++b)
+    {
+        buckets[b] = total(s, first + b);
+        snap.count += buckets[b];
+    }
+    
+    const uint64_t sum = total(s, first + detail::LATENCY_BUCKETS);
+    snap.max = total(s, first + detail::LATENCY_BUCKETS + 1);
+    snap.mean = snap.count ? sum / snap.count : 0;
+    
+    // each percentile is the top of the bucket holding its rank, never past the largest value seen
+    const double quantiles[] = { 0.5, 0.99, 0.999 };
+    uint64_t* const results[] = { &snap.p50, &snap.p99, &snap.p999 };
+    for (size_t q = 0; q < 3; ++q)
+    {
+        const uint64_t rank = static_cast<uint64_t>(quantiles[q] * static_cast<double>(snap.count) + 0.5);
+        uint64_t seen = 0;
+        uint32_t b = 0;
+        while (b + 1 < detail::LATENCY_BUCKETS && seen + buckets[b] < std::max<uint64_t>(rank, 1))
+        {
+            seen += buckets[b];
+            ++b;
+        }
+        *results[q] = snap.count ? std::min(detail::latencyBucketMax(b), snap.max) : 0;
+    }
+    return snap;
+}
+
+void appendDouble(std::string* const out, const double d)
+{
+    char buff[32];
+    std::snprintf(buff, sizeof(buff), "%.17g", d);
+    out->append(buff);
+}
+
+/// Appends `name{labels,extra} value`.
+void appendSample(std::string* const out, const std::string& name, const std::string& labels, const std::string& extra, const std::string& value)
+{
+    out->append(name);
+    if (!labels.empty() || !extra.empty())
+    {
+        out->push_back('{');
+        out->append(labels);
+        if (!labels.empty() && !extra.empty())
+        {
+            out->push_back(',');
+        }
+        out->append(extra);
+        out->push_back('}');
+    }
+    out->push_back(' ');
+    out->append(value);
+    out->push_back('\n');
+}
+
+} // end anonymous namespace
+
+std::atomic<uint64_t>* detail::attach()
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> cells(new std::atomic<uint64_t>[MAX_CELLS]());
+    
+    state& s = global();
+    std::lock_guard<std::mutex> lock(s.mut);
+    s.live.push_back(cells.get());
+    t_cells = cells.get();
+    t_owner.cells = std::move(cells);
+    return t_cells;
+}
+
+uint64_t detail::latencyBucketMax(const uint32_t b)
+{
+    if (b < LATENCY_SUB_BUCKETS)
+    {
+        return b;
+    }
+    
+    const uint32_t octave = b / LATENCY_SUB_BUCKETS;
+    const uint32_t sub = b % LATENCY_SUB_BUCKETS;
+    const uint32_t shift = octave - 1;
+    return ((static_cast<uint64_t>(LATENCY_SUB_BUCKETS + sub + 1)) << shift) - 1;
+}
+
+uint64_t detail::sum(const uint32_t cell)
+{
+    state& s = global();
+    std::lock_guard<std::mutex> lock(s.mut);
+    return total(s, cell);
+}
+
+counter registry::makeCounter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return counter(reserve(name, help, labels, kind::COUNTER).first);
+}
+
+gauge registry::makeGauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return gauge(reserve(name, help, labels, kind::GAUGE).first);
+}
+
+histogram registry::makeHistogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                                  const std::string& labels)
+{
+    const metric& m = reserve(name, help, labels, kind::HISTOGRAM, bounds);
+    return histogram(m.first, &m.bounds);
+}
+
+latency registry::makeLatency(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return latency(reserve(name, help, labels, kind::LATENCY).first);
+}
+
+latency_snapshot latency::snapshot() const
+{
+    state& s = global();
+    std::lock_guard<std::mutex> lock(s.mut);
+    return snapshotOf(s, _first);
+}
+
+std::string registry::exposition()
+{
+    state& s = global();
+    std::lock_guard<std::mutex> lock(s.mut);
+    
+    // samples of one name must be contiguous, names keep the order they were first registered in
+    std::vector<std::string> names;
+    std::map<std::string, std::vector<const metric*>> byName;
+    for (const std::unique_ptr<metric>& m : s.metrics)
+    {
+        std::vector<const metric*>& group = byName[m->name];
+        if (group.empty())
+        {
+            names.push_back(m->name);
+        }
+        group.push_back(m.get());
+    }
+    
+    std::string out;
+    for (const std::string& name : names)
+    {
+        const std::vector<const metric*>& group = byName[name];
+        const metric& head = *group.front();
+        out.append("# HELP ").append(name).append(" ").append(head.help).append("\n");
+        out.append("# TYPE ").append(name).append(head.type == kind::COUNTER ? " counter\n" : head.type == kind::GAUGE ? " gauge\n" 
+                                                                                           : head.type == kind::HISTOGRAM ? " histogram\n" : " summary\n");
+        
+        for (const metric* const m : group)
+        {
+            if (m->type == kind::COUNTER)
+            {
+                appendSample(&out, name, m->labels, std::string(), std::to_string(total(s, m->first)));
+            }
+            else if (m->type == kind::GAUGE)
+            {
+                appendSample(&out, name, m->labels, std::string(), std::to_string(static_cast<int64_t>(total(s, m->first))));
+            }
+            else if (m->type == kind::LATENCY)
+            {
+                const latency_snapshot snap = snapshotOf(s, m->first);
+                const std::pair<const char*, uint64_t> quantiles[] = { 
+                    { "quantile=\"0.5\"", snap.p50 }, { "quantile=\"0.99\"", snap.p99 }, 
+                    { "quantile=\"0.999\"", snap.p999 }, { "quantile=\"1\"", snap.max } 
+                };
+                for (const auto& q : quantiles)
+                {
+                    std::string v;
+                    appendDouble(&v, static_cast<double>(q.second) / 1e9);
+                    appendSample(&out, name, m->labels, q.first, v);
+                }
+                
+                std::string sum;
+                appendDouble(&sum, static_cast<double>(total(s, m->first + detail::LATENCY_BUCKETS)) / 1e9);
+                appendSample(&out, name + "_sum", m->labels, std::string(), sum);
+                appendSample(&out, name + "_count", m->labels, std::string(), std::to_string(snap.count));
+            }
+            else
+            {
+                uint64_t cumulative = 0;
+                for (size_t b = 0; b <= m->bounds.size(); ++b)
+                {
+                    cumulative += total(s, static_cast<uint32_t>(m->first + b));
+                    std::string le = "le=\"+Inf\"";
+                    if (b < m->bounds.size())
+                    {
+                        char buff[32];
+                        std::snprintf(buff, sizeof(buff), "le=\"%g\"", m->bounds[b]);
+                        le = buff;
+                    }
+                    appendSample(&out, name + "_bucket", m->labels, le, std::to_string(cumulative));
+                }
+                
+                std::string sum;
+                appendDouble(&sum, toDouble(total(s, static_cast<uint32_t>(m->first + m->bounds.size() + 1))));
+                appendSample(&out, name + "_sum", m->labels, std::string(), sum);
+                appendSample(&out, name + "_count", m->labels, std::string(), std::to_string(cumulative));
+            }
+        }
+    }
+    return out;
+}
+
+std::vector<double> registry::exponentialBounds(const double first, const double factor, const size_t count)
+{
+    std::vector<double> bounds;
+    double b = first;
+    for (size_t i = 0; i < count; ++i)
+    {
+        bounds.push_back(b);
+        b *= factor;
+    }
+    return bounds;
+}
@@ -38,49 +38,6 @@ constexpr const char error::PROPERTY_CODE[];
 constexpr const char error::PROPERTY_MESSAGE[];
 constexpr const char error::PROPERTY_ORIGINATOR[];
 
-boost::property_tree::ptree error::subToJson() const
-{
-    boost::property_tree::ptree json = baseJson();
-    
-    json.put(PROPERTY_CODE, static_cast<uint16_t>(_errorCode));
-    json.put(PROPERTY_MESSAGE, _message);
-    json.put(PROPERTY_ORIGINATOR, _originator);
-    
-    return json;
-}
-
-std::shared_ptr<error> error::fromJson(boost::property_tree::ptree& json)
-{
-    std::string sender;
-    time_point_t dateTime;
-    abstract_instance::extractCommonParams(json, &dateTime, &sender);
-    
-    // get all of the other parameters
-    const auto codeIt = json.find(PROPERTY_CODE);
-    if (codeIt == json.not_found())
-    {
-        throw std::runtime_error("Can not get error code from JSON");
-    }
-    const ErrorCode code = static_cast<ErrorCode>(codeIt->second.get_value<uint16_t>());
-    
-    const auto msgIt = json.find(PROPERTY_MESSAGE);
-    if (msgIt == json.not_found())
-    {
-        throw std::runtime_error("Can not get message from JSON");
-    }
-    const std::string message = msgIt->second.get_value<std::string>();
-    
-    const auto origIt = json.find(PROPERTY_ORIGINATOR);
-    if (origIt == json.not_found())
-    {
-        throw std::runtime_error("Can not get originator from JSON");
-    }
-    const std::string originator = origIt->second.get_value<std::string>();
-    
-    return std::make_shared<error>(dateTime, sender, originator, code, message);
-}
-
-
 const bool msg::response::is_error_msg(const std::shared_ptr<msg::instance> instance)
 {
     const auto err = std::dynamic_pointer_cast<error>(instance);
@@ -21,6 +21,7 @@
  */
 
 #include "msg/instance.hpp"
+#include "logging/log.hpp"
 
 #include <boost/property_tree/ptree.hpp>
 
@@ -35,6 +36,7 @@ constexpr const char instance::PROPERTY_SENDER[];
 
 constexpr const char instance::SERVER_SENDER[];
 constexpr const char instance::UNKNOWN_SENDER[];
+constexpr const char instance::DEFAULT_ROOM[];
 
 boost::optional<std::pair<std::string, boost::property_tree::ptree>>
 instance::extractFrom(boost::property_tree::ptree json)
@@ -46,19 +48,17 @@ instance::extractFrom(boost::property_tree::ptree json)
         
     if (type_prop_it == json.not_found())
     {   // invalid specification for the json, no "type" tag
-        std::cerr << "No type tag specified (tag=\"" 
-                  << msg::instance::PROPERTY_TYPE 
-                  << "\")" 
-                  << std::endl;
+        SE3313_LOG_DEBUG("No type tag specified (tag=\"" 
+                         << msg::instance::PROPERTY_TYPE 
+                         << "\")");
         return boost::none;
     } // fallthrough on else
         
     if (obj_prop_it == json.not_found())
     {
-        std::cerr << "No object tag specified (tag=\"" 
-                    << msg::instance::PROPERTY_OBJECT 
-                    << "\")"
-                    << std::endl;
+        SE3313_LOG_DEBUG("No object tag specified (tag=\"" 
+                         << msg::instance::PROPERTY_OBJECT 
+                         << "\")");
         return boost::none;
     }
     
@@ -25,49 +25,9 @@
 using namespace se3313;
 using namespace msg;
 
-namespace pt = boost::property_tree;
-
 constexpr const char request::login::TYPE[];
-
-std::shared_ptr<request::login> request::login::fromJson(pt::ptree& json)
-{
-    std::string sender;
-    time_point_t dateTime;
-    abstract_instance::extractCommonParams(json, &dateTime, &sender);
-    
-    return std::make_shared<login>(dateTime, sender);
-}
-
-pt::ptree request::login::subToJson() const
-{
-    return baseJson();
-}
-
+constexpr const char request::login::PROPERTY_CAPABILITIES[];
+constexpr const char request::login::CAPABILITY_FLOW_CONTROL[];
 
 constexpr const char response::login::TYPE[];
 constexpr const char response::login::PROPERTY_JOINING_USERNAME[];
-
-pt::ptree response::login::subToJson() const
-{   
-    boost::property_tree::ptree json = baseJson();
-    
-    json.put(PROPERTY_JOINING_USERNAME, this->joiningUsername());
-    
-    return json;
-}
-
-std::shared_ptr<response::login> response::login::fromJson(pt::ptree& json)
-{
-    std::string sender;
-    time_point_t dateTime;
-    abstract_instance::extractCommonParams(json, &dateTime, &sender);
-    
-    auto joiningUserIt = json.find(PROPERTY_JOINING_USERNAME);
-    if (joiningUserIt == json.not_found())
-    {
-        throw std::runtime_error("Can not get joining username from JSON");
-    }
-    const std::string joiningUser = joiningUserIt->second.get_value<std::string>();
-    
-    return std::make_shared<login>(dateTime, sender, joiningUser);
-}
@@ -25,73 +25,12 @@
 using namespace se3313;
 using namespace msg;
 
-namespace pt = boost::property_tree;
-
 constexpr const char request::message::TYPE[];
 
 constexpr const char request::message::PROPERTY_CONTENT[];
-
-std::shared_ptr<request::message> request::message::fromJson(pt::ptree& json)
-{
-    std::string sender;
-    time_point_t dateTime;
-    abstract_instance::extractCommonParams(json, &dateTime, &sender);
-    
-    const auto messageIt = json.find(PROPERTY_CONTENT);
-    if (messageIt == json.not_found())
-    {
-        throw std::runtime_error("Could not get message");
-    }
-    
-    const std::string message = messageIt->second.get_value<std::string>();
-    
-    return std::make_shared<request::message>(dateTime, sender, message);
-}
-
-pt::ptree request::message::subToJson() const
-{
-    boost::property_tree::ptree json = baseJson();
-    
-    json.put(PROPERTY_CONTENT, _content);
-    
-    return json;
-}
+constexpr const char request::message::PROPERTY_ROOM[];
 
 constexpr const char response::message::TYPE[];
 constexpr const char response::message::PROPERTY_ORIGINATOR[];
 constexpr const char response::message::PROPERTY_CONTENT[];
-
-pt::ptree response::message::subToJson() const
-{   
-    boost::property_tree::ptree json = baseJson();
-    
-    json.put(PROPERTY_ORIGINATOR, _originator);
-    json.put(PROPERTY_CONTENT, _content);
-    
-    return json;
-}
-
-std::shared_ptr<response::message> response::message::fromJson(pt::ptree& json)
-{
-    std::string sender;
-    time_point_t dateTime;
-    abstract_instance::extractCommonParams(json, &dateTime, &sender);
-    
-    const auto messageIt = json.find(PROPERTY_CONTENT);
-    if (messageIt == json.not_found())
-    {
-        throw std::runtime_error("Could not get message.");
-    }
-    
-    const std::string message = messageIt->second.get_value<std::string>();
-    
-    const auto origIt = json.find(PROPERTY_ORIGINATOR);
-    if (origIt == json.not_found())
-    {
-        throw std::runtime_error("Could not get originator.");
-    }
-    
-    const std::string originator = origIt->second.get_value<std::string>();
-    
-    return std::make_shared<response::message>(dateTime, sender, originator, message);
-}
+constexpr const char response::message::PROPERTY_ROOM[];
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msg/room.hpp"
+
+using namespace se3313;
+using namespace msg;
+
+constexpr const char request::join::TYPE[];
+constexpr const char request::join::PROPERTY_ROOM[];
+
+constexpr const char request::leave::TYPE[];
+constexpr const char request::leave::PROPERTY_ROOM[];
+
+constexpr const char response::join::TYPE[];
+constexpr const char response::join::PROPERTY_USERNAME[];
+constexpr const char response::join::PROPERTY_ROOM[];
+
+constexpr const char response::leave::TYPE[];
+constexpr const char response::leave::PROPERTY_USERNAME[];
+constexpr const char response::leave::PROPERTY_ROOM[];
@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "networking/chat_client.hpp"
+#include "logging/log.hpp"
+#include "metrics/registry.hpp"
+#include "msg/json.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <boost/assert.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace se3313;
+using namespace networking;
+
+namespace
+{
+
+using se3313::metrics::registry;
+
+const metrics::counter g_attempts = registry::makeCounter("chat_client_connect_attempts_total", "Connections clients started to make");
+const metrics::counter g_connects = registry::makeCounter("chat_client_connects_total", "Connections clients made");
+const metrics::counter g_failures = registry::makeCounter("chat_client_connect_failures_total", "Connections that could not be made, including timeouts");
+const metrics::counter g_timeouts = registry::makeCounter("chat_client_connect_timeouts_total", "Connections not made within the connect timeout");
+const metrics::counter g_disconnects = registry::makeCounter("chat_client_disconnects_total", "Connections clients lost");
+const metrics::gauge g_connected = registry::makeGauge("chat_client_connected", "Clients connected");
+const metrics::counter g_responses = registry::makeCounter("chat_client_responses_total", "Responses dispatched to the clients' visitors");
+const metrics::counter g_malformed = registry::makeCounter("chat_client_malformed_responses_total", "Responses that were not JSON");
+const metrics::counter g_refused = registry::makeCounter("chat_client_refused_sends_total", "Requests refused as too many were queued");
+
+/// Events handled by one call of `process()`, the rest are left for the next
+constexpr size_t MAX_EVENTS = 256;
+
+/// Reads of one client in one call of `process()`, so a busy connection does not hold up the loop
+constexpr int MAX_READS = 16;
+
+/// Marks the timer in the epoll set, clients are numbered from 1
+constexpr uint64_t TIMER = 0;
+
+std::string describe(const char* const what, const int err)
+{
+    std::ostringstream ss; ss << what << ": " << ::strerror(err);
+    return ss.str();
+}
+
+} // end anonymous namespace
+
+chat_client::chat_client(pool* const owner, const uint64_t id, const std::string& host, const port_t port, const config& conf,
+                         const std::shared_ptr<visitor_t> visitor, const std::shared_ptr<listener> events)
+    : _pool(owner)
+    , _id(id)
+    , _host(host)
+    , _port(port)
+    , _config(conf)
+    , _visitor(visitor)
+    , _listener(events)
+    , _state(state::CONNECTING)
+    , _scanned(0)
+    , _cut(false)
+    , _watchingWritable(false)
+    , _backoff(0)
+    , _deadline(0)
+    , _connections(0)
+{ }
+
+chat_client::~chat_client() = default;
+
+bool chat_client::send(const msg::instance& request)
+{
+    return send(msg::json::to(request.toJson()));
+}
+
+bool chat_client::send(const std::string& frame)
+{
+    const bool terminated = !frame.empty() && frame.back() == '\n';
+    if (_state == state::CLOSED)
+    {
+        return false;
+    }
+    if (_outbound.size() + frame.size() + (terminated ? 0 : 1) > _config.maxQueuedBytes)
+    {
+        g_refused.inc();
+        return false;
+    }
+    
+    _outbound.append(frame);
+    if (!terminated)
+    {
+        _outbound.push_back('\n');
+    }
+    
+    // with output already waiting for room the request goes out behind it
+    if (_state == state::CONNECTED && !_watchingWritable)
+    {
+        flush();
+    }
+    return true;
+}
+
+void chat_client::close()
+{
+    if (_state == state::CLOSED)
+    {
+        return;
+    }
+    if (_state == state::CONNECTED)
+    {
+        g_connected.dec();
+    }
+    if (_socket && _socket->isOpen())
+    {
+        if (_pool)
+        {
+            ::epoll_ctl(_pool->_epollFD, EPOLL_CTL_DEL, _socket->fd(), nullptr);
+        }
+        _socket->close();
+    }
+    
+    _state = state::CLOSED;
+    _outbound.clear();
+    _inbound.clear();
+    _scanned = 0;
+    _deadline = 0;
+    
+    // last, the pool may hold the only reference left
+    if (_pool)
+    {
+        _pool->remove(*this);
+    }
+}
+
+void chat_client::flush()
+{
+    while (!_outbound.empty())
+    {
+        const ssize_t written = _socket->write(_outbound.data(), _outbound.size());
+        if (written <= 0)
+        {
+            break;
+        }
+        _cut = _outbound[static_cast<size_t>(written) - 1] != '\n';
+        _outbound.erase(0, static_cast<size_t>(written));
+    }
+    
+    if (!_socket->isOpen())
+    {
+        _pool->lost(*this, "write failed");
+        return;
+    }
+    
+    const bool writable = !_outbound.empty();
+    if (writable != _watchingWritable)
+    {
+        _pool->control(*this, writable);
+    }
+}
+
+void chat_client::dispatch()
+{
+    // a response arriving over many reads is searched for its end only once
+    size_t start = 0;
+    size_t end;
+    while ((end = _inbound.find('\n', std::max(start, _scanned))) != std::string::npos)
+    {
+        const size_t begin = start;
+        start = end + 1;
+        if (end == begin)
+        {
+            continue;
+        }
+        
+        boost::property_tree::ptree json;
+        try
+        {
+            json = msg::json::from(_inbound.substr(begin, end - begin));
+        }
+        catch (const boost::property_tree::json_parser_error&)
+        {
+            g_malformed.inc();
+            SE3313_LOG_DEBUG("chat_client: response from " << _host << ":" << _port << " is not JSON");
+            continue;
+        }
+        
+        g_responses.inc();
+        _pool->_dispatching = this;
+        try
+        {
+            _visitor->visit(json);
+        }
+        catch (...)
+        {
+            _pool->_dispatching = nullptr;
+            throw;
+        }
+        _pool->_dispatching = nullptr;
+        
+        // the visitor closed the client, or a request it sent lost the connection
+        if (_state != state::CONNECTED)
+        {
+            return;
+        }
+    }
+    _inbound.erase(0, start);
+    _scanned = _inbound.size();
+}
+
+chat_client::pool::pool()
+    : _epollFD(::epoll_create1(EPOLL_CLOEXEC))
+    , _timerFD(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    , _events(MAX_EVENTS)
+    , _nextClient(TIMER + 1)
+    , _nextDeadline(1)
+    , _random(std::random_device()())
+    , _dispatching(nullptr)
+{
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = TIMER;
+    if (_epollFD < 0 || _timerFD < 0 || ::epoll_ctl(_epollFD, EPOLL_CTL_ADD, _timerFD, &ev) == -1)
+    {
+        std::ostringstream ss; ss << "chat_client::pool: could not create its epoll set, errno: " << errno;
+        if (_epollFD >= 0) ::close(_epollFD);
+        if (_timerFD >= 0) ::close(_timerFD);
+        throw std::runtime_error(ss.str());
+    }
+}
+
+chat_client::pool::~pool()
+{
+    // closing takes a client out of the map
+    std::unordered_map<uint64_t, std::shared_ptr<chat_client>> clients;
+    clients.swap(_clients);
+    for (auto& c : clients)
+    {
+        c.second->close();
+        
+        // a client still referenced elsewhere outlives the pool, closed
+        c.second->_pool = nullptr;
+    }
+    
+    ::close(_timerFD);
+    ::close(_epollFD);
+}
+
+std::shared_ptr<chat_client> chat_client::pool::connect(const std::string& host, const port_t port, const std::shared_ptr<visitor_t> visitor,
+                                                        const std::shared_ptr<listener> events, const config& conf)
+{
+    BOOST_ASSERT(visitor);
+    
+    in_addr address;
+    if (!::inet_aton(host.c_str(), &address))
+    {
+        throw std::runtime_error("chat_client: " + host + " is not an IPv4 address");
+    }
+    
+    const uint64_t id = _nextClient++;
+    const std::shared_ptr<chat_client> c(new chat_client(this, id, host, port, conf, visitor, events));
+    _clients.emplace(id, c);
+    open(*c);
+    return c;
+}
+
+void chat_client::pool::attach(flex_waiter& waiter)
+{
+    waiter.watch(_epollFD, [this](){ process(); });
+}
+
+void chat_client::pool::detach(flex_waiter& waiter)
+{
+    waiter.unwatch(_epollFD);
+}
+
+void chat_client::pool::process()
+{
+    const int n = ::epoll_wait(_epollFD, _events.data(), static_cast<int>(_events.size()), 0);
+    for (int i = 0; i < n; ++i)
+    {
+        const uint64_t id = _events[i].data.u64;
+        const uint32_t events = _events[i].events;
+        if (id == TIMER)
+        {
+            uint64_t expirations;
+            while (::read(_timerFD, &expirations, sizeof(expirations)) > 0)
+            {
+            }
+            continue;
+        }
+        
+        // handlers may close any client, each is looked up again and kept alive while handled
+        const auto found = _clients.find(id);
+        if (found == _clients.end())
+        {
+            continue;
+        }
+        const std::shared_ptr<chat_client> keep = found->second;
+        chat_client& c = *keep;
+        
+        if (c._state == state::CONNECTING)
+        {
+            opened(c);
+            continue;
+        }
+        if (c._state != state::CONNECTED)
+        {
+            continue;
+        }
+        
+        if (events & EPOLLOUT)
+        {
+            c.flush();
+        }
+        if (c._state == state::CONNECTED && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        {
+            std::string data;
+            ssize_t read = 0;
+            for (int r = 0; r < MAX_READS && (read = c._socket->read(&data)) > 0; ++r)
+            {
+                c._inbound.append(data);
+            }
+            
+            // what arrived before the server hung up is still dispatched
+            c.dispatch();
+            if (c._state == state::CONNECTED && !c._socket->isOpen())
+            {
+                lost(c, read == 0 ? "closed by the server" : "read failed");
+            }
+        }
+    }
+    
+    expire();
+}
+
+void chat_client::pool::open(chat_client& c)
+{
+    g_attempts.inc();
+    c._state = state::CONNECTING;
+    c._watchingWritable = false;
+    
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        lost(c, describe("could not create a socket", errno));
+        return;
+    }
+    c._socket = std::make_shared<socket>(fd);
+    
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(c._port);
+    ::inet_aton(c._host.c_str(), &address.sin_addr);
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0)
+    {
+        opened(c);
+        return;
+    }
+    if (errno != EINPROGRESS)
+    {
+        lost(c, describe("could not connect", errno));
+        return;
+    }
+    
+    // writable once connected, errors and hang ups are always reported
+    epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u64 = c._id;
+    ::epoll_ctl(_epollFD, EPOLL_CTL_ADD, fd, &ev);
+    schedule(c, std::chrono::steady_clock::now() + c._config.connectTimeout);
+}
+
+void chat_client::pool::opened(chat_client& c)
+{
+    int err = 0;
+    socklen_t length = sizeof(err);
+    if (::getsockopt(c._socket->fd(), SOL_SOCKET, SO_ERROR, &err, &length) == -1)
+    {
+        err = errno;
+    }
+    if (err != 0)
+    {
+        lost(c, describe("could not connect", err));
+        return;
+    }
+    
+    g_connects.inc();
+    g_connected.inc();
+    c._state = state::CONNECTED;
+    c._connectedAt = std::chrono::steady_clock::now();
+    c._deadline = 0;
+    ++c._connections;
+    
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = c._id;
+    if (::epoll_ctl(_epollFD, EPOLL_CTL_MOD, c._socket->fd(), &ev) == -1)
+    {
+        ::epoll_ctl(_epollFD, EPOLL_CTL_ADD, c._socket->fd(), &ev);
+    }
+    
+    // what the listener sends goes ahead of what was queued meanwhile, a login before the messages
+    std::string queued;
+    queued.swap(c._outbound);
+    const std::shared_ptr<chat_client> keep = find(c);
+    if (c._listener)
+    {
+        c._listener->onConnected(c);
+    }
+    if (c._state != state::CONNECTED)
+    {
+        return;
+    }
+    c._outbound.append(queued);
+    c.flush();
+}
+
+void chat_client::pool::lost(chat_client& c, const std::string& reason)
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (c._state == state::CONNECTED)
+    {
+        g_connected.dec();
+        g_disconnects.inc();
+        if (now - c._connectedAt > c._backoff)
+        {
+            c._backoff = std::chrono::milliseconds::zero();
+        }
+    }
+    else
+    {
+        g_failures.inc();
+    }
+    
+    // a socket closed by a failed read or write already left the epoll set
+    if (c._socket && c._socket->isOpen())
+    {
+        ::epoll_ctl(_epollFD, EPOLL_CTL_DEL, c._socket->fd(), nullptr);
+        c._socket->close();
+    }
+    c._socket.reset();
+    c._inbound.clear();
+    c._scanned = 0;
+    c._watchingWritable = false;
+    
+    // the rest of a request cut off would be taken for garbage by the next connection
+    if (c._cut)
+    {
+        const size_t end = c._outbound.find('\n');
+        c._outbound.erase(0, end == std::string::npos ? end : end + 1);
+        c._cut = false;
+    }
+    
+    const bool reconnecting = c._config.reconnect;
+    if (reconnecting)
+    {
+        c._state = state::WAITING;
+        c._backoff = c._backoff == std::chrono::milliseconds::zero() 
+                   ? c._config.backoffMin 
+                   : std::min(c._backoff * 2, c._config.backoffMax);
+        const std::chrono::milliseconds::rep half = c._backoff.count() / 2;
+        const std::chrono::milliseconds delay(half + std::uniform_int_distribution<std::chrono::milliseconds::rep>(0, c._backoff.count() - half)(_random));
+        schedule(c, now + delay);
+    }
+    else
+    {
+        c._state = state::CLOSED;
+        c._deadline = 0;
+    }
+    SE3313_LOG_DEBUG("chat_client: " << c._host << ":" << c._port << " " << reason << (reconnecting ? ", reconnecting" : ""));
+    
+    const std::shared_ptr<chat_client> keep = find(c);
+    if (c._listener)
+    {
+        c._listener->onDisconnected(c, reason, reconnecting);
+    }
+    if (!reconnecting)
+    {
+        remove(c);
+    }
+}
+
+void chat_client::pool::remove(chat_client& c)
+{
+    _clients.erase(c._id);
+}
+
+std::shared_ptr<chat_client> chat_client::pool::find(const chat_client& c) const
+{
+    const auto found = _clients.find(c._id);
+    return found != _clients.end() ? found->second : nullptr;
+}
+
+void chat_client::pool::control(chat_client& c, const bool writable)
+{
+    epoll_event ev;
+    ev.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u64 = c._id;
+    ::epoll_ctl(_epollFD, EPOLL_CTL_MOD, c._socket->fd(), &ev);
+    c._watchingWritable = writable;
+}
+
+void chat_client::pool::schedule(chat_client& c, const std::chrono::steady_clock::time_point at)
+{
+    c._deadline = _nextDeadline++;
+    _deadlines.push(deadline{ at, c._id, c._deadline });
+    arm();
+}
+
+void chat_client::pool::expire()
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    while (!_deadlines.empty() && _deadlines.top().at <= now)
+    {
+        const deadline due = _deadlines.top();
+        _deadlines.pop();
+        
+        // deadlines are not taken out of the queue when cancelled, only ignored
+        const auto found = _clients.find(due.client);
+        if (found == _clients.end() || found->second->_deadline != due.id)
+        {
+            continue;
+        }
+        const std::shared_ptr<chat_client> keep = found->second;
+        keep->_deadline = 0;
+        if (keep->_state == state::CONNECTING)
+        {
+            g_timeouts.inc();
+            lost(*keep, "connect timed out");
+        }
+        else if (keep->_state == state::WAITING)
+        {
+            open(*keep);
+        }
+    }
+    
+    arm();
+}
+
+void chat_client::pool::arm()
+{
+    // the timer wakes the loop for the first deadline only
+    const std::chrono::steady_clock::time_point next = _deadlines.empty() ? std::chrono::steady_clock::time_point() : _deadlines.top().at;
+    if (next != _armed)
+    {
+        itimerspec spec;
+        std::memset(&spec, 0, sizeof(spec));
+        const std::chrono::nanoseconds since = next.time_since_epoch();
+        spec.it_value.tv_sec = static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(since).count());
+        spec.it_value.tv_nsec = static_cast<long>((since % std::chrono::seconds(1)).count());
+        ::timerfd_settime(_timerFD, TFD_TIMER_ABSTIME, &spec, nullptr);
+        _armed = next;
+    }
+}
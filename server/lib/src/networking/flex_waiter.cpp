@@ -20,31 +20,64 @@
  * SOFTWARE.
  */
 
+#include "logging/log.hpp"
+#include "metrics/registry.hpp"
 #include "networking/flex_waiter.hpp"
 
-#include <iostream>
+#include <errno.h>
+#include <string.h>
 #include <stdio.h>
 #include <sys/eventfd.h>
-#include <sys/select.h>
-#include <sys/time.h>
 #include <sys/unistd.h> 
 
 #include <boost/assert.hpp>
 
+#include <sstream>
+
 using namespace se3313;
 using namespace networking;
 
 constexpr const uint64_t flex_waiter::KILL_SIGNAL;
 
+namespace
+{
+
+using se3313::metrics::registry;
+
+const metrics::counter g_wakeups = registry::makeCounter("flex_waiter_wakeups_total", "Waits that returned with activity");
+const metrics::counter g_timeouts = registry::makeCounter("flex_waiter_timeouts_total", "Waits that timed out");
+const metrics::counter g_events = registry::makeCounter("flex_waiter_events_total", "Ready descriptors handled");
+const metrics::counter g_postedTasks = registry::makeCounter("flex_waiter_posted_tasks_total", "Tasks posted from other threads and run");
+const metrics::gauge g_sockets = registry::makeGauge("flex_waiter_sockets", "Sockets waited on");
+const metrics::gauge g_paused = registry::makeGauge("flex_waiter_paused_sockets", "Sockets whose input is not waited on");
+const metrics::gauge g_writable = registry::makeGauge("flex_waiter_writable_sockets", "Sockets waited on for output");
+
+/// Events returned by one wait at most, more stay ready for the next
+constexpr size_t MAX_EVENTS = 1024;
+
+} // end anonymous namespace
+
 flex_waiter::flex_waiter(std::shared_ptr<networking::socket_server> master) 
-    : _killEventFD(-1)
-    , _master(master) 
+    : _epollFD(::epoll_create1(EPOLL_CLOEXEC))
+    , _events(MAX_EVENTS)
+    , _killEventFD(::eventfd(0, EFD_CLOEXEC))
+    , _postEventFD(::eventfd(0, EFD_CLOEXEC))
+    , _watchSTDIN(false)
+    , _pollSTDIN(true)
 {
+    if (_epollFD == -1 || _killEventFD == -1 || _postEventFD == -1)
+    {
+        throw std::runtime_error("Could not create the events to wait on.");
+    }
+    
+    control(_killEventFD, source::KILL, EPOLLIN);
+    control(_postEventFD, source::POST, EPOLLIN);
+    watchSTDIN(true);
+    setServer(master);
 }
 
 flex_waiter::flex_waiter() 
-    : _killEventFD(-1)
-    , _master(nullptr) 
+    : flex_waiter(nullptr)
 {
 }
 
@@ -56,171 +89,401 @@ flex_waiter::~flex_waiter()
         ::close(_killEventFD);
         _killEventFD = -1;
     }
+    
+    ::close(_postEventFD);
+    ::close(_epollFD);
+}
+
+void flex_waiter::control(const int fd, const source src, const uint32_t events)
+{
+    epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = (static_cast<uint64_t>(src) << 32) | static_cast<uint32_t>(fd);
+    if (::epoll_ctl(_epollFD, EPOLL_CTL_ADD, fd, &ev) == -1 
+        && (errno != EEXIST || ::epoll_ctl(_epollFD, EPOLL_CTL_MOD, fd, &ev) == -1))
+    {
+        std::ostringstream ss; ss << "Could not wait on descriptor " << fd << ", err: " << errno;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void flex_waiter::update(const int fd, registration& reg)
+{
+    const uint32_t events = (reg.paused ? 0u : static_cast<uint32_t>(EPOLLIN)) | (reg.writable ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (events != 0)
+    {
+        control(fd, source::SOCKET, events);
+        reg.registered = true;
+    }
+    else if (reg.registered)
+    {
+        // a paused socket leaves the set, a hung up peer would otherwise be reported on every wait
+        ::epoll_ctl(_epollFD, EPOLL_CTL_DEL, fd, nullptr);
+        reg.registered = false;
+    }
+}
+
+flex_waiter::registration* flex_waiter::find(const socket_ptr_t& sock)
+{
+    const auto it = _sockets.find(sock->fd());
+    return it != _sockets.end() && it->second.socket == sock ? &it->second : nullptr;
+}
+
+void flex_waiter::setServer(const socket_server_ptr_t server)
+{
+    // the old server may have released its descriptor already, then it left the set by itself
+    if (_master && _master->fd() >= 0)
+    {
+        ::epoll_ctl(_epollFD, EPOLL_CTL_DEL, _master->fd(), nullptr);
+    }
+    
+    _master = server;
+    if (_master)
+    {
+        control(_master->fd(), source::MASTER, EPOLLIN);
+    }
+}
+
+void flex_waiter::watchSTDIN(const bool watch)
+{
+    if (watch == _watchSTDIN)
+    {
+        return;
+    }
+    
+    _watchSTDIN = watch;
+    if (!watch)
+    {
+        ::epoll_ctl(_epollFD, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+        return;
+    }
+    
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = static_cast<uint64_t>(source::STDIN) << 32;
+    _pollSTDIN = ::epoll_ctl(_epollFD, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0 || errno == EEXIST;
 }
 
 void flex_waiter::addSocket(const std::shared_ptr<networking::socket> newSock)
 {
     BOOST_ASSERT(newSock);
     
-    _sockets.insert(newSock);
+    // a descriptor closed without `removeSocket()` left the set by itself and may now be reused
+    registration& reg = _sockets[newSock->fd()];
+    if (reg.socket == newSock)
+    {
+        return;
+    }
+    
+    if (!reg.socket)
+    {
+        g_sockets.inc();
+    }
+    else
+    {
+        g_paused.add(-static_cast<int64_t>(reg.paused));
+        g_writable.add(-static_cast<int64_t>(reg.writable));
+    }
+    reg = registration{ newSock, false, false, false };
+    update(newSock->fd(), reg);
 }
 
 void flex_waiter::removeSocket(const std::shared_ptr<networking::socket> sock) 
 {
     BOOST_ASSERT(sock);
     
-    auto it = _sockets.find(sock);
-    if (it != _sockets.end()) 
+    registration* const reg = find(sock);
+    if (!reg) 
     {
-        _sockets.erase(it);
+        return;
     }
+    
+    g_sockets.dec();
+    g_paused.add(-static_cast<int64_t>(reg->paused));
+    g_writable.add(-static_cast<int64_t>(reg->writable));
+    if (reg->registered && sock->isOpen())
+    {
+        ::epoll_ctl(_epollFD, EPOLL_CTL_DEL, sock->fd(), nullptr);
+    }
+    _sockets.erase(sock->fd());
 }
 
-void flex_waiter::kill() 
+void flex_waiter::pauseSocket(const socket_ptr_t sock)
 {
-    std::lock_guard<std::mutex> lock(_mut_killEvent);
-    if (_killEventFD >= 0)
+    BOOST_ASSERT(sock);
+    
+    registration* const reg = find(sock);
+    if (reg && !reg->paused)
     {
-        ::write(_killEventFD, &KILL_SIGNAL, sizeof(KILL_SIGNAL));
+        reg->paused = true;
+        g_paused.inc();
+        update(sock->fd(), *reg);
     }
 }
 
-void flex_waiter::wait(const std::shared_ptr<activity_visitor> handler, std::chrono::milliseconds timeout)
+void flex_waiter::resumeSocket(const socket_ptr_t sock)
 {
-    BOOST_ASSERT_MSG(handler, "Must specify a valid handler.");
+    BOOST_ASSERT(sock);
     
-    // calculate the timeout
-    ::timeval tv;
-    ::timeval * pTimeout = &tv;
+    registration* const reg = find(sock);
+    if (reg && reg->paused)
+    {
+        reg->paused = false;
+        g_paused.dec();
+        update(sock->fd(), *reg);
+    }
+}
 
-    if (timeout > std::chrono::seconds::min())
+void flex_waiter::watchWritable(const socket_ptr_t sock, const bool watch)
+{
+    BOOST_ASSERT(sock);
+    
+    registration* const reg = find(sock);
+    if (reg && reg->writable != watch)
     {
-        const auto v = timeout.count();
-        
-        tv.tv_sec = v/1000;
-        tv.tv_usec = (v%1000)*1000;
-    } 
-    else 
+        reg->writable = watch;
+        g_writable.add(watch ? 1 : -1);
+        update(sock->fd(), *reg);
+    }
+}
+
+void flex_waiter::post(task_t task)
+{
+    BOOST_ASSERT(task);
+    
+    bool wake;
     {
-        pTimeout = NULL;
+        std::lock_guard<std::mutex> lock(_mut_posted);
+        wake = _posted.empty();
+        _posted.push_back(std::move(task));
     }
     
-    ::fd_set theSet;
-    FD_ZERO(&theSet);
+    // only the first task of a batch needs to wake the waiter, it runs the whole batch
+    if (wake)
+    {
+        const uint64_t one = 1;
+        ::write(_postEventFD, &one, sizeof(one));
+    }
+}
+
+void flex_waiter::supervise(const loop_watchdog::config& conf)
+{
+    _watchdog.reset(new loop_watchdog(conf));
+}
+
+void flex_waiter::runPosted()
+{
+    std::vector<task_t> tasks;
+    {
+        std::lock_guard<std::mutex> lock(_mut_posted);
+        tasks.swap(_posted);
+    }
     
-    FD_SET(STDIN_FILENO, &theSet);
-    int maxFD = STDIN_FILENO; // stdin is LIKELY 0, but oh well.
+    for (const task_t& task : tasks)
+    {
+        loop_watchdog::handler_timer timed(_watchdog.get(), "posted task", -1);
+        task();
+    }
+    g_postedTasks.inc(tasks.size());
+}
+
+void flex_waiter::watch(const int fd, task_t onReadable)
+{
+    BOOST_ASSERT(fd >= 0 && onReadable);
     
-    if (_master)
+    control(fd, source::WATCHED, EPOLLIN);
+    _watched[fd] = std::move(onReadable);
+}
+
+void flex_waiter::unwatch(const int fd)
+{
+    if (_watched.erase(fd))
     {
-        const int masterFD = _master->fd();
-        maxFD = masterFD;
-        FD_SET(masterFD, &theSet);
+        ::epoll_ctl(_epollFD, EPOLL_CTL_DEL, fd, nullptr);
     }
-        
-    for (const auto& sock: _sockets)
+}
+
+void flex_waiter::kill() 
+{
+    std::lock_guard<std::mutex> lock(_mut_killEvent);
+    if (_killEventFD >= 0)
     {
-        if (sock->isOpen()) {
-            const int fd = sock->fd();
-            
-            maxFD = std::max(maxFD, fd);
-            FD_SET(fd, &theSet);
-        }
+        ::write(_killEventFD, &KILL_SIGNAL, sizeof(KILL_SIGNAL));
     }
+}
+
+void flex_waiter::readSTDIN(activity_visitor& handler)
+{
+    char buff[BUFFER_SIZE];
+    ::memset(buff, 0, BUFFER_SIZE);
+    ssize_t n = ::read(STDIN_FILENO, buff, BUFFER_SIZE - 1);
     
-    int killEventFD;
+    if (n < 0)
     {
-        // Scope lock the killEvent file descriptor, that way we can't close or change it
-        // while its locked
-        
-        std::lock_guard<std::mutex> lock(_mut_killEvent);
-        if (_killEventFD == -1)
-        {
-            // See `man eventfd(2)`
-            const int efd = ::eventfd(0, 0);
-            if (efd == -1) 
-            {
-                throw std::runtime_error("Could not create unlock event.");
-            }
-            
-            _killEventFD = efd;
-        }
-        killEventFD = _killEventFD;
+        throw std::runtime_error("Failed to read from stdin after being notified of being active.");
+    }
+    else if (n == 0)
+    {
+        // a closed stdin stays readable forever, stop waiting on it
+        watchSTDIN(false);
+        return;
     }
     
-    FD_SET(killEventFD, &theSet);
-    maxFD = std::max(maxFD, killEventFD);
+    std::string input = buff;
+    if (!input.empty() && input.back() == '\n')
+    {
+        input.erase(input.end() - 1);
+    }
     
-    const int retval = ::select(maxFD + 1, &theSet, NULL, NULL, pTimeout);
+    handler.onSTDIN(input);
+}
 
-    if (retval < 0)
+void flex_waiter::wait(const std::shared_ptr<activity_visitor> handler, std::chrono::milliseconds timeout)
+{
+    BOOST_ASSERT_MSG(handler, "Must specify a valid handler.");
+    
+    // the caller's work since the last wait belongs to the iteration too
+    if (_watchdog)
+    {
+        _watchdog->idle();
+    }
+    
+    // a stdin that can not be waited on is always ready, as select() would have said
+    if (_watchSTDIN && !_pollSTDIN)
+    {
+        readSTDIN(*handler);
+        timeout = std::chrono::milliseconds::zero();
+    }
+    
+    const int timeoutMs = timeout > std::chrono::milliseconds::min() 
+                        ? static_cast<int>(std::max<std::chrono::milliseconds::rep>(timeout.count(), 0)) 
+                        : -1;
+    
+    const int retval = ::epoll_wait(_epollFD, _events.data(), static_cast<int>(_events.size()), timeoutMs);
+    if (retval < 0 && errno == EINTR)
+    {
+        return;
+    }
+    else if (retval < 0)
     {
         throw std::runtime_error("Unexpected error in synchronization object");
     } 
-    else if (retval) 
+    else if (retval == 0)
     {
-        // Check if someone killed externally
-        if (FD_ISSET(killEventFD, &theSet)) 
+        g_timeouts.inc();
+        return;
+    }
+    
+    g_wakeups.inc();
+    g_events.inc(static_cast<uint64_t>(retval));
+    if (_watchdog)
+    {
+        _watchdog->busy();
+    }
+    
+    // control events first, the sockets' handlers may be affected by posted work
+    bool sockets = false;
+    for (int i = 0; i < retval; ++i)
+    {
+        const source src = static_cast<source>(_events[i].data.u64 >> 32);
+        const int fd = static_cast<int>(_events[i].data.u64 & 0xffffffff);
+        switch (src)
         {
-            std::cout << __func__ << ": Received kill signal." << std::endl;
-            uint64_t killv;
-            size_t killrv = ::read(killEventFD, (void*) &killv, sizeof(uint64_t));
-            
-            if (killrv > 0)
+            case source::KILL:
             {
-                if (killrv != sizeof(uint64_t)) 
-                {
-                    throw std::runtime_error("Invalid signal read from kill, "
-                                            "probably implementation problem.");
-                } 
-                else 
+                SE3313_LOG_INFO(__func__ << ": Received kill signal.");
+                uint64_t killv;
+                if (::read(_killEventFD, &killv, sizeof(killv)) == sizeof(killv))
                 {
                     return;
                 }
+                break;
             }
-        } 
-        else if (FD_ISSET(STDIN_FILENO, &theSet))
-        {
-            std::string input;
             
-            char buff[BUFFER_SIZE];
-            ::memset(buff, 0, BUFFER_SIZE);
-            ssize_t n = ::read(STDIN_FILENO, buff, BUFFER_SIZE);
-            
-            if (n < 0)
+            case source::POST:
             {
-                throw std::runtime_error("Failed to read from stdin after being notified of being active.");
+                uint64_t count;
+                ::read(_postEventFD, &count, sizeof(count));
+                runPosted();
+                break;
             }
             
-            input = buff;
-            if (!input.empty() && input.back() == '\n')
+            case source::STDIN:
+                if (_watchSTDIN)
+                {
+                    loop_watchdog::handler_timer timed(_watchdog.get(), "onSTDIN", STDIN_FILENO);
+                    readSTDIN(*handler);
+                }
+                break;
+                
+            case source::MASTER:
+                if (_master && _master->fd() == fd)
+                {
+                    loop_watchdog::handler_timer timed(_watchdog.get(), "onSocketServer", fd);
+                    handler->onSocketServer(_master);
+                }
+                break;
+                
+            case source::WATCHED:
             {
-                input.erase(input.end() - 1);
+                const auto w = _watched.find(fd);
+                if (w != _watched.end())
+                {
+                    // copied, the handler may unwatch its own descriptor
+                    const task_t onReadable = w->second;
+                    loop_watchdog::handler_timer timed(_watchdog.get(), "watched", fd);
+                    onReadable();
+                    
+                    // a watched descriptor may hand the sockets over, nothing else is handled after it
+                    return;
+                }
+                break;
             }
             
-            handler->onSTDIN(input);
+            case source::SOCKET:
+                sockets = true;
+                break;
         }
-        else 
+    }
+    
+    if (!sockets)
+    {
+        return;
+    }
+    
+    // draining output comes first, it frees memory rather than using more
+    for (int i = 0; i < retval; ++i)
+    {
+        const uint32_t events = _events[i].events;
+        if (static_cast<source>(_events[i].data.u64 >> 32) != source::SOCKET || !(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
         {
-            if (_master && FD_ISSET(_master->fd(), &theSet))
-            {
-                handler->onSocketServer(_master);
-            } 
-            else
-            {
-                for (const auto& child: _sockets)
-                {
-                    const int fd = child->fd();
-                    if (FD_ISSET(fd,&theSet)) 
-                    {
-                        handler->onSocket(child);
-                        break;
-                    }
-                }
-                
-                // If we don't find it, it just timed out *oh well*
-            }
-        } 
-    } // end if (retval)
+            continue;
+        }
+        
+        // handlers may close or remove any socket, each is looked up again
+        const auto it = _sockets.find(static_cast<int>(_events[i].data.u64 & 0xffffffff));
+        if (it != _sockets.end() && it->second.writable && it->second.socket->isOpen())
+        {
+            const socket_ptr_t sock = it->second.socket;
+            loop_watchdog::handler_timer timed(_watchdog.get(), "onWritable", sock->fd());
+            handler->onWritable(sock);
+        }
+    }
     
+    for (int i = 0; i < retval; ++i)
+    {
+        const uint32_t events = _events[i].events;
+        if (static_cast<source>(_events[i].data.u64 >> 32) != source::SOCKET || !(events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        {
+            continue;
+        }
+        
+        const auto it = _sockets.find(static_cast<int>(_events[i].data.u64 & 0xffffffff));
+        if (it != _sockets.end() && !it->second.paused && it->second.socket->isOpen())
+        {
+            const socket_ptr_t sock = it->second.socket;
+            loop_watchdog::handler_timer timed(_watchdog.get(), "onSocket", sock->fd());
+            handler->onSocket(sock);
+        }
+    }
 }
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "logging/log.hpp"
+#include "metrics/registry.hpp"
+#include "networking/loop_watchdog.hpp"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
+using namespace se3313;
+using namespace networking;
+
+namespace
+{
+
+using se3313::metrics::registry;
+
+const metrics::gauge g_lag = registry::makeGauge("flex_waiter_loop_lag_microseconds", "Time the last loop iteration took from waking up to waiting again");
+const metrics::latency g_iterations = registry::makeLatency("flex_waiter_iteration_seconds", "Time loop iterations take from waking up to waiting again");
+const metrics::counter g_slowHandlers = registry::makeCounter("flex_waiter_slow_handlers_total", "Handler calls over their budget");
+const metrics::counter g_slowIterations = registry::makeCounter("flex_waiter_slow_iterations_total", "Loop iterations over their budget");
+const metrics::counter g_stalls = registry::makeCounter("flex_waiter_stalls_total", "Times the loop was found busy past the stall timeout");
+
+/// What the handler running on this thread works on, see `annotate()`
+thread_local const char* t_what = nullptr;
+
+/// Frames of a stack sample, written by the signal handler
+constexpr int MAX_FRAMES = 64;
+void* g_frames[MAX_FRAMES];
+int g_depth = 0;
+
+/// Generation of the sample asked for, 0 once a handler took it or the request was withdrawn
+std::atomic<uint64_t> g_requested(0);
+
+/// Generation of the sample last written to @c g_frames
+std::atomic<uint64_t> g_answered(0);
+
+/// Only one stack is sampled at a time, over every watchdog, and guards @c g_generation
+std::mutex g_mut_sampling;
+uint64_t g_generation = 0;
+std::once_flag g_installed;
+
+void onSample(int)
+{
+    const int saved = errno;
+    
+    // one handler answers each request, a signal delivered late finds nothing to answer and leaves the frames alone
+    const uint64_t generation = g_requested.exchange(0, std::memory_order_acq_rel);
+    if (generation != 0)
+    {
+        g_depth = ::backtrace(g_frames, MAX_FRAMES);
+        g_answered.store(generation, std::memory_order_release);
+    }
+    errno = saved;
+}
+
+int64_t nanos(const std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+double millis(const std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+} // end anonymous namespace
+
+loop_watchdog::loop_watchdog(const config& conf)
+    : _config(conf)
+    , _handlers(0)
+    , _slowest(0)
+    , _slowestHandler(nullptr)
+    , _slowestFD(-1)
+    , _slowestWhat(nullptr)
+    , _lagMicros(0)
+    , _suppressed(0)
+    , _busySince(0)
+    , _knowsLoop(false)
+    , _stop(false)
+{
+    if (_config.stallTimeout > std::chrono::milliseconds::zero())
+    {
+        std::call_once(g_installed, [](){
+            // backtrace() loads libgcc on its first call, which must not happen in the signal handler
+            void* frame;
+            ::backtrace(&frame, 1);
+            
+            struct sigaction action;
+            ::memset(&action, 0, sizeof(action));
+            action.sa_handler = onSample;
+            action.sa_flags = SA_RESTART;
+            ::sigemptyset(&action.sa_mask);
+            ::sigaction(SIGRTMIN, &action, nullptr);
+        });
+        
+        _thread = std::thread(&loop_watchdog::run, this);
+    }
+}
+
+loop_watchdog::~loop_watchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mut_stop);
+        _stop = true;
+    }
+    _cv_stop.notify_one();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+void loop_watchdog::annotate(const char* const what)
+{
+    t_what = what;
+}
+
+void loop_watchdog::busy()
+{
+    _iterationStarted = std::chrono::steady_clock::now();
+    _handlers = 0;
+    _slowest = std::chrono::steady_clock::duration::zero();
+    _slowestHandler = nullptr;
+    
+    if (!_knowsLoop.load(std::memory_order_relaxed))
+    {
+        _loop = ::pthread_self();
+        _knowsLoop.store(true, std::memory_order_release);
+    }
+    _busySince.store(nanos(_iterationStarted), std::memory_order_release);
+}
+
+void loop_watchdog::idle()
+{
+    if (_busySince.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    _busySince.store(0, std::memory_order_release);
+    
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::duration took = now - _iterationStarted;
+    const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(took).count();
+    g_lag.add(micros - _lagMicros);
+    _lagMicros = micros;
+    g_iterations.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()));
+    
+    if (took <= _config.iterationBudget)
+    {
+        return;
+    }
+    g_slowIterations.inc();
+    if (mayReport(now))
+    {
+        std::ostringstream slowest;
+        if (_slowestHandler)
+        {
+            slowest << ", the slowest " << _slowestHandler << " on fd " << _slowestFD 
+                    << (_slowestWhat ? " handling " : "") << (_slowestWhat ? _slowestWhat : "") 
+                    << " for " << millis(_slowest) << " ms";
+        }
+        SE3313_LOG_WARN("Event loop iteration took " << millis(took) << " ms (budget " << _config.iterationBudget.count() 
+                        << " ms) running " << _handlers << " handlers" << slowest.str() 
+                        << (_suppressed ? ", " : "") << (_suppressed ? std::to_string(_suppressed) + " warnings suppressed before" : ""));
+        _suppressed = 0;
+    }
+}
+
+void loop_watchdog::handled(const char* const handler, const int fd, const std::chrono::steady_clock::duration took)
+{
+    ++_handlers;
+    if (took > _slowest)
+    {
+        _slowest = took;
+        _slowestHandler = handler;
+        _slowestFD = fd;
+        _slowestWhat = t_what;
+    }
+    
+    if (took <= _config.handlerBudget)
+    {
+        return;
+    }
+    g_slowHandlers.inc();
+    if (mayReport(std::chrono::steady_clock::now()))
+    {
+        SE3313_LOG_WARN("Slow handler: " << handler << " on fd " << fd << (t_what ? " handling " : "") << (t_what ? t_what : "") 
+                        << " took " << millis(took) << " ms (budget " << _config.handlerBudget.count() << " ms)"
+                        << (_suppressed ? ", " : "") << (_suppressed ? std::to_string(_suppressed) + " warnings suppressed before" : ""));
+        _suppressed = 0;
+    }
+}
+
+bool loop_watchdog::mayReport(const std::chrono::steady_clock::time_point now)
+{
+    if (_lastReport != std::chrono::steady_clock::time_point() && now - _lastReport < _config.reportInterval)
+    {
+        ++_suppressed;
+        return false;
+    }
+    _lastReport = now;
+    return true;
+}
+
+void loop_watchdog::run()
+{
+    const std::chrono::milliseconds period = std::max(_config.stallTimeout / 4, std::chrono::milliseconds(10));
+    
+    // the iteration already sampled, a stall is only sampled once
+    int64_t sampled = 0;
+    
+    std::unique_lock<std::mutex> lock(_mut_stop);
+    while (!_cv_stop.wait_for(lock, period, [this](){ return _stop; }))
+    {
+        const int64_t since = _busySince.load(std::memory_order_acquire);
+        if (since == 0 || since == sampled || !_knowsLoop.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+        
+        const std::chrono::nanoseconds busyFor(nanos(std::chrono::steady_clock::now()) - since);
+        if (busyFor >= _config.stallTimeout)
+        {
+            sampled = since;
+            lock.unlock();
+            sampleStack(since, busyFor);
+            lock.lock();
+        }
+    }
+}
+
+void loop_watchdog::sampleStack(const int64_t since, const std::chrono::steady_clock::duration busyFor)
+{
+    g_stalls.inc();
+    
+    std::lock_guard<std::mutex> lock(g_mut_sampling);
+    const uint64_t generation = ++g_generation;
+    g_requested.store(generation, std::memory_order_release);
+    if (::pthread_kill(_loop, SIGRTMIN) != 0)
+    {
+        g_requested.store(0, std::memory_order_relaxed);
+        return;
+    }
+    
+    bool answered = false;
+    for (int attempt = 0; attempt < 200 && !answered; ++attempt)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        answered = g_answered.load(std::memory_order_acquire) == generation;
+    }
+    
+    uint64_t pending = generation;
+    if (!answered && !g_requested.compare_exchange_strong(pending, 0, std::memory_order_acq_rel))
+    {
+        // too late to withdraw, a handler took the request and is writing the frames
+        while (g_answered.load(std::memory_order_acquire) != generation)
+        {
+            std::this_thread::yield();
+        }
+        answered = true;
+    }
+    
+    if (!answered)
+    {
+        SE3313_LOG_ERROR("Event loop stalled, busy for " << millis(busyFor) << " ms, its thread did not answer for a stack");
+        return;
+    }
+    
+    // the loop may have gone on to wait between being found busy and the signal, its stack would be epoll_wait()'s
+    if (_busySince.load(std::memory_order_acquire) != since)
+    {
+        SE3313_LOG_ERROR("Event loop stalled, busy for " << millis(busyFor) << " ms, it went on before its stack was taken");
+        return;
+    }
+
+    // log lines are short, so every frame gets its own
+    const int depth = g_depth;
+    SE3313_LOG_ERROR("Event loop stalled, busy for " << millis(busyFor) << " ms, its stack:");
+    if (char** const symbols = ::backtrace_symbols(g_frames, depth))
+    {
+        // the first frames are the signal handler's
+        for (int i = 2; i < depth; ++i)
+        {
+            SE3313_LOG_ERROR("    #" << i - 2 << " " << symbols[i]);
+        }
+        ::free(symbols);
+    }
+}
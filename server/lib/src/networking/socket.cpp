@@ -21,17 +21,20 @@
  */
 
 #include "networking/socket.hpp"
+#include "logging/log.hpp"
+#include "metrics/registry.hpp"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <boost/assert.hpp>
 
-#include <iostream>
 #include <stdexcept>
 #include <string>
 #include <sstream>
@@ -39,6 +42,21 @@
 
 namespace net = se3313::networking;
 
+namespace
+{
+
+using se3313::metrics::registry;
+
+const se3313::metrics::counter g_reads = registry::makeCounter("socket_reads_total", "Reads that returned data");
+const se3313::metrics::counter g_readBytes = registry::makeCounter("socket_read_bytes_total", "Bytes read from sockets");
+const se3313::metrics::counter g_writes = registry::makeCounter("socket_writes_total", "Writes that sent data");
+const se3313::metrics::counter g_writtenBytes = registry::makeCounter("socket_written_bytes_total", "Bytes written to sockets");
+const se3313::metrics::counter g_wouldBlock = registry::makeCounter("socket_would_block_total", "Reads and writes the socket was not ready for");
+const se3313::metrics::counter g_errors = registry::makeCounter("socket_errors_total", "Reads and writes that failed and closed the socket");
+const se3313::metrics::counter g_peerClosed = registry::makeCounter("socket_peer_closed_total", "Connections closed by the peer");
+
+} // end anonymous namespace
+
 net::socket::socket(const std::string& ipAddress, const uint16_t port)
     : _open(false)
 {
@@ -93,19 +111,22 @@ ssize_t net::socket::read(std::vector<char>* const vec)
     }
 
     char raw_buff[MAX_BUFFER_SIZE];
-    std::memset(raw_buff, MAX_BUFFER_SIZE, 0);
 
     ssize_t received = ::recv(_socketFD, raw_buff, MAX_BUFFER_SIZE, 0);
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return -1;
+    }
     
     if (received == -1)
     {
-        _open = false;
-        std::cout << "Failed to read from socket (" << _socketFD << ")." << std::endl;
+        this->close();
+        SE3313_LOG_WARN("Failed to read from socket (" << _socketFD << ").");
     } 
     else if (received == 0) 
     {
-        _open = false;
-        std::cout << __func__ << "@L" << __LINE__ << " Socket closed (" << _socketFD << ")." << std::endl;
+        this->close();
+        SE3313_LOG_DEBUG(__func__ << " Socket closed (" << _socketFD << ").");
     }
     else 
     {
@@ -123,14 +144,18 @@ ssize_t net::socket::read(std::string* const str)
 
     if (!_open)
     {
-        std::cout << __func__ << ": Tried to read form closed socket." << std::endl;
+        SE3313_LOG_DEBUG(__func__ << ": Tried to read form closed socket.");
         return -1;
     }
 
     char raw_buff[MAX_BUFFER_SIZE];
-    std::memset(raw_buff, MAX_BUFFER_SIZE, 0);
 
     ssize_t received = ::recv(_socketFD, raw_buff, MAX_BUFFER_SIZE, 0);
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        g_wouldBlock.inc();
+        return -1;
+    }
 
     // Return Value
     // These calls return the number of bytes received, or -1 if an error occurred. 
@@ -138,17 +163,21 @@ ssize_t net::socket::read(std::string* const str)
     
     if (received == -1)
     {
-        _open = false;
-        std::cout << __func__ << "@L" << __LINE__ << " Failed to read from socket (" << _socketFD << ")." << std::endl;
+        g_errors.inc();
+        this->close();
+        SE3313_LOG_WARN(__func__ << " Failed to read from socket (" << _socketFD << ").");
     } 
     else if (received == 0) 
     {
-        _open = false;
-        std::cout << __func__ << "@L" << __LINE__ << " Socket closed (" << _socketFD << ")." << std::endl;
+        g_peerClosed.inc();
+        this->close();
+        SE3313_LOG_DEBUG(__func__ << " Socket closed (" << _socketFD << ").");
     }
     else
     {
-        *str = std::string(raw_buff);
+        g_reads.inc();
+        g_readBytes.inc(static_cast<uint64_t>(received));
+        str->assign(raw_buff, received);
     }
 
     return received;
@@ -161,16 +190,37 @@ ssize_t net::socket::write(const char* const buff, const size_t length)
         throw std::runtime_error("Can not write to closed socket.");
     }
 
-    ssize_t ret = ::write(this->_socketFD, buff, length);
-    if (ret == -1)
+    // send() rather than write() so a peer that went away is an error, not a SIGPIPE
+    ssize_t ret = ::send(this->_socketFD, buff, length, MSG_NOSIGNAL);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
     {
-        this->_open = false;
-        std::cout << "Socket failed to write." << std::endl;
+        g_wouldBlock.inc();
+        return 0;
+    }
+    else if (ret == -1)
+    {
+        g_errors.inc();
+        this->close();
+        SE3313_LOG_WARN("Socket failed to write.");
+    }
+    else
+    {
+        g_writes.inc();
+        g_writtenBytes.inc(static_cast<uint64_t>(ret));
     }
     
     return ret;
 }
 
+void net::socket::setBlocking(const bool blocking)
+{
+    const int flags = ::fcntl(_socketFD, F_GETFL, 0);
+    if (flags == -1 || ::fcntl(_socketFD, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK)) == -1)
+    {
+        throw std::runtime_error("Could not change the blocking mode of the socket.");
+    }
+}
+
 void net::socket::close()
 {
     if (_open) 
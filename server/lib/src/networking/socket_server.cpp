@@ -25,10 +25,10 @@
 #include <unistd.h>
 
 #include <cstring>
-#include <iostream>
 #include <stdexcept>
 #include <sstream>
 
+#include "logging/log.hpp"
 #include "networking/socket_server.hpp"
 
 namespace net = se3313::networking;
@@ -58,11 +58,23 @@ net::socket_server::socket_server(const se3313::networking::port_t port)
     }
 
     // Set up a maximum number of pending connections to accept
-    ::listen(_socketFD, 20);
+    ::listen(_socketFD, SOMAXCONN);
 
     // At this point, the object is initialized.  So return.
 }
 
+net::socket_server::socket_server(const socket_desc_t fd)
+    : _socketFD(fd)
+{
+    socklen_t length = sizeof(sockaddr_in);
+    std::memset(&_socketDescriptor, 0, sizeof(sockaddr_in));
+    if (::getsockname(_socketFD, (sockaddr*)&_socketDescriptor, &length) < 0)
+    {
+        std::ostringstream ss; ss << "Unable to adopt listening socket, err: " << errno;
+        throw std::runtime_error(ss.str());
+    }
+}
+
 net::socket_server::~socket_server()
 {
     this->close();
@@ -80,11 +92,23 @@ std::shared_ptr<net::socket> net::socket_server::accept()
         throw std::runtime_error(ss.str());
     }
 
-    std::cout << __func__ << ": connectionFD:" << connectionFD << " socketFD:" << _socketFD << std::endl;
+    SE3313_LOG_DEBUG(__func__ << ": connectionFD:" << connectionFD << " socketFD:" << _socketFD);
     return std::make_shared<net::socket>(connectionFD);
 }
 
 void net::socket_server::close()
 {
-    ::shutdown(_socketFD, SHUT_RDWR);
+    if (_socketFD >= 0)
+    {
+        ::shutdown(_socketFD, SHUT_RDWR);
+    }
+}
+
+void net::socket_server::release()
+{
+    if (_socketFD >= 0)
+    {
+        ::close(_socketFD);
+        _socketFD = -1;
+    }
 }
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2016 Kevin Brightwell, Kenneth McIsaac
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "tracing/trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace se3313;
+using namespace tracing;
+
+namespace
+{
+
+/// One recorded span
+struct record
+{
+    uint64_t trace;
+    const char* name;
+    int64_t start;
+    int64_t end;
+    uint32_t thread;
+    int fd;
+    uint64_t detail;
+};
+
+/**
+ * Ring of spans written by any thread. A writer claims a slot with one atomic increment, the slot's
+ * sequence is odd while it is written so an export skips slots caught half written.
+ */
+struct ring
+{
+    explicit ring(const size_t capacity)
+        : slots(std::max<size_t>(capacity, 1))
+        , sequences(new std::atomic<uint64_t>[slots.size()])
+        , next(0)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            sequences[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    std::vector<record> slots;
+    std::unique_ptr<std::atomic<uint64_t>[]> sequences;
+    std::atomic<uint64_t> next;
+};
+
+/// Sample rate scaled to the range of a 64-bit random number
+std::atomic<uint64_t> g_threshold(0);
+
+std::atomic<uint64_t> g_nextTrace(1);
+
+std::atomic<uint32_t> g_nextThread(1);
+
+std::unique_ptr<ring> g_ring(new ring(config().capacity));
+
+/// Small number naming the calling thread in the export
+uint32_t threadID()
+{
+    static thread_local const uint32_t id = g_nextThread.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+/// xorshift64*, seeded per thread, deciding which messages are sampled
+uint64_t nextRandom()
+{
+    static thread_local uint64_t state = 0x9E3779B97F4A7C15ull * threadID();
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+}
+
+void appendEvent(std::string* const out, const char* const fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void appendEvent(std::string* const out, const char* const fmt, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, fmt);
+    const int n = std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    
+    out->append(out->back() == '[' ? "\n" : ",\n");
+    out->append(buffer, static_cast<size_t>(std::min<int>(n, sizeof(buffer) - 1)));
+}
+
+} // end anonymous namespace
+
+void tracing::configure(const config& conf)
+{
+    const double rate = std::min(std::max(conf.sampleRate, 0.0), 1.0);
+    g_threshold.store(rate >= 1.0 ? UINT64_MAX : static_cast<uint64_t>(rate * 18446744073709551616.0), std::memory_order_relaxed);
+    g_ring.reset(new ring(conf.capacity));
+}
+
+uint64_t tracing::sample()
+{
+    const uint64_t threshold = g_threshold.load(std::memory_order_relaxed);
+    if (threshold == 0 || nextRandom() > threshold)
+    {
+        return 0;
+    }
+    return g_nextTrace.fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t tracing::span(const uint64_t trace, const char* const name, const int64_t start, const int fd, const uint64_t detail)
+{
+    if (!trace)
+    {
+        return 0;
+    }
+    
+    const int64_t end = now(trace);
+    ring& r = *g_ring;
+    const uint64_t n = r.next.fetch_add(1, std::memory_order_relaxed);
+    const size_t slot = static_cast<size_t>(n % r.slots.size());
+    
+    r.sequences[slot].store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    r.slots[slot] = record{ trace, name, start, end, threadID(), fd, detail };
+    r.sequences[slot].store(2 * n + 2, std::memory_order_release);
+    return end;
+}
+
+std::string tracing::exportChrome()
+{
+    ring& r = *g_ring;
+    const uint64_t next = r.next.load(std::memory_order_acquire);
+    const uint64_t first = next > r.slots.size() ? next - r.slots.size() : 0;
+    
+    std::vector<record> spans;
+    spans.reserve(static_cast<size_t>(next - first));
+    for (uint64_t n = first; n < next; ++n)
+    {
+        const size_t slot = static_cast<size_t>(n % r.slots.size());
+        if (r.sequences[slot].load(std::memory_order_acquire) != 2 * n + 2)
+        {
+            continue;
+        }
+        
+        const record copy = r.slots[slot];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (r.sequences[slot].load(std::memory_order_relaxed) == 2 * n + 2)
+        {
+            spans.push_back(copy);
+        }
+    }
+    
+    // a trace's spans in the order they started, which is the order its flow arrow visits them
+    std::stable_sort(spans.begin(), spans.end(), [](const record& a, const record& b){
+        return a.trace != b.trace ? a.trace < b.trace : a.start < b.start;
+    });
+    
+    int64_t origin = INT64_MAX;
+    for (const record& s : spans)
+    {
+        origin = std::min(origin, s.start);
+    }
+    
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (size_t i = 0; i < spans.size(); ++i)
+    {
+        const record& s = spans[i];
+        const double ts = static_cast<double>(s.start - origin) / 1000;
+        appendEvent(&out, "{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"args\":{\"trace\":%llu,\"fd\":%d,\"detail\":%llu}}",
+                    s.name, s.thread, ts, static_cast<double>(s.end - s.start) / 1000,
+                    static_cast<unsigned long long>(s.trace), s.fd, static_cast<unsigned long long>(s.detail));
+        
+        const bool firstOfTrace = i == 0 || spans[i - 1].trace != s.trace;
+        const bool lastOfTrace = i + 1 == spans.size() || spans[i + 1].trace != s.trace;
+        if (firstOfTrace && lastOfTrace)
+        {
+            continue;
+        }
+        appendEvent(&out, "{\"name\":\"message\",\"cat\":\"message\",\"ph\":\"%s\",%s\"id\":%llu,\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                    firstOfTrace ? "s" : lastOfTrace ? "f" : "t", lastOfTrace ? "\"bp\":\"e\"," : "",
+                    static_cast<unsigned long long>(s.trace), s.thread, ts);
+    }
+    out.append("\n]}\n");
+    return out;
+}
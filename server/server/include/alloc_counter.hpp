@@ -0,0 +1,90 @@
+#ifndef DZAGAR_ALLOC_COUNTER_HPP
+#define DZAGAR_ALLOC_COUNTER_HPP
+
+#include "stage_latency.hpp"
+
+#include <cstdint>
+#include <ostream>
+
+namespace dzagar
+{
+
+/**
+ * Heap allocations made by each request stage, printed per request by the `allocs` command.
+ *
+ * Built with `ALLOC_COUNTING` the server replaces `malloc()` and its relatives, which `operator new`
+ * goes through as well, with versions counting calls and bytes in per-thread counters before handing
+ * over to glibc. Each count goes to the stage of the innermost @c scope active on the allocating thread,
+ * the stages being those of `stage_latency.hpp`, or to "other" outside of any. That covers everything
+ * `make_shared`, `ptree` and `ostringstream` do on behalf of a stage, down to the standard library.
+ *
+ * Without `ALLOC_COUNTING` nothing is replaced and the scopes compile to nothing.
+ */
+namespace alloc
+{
+
+#ifdef SE3313_ALLOC_COUNTING
+
+namespace detail
+{
+
+/// Stage charged for the allocations of this thread, @c stage::COUNT for none
+extern thread_local uint8_t t_stage;
+
+} // end namespace detail
+
+/// Charges the allocations of the current thread to a stage until destroyed.
+class scope final
+{
+
+public:
+
+    explicit scope(const stage::id s)
+        : _previous(detail::t_stage)
+    {
+        detail::t_stage = s;
+    }
+
+    ~scope()
+    {
+        detail::t_stage = _previous;
+    }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    /// Charges what follows to @p s instead, the stage before this scope is still restored at its end.
+    void enter(const stage::id s)
+    {
+        detail::t_stage = s;
+    }
+
+private:
+
+    const uint8_t _previous;
+};
+
+#else
+
+class scope final
+{
+
+public:
+
+    explicit scope(const stage::id)
+    { }
+
+    void enter(const stage::id)
+    { }
+};
+
+#endif
+
+/// Writes the allocations, bytes and frees of every stage per request, for @p requests handled so far.
+void report(std::ostream& out, const uint64_t requests);
+
+} // end namespace alloc
+
+} // end namespace dzagar
+
+#endif // DZAGAR_ALLOC_COUNTER_HPP
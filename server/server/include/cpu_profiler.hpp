@@ -0,0 +1,71 @@
+#ifndef DZAGAR_CPU_PROFILER_HPP
+#define DZAGAR_CPU_PROFILER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace dzagar
+{
+
+/**
+ * Samples the stacks of every thread of the process for a while and writes them as collapsed stacks,
+ * one `thread;outermost;...;innermost count` line per distinct stack, as `flamegraph.pl` and speedscope
+ * take them. Started by the `profile SECONDS PATH` command.
+ *
+ * Sampling is driven by `ITIMER_PROF`, which needs no privileges: every time the process used up another
+ * period of CPU time, `SIGPROF` interrupts the thread that was running and its stack is stored in a buffer
+ * allocated up front. Idle threads are never sampled, the profile shows where CPU time goes and not
+ * where threads wait. Symbols are resolved with `dladdr()` once sampling stopped, on the profiler's own
+ * thread, functions not exported by the binary show up as `binary+0xoffset`.
+ *
+ * Only one profile can run at a time in a process.
+ */
+class cpu_profiler final
+{
+
+public:
+
+    /// Samples per second of CPU time, off from 100 so it does not run in step with periodic work
+    static constexpr int DEFAULT_HZ = 99;
+
+    /**
+     * Starts sampling for @p duration, after which the profile is written to @p path.
+     * Throws a @c std::runtime_error if @p path can not be created or another profile is running.
+     */
+    cpu_profiler(const std::string& path, const std::chrono::seconds duration, const int hz = DEFAULT_HZ);
+
+    /// Stops sampling early if still running, the profile is written with the samples taken so far.
+    ~cpu_profiler();
+
+    cpu_profiler(const cpu_profiler&) = delete;
+    cpu_profiler& operator=(const cpu_profiler&) = delete;
+
+    /// Whether the profile was written
+    bool done() const;
+
+    const std::string& path() const { return _path; }
+
+private:
+
+    /// Waits out the duration, then stops sampling and writes the profile.
+    void run(const std::chrono::seconds duration);
+
+    const std::string _path;
+    std::ofstream _out;
+
+    mutable std::mutex _mut;
+    std::condition_variable _cv_stop;
+    bool _stop;
+    bool _done;
+
+    std::thread _thread;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_CPU_PROFILER_HPP
@@ -0,0 +1,218 @@
+#ifndef DZAGAR_MESSAGE_LOG_HPP
+#define DZAGAR_MESSAGE_LOG_HPP
+
+#include <boost/utility/string_ref.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dzagar
+{
+
+/**
+ * Durable, append-only log of the messages sent to rooms.
+ *
+ * The log is a directory of segment files named after the offset of their first record
+ * (`00000000000000000000.log`), each with a sparse index (`.index`) mapping every few kilobytes of
+ * records to their file position. Records are framed as
+ *
+ *     u32 length | u32 crc32 | u64 offset | i64 timestamp | varint room | varint frame
+ *
+ * `append()` only copies the record into a pending batch and returns. A background thread commits
+ * batches with one `write()` and one `fdatasync()` once @c config::syncMessages records are pending
+ * or @c config::syncInterval elapsed, whichever is first (group commit). Reads map the segments with
+ * `mmap()` and never touch the writer's descriptors.
+ */
+class message_log final
+{
+
+public:
+
+    /// Tunables of the log
+    struct config
+    {
+        /// Directory holding the segments, created if needed
+        std::string directory;
+
+        /// Longest time a record waits before being synced
+        std::chrono::milliseconds syncInterval = std::chrono::milliseconds(20);
+
+        /// Pending records that force a sync
+        size_t syncMessages = 256;
+
+        /// Size after which a new segment is started
+        size_t segmentBytes = 64 * 1024 * 1024;
+
+        /// Bytes of records between index entries
+        size_t indexIntervalBytes = 4096;
+
+        /// Segments kept on disk, the oldest are deleted beyond this, 0 keeps everything
+        size_t maxSegments = 16;
+    };
+
+    /// A record read back from the log, the strings point into mapped memory
+    struct record
+    {
+        uint64_t offset;
+        std::chrono::system_clock::time_point timestamp;
+        boost::string_ref room;
+        boost::string_ref frame;
+    };
+
+    /// Counters describing the log's activity
+    struct stats
+    {
+        /// Records appended since opening
+        uint64_t appended;
+
+        /// Bytes of records appended since opening
+        uint64_t appendedBytes;
+
+        /// Records appended per second since opening
+        double appendRate;
+
+        /// Group commits performed
+        uint64_t commits;
+
+        /// Latency of the last, slowest and average `fdatasync()`
+        std::chrono::nanoseconds fsyncLast;
+        std::chrono::nanoseconds fsyncMax;
+        std::chrono::nanoseconds fsyncMean;
+
+        /// Segments started since opening, and currently on disk
+        uint64_t rollovers;
+        uint64_t segments;
+
+        /// Offset of the next record, and of the first one not yet synced
+        uint64_t nextOffset;
+        uint64_t durableOffset;
+
+        /// Why the log stopped, empty while it accepts records
+        std::string error;
+    };
+
+    /**
+     * Opens the log in @c config::directory, recovering from a torn tail left by a crash, and
+     * starts the commit thread.
+     *
+     * Throws a @c std::runtime_error if the directory can not be used.
+     */
+    explicit message_log(const config& conf);
+
+    /// Commits everything pending and stops the commit thread.
+    ~message_log();
+
+    message_log(const message_log&) = delete;
+    message_log& operator=(const message_log&) = delete;
+
+    /**
+     * Queues a record for the next group commit. Never blocks on disk.
+     *
+     * Throws a @c std::runtime_error once the log stopped: a batch that could not be written and synced
+     * after a few attempts, or a segment that could not be created, ends the log rather than leave a gap.
+     * @return The offset assigned to the record
+     */
+    uint64_t append(const std::string& room, const std::string& frame);
+
+    /**
+     * Calls @p fn for every durable record from @p from onwards, in offset order, until it returns
+     * `false`. Segments are mapped with `mmap()`, the index is used to skip to @p from.
+     */
+    void scan(const uint64_t from, const std::function<bool(const record&)>& fn) const;
+
+    /// Offset of the oldest record still on disk
+    uint64_t firstOffset() const;
+
+    /// Snapshot of the activity counters
+    stats statistics() const;
+
+private:
+
+    /// A sparse index entry
+    struct index_entry
+    {
+        /// Offset relative to the segment base
+        uint32_t relativeOffset;
+
+        /// Byte position in the segment file
+        uint32_t position;
+    };
+
+    /// A segment file and its in-memory index
+    struct segment
+    {
+        uint64_t base;
+        std::string path;
+        std::string indexPath;
+        std::vector<index_entry> index;
+
+        /// Bytes of durable records in the file
+        uint64_t size;
+    };
+
+    /// Loads existing segments and truncates a torn tail. Called from the constructor.
+    void recover();
+
+    /// Creates a new segment starting at @p base, opening its descriptors for writing.
+    void roll(const uint64_t base);
+
+    /**
+     * Writes and syncs one batch, called on the commit thread. A failed attempt is cut off the segment
+     * and retried. Throws a @c std::runtime_error if the batch can not be committed.
+     */
+    void commit(std::string& batch, std::vector<std::pair<uint64_t, uint32_t>>& bounds);
+
+    /// Body of the commit thread
+    void run();
+
+    const config _config;
+
+    /// Protects the pending batch and the stop flag
+    mutable std::mutex _mut_pending;
+    std::condition_variable _cv_pending;
+    std::string _pending;
+
+    /// Offset and position in @c _pending of each pending record
+    std::vector<std::pair<uint64_t, uint32_t>> _pendingBounds;
+    uint64_t _nextOffset;
+    bool _stop;
+
+    /// Why the commit thread stopped, appends are refused once set
+    std::string _error;
+
+    /// Protects @c _segments, which readers copy under the lock
+    mutable std::mutex _mut_segments;
+    std::deque<segment> _segments;
+
+    /// Descriptors of the active segment, only used by the commit thread after construction
+    int _logFD;
+    int _indexFD;
+
+    /// Bytes since the last index entry in the active segment
+    uint64_t _sinceIndex;
+
+    const std::chrono::steady_clock::time_point _opened;
+    std::atomic<uint64_t> _appended;
+    std::atomic<uint64_t> _appendedBytes;
+    std::atomic<uint64_t> _commits;
+    std::atomic<uint64_t> _fsyncLastNs;
+    std::atomic<uint64_t> _fsyncMaxNs;
+    std::atomic<uint64_t> _fsyncTotalNs;
+    std::atomic<uint64_t> _rollovers;
+    std::atomic<uint64_t> _durableOffset;
+
+    std::thread _committer;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_MESSAGE_LOG_HPP
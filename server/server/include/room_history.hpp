@@ -0,0 +1,123 @@
+#ifndef DZAGAR_ROOM_HISTORY_HPP
+#define DZAGAR_ROOM_HISTORY_HPP
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dzagar
+{
+
+/**
+ * Fixed-capacity ring buffer of a room's most recent messages. 
+ * 
+ * Messages are stored as the frames already written to clients, so replaying history never re-encodes
+ * anything. The whole history is also available as a single page (all frames concatenated) that is 
+ * built on first use and shared by every replay until the next message arrives.
+ */
+class room_history final
+{
+    
+public:
+    
+    /**
+     * Creates an empty history.
+     * @param maxMessages Number of frames kept
+     * @param maxBytes Upper bound on the bytes of frames kept
+     */
+    room_history(const size_t maxMessages, const size_t maxBytes);
+    
+    /// Appends a frame, evicting the oldest ones to stay within both limits.
+    void append(const std::string& frame);
+    
+    /**
+     * All frames, oldest first, in one buffer ready to be written. 
+     * @return `nullptr` if there is no history
+     */
+    std::shared_ptr<const std::string> page() const;
+    
+    /// Number of frames kept
+    size_t size() const { return _count; }
+    
+    /// Bytes of frames kept
+    size_t bytes() const { return _bytes; }
+    
+private:
+    
+    /// Drops the oldest frame
+    void evict();
+    
+    /// Frame slots, reused as the ring wraps so their storage is recycled
+    std::vector<std::string> _frames;
+    
+    /// Index of the oldest frame
+    size_t _first;
+    
+    /// Number of frames kept
+    size_t _count;
+    
+    /// Bytes of frames kept
+    size_t _bytes;
+    
+    /// Byte limit
+    const size_t _maxBytes;
+    
+    /// Cached page, reset on append
+    mutable std::shared_ptr<const std::string> _page;
+};
+
+/**
+ * Keeps a @c room_history for each room that has seen messages, bounded in the number of rooms 
+ * with the least recently written room evicted first.
+ */
+class history_store final
+{
+    
+public:
+    
+    /**
+     * Creates an empty store.
+     * @param maxMessages Frames kept per room
+     * @param maxBytes Bytes kept per room
+     * @param maxRooms Rooms kept
+     */
+    history_store(const size_t maxMessages, const size_t maxBytes, const size_t maxRooms);
+    
+    /// Appends @p frame to the history of @p room, ignored if the frame is over the byte limit.
+    void append(const std::string& room, const std::string& frame);
+    
+    /// History page of @p room, `nullptr` if there is none.
+    std::shared_ptr<const std::string> page(const std::string& room) const;
+    
+    /// Rooms with history, least recently written first so appending to them in order keeps their recency.
+    std::vector<std::string> rooms() const;
+    
+    /// Number of rooms with history
+    size_t size() const { return _rooms.size(); }
+    
+private:
+    
+    /// A room's history and its position in the recency list
+    struct entry
+    {
+        room_history history;
+        std::list<std::string>::iterator recency;
+    };
+    
+    const size_t _maxMessages;
+    const size_t _maxBytes;
+    const size_t _maxRooms;
+    
+    /// Room names, most recently written first
+    std::list<std::string> _recency;
+    
+    /// Histories by room
+    std::unordered_map<std::string, entry> _rooms;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_ROOM_HISTORY_HPP
@@ -0,0 +1,101 @@
+#ifndef DZAGAR_ROOM_INDEX_HPP
+#define DZAGAR_ROOM_INDEX_HPP
+
+#include "session_table.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dzagar
+{
+
+/**
+ * Subscription index mapping each room to a dense array of member descriptors, so fan-out to a
+ * room is a linear walk over exactly its members. 
+ * 
+ * Every membership is stored twice: in the room's member array and in the session's list of rooms,
+ * each side remembering its position in the other. That makes join, leave and dropping every 
+ * membership of a closing session O(1) per membership.
+ */
+class room_index final
+{
+    
+public:
+    
+    /// Socket descriptor type
+    typedef session_table::fd_t fd_t;
+    
+    /// An entry in a room's member array
+    struct member
+    {
+        /// The subscribed session
+        fd_t fd;
+        
+        /// Position of this membership in the session's room list
+        uint32_t slot;
+    };
+    
+    /// Creates an empty index.
+    room_index() = default;
+    
+    /**
+     * Subscribes @p fd to @p room, creating the room if needed.
+     * @return `false` if it was already a member
+     */
+    bool join(const fd_t fd, const std::string& room);
+    
+    /**
+     * Unsubscribes @p fd from @p room, removing the room once it is empty.
+     * @return `false` if it was not a member
+     */
+    bool leave(const fd_t fd, const std::string& room);
+    
+    /// Unsubscribes @p fd from every room it joined, used when a session closes.
+    void leaveAll(const fd_t fd);
+    
+    /// `true` if @p fd is subscribed to @p room.
+    bool isMember(const fd_t fd, const std::string& room) const;
+    
+    /// Names of the rooms @p fd is subscribed to.
+    std::vector<std::string> roomsOf(const fd_t fd) const;
+    
+    /// Members of @p room, `nullptr` if nobody is in it.
+    const std::vector<member>* members(const std::string& room) const;
+    
+    /// Number of rooms with at least one member
+    size_t size() const { return _rooms.size(); }
+    
+private:
+    
+    /// A room and its members
+    struct room_t
+    {
+        std::string name;
+        std::vector<member> members;
+    };
+    
+    /// An entry in a session's room list
+    struct membership
+    {
+        /// The room, node addresses in @c _rooms are stable
+        room_t* room;
+        
+        /// Position of this membership in the room's member array
+        uint32_t index;
+    };
+    
+    /// Removes membership @p slot of @p fd from both sides.
+    void remove(const fd_t fd, const uint32_t slot);
+    
+    /// Rooms by name
+    std::unordered_map<std::string, room_t> _rooms;
+    
+    /// Room lists, indexed by descriptor
+    std::vector<std::vector<membership>> _bySession;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_ROOM_INDEX_HPP
@@ -9,10 +9,22 @@
 #include <msg/error.hpp>
 #include <msg/visitor.hpp>
 
+#include <metrics/http_exporter.hpp>
+
 #include <networking/flex_waiter.hpp>
 #include <networking/socket.hpp>
 #include <networking/socket_server.hpp>
 
+#include "cpu_profiler.hpp"
+#include "message_log.hpp"
+#include "room_history.hpp"
+#include "room_index.hpp"
+#include "session_table.hpp"
+#include "stage_latency.hpp"
+#include "traffic_capture.hpp"
+#include "upgrade.hpp"
+#include "worker_pool.hpp"
+
 #include <string>
 #include <vector>
 
@@ -35,6 +47,138 @@
 namespace dzagar 
 {
     
+/**
+ * Per-session ingress limits, enforced on each request before it is decoded.
+ */
+struct rate_limit_config
+{
+    /// What happens to a request over the limit
+    enum class policy {
+        /// Discard the request
+        DROP,
+        
+        /// Stop reading from the session until its buckets refill
+        PAUSE,
+        
+        /// Send a RATE_LIMITED error and close the session
+        DISCONNECT
+    };
+    
+    /// Sustained requests per second, 0 for unlimited
+    double messagesPerSecond = 0;
+    
+    /// Requests allowed in a burst
+    double messageBurst = 0;
+    
+    /// Sustained request bytes per second, 0 for unlimited
+    double bytesPerSecond = 0;
+    
+    /// Request bytes allowed in a burst
+    double byteBurst = 0;
+    
+    policy onViolation = policy::PAUSE;
+};
+
+/**
+ * Bounds on the output buffered for sessions that read slower than they are written to.
+ */
+struct egress_config
+{
+    /// What happens to a session past the high-water mark
+    enum class policy {
+        /// Skip room traffic to the session until it is below the low-water mark
+        DROP,
+        
+        /// Discard its queued room traffic too, and replay its rooms' recent history once it catches up
+        COLLAPSE,
+        
+        /// Close the session
+        DISCONNECT
+    };
+    
+    /// Buffered bytes that make a session slow
+    size_t highWaterBytes = 256 * 1024;
+    
+    /// Buffered bytes below which a slow session recovers
+    size_t lowWaterBytes = 64 * 1024;
+    
+    /// Bytes buffered over all sessions, past which any session with a backlog counts as slow
+    size_t maxTotalBytes = 256 * 1024 * 1024;
+    
+    policy onSlowConsumer = policy::COLLAPSE;
+};
+
+/**
+ * Load at which the server stops reading from its heaviest producers until it has caught up.
+ */
+struct backpressure_config
+{
+    /// Requests waiting for the workers that start backpressure, 0 to ignore the workers
+    size_t highPendingRequests = 4096;
+    
+    /// Requests waiting for the workers below which reads resume
+    size_t lowPendingRequests = 512;
+    
+    /// Output buffered over all sessions that starts backpressure, 0 to ignore egress
+    size_t highEgressBytes = 64 * 1024 * 1024;
+    
+    /// Output buffered over all sessions below which reads resume
+    size_t lowEgressBytes = 16 * 1024 * 1024;
+    
+    /// Send flow control messages to clients that support them
+    bool notifyClients = true;
+};
+
+/**
+ * Tunables of a @c server, set from the command line in `main.cpp`.
+ */
+struct server_config
+{
+    /// Messages kept in each room's history
+    size_t historyMessages = 50;
+    
+    /// Bytes kept in each room's history
+    size_t historyBytes = 64 * 1024;
+    
+    /// Rooms whose history is kept
+    size_t historyRooms = 1024;
+    
+    /// Durable message log, disabled while its directory is empty
+    message_log::config log;
+    
+    /// Threads decoding, visiting and encoding requests, 0 does it all on the I/O thread
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+    
+    /// Longest request accepted, a client sending more without a newline is disconnected
+    size_t maxFrameBytes = 64 * 1024;
+    
+    /// Limits on what each session may send
+    rate_limit_config ingress;
+    
+    /// Limits on what is buffered for each session
+    egress_config egress;
+    
+    /// When to push back on senders
+    backpressure_config backpressure;
+    
+    /// Unix socket a new process connects to for a hot upgrade, disabled while empty
+    std::string upgradeSocket;
+    
+    /// Take the sockets and sessions over from the server listening on @c upgradeSocket instead of binding the port
+    bool takeover = false;
+    
+    /// Loopback port serving Prometheus metrics, 0 to only print them with the `metrics` command
+    se3313::networking::port_t metricsPort = 0;
+    
+    /// Read commands (`stats`, `exit`...) from `stdin`, off for a server embedded in another program
+    bool stdinCommands = true;
+    
+    /// Budgets of the event loop's handlers, the slow ones are logged
+    se3313::networking::loop_watchdog::config watchdog;
+    
+    /// File the accepted requests are captured to from the start, for `tools/replay`, disabled while empty
+    std::string capture;
+};
     
 class server final : 
   public se3313::networking::flex_waiter::activity_visitor, 
@@ -50,15 +194,170 @@ private:
     
     const port_t _serverPort;
     bool _inActivity;
-    std::vector<std::shared_ptr<se3313::networking::socket>> _socketList;
     std::shared_ptr<se3313::networking::flex_waiter> _flexinWaiter;
-    std::vector<std::string> _clientNames;
+    std::shared_ptr<se3313::networking::socket_server> _master;
+    
+    /// Where a new process asks for the hand over, -1 if upgrades are disabled
+    int _upgradeListener;
+    
+    /// Channel to the new process while handing over, -1 otherwise
+    int _handOffChannel;
+    
+    /// Serves the metrics registry, `nullptr` if disabled
+    std::unique_ptr<se3313::metrics::http_exporter> _metricsExporter;
+    
+    /// Connected clients, by descriptor and by username
+    session_table _sessions;
+    
+    /**
+     * Guards @c _sessions, @c _rooms and the visit state against the workers. Only the I/O thread
+     * opens and closes sessions, so it may look them up without the lock.
+     */
+    std::mutex _mut_state;
+    
+    const server_config _config;
+    
+    /// Room subscriptions
+    room_index _rooms;
+    
+    /// Recent messages of each room, replayed on join
+    history_store _history;
+    
+    /// Durable copy of every room message, `nullptr` if disabled
+    std::unique_ptr<message_log> _log;
+    
+    /// Where accepted requests are recorded, `nullptr` unless capturing
+    std::unique_ptr<traffic_capture> _capture;
+    
+    /// The last profile started by the `profile` command, `nullptr` if none was
+    std::unique_ptr<cpu_profiler> _profiler;
+    
+    /// Descriptor of the session whose request is being visited
+    session_table::fd_t _currentFD;
+    
+    /// Where the response to the request being visited goes, set by the visit methods
+    struct delivery
+    {
+        /// Send to the requesting session
+        bool toSender;
+        
+        /// Send to this session too, `nullptr` for none
+        std::shared_ptr<se3313::networking::socket> recipient;
+        
+        /// Send to the members of this room, empty for none
+        std::string room;
+        
+        /// Keep the response in the room's history
+        bool record;
+        
+        /// Replay this room's history to the requesting session afterwards, empty for none
+        std::string replay;
+    } _delivery;
+    
+    /// An encoded response and where it goes, handed from a worker back to the I/O thread
+    struct outcome
+    {
+        /// Connection the request came from
+        std::shared_ptr<se3313::networking::socket> origin;
+        
+        delivery route;
+        
+        /// The encoded response, `nullptr` if there is nothing to send
+        std::shared_ptr<const std::string> frame;
+        
+        /// When `frame` was encoded, for the enqueue latency
+        stage::time_point encoded;
+        
+        /// Type of the response, named when delivering it takes too long
+        const char* type;
+        
+        /// Trace of the request, 0 if it is not sampled
+        uint64_t trace;
+        
+        /// When `frame` was encoded on the tracing clock
+        int64_t traced;
+    };
+    
+    /// What the ingress limits did, reported by `stats`
+    struct ingress_stats
+    {
+        /// Requests found over a limit
+        uint64_t limited = 0;
+        
+        uint64_t dropped = 0;
+        uint64_t pauses = 0;
+        uint64_t disconnects = 0;
+    } _ingress;
+    
+    /// What slow sessions cost, reported by `stats`
+    struct egress_stats
+    {
+        /// Times a session went past its high-water mark or the global cap
+        uint64_t slowConsumers = 0;
+        
+        /// Frames skipped or discarded for slow sessions
+        uint64_t dropped = 0;
+        
+        /// History replays to sessions that recovered after collapsing
+        uint64_t resyncs = 0;
+        
+        uint64_t disconnects = 0;
+        
+        /// Most bytes ever buffered at once
+        size_t peakBytes = 0;
+    } _egress;
+    
+    /// Bytes buffered over all sessions
+    size_t _egressBytes;
+    
+    /// What backpressure did, reported by `stats`
+    struct backpressure_stats
+    {
+        /// Times the server became overloaded
+        uint64_t episodes = 0;
+        
+        /// Sessions paused as heavy producers
+        uint64_t pauses = 0;
+    } _backpressure;
+    
+    /// `true` from passing a high-water mark until back under every low-water mark
+    bool _overloaded;
+    
+    /// Sessions paused by backpressure
+    std::vector<std::shared_ptr<se3313::networking::socket>> _backpressured;
+    
+    /// When producers were last ranked, they are re-ranked periodically while overloaded
+    std::chrono::steady_clock::time_point _lastRanking;
+    
+    /// Start of the ingress decay epochs
+    const std::chrono::steady_clock::time_point _started;
+    
+    /// Sessions paused by their rate limit, and when their buckets allow the next request
+    std::vector<std::pair<token_bucket::clock_t::time_point, std::shared_ptr<se3313::networking::socket>>> _throttled;
+    
+    /// Sockets a frame is being fanned out to, kept to reuse its storage
+    std::vector<std::shared_ptr<se3313::networking::socket>> _fanOut;
+    
+    /// Trace of the response being delivered, 0 if it is not sampled
+    uint64_t _tracing;
+    
+    /// Decodes, visits and encodes requests, declared last so it stops first
+    std::unique_ptr<worker_pool> _workers;
     
 public:
 
     inline
-    server(const port_t serverPort)
+    server(const port_t serverPort, const server_config& config = server_config())
         : _serverPort(serverPort)
+        , _upgradeListener(-1)
+        , _handOffChannel(-1)
+        , _config(config)
+        , _history(config.historyMessages, config.historyBytes, config.historyRooms)
+        , _currentFD(-1)
+        , _egressBytes(0)
+        , _overloaded(false)
+        , _started(std::chrono::steady_clock::now())
+        , _tracing(0)
     { }
 
     ~server();
@@ -70,6 +369,9 @@ public:
 
     /*!
      * \brief Stop the server.
+     * 
+     * Closes every session and makes `start()` return once in-flight requests are answered. Safe to
+     * call from any thread once `start()` is serving.
      */
     void stop();
     
@@ -88,10 +390,105 @@ private:
     
     void onSTDIN(const std::string& line);
     
+    /// Opens the message log, refilling room histories from its tail if @p restoreHistory.
+    void openLog(const bool restoreHistory = true);
+    
+    /// Rebuilds the sessions and histories handed over by the previous process.
+    void adopt(const upgrade::state& st, const std::vector<int>& fds);
+    
+    /**
+     * Answers a new process on @c _upgradeListener: stops admitting requests and lets the ones in flight
+     * finish, the loop goes on delivering their answers until the workers are done. `finishHandOff()`
+     * then runs as a posted task.
+     */
+    void handOff();
+    
+    /**
+     * Hands every socket and the state that goes with them to the new process and stops the loop.
+     * Carries on serving if the new process fails to take over.
+     */
+    void finishHandOff();
+    
+    /// Closes every session and ends the loop in `start()`, on the I/O thread.
+    void shutDown();
+    
+    void onWritable(const se3313::networking::flex_waiter::socket_ptr_t sock);
+    
+    /// Writes @p frame to every member of @p room as room traffic.
+    void fanOut(const std::string& room, const std::shared_ptr<const std::string>& frame);
+    
+    /**
+     * Writes @p frame to @p sock, queueing what the socket does not take right away. Room traffic
+     * (@p essential `false`) is subject to the slow consumer policy. Tears the session down if 
+     * writing fails.
+     */
+    void sendTo(const std::shared_ptr<se3313::networking::socket>& sock, const std::shared_ptr<const std::string>& frame, 
+                const bool essential = true);
+    
+    /// Queues the part of @p frame past @p written bytes.
+    void enqueue(const std::shared_ptr<se3313::networking::socket>& sock, session* const s, 
+                 const std::shared_ptr<const std::string>& frame, const bool essential, const size_t written);
+    
+    /// Writes as much queued output as @p sock takes, recovering it once below the low-water mark.
+    void flush(const std::shared_ptr<se3313::networking::socket>& sock, session* const s);
+    
+    /// Applies the slow consumer policy to @p sock.
+    void onSlowConsumer(const std::shared_ptr<se3313::networking::socket>& sock, session* const s);
+    
+    /// Hands the complete requests buffered for @p sock to the workers, as far as its limits allow.
+    void drainInbound(const std::shared_ptr<se3313::networking::socket>& sock, session* const s);
+    
+    /// Stops reading from @p sock for @p reason, reads resume once every reason is cleared.
+    void pauseReads(const std::shared_ptr<se3313::networking::socket>& sock, session* const s, const session::pause_reason reason);
+    
+    /// Clears @p reason, resuming reads and draining buffered requests if nothing else holds them.
+    void resumeReads(const std::shared_ptr<se3313::networking::socket>& sock, session* const s, const session::pause_reason reason);
+    
+    /// Adds @p bytes to the recent ingress of @p s.
+    void recordIngress(session* const s, const size_t bytes);
+    
+    /// Recent ingress of @p s, decayed to now.
+    uint64_t recentIngress(const session* const s) const;
+    
+    /// Starts or ends backpressure as the worker and egress queues cross their marks.
+    void applyBackpressure();
+    
+    /// Pauses every session producing at least its fair share of recent ingress.
+    void pauseHeaviestProducers();
+    
+    /// Resumes throttled sessions whose buckets have refilled.
+    void resumeThrottled();
+    
+    /// How long the loop may wait before a throttled session is due.
+    std::chrono::milliseconds nextTimeout() const;
+    
+    /**
+     * Hands one complete request from @p sock to its worker.
+     * @param framed When framing of the request started
+     * @param trace Trace of the request, 0 if it is not sampled
+     */
+    void onFrame(const std::shared_ptr<se3313::networking::socket>& sock, std::string frame, const stage::time_point framed, const uint64_t trace);
+    
+    /**
+     * Decodes, visits and encodes one request, called on a worker.
+     * @param submitted When the request was handed to the worker
+     * @param trace Trace of the request, 0 if it is not sampled
+     */
+    outcome process(const std::shared_ptr<se3313::networking::socket>& sock, const std::string& frame, const stage::time_point submitted, const uint64_t trace);
+    
+    /// Writes a worker's response where its route says, called on the I/O thread.
+    void deliver(const outcome& out);
+    
     return_t visitLogin(const se3313::msg::request::login& req);
     
     return_t visitMessage(const se3313::msg::request::message& req);
     
+    return_t visitJoin(const se3313::msg::request::join& req);
+    
+    return_t visitLeave(const se3313::msg::request::leave& req);
+    
+    return_t visitDirect(const se3313::msg::request::direct& req);
+    
     return_t error(const std::string& origSender,const se3313::msg::ErrorCode errCode, const std::string& msgStr);
 
 };
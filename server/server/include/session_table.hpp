@@ -0,0 +1,185 @@
+#ifndef DZAGAR_SESSION_TABLE_HPP
+#define DZAGAR_SESSION_TABLE_HPP
+
+#include <networking/socket.hpp>
+
+#include "stage_latency.hpp"
+#include "token_bucket.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dzagar
+{
+
+/**
+ * State kept for every connected client.
+ */
+struct session
+{
+    /// The connection, `nullptr` while the slot is unused
+    std::shared_ptr<se3313::networking::socket> socket;
+    
+    /// Name bound by a successful login, empty before that
+    std::string username;
+    
+    /// Why reads from this session are paused
+    enum pause_reason : uint8_t {
+        /// The session spent its rate limit
+        RATE_LIMITED = 1 << 0,
+        
+        /// The server is overloaded and the session is one of its heaviest producers
+        BACKPRESSURE = 1 << 1,
+        
+        /// The session is being handed to a new process
+        HANDOFF = 1 << 2
+    };
+    
+    /// Received bytes not yet handed to a worker
+    std::string inbound;
+    
+    /// Ingress limits, in requests and in bytes
+    token_bucket messageBucket;
+    token_bucket byteBucket;
+    
+    /// Combination of \c pause_reason, reads are paused while it is non-zero
+    uint8_t paused;
+    
+    /// Request bytes admitted recently, halved for every second since \c ingressEpoch
+    uint64_t ingressBytes;
+    uint32_t ingressEpoch;
+    
+    /// The client asked to be told when it is paused, see \c se3313::msg::response::flow_control
+    bool flowControl;
+    
+    /// An encoded frame waiting for the socket, shared by every session it was fanned out to
+    struct queued_frame
+    {
+        std::shared_ptr<const std::string> frame;
+        
+        /// `false` for room traffic, which a slow session may miss
+        bool essential;
+        
+        /// When the frame was queued, for the flush latency
+        stage::time_point queued;
+        
+        /// Trace of the message the frame answers, 0 if it is not sampled
+        uint64_t trace;
+        
+        /// When the frame was queued on the tracing clock
+        int64_t traced;
+    };
+    
+    typedef std::deque<queued_frame> frame_queue;
+    
+    /**
+     * Output the socket has not accepted yet, allocated when a frame first has to wait. A deque 
+     * allocates even when empty, which every idle slot of the table would pay for.
+     */
+    std::unique_ptr<frame_queue> outbound;
+    
+    /// Bytes of the first frame in \c outbound already written
+    size_t outboundOffset;
+    
+    /// Bytes in \c outbound still to be written
+    size_t outboundBytes;
+    
+    /// Set past the high-water mark of \c outboundBytes, cleared below the low-water mark
+    bool slow;
+    
+    /// Room traffic was discarded while slow, room histories are replayed once the session catches up
+    bool collapsed;
+    
+    /// Position of this session in \c session_table::fds()
+    uint32_t activeIndex;
+    
+    /// `true` once a login has been accepted
+    bool loggedIn() const { return !username.empty(); }
+    
+    /// `true` while output is waiting for the socket
+    bool backlogged() const { return outbound && !outbound->empty(); }
+};
+
+/**
+ * Registry of connected sessions. 
+ * 
+ * Sessions live in a vector indexed by file descriptor (descriptors are small, dense integers) and 
+ * a hash map indexes logged in sessions by username. Opening, looking up and closing a session are all
+ * O(1), and closing a session releases its username.
+ * 
+ * Pointers returned from this type are only valid until the next call to \c open().
+ */
+class session_table final
+{
+    
+public:
+    
+    /// Socket descriptor type
+    typedef se3313::networking::socket::socket_desc_t fd_t;
+    
+    /// Outcome of \c login()
+    enum class login_result {
+        OK,
+        
+        /// Another session has the name
+        NAME_IN_USE,
+        
+        /// The name is empty
+        INVALID_NAME,
+        
+        /// This session already logged in
+        ALREADY_LOGGED_IN
+    };
+    
+    /// Creates an empty table, reserving room for @p expected sessions. 
+    explicit session_table(const size_t expected = 0);
+    
+    /**
+     * Registers a newly accepted socket.
+     * @return The new session
+     */
+    session* open(const std::shared_ptr<se3313::networking::socket>& sock);
+    
+    /// Finds the session for @p fd, `nullptr` if there is none.
+    session* find(const fd_t fd);
+    
+    /// Finds the session logged in as @p username, `nullptr` if there is none.
+    session* findByName(const std::string& username);
+    
+    /// Binds @p username to the session on @p fd if the name is free. 
+    login_result login(const fd_t fd, const std::string& username);
+    
+    /**
+     * Removes the session on @p fd, releasing its username. Does not close the socket.
+     * @return `true` if there was a session
+     */
+    bool close(const fd_t fd);
+    
+    /// Descriptors of all open sessions, in no particular order.
+    const std::vector<fd_t>& fds() const { return _active; }
+    
+    /// Number of open sessions
+    size_t size() const { return _active.size(); }
+    
+    /// Number of logged in sessions
+    size_t loggedIn() const { return _byName.size(); }
+    
+private:
+    
+    /// Slots indexed by file descriptor
+    std::vector<session> _slots;
+    
+    /// Dense list of open descriptors, used for iteration
+    std::vector<fd_t> _active;
+    
+    /// Logged in sessions by name
+    std::unordered_map<std::string, fd_t> _byName;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_SESSION_TABLE_HPP
@@ -0,0 +1,85 @@
+#ifndef DZAGAR_STAGE_LATENCY_HPP
+#define DZAGAR_STAGE_LATENCY_HPP
+
+#include <metrics/registry.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace dzagar
+{
+
+/**
+ * Time spent by requests in each stage between the socket and the client, exported as the
+ * `chat_stage_seconds` summary and printed by the `latency` command.
+ *
+ * The stages are contiguous, each ends where the next starts:
+ *
+ *     RECV     the read of the socket
+ *     FRAME    from the read to the request being handed to a worker, including rate limiting
+ *     PARSE    from the hand over to the request being decoded, including the wait for a worker
+ *     VISIT    handling the request, including the wait for the state lock
+ *     ENCODE   encoding the response
+ *     ENQUEUE  from the encoded response to every recipient having it written or queued
+ *     FLUSH    a queued frame waiting for its socket to take it
+ *
+ * Built without `STAGE_LATENCY` the timestamps are empty and every call compiles to nothing.
+ */
+namespace stage
+{
+
+enum id : uint8_t { RECV, FRAME, PARSE, VISIT, ENCODE, ENQUEUE, FLUSH, COUNT };
+
+#ifdef SE3313_STAGE_LATENCY
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+namespace detail
+{
+
+/// One latency per stage, indexed by @c id
+extern const se3313::metrics::latency g_stages[COUNT];
+
+} // end namespace detail
+
+inline
+time_point now()
+{
+    return std::chrono::steady_clock::now();
+}
+
+/// Records @p from to @p to as time spent in @p s.
+inline
+void record(const id s, const time_point from, const time_point to)
+{
+    detail::g_stages[s].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()));
+}
+
+#else
+
+struct time_point { };
+
+inline
+time_point now()
+{
+    return time_point();
+}
+
+inline
+void record(const id, const time_point, const time_point)
+{ }
+
+#endif
+
+/// Lower case name of @p s, as in the `stage` label
+const char* name(const id s);
+
+/// Writes the percentiles of every stage to @p out, a line each.
+void report(std::ostream& out);
+
+} // end namespace stage
+
+} // end namespace dzagar
+
+#endif // DZAGAR_STAGE_LATENCY_HPP
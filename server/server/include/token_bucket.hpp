@@ -0,0 +1,89 @@
+#ifndef DZAGAR_TOKEN_BUCKET_HPP
+#define DZAGAR_TOKEN_BUCKET_HPP
+
+#include <algorithm>
+#include <chrono>
+
+namespace dzagar
+{
+
+/**
+ * Classic token bucket: tokens accrue at a fixed rate up to a burst size and every admitted unit of 
+ * work spends some. 
+ * 
+ * A request larger than the burst is admitted once the bucket is full and leaves it in debt, so an 
+ * oversized frame is slowed down instead of being refused forever. A rate of zero disables the bucket.
+ */
+class token_bucket final
+{
+    
+public:
+    
+    typedef std::chrono::steady_clock clock_t;
+    
+    /**
+     * Creates a full bucket. 
+     * @param rate Tokens added per second, 0 for unlimited
+     * @param burst Most tokens held at once
+     */
+    explicit token_bucket(const double rate = 0, const double burst = 0)
+        : _rate(rate)
+        , _burst(std::max(burst, rate > 0 ? 1.0 : 0.0))
+        , _tokens(_burst)
+        , _last(clock_t::now())
+    { }
+    
+    /// `true` if this bucket limits anything
+    bool enabled() const { return _rate > 0; }
+    
+    /// Refills for the time elapsed and checks whether @p n tokens can be spent.
+    bool ready(const double n, const clock_t::time_point now)
+    {
+        if (!enabled())
+        {
+            return true;
+        }
+        
+        refill(now);
+        return _tokens >= std::min(n, _burst);
+    }
+    
+    /// Spends @p n tokens, call after `ready()`.
+    void take(const double n)
+    {
+        if (enabled())
+        {
+            _tokens -= n;
+        }
+    }
+    
+    /// Time until `ready(n)` holds, zero if it already does.
+    clock_t::duration until(const double n) const
+    {
+        const double missing = std::min(n, _burst) - _tokens;
+        if (!enabled() || missing <= 0)
+        {
+            return clock_t::duration::zero();
+        }
+        
+        return std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(missing / _rate));
+    }
+    
+private:
+    
+    void refill(const clock_t::time_point now)
+    {
+        const std::chrono::duration<double> elapsed = now - _last;
+        _tokens = std::min(_burst, _tokens + elapsed.count() * _rate);
+        _last = now;
+    }
+    
+    double _rate;
+    double _burst;
+    double _tokens;
+    clock_t::time_point _last;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_TOKEN_BUCKET_HPP
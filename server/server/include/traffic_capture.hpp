@@ -0,0 +1,125 @@
+#ifndef DZAGAR_TRAFFIC_CAPTURE_HPP
+#define DZAGAR_TRAFFIC_CAPTURE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace dzagar
+{
+
+/**
+ * Records the requests the server accepts, with when and on which connection they arrived, so the
+ * traffic can be replayed against another build (see `tools/replay.cpp`).
+ *
+ * The file starts with the magic `SE3313CAP`, a version byte and the wall clock time capturing began
+ * (i64 nanoseconds since the epoch), followed by records framed as
+ *
+ *     u8 kind | varint nanoseconds since the previous record | varint connection | [varint length | frame]
+ *
+ * Connections are numbered in the order they were first seen, descriptors are reused too quickly to
+ * tell clients apart. Only @c kind::FRAME records carry a frame, without its newline. Records are
+ * buffered and written in chunks on the calling thread, the capture is only meant to be on while
+ * gathering traffic.
+ */
+class traffic_capture final
+{
+
+public:
+
+    enum class kind : uint8_t { OPEN = 1, FRAME = 2, CLOSE = 3 };
+
+    /// A record read back from a capture
+    struct record
+    {
+        kind type;
+
+        /// Time since capturing began
+        std::chrono::nanoseconds at;
+
+        uint64_t connection;
+
+        std::string frame;
+    };
+
+    /// Reads a capture file from the start.
+    class reader final
+    {
+
+    public:
+
+        /// Throws a @c std::runtime_error if @p path is not a capture.
+        explicit reader(const std::string& path);
+        ~reader();
+
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+
+        /**
+         * Reads the next record into @p rec.
+         * @return `false` at the end of the capture, or at a record cut short by a crash
+         */
+        bool next(record* const rec);
+
+        /// When capturing began
+        std::chrono::system_clock::time_point started() const { return _started; }
+
+    private:
+
+        /// Reads more of the file after what is left unparsed. @return `false` at the end of the file
+        bool fill();
+
+        const int _fd;
+        std::string _buffer;
+        size_t _position;
+        std::chrono::nanoseconds _at;
+        std::chrono::system_clock::time_point _started;
+    };
+
+    /// Creates or truncates @p path, throws a @c std::runtime_error if it can not be opened.
+    explicit traffic_capture(const std::string& path);
+
+    /// Writes out whatever is buffered.
+    ~traffic_capture();
+
+    traffic_capture(const traffic_capture&) = delete;
+    traffic_capture& operator=(const traffic_capture&) = delete;
+
+    /// Records that a client connected on @p fd.
+    void open(const int fd);
+
+    /// Records a request of @p length bytes at @p data received on @p fd.
+    void frame(const int fd, const char* const data, const size_t length);
+
+    /// Records that the client on @p fd disconnected.
+    void close(const int fd);
+
+    const std::string& path() const { return _path; }
+
+    /// Connections and frames recorded so far
+    uint64_t connections() const { return _nextConnection; }
+    uint64_t frames() const { return _frames; }
+
+private:
+
+    /// Starts a record of @p type on the connection on @p fd, opening it if it was never seen.
+    void begin(const kind type, const int fd);
+
+    /// Writes the buffer out once it is large enough, or always if @p force.
+    void flush(const bool force);
+
+    const std::string _path;
+    int _fd;
+    std::string _buffer;
+    std::chrono::steady_clock::time_point _last;
+
+    /// Connection number of each open descriptor
+    std::unordered_map<int, uint64_t> _connections;
+    uint64_t _nextConnection;
+    uint64_t _frames;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_TRAFFIC_CAPTURE_HPP
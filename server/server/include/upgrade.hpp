@@ -0,0 +1,94 @@
+#ifndef DZAGAR_UPGRADE_HPP
+#define DZAGAR_UPGRADE_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dzagar
+{
+
+/**
+ * Hands a running server's sockets and state to a new process, so the binary can be replaced without
+ * dropping clients.
+ *
+ * The running server listens on a Unix socket (`--upgrade-socket`). A new process started with
+ * `--takeover` connects to it, and the running server answers with its listening descriptor and every
+ * client descriptor, passed as `SCM_RIGHTS` ancillary data, followed by the state of each session and
+ * the room histories. The new process acknowledges once it holds everything, the old one then closes
+ * its copies (without shutting the sockets down) and exits. Clients only notice a short pause.
+ *
+ * The channel is a `SOCK_SEQPACKET` socket, every message starts with a one byte tag:
+ *
+ *     'U'                               new → old, asks for the handover
+ *     'H' u64 stateBytes | u32 fds      old → new, what follows
+ *     'F'                               old → new, up to @c MAX_FDS descriptors, listener first
+ *     'S' bytes                         old → new, the next chunk of the encoded state
+ *     'A'                               new → old, everything arrived
+ */
+namespace upgrade
+{
+
+/// A session carried over, in the order of the client descriptors
+struct session_state
+{
+    std::string username;
+    std::vector<std::string> rooms;
+
+    /// Received bytes not handed to a worker yet
+    std::string inbound;
+
+    /// Output the socket had not accepted yet
+    std::string outbound;
+
+    bool flowControl;
+};
+
+/// Everything handed to the new process besides the descriptors
+struct state
+{
+    std::vector<session_state> sessions;
+
+    /// Each room's history page, least recently written room first
+    std::vector<std::pair<std::string, std::string>> history;
+};
+
+/// Descriptors passed in one message
+constexpr size_t MAX_FDS = 250;
+
+/**
+ * Listens for a new process on the Unix socket at @p path, replacing a stale socket file.
+ * @return The listening descriptor
+ */
+int listen(const std::string& path);
+
+/**
+ * Connects to the server listening at @p path and asks it to hand over.
+ * @return The channel to `receive()` from
+ */
+int request(const std::string& path);
+
+/**
+ * Accepts a new process from @p listener and waits for its request.
+ * @return The channel to `send()` to
+ */
+int accept(const int listener);
+
+/**
+ * Sends @p listenFD, @p sessionFDs and @p st to the new process on @p channel and waits for it to
+ * acknowledge. Throws a @c std::runtime_error if it does not, the caller still owns everything then.
+ */
+void send(const int channel, const int listenFD, const std::vector<int>& sessionFDs, const state& st);
+
+/**
+ * Receives what `send()` sent on @p channel and acknowledges it.
+ * @param listenFD Set to the listening descriptor
+ * @param sessionFDs Set to a descriptor per session in the returned state
+ */
+state receive(const int channel, int* const listenFD, std::vector<int>* const sessionFDs);
+
+} // end namespace upgrade
+
+} // end namespace dzagar
+
+#endif // DZAGAR_UPGRADE_HPP
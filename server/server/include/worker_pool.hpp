@@ -0,0 +1,78 @@
+#ifndef DZAGAR_WORKER_POOL_HPP
+#define DZAGAR_WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dzagar
+{
+
+/**
+ * Fixed set of threads running tasks off the I/O thread.
+ * 
+ * Every worker owns a FIFO queue and a task goes to the worker picked by hashing its key, so tasks 
+ * submitted with the same key (the sender's descriptor) run one at a time and in submission order. 
+ * A pool of zero workers runs every task inline in `submit()`.
+ */
+class worker_pool final
+{
+    
+public:
+    
+    /// Work handed to the pool
+    typedef std::function<void()> task_t;
+    
+    /// Starts @p workers threads.
+    explicit worker_pool(const size_t workers);
+    
+    /// Runs the tasks still queued, then joins the threads.
+    ~worker_pool();
+    
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+    
+    /// Queues @p task on the worker owning @p key.
+    void submit(const size_t key, task_t task);
+    
+    /**
+     * Runs @p done once every task submitted before has finished, on the worker that got there last.
+     * A pool without workers runs it right away.
+     */
+    void drain(task_t done);
+    
+    /// Number of threads, 0 if tasks run inline
+    size_t size() const { return _workers.size(); }
+    
+    /// Tasks submitted but not yet finished, over all workers
+    size_t pending() const { return _pending.load(std::memory_order_relaxed); }
+    
+private:
+    
+    /// One thread and its queue
+    struct worker
+    {
+        mutable std::mutex mut;
+        std::condition_variable cv;
+        std::deque<task_t> queue;
+        bool stop = false;
+        std::thread thread;
+    };
+    
+    /// Body of every worker thread
+    void run(worker& w);
+    
+    std::vector<std::unique_ptr<worker>> _workers;
+    
+    std::atomic<size_t> _pending;
+};
+
+} // end namespace dzagar
+
+#endif // DZAGAR_WORKER_POOL_HPP
@@ -1,12 +1,52 @@
 include(${CMAKE_CURRENT_LIST_DIR}/../lib/lib.cmake)
 
-set(server_HEADERS  server/include/server.hpp)
+set(server_HEADERS  server/include/server.hpp
+                    server/include/alloc_counter.hpp
+                    server/include/cpu_profiler.hpp
+                    server/include/message_log.hpp
+                    server/include/room_history.hpp
+                    server/include/room_index.hpp
+                    server/include/session_table.hpp
+                    server/include/stage_latency.hpp
+                    server/include/token_bucket.hpp
+                    server/include/traffic_capture.hpp
+                    server/include/upgrade.hpp
+                    server/include/worker_pool.hpp)
 
 set(server_SOURCES  server/src/server.cpp
-                    server/src/main.cpp)
+                    server/src/alloc_counter.cpp
+                    server/src/cpu_profiler.cpp
+                    server/src/message_log.cpp
+                    server/src/room_history.cpp
+                    server/src/room_index.cpp
+                    server/src/session_table.cpp
+                    server/src/stage_latency.cpp
+                    server/src/traffic_capture.cpp
+                    server/src/upgrade.cpp
+                    server/src/worker_pool.cpp)
 
-add_executable(server ${server_SOURCES} ${server_HEADERS})
-target_link_libraries(server se3313)
+# Everything but main(), compiled once for the server and the tools running one in-process
+add_library(server_core STATIC ${server_SOURCES} ${server_HEADERS})
+target_link_libraries(server_core PUBLIC se3313)
+target_include_directories(server_core PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include)
+
+# Per stage request latencies, off removes the timestamps altogether
+option(STAGE_LATENCY "Measure the latency of each request stage" ON)
+if(STAGE_LATENCY)
+    target_compile_definitions(server_core PUBLIC SE3313_STAGE_LATENCY)
+endif()
+
+# Per stage allocation counts, replaces malloc() so it is off unless hunting allocations
+option(ALLOC_COUNTING "Count the heap allocations of each request stage" OFF)
+if(ALLOC_COUNTING)
+    target_compile_definitions(server_core PUBLIC SE3313_ALLOC_COUNTING)
+endif()
+
+add_executable(server server/src/main.cpp)
+target_link_libraries(server server_core)
+
+# -rdynamic, so the stack logged for a stalled event loop and CPU profiles name the functions
+set_target_properties(server PROPERTIES ENABLE_EXPORTS ON)
 
 install(TARGETS server RUNTIME DESTINATION bin)
 target_include_directories(server PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include)
@@ -0,0 +1,192 @@
+#include "alloc_counter.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace dzagar;
+
+#ifdef SE3313_ALLOC_COUNTING
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+} // end extern "C"
+
+namespace
+{
+
+/// Threads with counters of their own, allocations of any further thread are only counted in total
+constexpr int MAX_THREADS = 64;
+
+/// The stages and "other"
+constexpr int SLOTS = stage::COUNT + 1;
+
+/// Counters of one thread, only written by it
+struct alignas(64) thread_counters
+{
+    std::atomic<uint64_t> allocations[SLOTS];
+    std::atomic<uint64_t> bytes[SLOTS];
+    std::atomic<uint64_t> frees[SLOTS];
+};
+
+thread_counters g_threads[MAX_THREADS];
+std::atomic<int> g_nextThread(0);
+
+/// Allocations of threads without counters of their own
+std::atomic<uint64_t> g_untracked(0);
+
+/// Index of this thread's counters, -1 before its first allocation and MAX_THREADS without any
+thread_local int t_slot = -1;
+
+thread_counters* counters()
+{
+    if (t_slot < 0)
+    {
+        const int claimed = g_nextThread.fetch_add(1, std::memory_order_relaxed);
+        t_slot = claimed < MAX_THREADS ? claimed : MAX_THREADS;
+    }
+    return t_slot < MAX_THREADS ? &g_threads[t_slot] : nullptr;
+}
+
+/// Adds @p n to a counter only this thread writes, without the cost of a locked add.
+inline
+void bump(std::atomic<uint64_t>& counter, const uint64_t n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void countAllocation(const size_t size)
+{
+    if (thread_counters* const c = counters())
+    {
+        bump(c->allocations[alloc::detail::t_stage], 1);
+        bump(c->bytes[alloc::detail::t_stage], size);
+    }
+    else
+    {
+        g_untracked.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void countFree()
+{
+    if (thread_counters* const c = counters())
+    {
+        bump(c->frees[alloc::detail::t_stage], 1);
+    }
+}
+
+} // end anonymous namespace
+
+thread_local uint8_t alloc::detail::t_stage = stage::COUNT;
+
+// operator new and delete of libstdc++ call these, so they are counted here too
+
+extern "C" void* malloc(size_t size)
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    countAllocation(n * size);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+    countAllocation(size);
+    return __libc_realloc(p, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size)
+{
+    countAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size)
+{
+    countAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** out, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    countAllocation(size);
+    void* const p = __libc_memalign(alignment, size);
+    if (!p)
+    {
+        return ENOMEM;
+    }
+    *out = p;
+    return 0;
+}
+
+extern "C" void free(void* p)
+{
+    if (p)
+    {
+        countFree();
+    }
+    __libc_free(p);
+}
+
+void alloc::report(std::ostream& out, const uint64_t requests)
+{
+    uint64_t allocations[SLOTS] = { };
+    uint64_t bytes[SLOTS] = { };
+    uint64_t frees[SLOTS] = { };
+    const int threads = std::min(g_nextThread.load(std::memory_order_relaxed), MAX_THREADS);
+    for (int t = 0; t < threads; ++t)
+    {
+        for (int s = 0; s < SLOTS; ++s)
+        {
+            allocations[s] += g_threads[t].allocations[s].load(std::memory_order_relaxed);
+            bytes[s] += g_threads[t].bytes[s].load(std::memory_order_relaxed);
+            frees[s] += g_threads[t].frees[s].load(std::memory_order_relaxed);
+        }
+    }
+
+    const double perRequest = requests > 0 ? 1.0 / static_cast<double>(requests) : 0;
+    out << requests << " requests" << std::endl
+        << std::left << std::setw(9) << "stage" << std::right << std::setw(14) << "allocs" << std::setw(14) << "bytes"
+        << std::setw(12) << "allocs/req" << std::setw(12) << "bytes/req" << std::setw(12) << "frees/req" << std::endl;
+    for (int s = 0; s < SLOTS; ++s)
+    {
+        out << std::left << std::setw(9) << (s < stage::COUNT ? stage::name(static_cast<stage::id>(s)) : "other") << std::right
+            << std::setw(14) << allocations[s] << std::setw(14) << bytes[s] << std::fixed << std::setprecision(2)
+            << std::setw(12) << static_cast<double>(allocations[s]) * perRequest
+            << std::setw(12) << static_cast<double>(bytes[s]) * perRequest
+            << std::setw(12) << static_cast<double>(frees[s]) * perRequest << std::defaultfloat << std::endl;
+    }
+
+    const uint64_t untracked = g_untracked.load(std::memory_order_relaxed);
+    if (untracked > 0)
+    {
+        out << untracked << " allocations by threads beyond the first " << MAX_THREADS << " were not attributed" << std::endl;
+    }
+}
+
+#else
+
+void alloc::report(std::ostream& out, const uint64_t)
+{
+    out << "Allocation counting was compiled out, build with -DALLOC_COUNTING=ON" << std::endl;
+}
+
+#endif
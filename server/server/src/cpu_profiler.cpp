@@ -0,0 +1,261 @@
+#include "cpu_profiler.hpp"
+
+#include <logging/log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace dzagar;
+
+namespace
+{
+
+constexpr int MAX_FRAMES = 64;
+
+/// Frames of the signal handler and the kernel's signal trampoline at the top of every sample
+constexpr int HANDLER_FRAMES = 2;
+
+/// Samples kept by a profile, later ones are counted as dropped
+constexpr size_t MAX_SAMPLES = 64 * 1024;
+
+struct sample
+{
+    pid_t tid;
+    int depth;
+    void* frames[MAX_FRAMES];
+};
+
+/// Where the signal handler stores samples, null while not profiling
+std::atomic<sample*> g_samples(nullptr);
+size_t g_capacity = 0;
+std::atomic<size_t> g_next(0);
+
+/// Signal handlers between seeing @c g_samples and being done with it
+std::atomic<int> g_sampling(0);
+
+std::atomic<bool> g_running(false);
+std::once_flag g_installed;
+
+void onProfile(int)
+{
+    const int saved = errno;
+    g_sampling.fetch_add(1);
+    if (sample* const samples = g_samples.load())
+    {
+        const size_t i = g_next.fetch_add(1);
+        if (i < g_capacity)
+        {
+            samples[i].tid = static_cast<pid_t>(::syscall(SYS_gettid));
+            samples[i].depth = ::backtrace(samples[i].frames, MAX_FRAMES);
+        }
+    }
+    g_sampling.fetch_sub(1);
+    errno = saved;
+}
+
+void arm(const int hz)
+{
+    itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz > 0 ? 1000000 / hz : 0;
+    timer.it_value = timer.it_interval;
+    ::setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+std::string threadName(const pid_t tid)
+{
+    std::ifstream comm("/proc/self/task/" + std::to_string(tid) + "/comm");
+    std::string name;
+    if (!std::getline(comm, name) || name.empty())
+    {
+        // the thread is gone by now
+        name = "thread-" + std::to_string(tid);
+    }
+    return name;
+}
+
+/// Name of the function @p pc is in, the names are collapsed stack frames so they can not contain ';'
+std::string symbolize(void* const pc)
+{
+    std::ostringstream name;
+    Dl_info info;
+    if (::dladdr(pc, &info) != 0 && info.dli_sname)
+    {
+        int status = -1;
+        char* const demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name << (status == 0 ? demangled : info.dli_sname);
+        ::free(demangled);
+    }
+    else if (info.dli_fname)
+    {
+        const char* const slash = std::strrchr(info.dli_fname, '/');
+        name << (slash ? slash + 1 : info.dli_fname) << "+0x" << std::hex
+             << (reinterpret_cast<uintptr_t>(pc) - reinterpret_cast<uintptr_t>(info.dli_fbase));
+    }
+    else
+    {
+        name << "[unknown]";
+    }
+
+    std::string s = name.str();
+    std::replace(s.begin(), s.end(), ';', ':');
+    return s;
+}
+
+/// Writes @p count samples as collapsed stacks, returns how many distinct stacks there were.
+size_t collapse(std::ostream& out, const sample* const samples, const size_t count)
+{
+    std::unordered_map<pid_t, std::string> threads;
+    std::unordered_map<void*, std::string> symbols;
+    std::map<std::string, uint64_t> stacks;
+    std::string stack;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const sample& s = samples[i];
+        auto thread = threads.find(s.tid);
+        if (thread == threads.end())
+        {
+            thread = threads.emplace(s.tid, threadName(s.tid)).first;
+        }
+
+        stack = thread->second;
+        for (int f = s.depth - 1; f >= HANDLER_FRAMES; --f)
+        {
+            // callers' frames hold return addresses, which can be past the end of the calling function
+            void* const pc = f > HANDLER_FRAMES ? static_cast<char*>(s.frames[f]) - 1 : s.frames[f];
+            auto symbol = symbols.find(pc);
+            if (symbol == symbols.end())
+            {
+                symbol = symbols.emplace(pc, symbolize(pc)).first;
+            }
+            stack.push_back(';');
+            stack.append(symbol->second);
+        }
+        ++stacks[stack];
+    }
+
+    for (const auto& s : stacks)
+    {
+        out << s.first << ' ' << s.second << '\n';
+    }
+    return stacks.size();
+}
+
+} // end anonymous namespace
+
+cpu_profiler::cpu_profiler(const std::string& path, const std::chrono::seconds duration, const int hz)
+    : _path(path)
+    , _stop(false)
+    , _done(false)
+{
+    if (hz <= 0 || hz > 1000 || duration <= std::chrono::seconds::zero())
+    {
+        throw std::runtime_error("cpu_profiler: the duration must be positive and the rate within 1 to 1000 Hz");
+    }
+
+    bool idle = false;
+    if (!g_running.compare_exchange_strong(idle, true))
+    {
+        throw std::runtime_error("cpu_profiler: a profile is already running");
+    }
+
+    _out.open(path, std::ios::trunc);
+    if (!_out)
+    {
+        g_running = false;
+        throw std::runtime_error("cpu_profiler: could not open " + path);
+    }
+
+    std::call_once(g_installed, [](){
+        // backtrace() loads libgcc on its first call, which must not happen in the signal handler
+        void* frame;
+        ::backtrace(&frame, 1);
+
+        // stays installed, a SIGPROF still pending after a profile must not take the default action
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = onProfile;
+        action.sa_flags = SA_RESTART;
+        ::sigemptyset(&action.sa_mask);
+        ::sigaction(SIGPROF, &action, nullptr);
+    });
+
+    // the process accrues CPU time on every core at once
+    const size_t cores = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    g_capacity = std::min(MAX_SAMPLES, static_cast<size_t>(hz) * static_cast<size_t>(duration.count() + 1) * cores);
+    g_next = 0;
+    g_samples = new sample[g_capacity];
+    arm(hz);
+
+    _thread = std::thread(&cpu_profiler::run, this, duration);
+}
+
+cpu_profiler::~cpu_profiler()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mut);
+        _stop = true;
+    }
+    _cv_stop.notify_one();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+bool cpu_profiler::done() const
+{
+    std::lock_guard<std::mutex> lock(_mut);
+    return _done;
+}
+
+void cpu_profiler::run(const std::chrono::seconds duration)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mut);
+        _cv_stop.wait_for(lock, duration, [this](){ return _stop; });
+    }
+
+    arm(0);
+    std::unique_ptr<sample[]> samples(g_samples.exchange(nullptr));
+    while (g_sampling.load() > 0)
+    {
+        std::this_thread::yield();
+    }
+
+    const size_t taken = g_next.load();
+    const size_t kept = std::min(taken, g_capacity);
+    const size_t stacks = collapse(_out, samples.get(), kept);
+    _out.close();
+
+    std::ostringstream summary;
+    summary << "Profile of " << kept << " samples (" << stacks << " distinct stacks) written to " << _path;
+    if (taken > kept)
+    {
+        summary << ", " << taken - kept << " samples dropped";
+    }
+    std::cout << summary.str() << std::endl;
+    SE3313_LOG_INFO(summary.str());
+
+    {
+        std::lock_guard<std::mutex> lock(_mut);
+        _done = true;
+    }
+    g_running = false;
+}
@@ -1,12 +1,246 @@
-
 #include "server.hpp"
 
-int main(int /*argc*/, char** /*argv*/)
+#include <logging/log.hpp>
+#include <tracing/trace.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+namespace
+{
+
+/// Prints the command line options to @p os.
+void usage(std::ostream& os, const char* const argv0)
+{
+     const dzagar::server_config defaults;
+     os << "Usage: " << argv0 << " [options]" << std::endl
+        << "  --port N              Port to listen on, asked for on stdin if absent" << std::endl
+        << "  --history-messages N  Messages kept per room (default " << defaults.historyMessages << ")" << std::endl
+        << "  --history-bytes N     Bytes kept per room (default " << defaults.historyBytes << ")" << std::endl
+        << "  --history-rooms N     Rooms whose history is kept (default " << defaults.historyRooms << ")" << std::endl
+        << "  --log-dir PATH        Directory of the durable message log, disabled if absent" << std::endl
+        << "  --log-sync-ms N       Longest wait before a logged message is synced (default " << defaults.log.syncInterval.count() << ")" << std::endl
+        << "  --log-sync-messages N Pending messages that force a sync (default " << defaults.log.syncMessages << ")" << std::endl
+        << "  --log-segment-bytes N Size of a log segment (default " << defaults.log.segmentBytes << ")" << std::endl
+        << "  --log-segments N      Log segments kept, 0 for all (default " << defaults.log.maxSegments << ")" << std::endl
+        << "  --workers N           Request worker threads, 0 for none (default " << defaults.workers << ")" << std::endl
+        << "  --max-frame-bytes N   Longest request accepted (default " << defaults.maxFrameBytes << ")" << std::endl
+        << "  --rate-messages N     Requests per second per session, 0 for unlimited (default " << defaults.ingress.messagesPerSecond << ")" << std::endl
+        << "  --rate-message-burst N  Requests per session in a burst" << std::endl
+        << "  --rate-bytes N        Request bytes per second per session, 0 for unlimited (default " << defaults.ingress.bytesPerSecond << ")" << std::endl
+        << "  --rate-byte-burst N   Request bytes per session in a burst" << std::endl
+        << "  --rate-policy P       drop, pause or disconnect when over the limit (default pause)" << std::endl
+        << "  --egress-high-water N Bytes queued for a session that make it slow (default " << defaults.egress.highWaterBytes << ")" << std::endl
+        << "  --egress-low-water N  Bytes queued below which it recovers (default " << defaults.egress.lowWaterBytes << ")" << std::endl
+        << "  --egress-max-bytes N  Bytes queued over all sessions (default " << defaults.egress.maxTotalBytes << ")" << std::endl
+        << "  --slow-policy P       drop, collapse or disconnect for slow sessions (default collapse)" << std::endl
+        << "  --bp-high-requests N  Queued requests that pause the heaviest senders, 0 to ignore (default " << defaults.backpressure.highPendingRequests << ")" << std::endl
+        << "  --bp-low-requests N   Queued requests below which they resume (default " << defaults.backpressure.lowPendingRequests << ")" << std::endl
+        << "  --bp-high-bytes N     Queued output that pauses the heaviest senders, 0 to ignore (default " << defaults.backpressure.highEgressBytes << ")" << std::endl
+        << "  --bp-low-bytes N      Queued output below which they resume (default " << defaults.backpressure.lowEgressBytes << ")" << std::endl
+        << "  --bp-notify 0|1       Tell clients supporting flow control when they are paused (default " << defaults.backpressure.notifyClients << ")" << std::endl
+        << "  --upgrade-socket PATH Unix socket a new process takes the server over through, disabled if absent" << std::endl
+        << "  --takeover 0|1        Take the port and clients over from the server on --upgrade-socket (default " << defaults.takeover << ")" << std::endl
+        << "  --capture PATH        File the accepted requests are captured to for tools/replay, disabled if absent" << std::endl
+        << "  --handler-budget-ms N Event loop handlers taking longer are logged (default " << defaults.watchdog.handlerBudget.count() << ")" << std::endl
+        << "  --iteration-budget-ms N  Event loop iterations taking longer are logged (default " << defaults.watchdog.iterationBudget.count() << ")" << std::endl
+        << "  --stall-ms N          Event loop busy time after which its stack is logged, 0 to never (default " << defaults.watchdog.stallTimeout.count() << ")" << std::endl
+        << "  --metrics-port N      Loopback port serving Prometheus metrics on /metrics, disabled if absent" << std::endl
+        << "  --diag-file PATH      File diagnostics are appended to, standard output if absent" << std::endl
+        << "  --diag-level L        trace, debug, info, warn, error or off (default info, " << SE3313_LOG_MIN_LEVEL_NAME << " and up compiled in)" << std::endl
+        << "  --trace-sample F      Fraction of messages traced, written out by the trace FILE command (default 0)" << std::endl
+        << "  --trace-spans N       Spans kept for the export (default " << se3313::tracing::config().capacity << ")" << std::endl;
+}
+
+/// Parses a non-negative integer option value, exiting on garbage.
+size_t parseSize(const char* const option, const char* const value)
+{
+     char* end = nullptr;
+     const unsigned long long v = std::strtoull(value, &end, 10);
+     if (!*value || *end)
+     {
+          std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+          std::exit(EXIT_FAILURE);
+     }
+     
+     return static_cast<size_t>(v);
+}
+
+/// Parses a fraction between 0 and 1, exiting on garbage.
+double parseFraction(const char* const option, const char* const value)
+{
+     char* end = nullptr;
+     const double v = std::strtod(value, &end);
+     if (!*value || *end || !(v >= 0 && v <= 1))
+     {
+          std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+          std::exit(EXIT_FAILURE);
+     }
+     
+     return v;
+}
+
+/// Parses a rate limit policy name, exiting on garbage.
+dzagar::rate_limit_config::policy parsePolicy(const char* const option, const char* const value)
+{
+     typedef dzagar::rate_limit_config::policy policy;
+     if (std::strcmp(value, "drop") == 0)
+     {
+          return policy::DROP;
+     }
+     else if (std::strcmp(value, "pause") == 0)
+     {
+          return policy::PAUSE;
+     }
+     else if (std::strcmp(value, "disconnect") == 0)
+     {
+          return policy::DISCONNECT;
+     }
+     
+     std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+     std::exit(EXIT_FAILURE);
+}
+
+/// Parses a slow consumer policy name, exiting on garbage.
+dzagar::egress_config::policy parseSlowPolicy(const char* const option, const char* const value)
+{
+     typedef dzagar::egress_config::policy policy;
+     if (std::strcmp(value, "drop") == 0)
+     {
+          return policy::DROP;
+     }
+     else if (std::strcmp(value, "collapse") == 0)
+     {
+          return policy::COLLAPSE;
+     }
+     else if (std::strcmp(value, "disconnect") == 0)
+     {
+          return policy::DISCONNECT;
+     }
+     
+     std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+     std::exit(EXIT_FAILURE);
+}
+
+/// Parses a diagnostics level name, exiting on garbage.
+se3313::logging::level parseLevel(const char* const option, const char* const value)
+{
+     typedef se3313::logging::level level;
+     const struct { const char* name; level l; } levels[] = {
+          { "trace", level::TRACE }, { "debug", level::DEBUG }, { "info", level::INFO },
+          { "warn", level::WARN }, { "error", level::ERROR }, { "off", level::OFF }
+     };
+     for (const auto& l : levels)
+     {
+          if (std::strcmp(value, l.name) == 0)
+          {
+               return l.l;
+          }
+     }
+     
+     std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+     std::exit(EXIT_FAILURE);
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
 {
-     se3313::networking::port_t serverPort;
+     dzagar::server_config config;
+     se3313::logging::config diagnostics;
+     se3313::tracing::config tracing;
+     size_t serverPort = 0;
+     
+     const struct {
+          const char* name;
+          std::function<void(const char* option, const char* value)> set;
+     } options[] = {
+          { "--port", [&](const char* o, const char* v) { serverPort = parseSize(o, v); } },
+          { "--history-messages", [&](const char* o, const char* v) { config.historyMessages = parseSize(o, v); } },
+          { "--history-bytes", [&](const char* o, const char* v) { config.historyBytes = parseSize(o, v); } },
+          { "--history-rooms", [&](const char* o, const char* v) { config.historyRooms = parseSize(o, v); } },
+          { "--log-dir", [&](const char*, const char* v) { config.log.directory = v; } },
+          { "--log-sync-ms", [&](const char* o, const char* v) { config.log.syncInterval = std::chrono::milliseconds(parseSize(o, v)); } },
+          { "--log-sync-messages", [&](const char* o, const char* v) { config.log.syncMessages = parseSize(o, v); } },
+          { "--log-segment-bytes", [&](const char* o, const char* v) { config.log.segmentBytes = parseSize(o, v); } },
+          { "--log-segments", [&](const char* o, const char* v) { config.log.maxSegments = parseSize(o, v); } },
+          { "--workers", [&](const char* o, const char* v) { config.workers = parseSize(o, v); } },
+          { "--max-frame-bytes", [&](const char* o, const char* v) { config.maxFrameBytes = parseSize(o, v); } },
+          { "--rate-messages", [&](const char* o, const char* v) { config.ingress.messagesPerSecond = parseSize(o, v); } },
+          { "--rate-message-burst", [&](const char* o, const char* v) { config.ingress.messageBurst = parseSize(o, v); } },
+          { "--rate-bytes", [&](const char* o, const char* v) { config.ingress.bytesPerSecond = parseSize(o, v); } },
+          { "--rate-byte-burst", [&](const char* o, const char* v) { config.ingress.byteBurst = parseSize(o, v); } },
+          { "--rate-policy", [&](const char* o, const char* v) { config.ingress.onViolation = parsePolicy(o, v); } },
+          { "--egress-high-water", [&](const char* o, const char* v) { config.egress.highWaterBytes = parseSize(o, v); } },
+          { "--egress-low-water", [&](const char* o, const char* v) { config.egress.lowWaterBytes = parseSize(o, v); } },
+          { "--egress-max-bytes", [&](const char* o, const char* v) { config.egress.maxTotalBytes = parseSize(o, v); } },
+          { "--slow-policy", [&](const char* o, const char* v) { config.egress.onSlowConsumer = parseSlowPolicy(o, v); } },
+          { "--bp-high-requests", [&](const char* o, const char* v) { config.backpressure.highPendingRequests = parseSize(o, v); } },
+          { "--bp-low-requests", [&](const char* o, const char* v) { config.backpressure.lowPendingRequests = parseSize(o, v); } },
+          { "--bp-high-bytes", [&](const char* o, const char* v) { config.backpressure.highEgressBytes = parseSize(o, v); } },
+          { "--bp-low-bytes", [&](const char* o, const char* v) { config.backpressure.lowEgressBytes = parseSize(o, v); } },
+          { "--bp-notify", [&](const char* o, const char* v) { config.backpressure.notifyClients = parseSize(o, v) != 0; } },
+          { "--upgrade-socket", [&](const char*, const char* v) { config.upgradeSocket = v; } },
+          { "--takeover", [&](const char* o, const char* v) { config.takeover = parseSize(o, v) != 0; } },
+          { "--capture", [&](const char*, const char* v) { config.capture = v; } },
+          { "--handler-budget-ms", [&](const char* o, const char* v) { config.watchdog.handlerBudget = std::chrono::milliseconds(parseSize(o, v)); } },
+          { "--iteration-budget-ms", [&](const char* o, const char* v) { config.watchdog.iterationBudget = std::chrono::milliseconds(parseSize(o, v)); } },
+          { "--stall-ms", [&](const char* o, const char* v) { config.watchdog.stallTimeout = std::chrono::milliseconds(parseSize(o, v)); } },
+          { "--metrics-port", [&](const char* o, const char* v) { config.metricsPort = static_cast<se3313::networking::port_t>(parseSize(o, v)); } },
+          { "--diag-file", [&](const char*, const char* v) { diagnostics.path = v; } },
+          { "--diag-level", [&](const char* o, const char* v) { diagnostics.threshold = parseLevel(o, v); } },
+          { "--trace-sample", [&](const char* o, const char* v) { tracing.sampleRate = parseFraction(o, v); } },
+          { "--trace-spans", [&](const char* o, const char* v) { tracing.capacity = parseSize(o, v); } },
+     };
+     
+     for (int i = 1; i < argc; ++i)
+     {
+          bool known = false;
+          for (const auto& opt : options)
+          {
+               if (std::strcmp(argv[i], opt.name) == 0 && i + 1 < argc)
+               {
+                    opt.set(opt.name, argv[++i]);
+                    known = true;
+                    break;
+               }
+          }
+          
+          if (!known)
+          {
+               usage(std::cerr, argv[0]);
+               return EXIT_FAILURE;
+          }
+     }
+     
+     if (config.takeover && config.upgradeSocket.empty())
+     {
+          std::cerr << "--takeover needs --upgrade-socket" << std::endl;
+          return EXIT_FAILURE;
+     }
+     
+     try
+     {
+          se3313::logging::configure(diagnostics);
+     }
+     catch (const std::runtime_error& err)
+     {
+          std::cerr << err.what() << std::endl;
+          return EXIT_FAILURE;
+     }
+     
+     se3313::tracing::configure(tracing);
+     
      std::cout << "Server: dzagar" << std::endl;
-     std::cout << "Enter port number:" << std::endl;
-     std::cin >> serverPort;
-     std::shared_ptr<dzagar::server> srv = std::make_shared<dzagar::server>(serverPort);
+     
+     // a takeover inherits the listening socket, there is no port to bind
+     if (serverPort == 0 && !config.takeover)
+     {
+          std::cout << "Enter port number:" << std::endl;
+          std::cin >> serverPort;
+     }
+     
+     std::shared_ptr<dzagar::server> srv = std::make_shared<dzagar::server>(static_cast<se3313::networking::port_t>(serverPort), config);
      srv->start();
 }
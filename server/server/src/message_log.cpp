@@ -0,0 +1,679 @@
+#include "message_log.hpp"
+
+#include <logging/log.hpp>
+#include <msg/schema.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/crc.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace dzagar;
+
+namespace binary = se3313::msg::schema::binary;
+
+namespace
+{
+
+/// Bytes before the payload: length, crc, offset and timestamp
+constexpr size_t RECORD_HEADER = 4 + 4 + 8 + 8;
+
+/// Bytes of length and crc, which the crc does not cover
+constexpr size_t RECORD_PREFIX = 4 + 4;
+
+/// Largest record accepted when reading, anything bigger is treated as corruption
+constexpr uint32_t MAX_RECORD = 64 * 1024 * 1024;
+
+/// Times a batch is written before the log gives up on it
+constexpr int COMMIT_ATTEMPTS = 3;
+
+uint32_t crc32(const char* const data, const size_t length)
+{
+    boost::crc_32_type crc;
+    crc.process_bytes(data, length);
+    return crc.checksum();
+}
+
+/// Writes a little-endian @p v at @p out, used to patch the length and crc in place.
+void patch32(char* const out, const uint32_t v)
+{
+    for (size_t i = 0; i < 4; ++i)
+    {
+        out[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+/// Appends the framed record to @p out.
+void encodeRecord(std::string* const out, const uint64_t offset, const std::string& room, const std::string& frame)
+{
+    const size_t start = out->size();
+    out->append(RECORD_PREFIX, '\0');
+
+    binary::put_fixed<uint64_t>(out, offset);
+    binary::put_fixed<int64_t>(out, std::chrono::system_clock::now().time_since_epoch().count());
+    binary::put_varint(out, room.size());
+    out->append(room);
+    binary::put_varint(out, frame.size());
+    out->append(frame);
+
+    char* const raw = &(*out)[start];
+    const size_t length = out->size() - start - RECORD_PREFIX;
+    patch32(raw, static_cast<uint32_t>(length));
+    patch32(raw + 4, crc32(raw + RECORD_PREFIX, length));
+}
+
+/**
+ * Reads the record at @p first, checking its crc.
+ * @return Bytes consumed, 0 if the record is truncated or corrupt
+ */
+size_t decodeRecord(const char* const first, const char* const last, message_log::record* const rec)
+{
+    const char* p = first;
+
+    uint32_t length, crc;
+    if (!binary::get_fixed(&p, last, &length) || !binary::get_fixed(&p, last, &crc)
+        || length > MAX_RECORD || static_cast<size_t>(last - p) < length || length < RECORD_HEADER - RECORD_PREFIX)
+    {
+        return 0;
+    }
+
+    if (crc32(p, length) != crc)
+    {
+        return 0;
+    }
+
+    const char* const end = p + length;
+
+    int64_t ticks = 0;
+    uint64_t roomSize, frameSize;
+    if (!binary::get_fixed(&p, end, &rec->offset) || !binary::get_fixed(&p, end, &ticks))
+    {
+        return 0;
+    }
+    rec->timestamp = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(ticks));
+
+    if (!binary::get_varint(&p, end, &roomSize) || static_cast<uint64_t>(end - p) < roomSize)
+    {
+        return 0;
+    }
+    rec->room = boost::string_ref(p, roomSize);
+    p += roomSize;
+
+    if (!binary::get_varint(&p, end, &frameSize) || static_cast<uint64_t>(end - p) < frameSize)
+    {
+        return 0;
+    }
+    rec->frame = boost::string_ref(p, frameSize);
+
+    return RECORD_PREFIX + length;
+}
+
+std::string segmentName(const std::string& dir, const uint64_t base, const char* const ext)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(base), ext);
+    return dir + "/" + name;
+}
+
+[[noreturn]]
+void fail(const std::string& what)
+{
+    std::ostringstream ss; ss << "message_log: " << what << ", errno: " << errno;
+    throw std::runtime_error(ss.str());
+}
+
+/// Writes all of @p length bytes, retrying partial writes.
+bool writeAll(const int fd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        const ssize_t n = ::write(fd, data, length);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+/// A read-only mapping of a file, unmapped on destruction
+class mapping final
+{
+
+public:
+
+    mapping(const std::string& path, const size_t length)
+        : _data(nullptr)
+        , _length(length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        void* const addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (addr != MAP_FAILED)
+        {
+            ::madvise(addr, length, MADV_SEQUENTIAL);
+            _data = static_cast<const char*>(addr);
+        }
+    }
+
+    ~mapping()
+    {
+        if (_data)
+        {
+            ::munmap(const_cast<char*>(_data), _length);
+        }
+    }
+
+    mapping(const mapping&) = delete;
+    mapping& operator=(const mapping&) = delete;
+
+    const char* data() const { return _data; }
+
+    size_t size() const { return _length; }
+
+private:
+
+    const char* _data;
+    const size_t _length;
+};
+
+} // end anonymous namespace
+
+message_log::message_log(const config& conf)
+    : _config(conf)
+    , _nextOffset(0)
+    , _stop(false)
+    , _logFD(-1)
+    , _indexFD(-1)
+    , _sinceIndex(0)
+    , _opened(std::chrono::steady_clock::now())
+    , _appended(0)
+    , _appendedBytes(0)
+    , _commits(0)
+    , _fsyncLastNs(0)
+    , _fsyncMaxNs(0)
+    , _fsyncTotalNs(0)
+    , _rollovers(0)
+    , _durableOffset(0)
+{
+    if (_config.directory.empty())
+    {
+        throw std::runtime_error("message_log: no directory specified.");
+    }
+
+    if (::mkdir(_config.directory.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        fail("could not create " + _config.directory);
+    }
+
+    recover();
+
+    _committer = std::thread(&message_log::run, this);
+}
+
+message_log::~message_log()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mut_pending);
+        _stop = true;
+    }
+    _cv_pending.notify_one();
+
+    if (_committer.joinable())
+    {
+        _committer.join();
+    }
+
+    if (_logFD >= 0)
+    {
+        ::close(_logFD);
+    }
+    if (_indexFD >= 0)
+    {
+        ::close(_indexFD);
+    }
+}
+
+void message_log::recover()
+{
+    DIR* const dir = ::opendir(_config.directory.c_str());
+    if (!dir)
+    {
+        fail("could not open " + _config.directory);
+    }
+
+    std::vector<uint64_t> bases;
+    while (const dirent* const entry = ::readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name.size() == 24 && name.compare(20, 4, ".log") == 0
+            && name.find_first_not_of("0123456789") == 20)
+        {
+            bases.push_back(std::stoull(name.substr(0, 20)));
+        }
+    }
+    ::closedir(dir);
+
+    std::sort(bases.begin(), bases.end());
+
+    for (const uint64_t base : bases)
+    {
+        segment seg;
+        seg.base = base;
+        seg.path = segmentName(_config.directory, base, ".log");
+        seg.indexPath = segmentName(_config.directory, base, ".index");
+
+        struct stat st;
+        seg.size = (::stat(seg.path.c_str(), &st) == 0) ? st.st_size : 0;
+
+        const int indexFD = ::open(seg.indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (indexFD >= 0)
+        {
+            index_entry raw[512];
+            ssize_t n;
+            while ((n = ::read(indexFD, raw, sizeof(raw))) > 0)
+            {
+                seg.index.insert(seg.index.end(), raw, raw + n / sizeof(index_entry));
+            }
+            ::close(indexFD);
+        }
+
+        _segments.push_back(std::move(seg));
+    }
+
+    if (_segments.empty())
+    {
+        roll(0);
+        return;
+    }
+
+    // The active segment may end with a torn record, validate it fully and rebuild its index
+    segment& active = _segments.back();
+    active.index.clear();
+    _nextOffset = active.base;
+
+    uint64_t valid = 0;
+    {
+        const mapping map(active.path, active.size);
+        const char* const data = map.data();
+        const char* const end = data ? data + map.size() : data;
+
+        record rec;
+        size_t n;
+        while (data && (n = decodeRecord(data + valid, end, &rec)) > 0)
+        {
+            if (active.index.empty() || _sinceIndex >= _config.indexIntervalBytes)
+            {
+                active.index.push_back(index_entry{ static_cast<uint32_t>(rec.offset - active.base),
+                                                    static_cast<uint32_t>(valid) });
+                _sinceIndex = 0;
+            }
+
+            valid += n;
+            _sinceIndex += n;
+            _nextOffset = rec.offset + 1;
+        }
+    }
+
+    if (valid != active.size)
+    {
+        SE3313_LOG_WARN("message_log: truncating " << active.path << " from " << active.size
+                        << " to " << valid << " bytes.");
+        if (::truncate(active.path.c_str(), valid) < 0)
+        {
+            fail("could not truncate " + active.path);
+        }
+        active.size = valid;
+    }
+
+    _logFD = ::open(active.path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    _indexFD = ::open(active.indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_logFD < 0 || _indexFD < 0)
+    {
+        fail("could not open " + active.path);
+    }
+
+    if (!active.index.empty())
+    {
+        writeAll(_indexFD, reinterpret_cast<const char*>(active.index.data()), active.index.size() * sizeof(index_entry));
+    }
+
+    _durableOffset = _nextOffset;
+}
+
+void message_log::roll(const uint64_t base)
+{
+    if (_logFD >= 0)
+    {
+        ::close(_logFD);
+        ::close(_indexFD);
+    }
+
+    segment seg;
+    seg.base = base;
+    seg.path = segmentName(_config.directory, base, ".log");
+    seg.indexPath = segmentName(_config.directory, base, ".index");
+    seg.size = 0;
+
+    _logFD = ::open(seg.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    _indexFD = ::open(seg.indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_logFD < 0 || _indexFD < 0)
+    {
+        fail("could not create " + seg.path);
+    }
+    _sinceIndex = 0;
+
+    // make the new directory entry durable
+    const int dirFD = ::open(_config.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFD >= 0)
+    {
+        ::fsync(dirFD);
+        ::close(dirFD);
+    }
+
+    std::lock_guard<std::mutex> lock(_mut_segments);
+    _segments.push_back(std::move(seg));
+
+    while (_config.maxSegments > 0 && _segments.size() > _config.maxSegments)
+    {
+        ::unlink(_segments.front().path.c_str());
+        ::unlink(_segments.front().indexPath.c_str());
+        _segments.pop_front();
+    }
+}
+
+uint64_t message_log::append(const std::string& room, const std::string& frame)
+{
+    uint64_t offset;
+    size_t pending;
+    size_t bytes;
+    {
+        std::lock_guard<std::mutex> lock(_mut_pending);
+        if (!_error.empty())
+        {
+            throw std::runtime_error(_error);
+        }
+
+        offset = _nextOffset++;
+        const size_t position = _pending.size();
+        encodeRecord(&_pending, offset, room, frame);
+        _pendingBounds.emplace_back(offset, static_cast<uint32_t>(position));
+
+        pending = _pendingBounds.size();
+        bytes = _pending.size() - position;
+    }
+
+    _appended.fetch_add(1, std::memory_order_relaxed);
+    _appendedBytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    if (pending >= _config.syncMessages)
+    {
+        _cv_pending.notify_one();
+    }
+
+    return offset;
+}
+
+void message_log::run()
+{
+    std::string batch;
+    std::vector<std::pair<uint64_t, uint32_t>> bounds;
+
+    std::unique_lock<std::mutex> lock(_mut_pending);
+    while (true)
+    {
+        _cv_pending.wait_for(lock, _config.syncInterval,
+                             [this] { return _stop || _pendingBounds.size() >= _config.syncMessages; });
+
+        if (_pending.empty())
+        {
+            if (_stop)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // take the whole batch, appenders keep filling a fresh buffer while this one is written
+        batch.swap(_pending);
+        bounds.swap(_pendingBounds);
+        lock.unlock();
+
+        std::string error;
+        try
+        {
+            commit(batch, bounds);
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+        batch.clear();
+        bounds.clear();
+
+        lock.lock();
+        if (!error.empty())
+        {
+            // nothing after the lost batch may be written, the log would have a gap
+            SE3313_LOG_ERROR(error << ", " << _pendingBounds.size() << " more records dropped, the log stopped.");
+            _error = error;
+            _pending.clear();
+            _pendingBounds.clear();
+            break;
+        }
+    }
+}
+
+void message_log::commit(std::string& batch, std::vector<std::pair<uint64_t, uint32_t>>& bounds)
+{
+    BOOST_ASSERT(!bounds.empty());
+
+    uint64_t fileSize;
+    {
+        std::lock_guard<std::mutex> lock(_mut_segments);
+        fileSize = _segments.back().size;
+    }
+
+    if (fileSize > 0 && fileSize >= _config.segmentBytes)
+    {
+        roll(bounds.front().first);
+        _rollovers.fetch_add(1, std::memory_order_relaxed);
+        fileSize = 0;
+    }
+
+    uint64_t base;
+    std::string path;
+    off_t indexSize;
+    {
+        std::lock_guard<std::mutex> lock(_mut_segments);
+        base = _segments.back().base;
+        path = _segments.back().path;
+        indexSize = static_cast<off_t>(_segments.back().index.size() * sizeof(index_entry));
+    }
+
+    // sparse index entries for the records in this batch
+    std::vector<index_entry> entries;
+    uint64_t sinceIndex = _sinceIndex;
+    for (size_t i = 0; i < bounds.size(); ++i)
+    {
+        const uint64_t position = fileSize + bounds[i].second;
+        const uint64_t length = ((i + 1 < bounds.size()) ? bounds[i + 1].second : batch.size()) - bounds[i].second;
+
+        if ((fileSize == 0 && i == 0) || sinceIndex >= _config.indexIntervalBytes)
+        {
+            entries.push_back(index_entry{ static_cast<uint32_t>(bounds[i].first - base), static_cast<uint32_t>(position) });
+            sinceIndex = 0;
+        }
+        sinceIndex += length;
+    }
+
+    uint64_t syncNs = 0;
+    for (int attempt = 1; ; ++attempt)
+    {
+        if (writeAll(_logFD, batch.data(), batch.size())
+            && writeAll(_indexFD, reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(index_entry)))
+        {
+            const auto syncStart = std::chrono::steady_clock::now();
+            if (::fdatasync(_logFD) == 0)
+            {
+                syncNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - syncStart).count();
+                break;
+            }
+        }
+
+        const int err = errno;
+        SE3313_LOG_WARN("message_log: could not commit " << bounds.size() << " records to " << path
+                        << " (attempt " << attempt << " of " << COMMIT_ATTEMPTS << "), errno: " << err);
+
+        // Cut off whatever part of the batch reached the files, a torn record must not be followed by
+        // later ones. After a failed fdatasync() the written pages are in an unknown state, so the batch
+        // is written again rather than synced again.
+        if (::ftruncate(_logFD, static_cast<off_t>(fileSize)) < 0 || ::ftruncate(_indexFD, indexSize) < 0)
+        {
+            fail("could not truncate " + path + " back to its last commit");
+        }
+        if (attempt == COMMIT_ATTEMPTS)
+        {
+            errno = err;
+            fail("could not commit " + std::to_string(bounds.size()) + " records to " + path);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10 * attempt));
+    }
+    _sinceIndex = sinceIndex;
+
+    {
+        std::lock_guard<std::mutex> lock(_mut_segments);
+        segment& active = _segments.back();
+        active.size += batch.size();
+        active.index.insert(active.index.end(), entries.begin(), entries.end());
+    }
+
+    _durableOffset.store(bounds.back().first + 1, std::memory_order_release);
+    _commits.fetch_add(1, std::memory_order_relaxed);
+    _fsyncLastNs.store(syncNs, std::memory_order_relaxed);
+    _fsyncTotalNs.fetch_add(syncNs, std::memory_order_relaxed);
+    if (syncNs > _fsyncMaxNs.load(std::memory_order_relaxed))
+    {
+        _fsyncMaxNs.store(syncNs, std::memory_order_relaxed);
+    }
+}
+
+void message_log::scan(const uint64_t from, const std::function<bool(const record&)>& fn) const
+{
+    std::vector<segment> segments;
+    {
+        std::lock_guard<std::mutex> lock(_mut_segments);
+
+        // the last segment starting at or before `from` holds it
+        auto it = std::upper_bound(_segments.begin(), _segments.end(), from,
+                                   [](const uint64_t offset, const segment& seg) { return offset < seg.base; });
+        if (it != _segments.begin())
+        {
+            --it;
+        }
+        segments.assign(it, _segments.end());
+    }
+
+    for (const segment& seg : segments)
+    {
+        const mapping map(seg.path, seg.size);
+        if (!map.data())
+        {
+            continue;
+        }
+
+        // skip to the closest indexed record at or before `from`
+        uint64_t position = 0;
+        if (from > seg.base)
+        {
+            const auto entry = std::upper_bound(seg.index.begin(), seg.index.end(), from - seg.base,
+                                                [](const uint64_t rel, const index_entry& e) { return rel < e.relativeOffset; });
+            if (entry != seg.index.begin())
+            {
+                position = std::prev(entry)->position;
+            }
+        }
+
+        const char* const end = map.data() + map.size();
+        record rec;
+        size_t n;
+        while (position < map.size() && (n = decodeRecord(map.data() + position, end, &rec)) > 0)
+        {
+            position += n;
+
+            if (rec.offset >= from && !fn(rec))
+            {
+                return;
+            }
+        }
+    }
+}
+
+uint64_t message_log::firstOffset() const
+{
+    std::lock_guard<std::mutex> lock(_mut_segments);
+    return _segments.empty() ? 0 : _segments.front().base;
+}
+
+message_log::stats message_log::statistics() const
+{
+    stats s;
+
+    s.appended = _appended.load(std::memory_order_relaxed);
+    s.appendedBytes = _appendedBytes.load(std::memory_order_relaxed);
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _opened).count();
+    s.appendRate = seconds > 0 ? s.appended / seconds : 0;
+
+    s.commits = _commits.load(std::memory_order_relaxed);
+    s.fsyncLast = std::chrono::nanoseconds(_fsyncLastNs.load(std::memory_order_relaxed));
+    s.fsyncMax = std::chrono::nanoseconds(_fsyncMaxNs.load(std::memory_order_relaxed));
+    s.fsyncMean = std::chrono::nanoseconds(s.commits ? _fsyncTotalNs.load(std::memory_order_relaxed) / s.commits : 0);
+
+    s.rollovers = _rollovers.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(_mut_segments);
+        s.segments = _segments.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mut_pending);
+        s.nextOffset = _nextOffset;
+        s.error = _error;
+    }
+    s.durableOffset = _durableOffset.load(std::memory_order_acquire);
+
+    return s;
+}
@@ -0,0 +1,119 @@
+#include "room_history.hpp"
+
+#include <boost/assert.hpp>
+
+using namespace dzagar;
+
+room_history::room_history(const size_t maxMessages, const size_t maxBytes)
+    : _frames(maxMessages)
+    , _first(0)
+    , _count(0)
+    , _bytes(0)
+    , _maxBytes(maxBytes)
+{
+}
+
+void room_history::append(const std::string& frame)
+{
+    if (_frames.empty() || frame.size() > _maxBytes)
+    {
+        return;
+    }
+    
+    while (_count == _frames.size() || _bytes + frame.size() > _maxBytes)
+    {
+        evict();
+    }
+    
+    // assign into the existing slot so its capacity is reused
+    _frames[(_first + _count) % _frames.size()].assign(frame);
+    ++_count;
+    _bytes += frame.size();
+    
+    _page.reset();
+}
+
+std::shared_ptr<const std::string> room_history::page() const
+{
+    if (_count == 0)
+    {
+        return nullptr;
+    }
+    
+    if (!_page)
+    {
+        std::string buff;
+        buff.reserve(_bytes);
+        for (size_t i = 0; i < _count; ++i)
+        {
+            buff.append(_frames[(_first + i) % _frames.size()]);
+        }
+        
+        _page = std::make_shared<const std::string>(std::move(buff));
+    }
+    
+    return _page;
+}
+
+void room_history::evict()
+{
+    BOOST_ASSERT(_count > 0);
+    
+    std::string& oldest = _frames[_first];
+    _bytes -= oldest.size();
+    oldest.clear();
+    
+    _first = (_first + 1) % _frames.size();
+    --_count;
+}
+
+history_store::history_store(const size_t maxMessages, const size_t maxBytes, const size_t maxRooms)
+    : _maxMessages(maxMessages)
+    , _maxBytes(maxBytes)
+    , _maxRooms(maxRooms)
+{
+}
+
+void history_store::append(const std::string& room, const std::string& frame)
+{
+    // a frame no history would keep must not make room for an empty entry
+    if (_maxRooms == 0 || _maxMessages == 0 || frame.size() > _maxBytes)
+    {
+        return;
+    }
+    
+    auto it = _rooms.find(room);
+    if (it == _rooms.end())
+    {
+        if (_rooms.size() == _maxRooms)
+        {
+            _rooms.erase(_recency.back());
+            _recency.pop_back();
+        }
+        
+        _recency.push_front(room);
+        it = _rooms.emplace(room, entry{ room_history(_maxMessages, _maxBytes), _recency.begin() }).first;
+    }
+    else
+    {
+        _recency.splice(_recency.begin(), _recency, it->second.recency);
+    }
+    
+    it->second.history.append(frame);
+}
+
+std::shared_ptr<const std::string> history_store::page(const std::string& room) const
+{
+    const auto it = _rooms.find(room);
+    if (it == _rooms.end())
+    {
+        return nullptr;
+    }
+    
+    return it->second.history.page();
+}
+
+std::vector<std::string> history_store::rooms() const
+{
+    return std::vector<std::string>(_recency.rbegin(), _recency.rend());
+}
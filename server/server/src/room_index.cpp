@@ -0,0 +1,139 @@
+#include "room_index.hpp"
+
+#include <boost/assert.hpp>
+
+#include <algorithm>
+
+using namespace dzagar;
+
+bool room_index::join(const fd_t fd, const std::string& room)
+{
+    BOOST_ASSERT(fd >= 0);
+    
+    if (isMember(fd, room))
+    {
+        return false;
+    }
+    
+    if (static_cast<size_t>(fd) >= _bySession.size())
+    {
+        _bySession.resize(fd + 1);
+    }
+    
+    auto it = _rooms.find(room);
+    if (it == _rooms.end())
+    {
+        it = _rooms.emplace(room, room_t{ room, {} }).first;
+    }
+    
+    room_t& r = it->second;
+    std::vector<membership>& rooms = _bySession[fd];
+    
+    r.members.push_back(member{ fd, static_cast<uint32_t>(rooms.size()) });
+    rooms.push_back(membership{ &r, static_cast<uint32_t>(r.members.size() - 1) });
+    
+    return true;
+}
+
+bool room_index::leave(const fd_t fd, const std::string& room)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _bySession.size())
+    {
+        return false;
+    }
+    
+    const std::vector<membership>& rooms = _bySession[fd];
+    for (uint32_t slot = 0; slot < rooms.size(); ++slot)
+    {
+        if (rooms[slot].room->name == room)
+        {
+            remove(fd, slot);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void room_index::leaveAll(const fd_t fd)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _bySession.size())
+    {
+        return;
+    }
+    
+    while (!_bySession[fd].empty())
+    {
+        remove(fd, static_cast<uint32_t>(_bySession[fd].size() - 1));
+    }
+    
+    _bySession[fd].shrink_to_fit();
+}
+
+bool room_index::isMember(const fd_t fd, const std::string& room) const
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _bySession.size())
+    {
+        return false;
+    }
+    
+    // sessions belong to a handful of rooms, a scan beats hashing here
+    const std::vector<membership>& rooms = _bySession[fd];
+    return std::any_of(rooms.begin(), rooms.end(), 
+                       [&room](const membership& m) { return m.room->name == room; });
+}
+
+std::vector<std::string> room_index::roomsOf(const fd_t fd) const
+{
+    std::vector<std::string> names;
+    if (fd >= 0 && static_cast<size_t>(fd) < _bySession.size())
+    {
+        for (const membership& m : _bySession[fd])
+        {
+            names.push_back(m.room->name);
+        }
+    }
+    
+    return names;
+}
+
+const std::vector<room_index::member>* room_index::members(const std::string& room) const
+{
+    const auto it = _rooms.find(room);
+    if (it == _rooms.end())
+    {
+        return nullptr;
+    }
+    
+    return &it->second.members;
+}
+
+void room_index::remove(const fd_t fd, const uint32_t slot)
+{
+    std::vector<membership>& rooms = _bySession[fd];
+    BOOST_ASSERT(slot < rooms.size());
+    
+    room_t* const r = rooms[slot].room;
+    const uint32_t index = rooms[slot].index;
+    
+    // swap-remove from the room's members, fixing the back-pointer of the moved member
+    const member moved = r->members.back();
+    r->members[index] = moved;
+    _bySession[moved.fd][moved.slot].index = index;
+    r->members.pop_back();
+    
+    // swap-remove from the session's rooms, fixing the back-pointer in the moved room
+    if (slot + 1 < rooms.size())
+    {
+        const membership movedRoom = rooms.back();
+        rooms[slot] = movedRoom;
+        movedRoom.room->members[movedRoom.index].slot = slot;
+    }
+    rooms.pop_back();
+    
+    if (r->members.empty())
+    {
+        const std::string name = r->name;
+        _rooms.erase(name);
+    }
+}
@@ -6,23 +6,34 @@
 #include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <fstream>
 #include <mutex>
+#include <sstream>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <unistd.h>
+
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <logging/log.hpp>
+#include <metrics/registry.hpp>
+#include <tracing/trace.hpp>
+
 #include <networking/socket.hpp>
 #include <networking/socket_server.hpp>
 
 #include <msg/visitor.hpp>
 #include <msg/error.hpp>
 #include <msg/login.hpp>
+#include <msg/flow.hpp>
 #include <msg/json.hpp>
+#include <msg/room.hpp>
 
 #include "server.hpp"
+#include "alloc_counter.hpp"
 
 using namespace dzagar;
 
@@ -32,98 +43,1084 @@ namespace net = se3313::networking;
 
 namespace pt  = boost::property_tree;
 
+namespace
+{
+
+using se3313::metrics::registry;
+
+const se3313::metrics::counter g_accepted = registry::makeCounter("chat_connections_accepted_total", "Connections accepted");
+const se3313::metrics::gauge g_sessions = registry::makeGauge("chat_sessions", "Open sessions");
+const se3313::metrics::gauge g_loggedIn = registry::makeGauge("chat_logged_in_sessions", "Sessions that logged in");
+const se3313::metrics::counter g_requests = registry::makeCounter("chat_requests_total", "Requests handed to the workers");
+const se3313::metrics::histogram g_requestBytes = registry::makeHistogram("chat_request_bytes", "Size of requests", registry::exponentialBounds(64, 4, 6));
+const se3313::metrics::counter g_rateLimited = registry::makeCounter("chat_requests_rate_limited_total", "Requests over their session's rate limit");
+const se3313::metrics::counter g_responses = registry::makeCounter("chat_responses_total", "Responses delivered");
+const se3313::metrics::counter g_roomMessages = registry::makeCounter("chat_room_messages_total", "Messages sent to rooms");
+const se3313::metrics::counter g_fanOut = registry::makeCounter("chat_fanout_writes_total", "Room frames addressed to members");
+const se3313::metrics::gauge g_egressBytes = registry::makeGauge("chat_egress_queued_bytes", "Output buffered for sessions");
+const se3313::metrics::counter g_slowConsumers = registry::makeCounter("chat_slow_consumers_total", "Sessions that went past their high-water mark");
+const se3313::metrics::counter g_egressDropped = registry::makeCounter("chat_egress_dropped_frames_total", "Room frames skipped for slow sessions");
+const se3313::metrics::gauge g_overloaded = registry::makeGauge("chat_backpressure_active", "1 while the heaviest producers are paused");
+const se3313::metrics::counter g_backpressurePauses = registry::makeCounter("chat_backpressure_pauses_total", "Sessions paused as heavy producers");
+
+} // end anonymous namespace
+
 server::~server()
 {
-    std::cout << "Stopping the server.";
+    SE3313_LOG_INFO("Stopping the server.");
 }
 
 void server::start()
 {
-    std::cout << "Starting server on port: " << _serverPort << std::endl;
-    net::socket_server sockServ(_serverPort);
-    std::shared_ptr<net::socket_server> sockServPtr = std::make_shared<net::socket_server>(sockServ);
+  upgrade::state inherited;
+  std::vector<int> inheritedFDs;
+  if (_config.takeover){
+    SE3313_LOG_INFO("Taking over from the server at " << _config.upgradeSocket);
+    const int channel = upgrade::request(_config.upgradeSocket);
+    int listenFD;
+    try {
+      inherited = upgrade::receive(channel, &listenFD, &inheritedFDs);
+    }
+    catch (...){
+      ::close(channel);
+      throw;
+    }
+    ::close(channel);
+    _master = std::make_shared<net::socket_server>(listenFD);
+  }
+  else {
+    SE3313_LOG_INFO("Starting server on port: " << _serverPort);
+    _master = std::make_shared<net::socket_server>(_serverPort);
+  }
+  
+  // histories came with the hand over, the previous process closed the log before sending them
+  if (!_config.log.directory.empty()){
+    openLog(!_config.takeover);
+  }
+
+  if (!_config.capture.empty()){
+    _capture.reset(new traffic_capture(_config.capture));
+    SE3313_LOG_INFO("Capturing requests to " << _config.capture);
+  }
 
-    _flexinWaiter = std::shared_ptr<net::flex_waiter>(new net::flex_waiter(sockServPtr));
+  if (_config.metricsPort != 0){
+    _metricsExporter.reset(new se3313::metrics::http_exporter(_config.metricsPort));
+    SE3313_LOG_INFO("Serving metrics on 127.0.0.1:" << _config.metricsPort << "/metrics");
+  }
+
+    _flexinWaiter = std::shared_ptr<net::flex_waiter>(new net::flex_waiter(_master));
+    _flexinWaiter->watchSTDIN(_config.stdinCommands);
+    _flexinWaiter->supervise(_config.watchdog);
+    _workers.reset(new worker_pool(_config.workers));
+  if (_config.takeover){
+    adopt(inherited, inheritedFDs);
+  }
+  if (!_config.upgradeSocket.empty()){
+    _upgradeListener = upgrade::listen(_config.upgradeSocket);
+    _flexinWaiter->watch(_upgradeListener, [this](){ handOff(); });
+  }
     _inActivity = true;
     while(_inActivity){
-      _flexinWaiter->wait(this->shared_from_this(), std::chrono::seconds(1)); //random timeout
+      _flexinWaiter->wait(this->shared_from_this(), nextTimeout());
+      resumeThrottled();
+      applyBackpressure();
     }
+    _workers.reset();
 }
 
 void server::stop()
 {
-    
+    // the sessions belong to the I/O thread, they are closed there
+    _flexinWaiter->post([this](){ shutDown(); });
+}
+
+void server::shutDown(){
+  // a hand over still waiting for the workers is abandoned, the new process sees the channel close
+  if (_handOffChannel >= 0){
+    ::close(_handOffChannel);
+    _handOffChannel = -1;
+  }
+  while (_sessions.size() > 0){
+    removeSocketConnection(_sessions.find(_sessions.fds().back())->socket);
+  }
+  _capture.reset();
+  _profiler.reset();
+  _inActivity = false;
 }
 
 void server::onSocketServer(const std::shared_ptr<net::socket_server> socksrv){
-  std::cout << "Server - onSocketServer Called" << std::endl;
+  SE3313_LOG_TRACE("Server - onSocketServer Called");
+  g_accepted.inc();
   addSocketConnection(socksrv->accept());
 }
     
 void server::onSocket(const net::flex_waiter::socket_ptr_t sockPtr){
-  std::cout << "Server - onSocket Called" << std::endl;
+  SE3313_LOG_TRACE("Server - onSocket Called, fd " << sockPtr->fd());
+  alloc::scope marker(stage::RECV);
   std::string readSock;
+  const stage::time_point readStart = stage::now();
   int successful = sockPtr->read(&readSock);
   if (successful > 0){
-    std::cout<<"Read socket successfully"<<std::endl;
-    pt::ptree json = msg::json::from(readSock);
-    pt::write_json(std::cout, json, true);
-
-    std::shared_ptr<msg::instance> incomingMessage = visit(json);
-    std::cout<< msg::json::to(incomingMessage->toJson(), true) << std::endl;
-    for (int i = 0; i < _socketList.size(); i++){
-      _socketList[i]->write(msg::json::to(incomingMessage->toJson()));
+    stage::record(stage::RECV, readStart, stage::now());
+    session* const s = _sessions.find(sockPtr->fd());
+    if (!s){
+      return;
+    }
+    
+    // requests are newline terminated and may arrive split or several to a read
+    s->inbound.append(readSock);
+    drainInbound(sockPtr, s);
+    
+    if (sockPtr->isOpen() && !s->paused && s->inbound.size() > _config.maxFrameBytes){
+      sendTo(sockPtr, std::make_shared<const std::string>(msg::json::to(msg::response::error(msg::instance::SERVER_SENDER, msg::ErrorCode::MALFORMED_REQUEST_UNKNWN, "Request too long.").toJson())));
+      removeSocketConnection(sockPtr);
     }
     return;
   }
   else if (successful == 0){
     removeSocketConnection(sockPtr);
-    std::cout<< "Client has disconnected from server." << std::endl;
+    SE3313_LOG_DEBUG("Client has disconnected from server.");
+    return;
+  }
+  else if (sockPtr->isOpen()){
+    // nothing to read after all, the socket is non-blocking
     return;
   }
   else {	//something bad happened :(
-    std::cout<< "Server error" << std::endl;
+    removeSocketConnection(sockPtr);
+    SE3313_LOG_WARN("Server error");
+  }
+}
+
+void server::drainInbound(const std::shared_ptr<net::socket>& sock, session* const s){
+  alloc::scope marker(stage::FRAME);
+  std::string& inbound = s->inbound;
+  const stage::time_point framed = stage::now();
+  const token_bucket::clock_t::time_point now = token_bucket::clock_t::now();
+  size_t start = 0;
+  size_t end;
+  while (!s->paused && (end = inbound.find('\n', start)) != std::string::npos){
+    const size_t length = end + 1 - start;
+    if (length == 1){
+      ++start;
+      continue;
+    }
+    
+    // limits are checked on the raw frame, before anything is spent decoding it
+    if (!s->messageBucket.ready(1, now) || !s->byteBucket.ready(length, now)){
+      ++_ingress.limited;
+      g_rateLimited.inc();
+      if (_config.ingress.onViolation == rate_limit_config::policy::DROP){
+        ++_ingress.dropped;
+        start = end + 1;
+        continue;
+      }
+      else if (_config.ingress.onViolation == rate_limit_config::policy::DISCONNECT){
+        ++_ingress.disconnects;
+        pauseReads(sock, s, session::RATE_LIMITED);
+        inbound.clear();
+        
+        // queued behind the sender's earlier requests so those are still answered
+        _workers->submit(static_cast<size_t>(sock->fd()), [this, sock](){
+          const auto disconnect = [this, sock](){
+            sendTo(sock, std::make_shared<const std::string>(msg::json::to(msg::response::error(msg::instance::SERVER_SENDER, msg::ErrorCode::RATE_LIMITED, "Sending too fast.").toJson())));
+            if (sock->isOpen()){
+              removeSocketConnection(sock);
+            }
+          };
+          if (_config.workers == 0){
+            disconnect();
+          }
+          else {
+            _flexinWaiter->post(disconnect);
+          }
+        });
+        return;
+      }
+      
+      // the request stays buffered and is retried once the buckets have refilled
+      ++_ingress.pauses;
+      _throttled.emplace_back(now + std::max(s->messageBucket.until(1), s->byteBucket.until(length)), sock);
+      pauseReads(sock, s, session::RATE_LIMITED);
+      break;
+    }
+    
+    s->messageBucket.take(1);
+    s->byteBucket.take(length);
+    recordIngress(s, length);
+    if (_capture){
+      _capture->frame(sock->fd(), inbound.data() + start, length - 1);
+    }
+    g_requests.inc();
+    g_requestBytes.observe(static_cast<double>(length));
+    onFrame(sock, inbound.substr(start, length - 1), framed, se3313::tracing::sample());
+    
+    // without workers the request is answered inline, which can tear the session down
+    if (!sock->isOpen()){
+      return;
+    }
+    start = end + 1;
+  }
+  inbound.erase(0, start);
+}
+
+void server::pauseReads(const std::shared_ptr<net::socket>& sock, session* const s, const session::pause_reason reason){
+  if (!s->paused){
+    _flexinWaiter->pauseSocket(sock);
   }
+  s->paused |= reason;
+}
+
+void server::resumeReads(const std::shared_ptr<net::socket>& sock, session* const s, const session::pause_reason reason){
+  s->paused &= ~reason;
+  if (!s->paused){
+    drainInbound(sock, s);
+  }
+  
+  // draining may have paused the session again
+  if (sock->isOpen() && !s->paused){
+    _flexinWaiter->resumeSocket(sock);
+  }
+}
+
+void server::resumeThrottled(){
+  const token_bucket::clock_t::time_point now = token_bucket::clock_t::now();
+  for (size_t i = 0; i < _throttled.size(); ){
+    if (_throttled[i].first > now){
+      ++i;
+      continue;
+    }
+    
+    const std::shared_ptr<net::socket> sock = _throttled[i].second;
+    _throttled[i] = _throttled.back();
+    _throttled.pop_back();
+    
+    session* const s = _sessions.find(sock->fd());
+    if (s && s->socket == sock){
+      resumeReads(sock, s, session::RATE_LIMITED);
+    }
+  }
+}
+
+void server::recordIngress(session* const s, const size_t bytes){
+  s->ingressBytes = recentIngress(s) + bytes;
+  s->ingressEpoch = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - _started).count());
+}
+
+uint64_t server::recentIngress(const session* const s) const{
+  const uint32_t epoch = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - _started).count());
+  const uint32_t halvings = epoch - s->ingressEpoch;
+  return halvings >= 64 ? 0 : s->ingressBytes >> halvings;
+}
+
+void server::applyBackpressure(){
+  const backpressure_config& bp = _config.backpressure;
+  const size_t pending = _workers->pending();
+  const bool over = (bp.highPendingRequests && pending > bp.highPendingRequests)
+                 || (bp.highEgressBytes && _egressBytes > bp.highEgressBytes);
+  const bool under = (!bp.highPendingRequests || pending <= bp.lowPendingRequests)
+                  && (!bp.highEgressBytes || _egressBytes <= bp.lowEgressBytes);
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  
+  if (!_overloaded && over){
+    _overloaded = true;
+    ++_backpressure.episodes;
+    g_overloaded.inc();
+    _lastRanking = now;
+    pauseHeaviestProducers();
+  }
+  else if (_overloaded && under){
+    _overloaded = false;
+    g_overloaded.dec();
+    const std::shared_ptr<const std::string> resume = std::make_shared<const std::string>(
+        msg::json::to(msg::response::flow_control(msg::response::flow_control::ACTION_RESUME).toJson()));
+    
+    std::vector<std::shared_ptr<net::socket>> paused;
+    paused.swap(_backpressured);
+    
+    // read under the lock, flowControl is set by the workers
+    std::vector<bool> flowControl(paused.size(), false);
+    {
+      std::lock_guard<std::mutex> lock(_mut_state);
+      for (size_t i = 0; i < paused.size(); ++i){
+        const session* const s = _sessions.find(paused[i]->fd());
+        flowControl[i] = s && s->socket == paused[i] && s->flowControl;
+      }
+    }
+    
+    for (size_t i = 0; i < paused.size(); ++i){
+      const std::shared_ptr<net::socket>& sock = paused[i];
+      session* const s = _sessions.find(sock->fd());
+      if (!s || s->socket != sock){
+        continue;
+      }
+      
+      if (flowControl[i] && bp.notifyClients){
+        sendTo(sock, resume);
+      }
+      if (sock->isOpen()){
+        resumeReads(sock, s, session::BACKPRESSURE);
+      }
+    }
+  }
+  else if (_overloaded && now - _lastRanking >= std::chrono::milliseconds(100)){
+    // producers that were light when the overload started may have picked up
+    _lastRanking = now;
+    pauseHeaviestProducers();
+  }
+}
+
+void server::pauseHeaviestProducers(){
+  // rank under the lock, flowControl is set by the workers
+  std::vector<std::pair<std::shared_ptr<net::socket>, bool>> heaviest;
+  {
+    std::lock_guard<std::mutex> lock(_mut_state);
+    uint64_t total = 0;
+    size_t producers = 0;
+    for (const session_table::fd_t fd : _sessions.fds()){
+      const uint64_t recent = recentIngress(_sessions.find(fd));
+      total += recent;
+      producers += recent > 0;
+    }
+    if (producers == 0){
+      return;
+    }
+    
+    const uint64_t fairShare = total / producers;
+    for (const session_table::fd_t fd : _sessions.fds()){
+      const session* const s = _sessions.find(fd);
+      const uint64_t recent = recentIngress(s);
+      if (recent > 0 && recent >= fairShare && !(s->paused & session::BACKPRESSURE)){
+        heaviest.emplace_back(s->socket, s->flowControl);
+      }
+    }
+  }
+  
+  const std::shared_ptr<const std::string> pause = std::make_shared<const std::string>(
+      msg::json::to(msg::response::flow_control(msg::response::flow_control::ACTION_PAUSE).toJson()));
+  for (const auto& h : heaviest){
+    const std::shared_ptr<net::socket>& sock = h.first;
+    session* const s = _sessions.find(sock->fd());
+    if (!s || s->socket != sock){
+      continue;
+    }
+    
+    ++_backpressure.pauses;
+    g_backpressurePauses.inc();
+    _backpressured.push_back(sock);
+    pauseReads(sock, s, session::BACKPRESSURE);
+    if (h.second && _config.backpressure.notifyClients){
+      sendTo(sock, pause);
+    }
+  }
+}
+
+std::chrono::milliseconds server::nextTimeout() const{
+  std::chrono::milliseconds timeout = std::chrono::seconds(1);
+  const token_bucket::clock_t::time_point now = token_bucket::clock_t::now();
+  for (const auto& t : _throttled){
+    // round up so the bucket has refilled when the loop wakes
+    const auto due = std::chrono::duration_cast<std::chrono::milliseconds>(t.first - now) + std::chrono::milliseconds(1);
+    timeout = std::min(timeout, std::max(due, std::chrono::milliseconds(0)));
+  }
+  return timeout;
+}
+
+void server::onFrame(const std::shared_ptr<net::socket>& sock, std::string frame, const stage::time_point framed, const uint64_t trace){
+  const stage::time_point submitted = stage::now();
+  stage::record(stage::FRAME, framed, submitted);
+  const int64_t queued = se3313::tracing::now(trace);
+  
+  // hashing on the descriptor keeps each sender's requests in order
+  _workers->submit(static_cast<size_t>(sock->fd()), [this, sock, frame, submitted, trace, queued](){
+    se3313::tracing::span(trace, "queue", queued, sock->fd());
+    
+    // process() charges its own stages, the outcome and its hand over belong to the delivery
+    alloc::scope marker(stage::ENQUEUE);
+    std::shared_ptr<outcome> out = std::make_shared<outcome>(process(sock, frame, submitted, trace));
+
+    // not _workers, the pool is already unreachable while it finishes the last tasks on shutdown
+    if (_config.workers == 0){
+      deliver(*out);
+    }
+    else {
+      _flexinWaiter->post([this, out](){ deliver(*out); });
+    }
+  });
+}
+
+server::outcome server::process(const std::shared_ptr<net::socket>& sock, const std::string& frame, const stage::time_point submitted, const uint64_t trace){
+  alloc::scope marker(stage::PARSE);
+  outcome out;
+  out.origin = sock;
+  out.type = nullptr;
+  out.route.toSender = true;
+  out.route.record = false;
+  out.trace = trace;
+  out.traced = se3313::tracing::now(trace);
+  
+  pt::ptree json;
+  try {
+    json = msg::json::from(frame);
+  }
+  catch (const pt::json_parser_error& err){
+    out.type = msg::response::error::TYPE;
+    out.frame = std::make_shared<const std::string>(msg::json::to(msg::response::error(msg::instance::UNKNOWN_SENDER, msg::ErrorCode::MALFORMED_REQUEST_UNKNWN, err.what()).toJson()));
+    out.encoded = stage::now();
+    out.traced = se3313::tracing::span(trace, "decode", out.traced, sock->fd(), frame.size());
+    return out;
+  }
+  const stage::time_point parsed = stage::now();
+  stage::record(stage::PARSE, submitted, parsed);
+  out.traced = se3313::tracing::span(trace, "decode", out.traced, sock->fd(), frame.size());
+  
+  std::shared_ptr<msg::instance> response;
+  marker.enter(stage::VISIT);
+  {
+    std::lock_guard<std::mutex> lock(_mut_state);
+    
+    // the connection may have closed, and its descriptor been reused, while the request was queued
+    const session* const s = _sessions.find(sock->fd());
+    if (!s || s->socket != sock){
+      return out;
+    }
+    
+    // unless a visit says otherwise the response (usually an error) only goes back to the sender
+    _currentFD = sock->fd();
+    _delivery.toSender = true;
+    _delivery.recipient.reset();
+    _delivery.room.clear();
+    _delivery.record = false;
+    _delivery.replay.clear();
+    response = visit(json);
+    _currentFD = -1;
+    out.route = _delivery;
+  }
+  const stage::time_point visited = stage::now();
+  stage::record(stage::VISIT, parsed, visited);
+  out.traced = se3313::tracing::span(trace, "visit", out.traced, sock->fd());
+  
+  marker.enter(stage::ENCODE);
+  out.type = response->type();
+  out.frame = std::make_shared<const std::string>(msg::json::to(response->toJson()));
+  out.encoded = stage::now();
+  stage::record(stage::ENCODE, visited, out.encoded);
+  out.traced = se3313::tracing::span(trace, "encode", out.traced, sock->fd(), out.frame->size());
+  return out;
+}
+
+void server::deliver(const outcome& out){
+  if (!out.frame){
+    return;
+  }
+  alloc::scope marker(stage::ENQUEUE);
+  net::loop_watchdog::annotate(out.type);
+  g_responses.inc();
+  
+  // the wait for the I/O thread, sends below pick the trace up from _tracing
+  _tracing = out.trace;
+  const int64_t delivering = se3313::tracing::span(out.trace, "post", out.traced);
+  
+  if (out.route.toSender){
+    sendTo(out.origin, out.frame);
+  }
+  if (out.route.recipient){
+    sendTo(out.route.recipient, out.frame);
+  }
+  if (!out.route.room.empty()){
+    fanOut(out.route.room, out.frame);
+    if (out.route.record){
+      _history.append(out.route.room, *out.frame);
+      g_roomMessages.inc();
+      if (_log){
+        try {
+          _log->append(out.route.room, *out.frame);
+        }
+        catch (const std::runtime_error& e){
+          // the log stopped on a disk error, rooms keep working from memory
+          SE3313_LOG_ERROR(e.what() << ", messages are no longer logged.");
+          _log.reset();
+        }
+      }
+    }
+  }
+  if (!out.route.replay.empty()){
+    // the whole history goes out in one write, the page is shared by every replay until the next message
+    const std::shared_ptr<const std::string> page = _history.page(out.route.replay);
+    if (page){
+      sendTo(out.origin, page);
+    }
+  }
+  stage::record(stage::ENQUEUE, out.encoded, stage::now());
+  se3313::tracing::span(out.trace, "deliver", delivering);
+  _tracing = 0;
 }
     
 void server::onSTDIN(const std::string& line){
-  std::cout << "Server onSTDIN Called" << std::endl;
+  SE3313_LOG_TRACE("Server onSTDIN Called");
   if(line.compare("exit") == 0){
-    for (int i = 0; i < _socketList.size(); i++){
-      removeSocketConnection(_socketList[i]);
+    shutDown();
+  }
+  else if(line.compare("metrics") == 0){
+    std::cout << se3313::metrics::registry::exposition() << std::flush;
+  }
+  else if(line.compare("latency") == 0){
+    stage::report(std::cout);
+  }
+  else if(line.compare("allocs") == 0){
+    alloc::report(std::cout, g_requests.value());
+  }
+  else if(line.compare(0, 6, "trace ") == 0){
+    const std::string path = line.substr(6);
+    std::ofstream file(path, std::ios::trunc);
+    file << se3313::tracing::exportChrome();
+    if (file.flush()){
+      std::cout << "Trace written to " << path << std::endl;
+    }
+    else {
+      std::cout << "Could not write the trace to " << path << std::endl;
+    }
+  }
+  else if(line.compare("capture off") == 0){
+    if (_capture){
+      std::cout << "Captured " << _capture->frames() << " requests from " << _capture->connections() << " connections to " << _capture->path() << std::endl;
+      _capture.reset();
+    }
+  }
+  else if(line.compare(0, 8, "capture ") == 0){
+    try {
+      _capture.reset();
+      _capture.reset(new traffic_capture(line.substr(8)));
+      std::cout << "Capturing requests to " << _capture->path() << std::endl;
+    }
+    catch (const std::runtime_error& err){
+      std::cout << err.what() << std::endl;
+    }
+  }
+  else if(line.compare(0, 8, "profile ") == 0){
+    // profile SECONDS PATH, written once the seconds are up
+    std::istringstream args(line.substr(8));
+    long seconds = 0;
+    std::string path;
+    if (!(args >> seconds >> path)){
+      std::cout << "Usage: profile SECONDS PATH" << std::endl;
+    }
+    else if (_profiler && !_profiler->done()){
+      std::cout << "A profile is still being written to " << _profiler->path() << std::endl;
+    }
+    else {
+      try {
+        _profiler.reset();
+        _profiler.reset(new cpu_profiler(path, std::chrono::seconds(seconds)));
+        std::cout << "Profiling for " << seconds << " s to " << path << std::endl;
+      }
+      catch (const std::runtime_error& err){
+        std::cout << err.what() << std::endl;
+      }
+    }
+  }
+  else if(line.compare("stats") == 0){
+    {
+      std::lock_guard<std::mutex> lock(_mut_state);
+      std::cout << "Sessions: " << _sessions.size() << " (" << _sessions.loggedIn() << " logged in), rooms: " << _rooms.size() << std::endl;
+    }
+    std::cout << "Workers: " << _workers->size() << " (" << _workers->pending() << " requests pending)" << std::endl;
+    std::cout << "Ingress: " << _ingress.limited << " requests over limit (" << _ingress.dropped << " dropped, "
+              << _ingress.pauses << " pauses, " << _ingress.disconnects << " disconnects), "
+              << _throttled.size() << " sessions throttled" << std::endl;
+    std::cout << "Backpressure: " << (_overloaded ? "on" : "off") << ", " << _backpressure.episodes << " episodes, "
+              << _backpressure.pauses << " producers paused, " << _backpressured.size() << " paused now" << std::endl;
+    std::cout << "Egress: " << _egressBytes << " bytes queued (peak " << _egress.peakBytes << "), " 
+              << _egress.slowConsumers << " slow consumers, " << _egress.dropped << " frames dropped, "
+              << _egress.resyncs << " resyncs, " << _egress.disconnects << " disconnects" << std::endl;
+    if (_log){
+      const message_log::stats st = _log->statistics();
+      std::cout << "Log: " << st.appended << " records (" << st.appendedBytes << " bytes, " << st.appendRate << "/s), "
+                << st.commits << " commits, fsync last/mean/max: "
+                << st.fsyncLast.count() / 1000 << "/" << st.fsyncMean.count() / 1000 << "/" << st.fsyncMax.count() / 1000 << " us, "
+                << st.rollovers << " rollovers, " << st.segments << " segments, offsets next/durable: "
+                << st.nextOffset << "/" << st.durableOffset << std::endl;
+    }
+  }
+}
+
+void server::openLog(const bool restoreHistory){
+  _log.reset(new message_log(_config.log));
+  if (!restoreHistory){
+    return;
+  }
+  
+  // only the tail can still be in any room's history
+  const message_log::stats st = _log->statistics();
+  const uint64_t tail = _config.historyMessages * _config.historyRooms;
+  const uint64_t from = std::max(_log->firstOffset(), st.nextOffset > tail ? st.nextOffset - tail : 0);
+  
+  size_t restored = 0;
+  _log->scan(from, [this, &restored](const message_log::record& rec){
+    _history.append(rec.room.to_string(), rec.frame.to_string());
+    ++restored;
+    return true;
+  });
+  SE3313_LOG_INFO("Restored " << restored << " messages from " << _config.log.directory);
+}
+
+void server::adopt(const upgrade::state& st, const std::vector<int>& fds){
+  std::vector<std::shared_ptr<net::socket>> adopted;
+  for (size_t i = 0; i < fds.size(); ++i){
+    const std::shared_ptr<net::socket> sock = std::make_shared<net::socket>(fds[i]);
+    const upgrade::session_state& in = st.sessions[i];
+    addSocketConnection(sock);
+    {
+      std::lock_guard<std::mutex> lock(_mut_state);
+      session* const s = _sessions.find(sock->fd());
+      if (!in.username.empty() && _sessions.login(sock->fd(), in.username) == session_table::login_result::OK){
+        g_loggedIn.inc();
+      }
+      for (const std::string& room : in.rooms){
+        _rooms.join(sock->fd(), room);
+      }
+      s->inbound = in.inbound;
+      s->flowControl = in.flowControl;
+    }
+    if (!in.outbound.empty()){
+      sendTo(sock, std::make_shared<const std::string>(in.outbound));
+    }
+    adopted.push_back(sock);
+  }
+  
+  // pages are newline terminated frames, appended back one by one so the limits still apply
+  for (const auto& h : st.history){
+    size_t start = 0;
+    size_t end;
+    while ((end = h.second.find('\n', start)) != std::string::npos){
+      _history.append(h.first, h.second.substr(start, end + 1 - start));
+      start = end + 1;
+    }
+  }
+  
+  // every session is back before requests that were left buffered are answered, they may address each other
+  for (const std::shared_ptr<net::socket>& sock : adopted){
+    session* const s = _sessions.find(sock->fd());
+    if (sock->isOpen() && s && s->socket == sock){
+      drainInbound(sock, s);
+    }
+  }
+  SE3313_LOG_INFO("Took over " << adopted.size() << " sessions and " << st.history.size() << " room histories");
+}
+
+void server::handOff(){
+  int channel;
+  try {
+    channel = upgrade::accept(_upgradeListener);
+  }
+  catch (const std::runtime_error& err){
+    SE3313_LOG_WARN(err.what());
+    return;
+  }
+  if (_handOffChannel >= 0){
+    ::close(channel);
+    SE3313_LOG_WARN("Already handing over, turned another new process away");
+    return;
+  }
+  _handOffChannel = channel;
+  SE3313_LOG_INFO("Handing over to a new process");
+  
+  // Requests already admitted are answered here, so what they changed is part of the state. Nothing new
+  // is let in meanwhile, what clients send waits in their sockets for the new process.
+  _flexinWaiter->setServer(nullptr);
+  for (const session_table::fd_t fd : _sessions.fds()){
+    session* const s = _sessions.find(fd);
+    pauseReads(s->socket, s, session::HANDOFF);
+  }
+  
+  // the workers post their last answers before the marker, so they are delivered by the time it runs
+  _workers->drain([this](){
+    _flexinWaiter->post([this](){ finishHandOff(); });
+  });
+}
+
+void server::finishHandOff(){
+  const int channel = _handOffChannel;
+  if (channel < 0){
+    return;
+  }
+  _handOffChannel = -1;
+  
+  // commits what is pending, the new process opens the log after us
+  _log.reset();
+  
+  upgrade::state st;
+  std::vector<int> fds;
+  {
+    std::lock_guard<std::mutex> lock(_mut_state);
+    st.sessions.reserve(_sessions.size());
+    for (const session_table::fd_t fd : _sessions.fds()){
+      const session* const s = _sessions.find(fd);
+      upgrade::session_state out;
+      out.username = s->username;
+      out.rooms = _rooms.roomsOf(fd);
+      out.inbound = s->inbound;
+      for (size_t i = 0; s->outbound && i < s->outbound->size(); ++i){
+        out.outbound.append(*(*s->outbound)[i].frame, i == 0 ? s->outboundOffset : 0, std::string::npos);
+      }
+      out.flowControl = s->flowControl;
+      st.sessions.push_back(std::move(out));
+      fds.push_back(fd);
+    }
+  }
+  for (const std::string& room : _history.rooms()){
+    if (const std::shared_ptr<const std::string> page = _history.page(room)){
+      st.history.emplace_back(room, *page);
+    }
+  }
+  
+  // blocks the loop until the new process acknowledges, the output taken above must not be written meanwhile
+  try {
+    upgrade::send(channel, _master->fd(), fds, st);
+  }
+  catch (const std::runtime_error& err){
+    ::close(channel);
+    SE3313_LOG_ERROR(err.what() << ", carrying on");
+    if (!_config.log.directory.empty()){
+      openLog(false);
+    }
+    _flexinWaiter->setServer(_master);
+    std::vector<std::shared_ptr<net::socket>> paused;
+    for (const session_table::fd_t fd : _sessions.fds()){
+      paused.push_back(_sessions.find(fd)->socket);
+    }
+    for (const std::shared_ptr<net::socket>& sock : paused){
+      session* const s = _sessions.find(sock->fd());
+      if (s && s->socket == sock){
+        resumeReads(sock, s, session::HANDOFF);
+      }
+    }
+    return;
+  }
+  ::close(channel);
+  
+  // the new process holds the connections now, closing our copies does not end them
+  while (_sessions.size() > 0){
+    removeSocketConnection(_sessions.find(_sessions.fds().back())->socket);
+  }
+  _flexinWaiter->unwatch(_upgradeListener);
+  ::close(_upgradeListener);
+  _upgradeListener = -1;
+  _master->release();
+  _inActivity = false;
+  SE3313_LOG_INFO("Handed " << fds.size() << " sessions over, exiting");
+}
+
+void server::fanOut(const std::string& room, const std::shared_ptr<const std::string>& frame){
+  // copy the members so the workers can go on visiting while the frame is written
+  _fanOut.clear();
+  {
+    std::lock_guard<std::mutex> lock(_mut_state);
+    const std::vector<room_index::member>* const members = _rooms.members(room);
+    if (!members){
+      return;
+    }
+    
+    _fanOut.reserve(members->size());
+    for (const room_index::member& m : *members){
+      _fanOut.push_back(_sessions.find(m.fd)->socket);
+    }
+  }
+  
+  const int64_t started = se3313::tracing::now(_tracing);
+  for (const std::shared_ptr<net::socket>& sock : _fanOut){
+    sendTo(sock, frame, false);
+  }
+  g_fanOut.inc(_fanOut.size());
+  se3313::tracing::span(_tracing, "fanout", started, -1, _fanOut.size());
+  _fanOut.clear();
+}
+
+void server::sendTo(const std::shared_ptr<net::socket>& sock, const std::shared_ptr<const std::string>& frame, const bool essential){
+  session* const s = _sessions.find(sock->fd());
+  if (!sock->isOpen() || !s || s->socket != sock){
+    return;
+  }
+  
+  if (s->backlogged()){
+    // a slow session misses room traffic, it only gets what concerns it directly
+    if (s->slow && !essential){
+      ++_egress.dropped;
+      g_egressDropped.inc();
+      if (_config.egress.onSlowConsumer == egress_config::policy::COLLAPSE){
+        s->collapsed = true;
+      }
+      return;
+    }
+    
+    enqueue(sock, s, frame, essential, 0);
+    return;
+  }
+  
+  const int64_t writing = se3313::tracing::now(_tracing);
+  const ssize_t written = sock->write(frame->data(), frame->size());
+  se3313::tracing::span(_tracing, "write", writing, sock->fd(), written > 0 ? static_cast<uint64_t>(written) : 0);
+  if (written < 0){
+    removeSocketConnection(sock);
+  }
+  else if (static_cast<size_t>(written) < frame->size()){
+    enqueue(sock, s, frame, essential, static_cast<size_t>(written));
+  }
+}
+
+void server::enqueue(const std::shared_ptr<net::socket>& sock, session* const s, 
+                     const std::shared_ptr<const std::string>& frame, const bool essential, const size_t written){
+  if (!s->backlogged()){
+    if (!s->outbound){
+      // kept until the session closes, one that fell behind once is likely to again
+      s->outbound.reset(new session::frame_queue());
+    }
+    s->outboundOffset = written;
+    _flexinWaiter->watchWritable(sock, true);
+  }
+  s->outbound->push_back(session::queued_frame{ frame, essential, stage::now(), _tracing, se3313::tracing::now(_tracing) });
+  
+  const size_t bytes = frame->size() - written;
+  s->outboundBytes += bytes;
+  _egressBytes += bytes;
+  g_egressBytes.add(static_cast<int64_t>(bytes));
+  _egress.peakBytes = std::max(_egress.peakBytes, _egressBytes);
+  
+  // past the global cap, even a slow session's essential output is too much to keep
+  if ((!s->slow && s->outboundBytes > _config.egress.highWaterBytes) || _egressBytes > _config.egress.maxTotalBytes){
+    onSlowConsumer(sock, s);
+  }
+}
+
+void server::onSlowConsumer(const std::shared_ptr<net::socket>& sock, session* const s){
+  ++_egress.slowConsumers;
+  g_slowConsumers.inc();
+  if (s->slow || _config.egress.onSlowConsumer == egress_config::policy::DISCONNECT){
+    ++_egress.disconnects;
+    removeSocketConnection(sock);
+    return;
+  }
+  
+  s->slow = true;
+  if (_config.egress.onSlowConsumer == egress_config::policy::COLLAPSE){
+    // keep the frame being written and everything addressed to the session itself
+    session::frame_queue kept;
+    for (size_t i = 0; i < s->outbound->size(); ++i){
+      const session::queued_frame& f = (*s->outbound)[i];
+      if (i == 0 || f.essential){
+        kept.push_back(f);
+      }
+      else {
+        const size_t bytes = f.frame->size();
+        s->outboundBytes -= bytes;
+        _egressBytes -= bytes;
+        g_egressBytes.add(-static_cast<int64_t>(bytes));
+        ++_egress.dropped;
+        g_egressDropped.inc();
+        s->collapsed = true;
+      }
+    }
+    s->outbound->swap(kept);
+  }
+}
+
+void server::onWritable(const net::flex_waiter::socket_ptr_t sock){
+  session* const s = _sessions.find(sock->fd());
+  if (!s || s->socket != sock){
+    _flexinWaiter->watchWritable(sock, false);
+    return;
+  }
+  
+  alloc::scope marker(stage::FLUSH);
+  flush(sock, s);
+}
+
+void server::flush(const std::shared_ptr<net::socket>& sock, session* const s){
+  while (s->backlogged()){
+    const std::string& frame = *s->outbound->front().frame;
+    const ssize_t written = sock->write(frame.data() + s->outboundOffset, frame.size() - s->outboundOffset);
+    if (written < 0){
+      removeSocketConnection(sock);
+      return;
+    }
+    else if (written == 0){
+      break;
+    }
+    
+    s->outboundOffset += written;
+    s->outboundBytes -= written;
+    _egressBytes -= written;
+    g_egressBytes.add(-static_cast<int64_t>(written));
+    if (s->outboundOffset == frame.size()){
+      stage::record(stage::FLUSH, s->outbound->front().queued, stage::now());
+      se3313::tracing::span(s->outbound->front().trace, "flush", s->outbound->front().traced, sock->fd(), frame.size());
+      s->outbound->pop_front();
+      s->outboundOffset = 0;
+    }
+  }
+  
+  if (!s->backlogged()){
+    _flexinWaiter->watchWritable(sock, false);
+  }
+  
+  if (s->slow && s->outboundBytes <= _config.egress.lowWaterBytes){
+    s->slow = false;
+    if (s->collapsed){
+      // replaces whatever room traffic was missed with the latest of each room
+      s->collapsed = false;
+      ++_egress.resyncs;
+      std::vector<std::string> rooms;
+      {
+        std::lock_guard<std::mutex> lock(_mut_state);
+        rooms = _rooms.roomsOf(sock->fd());
+      }
+      for (const std::string& room : rooms){
+        const std::shared_ptr<const std::string> page = _history.page(room);
+        if (page){
+          sendTo(sock, page);
+        }
+      }
     }
-    _inActivity = false;
   }
 }
 
 void server::addSocketConnection(const std::shared_ptr<net::socket> newSock){
-  _socketList.push_back(newSock);
+  // writes must never block the loop, a client that stops reading gets its output queued
+  newSock->setBlocking(false);
+  {
+    std::lock_guard<std::mutex> lock(_mut_state);
+    session* const s = _sessions.open(newSock);
+    s->messageBucket = token_bucket(_config.ingress.messagesPerSecond, _config.ingress.messageBurst);
+    s->byteBucket = token_bucket(_config.ingress.bytesPerSecond, _config.ingress.byteBurst);
+  }
+  g_sessions.inc();
+  if (_capture){
+    _capture->open(newSock->fd());
+  }
   _flexinWaiter->addSocket(newSock);
 }
 
 void server::removeSocketConnection(const std::shared_ptr<net::socket> oldSock){
-  _socketList.erase(std::remove(_socketList.begin(), _socketList.end(), oldSock), _socketList.end());
-  _flexinWaiter->removeSocket(oldSock);
+  // keep the socket alive until both registries have let go of it
+  const std::shared_ptr<net::socket> sock = oldSock;
+  {
+    std::lock_guard<std::mutex> lock(_mut_state);
+    const session* const s = _sessions.find(sock->fd());
+    if (s && s->socket == sock){
+      _egressBytes -= s->outboundBytes;
+      g_egressBytes.add(-static_cast<int64_t>(s->outboundBytes));
+      g_sessions.dec();
+      if (s->loggedIn()){
+        g_loggedIn.dec();
+      }
+      _rooms.leaveAll(sock->fd());
+      _sessions.close(sock->fd());
+      if (_capture){
+        _capture->close(sock->fd());
+      }
+    }
+  }
+  _flexinWaiter->removeSocket(sock);
+  sock->close();
 }
 
 server::return_t server::visitLogin(const msg::request::login& req){
-  std::cout << "Entered visitor login" << std::endl;
-  std::string clientName = req.sender();
-  for (int i = 0; i < _clientNames.size(); i++){
-    if(_clientNames[i].compare(clientName) == 0){
+  SE3313_LOG_TRACE("Entered visitor login");
+  const std::string clientName = req.sender();
+  switch (_sessions.login(_currentFD, clientName)){
+    case session_table::login_result::OK:
+      g_loggedIn.inc();
+      _sessions.find(_currentFD)->flowControl = req.supports(msg::request::login::CAPABILITY_FLOW_CONTROL);
+      
+      // everyone starts in the default room and the room hears about it
+      _rooms.join(_currentFD, msg::instance::DEFAULT_ROOM);
+      _delivery.toSender = false;
+      _delivery.room = msg::instance::DEFAULT_ROOM;
+      _delivery.replay = msg::instance::DEFAULT_ROOM;
+      return std::make_shared<msg::response::login>(msg::response::login(clientName));
+      
+    case session_table::login_result::NAME_IN_USE:
       return std::make_shared<msg::response::error>(msg::response::error(msg::instance::SERVER_SENDER, msg::ErrorCode::USER_NAME_IN_USE, "You dun goofed. Username is in use. (Server Error)"));
-    }
+      
+    case session_table::login_result::INVALID_NAME:
+      return std::make_shared<msg::response::error>(msg::response::error(msg::instance::SERVER_SENDER, msg::ErrorCode::INVALID_USER_NAME, "Username can not be empty."));
+      
+    case session_table::login_result::ALREADY_LOGGED_IN:
+    default:
+      return std::make_shared<msg::response::error>(msg::response::error(msg::instance::SERVER_SENDER, msg::ErrorCode::INVALID_REQUEST_FROM_CLIENT, "Already logged in."));
   }
-  _clientNames.push_back(clientName);
-  return std::make_shared<msg::response::login>(msg::response::login(req.sender()));
 }
 
 server::return_t server::visitMessage(const msg::request::message& req) {
-  std::cout<< "Entered visitor msg" << std::endl;
-  msg::response::message res = msg::response::message(req.sender(), req.content());
+  SE3313_LOG_TRACE("Entered visitor msg");
+  const session* const sender = _sessions.find(_currentFD);
+  if (!sender || !sender->loggedIn()){
+    return std::make_shared<msg::response::error>(msg::response::error(req.sender(), msg::ErrorCode::INVALID_REQUEST_FROM_CLIENT, "Must log in before sending messages."));
+  }
+  
+  if (!_rooms.isMember(_currentFD, req.room())){
+    return std::make_shared<msg::response::error>(msg::response::error(sender->username, msg::ErrorCode::NOT_IN_ROOM, "Join the room before sending messages to it."));
+  }
+  
+  _delivery.toSender = false;
+  _delivery.room = req.room();
+  _delivery.record = true;
+  msg::response::message res = msg::response::message(sender->username, req.content(), req.room());
   return std::make_shared<msg::response::message>(res);
 }
 
+server::return_t server::visitJoin(const msg::request::join& req) {
+  const session* const sender = _sessions.find(_currentFD);
+  if (!sender || !sender->loggedIn()){
+    return std::make_shared<msg::response::error>(msg::response::error(req.sender(), msg::ErrorCode::INVALID_REQUEST_FROM_CLIENT, "Must log in before joining rooms."));
+  }
+  
+  if (req.room().empty()){
+    return std::make_shared<msg::response::error>(msg::response::error(sender->username, msg::ErrorCode::INVALID_ROOM_NAME, "Room name can not be empty."));
+  }
+  
+  // joining twice is harmless, the client still gets its confirmation
+  if (_rooms.join(_currentFD, req.room())){
+    _delivery.toSender = false;
+    _delivery.room = req.room();
+    _delivery.replay = req.room();
+  }
+  return std::make_shared<msg::response::join>(sender->username, req.room());
+}
+
+server::return_t server::visitLeave(const msg::request::leave& req) {
+  const session* const sender = _sessions.find(_currentFD);
+  if (!sender || !sender->loggedIn()){
+    return std::make_shared<msg::response::error>(msg::response::error(req.sender(), msg::ErrorCode::INVALID_REQUEST_FROM_CLIENT, "Must log in before leaving rooms."));
+  }
+  
+  if (!_rooms.leave(_currentFD, req.room())){
+    return std::make_shared<msg::response::error>(msg::response::error(sender->username, msg::ErrorCode::NOT_IN_ROOM, "Not a member of the room."));
+  }
+  
+  // the leaver is no longer a member, so it is told directly
+  _delivery.toSender = true;
+  _delivery.room = req.room();
+  return std::make_shared<msg::response::leave>(sender->username, req.room());
+}
+
+server::return_t server::visitDirect(const msg::request::direct& req) {
+  const session* const sender = _sessions.find(_currentFD);
+  if (!sender || !sender->loggedIn()){
+    return std::make_shared<msg::response::error>(msg::response::error(req.sender(), msg::ErrorCode::INVALID_REQUEST_FROM_CLIENT, "Must log in before sending messages."));
+  }
+  
+  // one hash lookup, no room or broadcast work
+  const session* const recipient = _sessions.findByName(req.recipient());
+  if (!recipient){
+    return std::make_shared<msg::response::error>(msg::response::error(sender->username, msg::ErrorCode::UNKNOWN_RECIPIENT, "No user named " + req.recipient() + " is logged in."));
+  }
+  
+  _delivery.toSender = false;
+  _delivery.recipient = recipient->socket;
+  return std::make_shared<msg::response::direct>(sender->username, req.recipient(), req.content());
+}
+
 server::return_t server::error(const std::string& origSender,const msg::ErrorCode errCode, const std::string& msgStr){
   return std::make_shared<msg::response::error>(msg::response::error(origSender, errCode, msgStr));
 }
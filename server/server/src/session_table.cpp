@@ -0,0 +1,127 @@
+#include "session_table.hpp"
+
+#include <boost/assert.hpp>
+
+using namespace dzagar;
+
+namespace net = se3313::networking;
+
+session_table::session_table(const size_t expected)
+{
+    _slots.reserve(expected);
+    _active.reserve(expected);
+    _byName.reserve(expected);
+}
+
+session* session_table::open(const std::shared_ptr<net::socket>& sock)
+{
+    BOOST_ASSERT(sock);
+    
+    const fd_t fd = sock->fd();
+    BOOST_ASSERT(fd >= 0);
+    
+    if (static_cast<size_t>(fd) >= _slots.size())
+    {
+        _slots.resize(fd + 1);
+    }
+    
+    session& s = _slots[fd];
+    if (s.socket)
+    {
+        // The descriptor was reused before the old session was torn down
+        close(fd);
+    }
+    
+    s.socket = sock;
+    s.username.clear();
+    s.inbound.clear();
+    s.messageBucket = token_bucket();
+    s.byteBucket = token_bucket();
+    s.paused = 0;
+    s.ingressBytes = 0;
+    s.ingressEpoch = 0;
+    s.flowControl = false;
+    s.outbound.reset();
+    s.outboundOffset = 0;
+    s.outboundBytes = 0;
+    s.slow = false;
+    s.collapsed = false;
+    s.activeIndex = static_cast<uint32_t>(_active.size());
+    _active.push_back(fd);
+    
+    return &s;
+}
+
+session* session_table::find(const fd_t fd)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= _slots.size() || !_slots[fd].socket)
+    {
+        return nullptr;
+    }
+    
+    return &_slots[fd];
+}
+
+session* session_table::findByName(const std::string& username)
+{
+    const auto it = _byName.find(username);
+    if (it == _byName.end())
+    {
+        return nullptr;
+    }
+    
+    return &_slots[it->second];
+}
+
+session_table::login_result session_table::login(const fd_t fd, const std::string& username)
+{
+    session* const s = find(fd);
+    BOOST_ASSERT(s);
+    
+    if (username.empty())
+    {
+        return login_result::INVALID_NAME;
+    }
+    
+    if (s->loggedIn())
+    {
+        return login_result::ALREADY_LOGGED_IN;
+    }
+    
+    if (!_byName.emplace(username, fd).second)
+    {
+        return login_result::NAME_IN_USE;
+    }
+    
+    s->username = username;
+    return login_result::OK;
+}
+
+bool session_table::close(const fd_t fd)
+{
+    session* const s = find(fd);
+    if (!s)
+    {
+        return false;
+    }
+    
+    if (s->loggedIn())
+    {
+        _byName.erase(s->username);
+    }
+    
+    // swap-remove from the dense list
+    const fd_t moved = _active.back();
+    _active[s->activeIndex] = moved;
+    _slots[moved].activeIndex = s->activeIndex;
+    _active.pop_back();
+    
+    s->socket.reset();
+    s->username.clear();
+    s->username.shrink_to_fit();
+    s->inbound.clear();
+    s->inbound.shrink_to_fit();
+    s->outbound.reset();
+    
+    return true;
+}
@@ -0,0 +1,62 @@
+#include "stage_latency.hpp"
+
+#include <iomanip>
+
+using namespace dzagar;
+
+namespace
+{
+
+const char* const NAMES[stage::COUNT] = { "recv", "frame", "parse", "visit", "encode", "enqueue", "flush" };
+
+} // end anonymous namespace
+
+const char* stage::name(const id s)
+{
+    return NAMES[s];
+}
+
+#ifdef SE3313_STAGE_LATENCY
+
+namespace
+{
+
+se3313::metrics::latency makeStage(const stage::id s)
+{
+    return se3313::metrics::registry::makeLatency("chat_stage_seconds", "Time requests spend in each stage",
+                                                  std::string("stage=\"") + NAMES[s] + "\"");
+}
+
+} // end anonymous namespace
+
+const se3313::metrics::latency stage::detail::g_stages[stage::COUNT] = {
+    makeStage(RECV), makeStage(FRAME), makeStage(PARSE), makeStage(VISIT), 
+    makeStage(ENCODE), makeStage(ENQUEUE), makeStage(FLUSH)
+};
+
+void stage::report(std::ostream& out)
+{
+    out << std::left << std::setw(9) << "stage" << std::right << std::setw(10) << "count" 
+        << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p99" 
+        << std::setw(10) << "p999" << std::setw(10) << "max" << "  (us)" << std::endl;
+    
+    for (int s = 0; s < COUNT; ++s)
+    {
+        const se3313::metrics::latency_snapshot snap = detail::g_stages[s].snapshot();
+        out << std::left << std::setw(9) << NAMES[s] << std::right << std::setw(10) << snap.count << std::fixed << std::setprecision(1);
+        for (const uint64_t ns : { snap.mean, snap.p50, snap.p99, snap.p999, snap.max })
+        {
+            out << std::setw(10) << static_cast<double>(ns) / 1000;
+        }
+        out << std::defaultfloat << std::endl;
+    }
+}
+
+#else
+
+void stage::report(std::ostream& out)
+{
+    out << "Stage latencies were compiled out, build with -DSTAGE_LATENCY=ON" << std::endl;
+}
+
+#endif
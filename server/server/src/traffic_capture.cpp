@@ -0,0 +1,239 @@
+#include "traffic_capture.hpp"
+
+#include <logging/log.hpp>
+#include <msg/schema.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace dzagar;
+
+namespace binary = se3313::msg::schema::binary;
+
+namespace
+{
+
+const char MAGIC[] = "SE3313CAP";
+constexpr size_t MAGIC_BYTES = sizeof(MAGIC) - 1;
+constexpr uint8_t VERSION = 1;
+constexpr size_t HEADER_BYTES = MAGIC_BYTES + 1 + 8;
+
+/// Buffered bytes that are written out
+constexpr size_t FLUSH_BYTES = 64 * 1024;
+
+/// Largest frame accepted when reading, anything bigger is treated as corruption
+constexpr uint64_t MAX_FRAME = 64 * 1024 * 1024;
+
+[[noreturn]]
+void fail(const std::string& what)
+{
+    std::ostringstream ss; ss << "traffic_capture: " << what << ", errno: " << errno;
+    throw std::runtime_error(ss.str());
+}
+
+} // end anonymous namespace
+
+traffic_capture::traffic_capture(const std::string& path)
+    : _path(path)
+    , _fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+    , _last(std::chrono::steady_clock::now())
+    , _nextConnection(0)
+    , _frames(0)
+{
+    if (_fd < 0)
+    {
+        fail("could not open " + path);
+    }
+
+    _buffer.append(MAGIC, MAGIC_BYTES);
+    _buffer.push_back(static_cast<char>(VERSION));
+    binary::put_fixed<int64_t>(&_buffer, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    flush(true);
+}
+
+traffic_capture::~traffic_capture()
+{
+    flush(true);
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+    }
+}
+
+void traffic_capture::open(const int fd)
+{
+    // a descriptor can only be reused once its previous connection is gone
+    _connections.erase(fd);
+    begin(kind::OPEN, fd);
+    flush(false);
+}
+
+void traffic_capture::frame(const int fd, const char* const data, const size_t length)
+{
+    begin(kind::FRAME, fd);
+    binary::put_varint(&_buffer, length);
+    _buffer.append(data, length);
+    ++_frames;
+    flush(false);
+}
+
+void traffic_capture::close(const int fd)
+{
+    // connections that were never seen stay unknown to the capture
+    if (_connections.count(fd) == 0)
+    {
+        return;
+    }
+    begin(kind::CLOSE, fd);
+    _connections.erase(fd);
+    flush(false);
+}
+
+void traffic_capture::begin(const kind type, const int fd)
+{
+    // clients connected before capturing began are opened by their first frame
+    auto found = _connections.find(fd);
+    if (found == _connections.end())
+    {
+        found = _connections.emplace(fd, _nextConnection++).first;
+        if (type != kind::OPEN)
+        {
+            begin(kind::OPEN, fd);
+        }
+    }
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    _buffer.push_back(static_cast<char>(type));
+    binary::put_varint(&_buffer, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - _last).count()));
+    binary::put_varint(&_buffer, found->second);
+    _last = now;
+}
+
+void traffic_capture::flush(const bool force)
+{
+    if (_fd < 0 || _buffer.empty() || (!force && _buffer.size() < FLUSH_BYTES))
+    {
+        return;
+    }
+
+    const char* data = _buffer.data();
+    size_t remaining = _buffer.size();
+    while (remaining > 0)
+    {
+        const ssize_t written = ::write(_fd, data, remaining);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written < 0)
+        {
+            // losing the capture must not take the server down with it
+            SE3313_LOG_ERROR("traffic_capture: failed to write " << _path << ", errno: " << errno << ", capture stopped");
+            ::close(_fd);
+            _fd = -1;
+            break;
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+    _buffer.clear();
+}
+
+traffic_capture::reader::reader(const std::string& path)
+    : _fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    , _position(0)
+    , _at(0)
+{
+    if (_fd < 0)
+    {
+        fail("could not open " + path);
+    }
+
+    while (_buffer.size() < HEADER_BYTES && fill())
+    {
+    }
+
+    const char* p = _buffer.data() + MAGIC_BYTES + 1;
+    int64_t started = 0;
+    if (_buffer.size() < HEADER_BYTES || _buffer.compare(0, MAGIC_BYTES, MAGIC) != 0
+        || static_cast<uint8_t>(_buffer[MAGIC_BYTES]) != VERSION
+        || !binary::get_fixed(&p, _buffer.data() + _buffer.size(), &started))
+    {
+        ::close(_fd);
+        throw std::runtime_error("traffic_capture: " + path + " is not a capture");
+    }
+    _started = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(started)));
+    _position = HEADER_BYTES;
+}
+
+traffic_capture::reader::~reader()
+{
+    ::close(_fd);
+}
+
+bool traffic_capture::reader::next(record* const rec)
+{
+    for (;;)
+    {
+        const char* p = _buffer.data() + _position;
+        const char* const last = _buffer.data() + _buffer.size();
+
+        uint64_t delta;
+        uint64_t connection;
+        uint64_t length = 0;
+        if (p != last)
+        {
+            const kind type = static_cast<kind>(*p++);
+            if (type != kind::OPEN && type != kind::FRAME && type != kind::CLOSE)
+            {
+                return false;
+            }
+
+            const bool header = binary::get_varint(&p, last, &delta) && binary::get_varint(&p, last, &connection)
+                && (type != kind::FRAME || binary::get_varint(&p, last, &length));
+            if (header && length > MAX_FRAME)
+            {
+                return false;
+            }
+            if (header && static_cast<uint64_t>(last - p) >= length)
+            {
+                rec->type = type;
+                _at += std::chrono::nanoseconds(delta);
+                rec->at = _at;
+                rec->connection = connection;
+                rec->frame.assign(p, static_cast<size_t>(length));
+                _position = static_cast<size_t>(p + length - _buffer.data());
+                return true;
+            }
+        }
+
+        // the record continues past what was read so far
+        if (!fill())
+        {
+            return false;
+        }
+    }
+}
+
+bool traffic_capture::reader::fill()
+{
+    _buffer.erase(0, _position);
+    _position = 0;
+
+    char chunk[FLUSH_BYTES];
+    ssize_t n;
+    while ((n = ::read(_fd, chunk, sizeof(chunk))) < 0 && errno == EINTR)
+    {
+    }
+    if (n <= 0)
+    {
+        return false;
+    }
+    _buffer.append(chunk, static_cast<size_t>(n));
+    return true;
+}
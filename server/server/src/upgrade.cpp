@@ -0,0 +1,378 @@
+#include "upgrade.hpp"
+
+#include <msg/schema.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace dzagar;
+
+namespace binary = se3313::msg::schema::binary;
+
+namespace
+{
+
+/// Largest state chunk, well below the default socket buffer so a chunk always fits in one message
+constexpr size_t CHUNK_BYTES = 64 * 1024;
+
+/// How long either side waits for the other before giving up
+constexpr int TIMEOUT_SECONDS = 10;
+
+[[noreturn]]
+void fail(const std::string& what)
+{
+    std::ostringstream ss; ss << "Upgrade failed: " << what << ", err: " << errno;
+    throw std::runtime_error(ss.str());
+}
+
+sockaddr_un address(const std::string& path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::runtime_error("Upgrade socket path too long: " + path);
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return addr;
+}
+
+/// Bounds every blocking call on @p fd, so a peer that dies mid-handover can not hang the other side.
+void setTimeouts(const int fd)
+{
+    timeval tv;
+    tv.tv_sec = TIMEOUT_SECONDS;
+    tv.tv_usec = 0;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/// Sends one message of @p tag and @p payload, with @p fds attached if there are any.
+void sendMessage(const int channel, const char tag, const std::string& payload, const int* const fds = nullptr, const size_t count = 0)
+{
+    std::string message(1, tag);
+    message.append(payload);
+
+    iovec iov;
+    iov.iov_base = &message[0];
+    iov.iov_len = message.size();
+
+    msghdr hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    std::vector<char> control;
+    if (count > 0)
+    {
+        control.resize(CMSG_SPACE(count * sizeof(int)));
+        hdr.msg_control = control.data();
+        hdr.msg_controllen = control.size();
+
+        cmsghdr* const cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    }
+
+    if (::sendmsg(channel, &hdr, MSG_NOSIGNAL) != static_cast<ssize_t>(message.size()))
+    {
+        fail("could not send to the new process");
+    }
+}
+
+/**
+ * Receives one message, checking its tag is @p tag. Descriptors attached to it are appended to @p fds.
+ * @return The payload
+ */
+std::string receiveMessage(const int channel, const char tag, std::vector<int>* const fds = nullptr)
+{
+    std::string message(CHUNK_BYTES + 1, '\0');
+    iovec iov;
+    iov.iov_base = &message[0];
+    iov.iov_len = message.size();
+
+    std::vector<char> control(CMSG_SPACE(upgrade::MAX_FDS * sizeof(int)));
+    msghdr hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.data();
+    hdr.msg_controllen = control.size();
+
+    const ssize_t received = ::recvmsg(channel, &hdr, MSG_CMSG_CLOEXEC);
+    if (received <= 0)
+    {
+        fail("the other process went away");
+    }
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* const first = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            if (fds)
+            {
+                fds->insert(fds->end(), first, first + count);
+            }
+            else
+            {
+                std::for_each(first, first + count, ::close);
+            }
+        }
+    }
+
+    if ((hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || message[0] != tag)
+    {
+        errno = EPROTO;
+        fail("unexpected message");
+    }
+
+    message.resize(static_cast<size_t>(received));
+    return message.substr(1);
+}
+
+void putString(std::string* const out, const std::string& s)
+{
+    binary::put_varint(out, s.size());
+    out->append(s);
+}
+
+void getString(const char** first, const char* last, std::string* const s)
+{
+    uint64_t size;
+    if (!binary::get_varint(first, last, &size) || static_cast<uint64_t>(last - *first) < size)
+    {
+        errno = EPROTO;
+        fail("truncated state");
+    }
+    s->assign(*first, static_cast<size_t>(size));
+    *first += size;
+}
+
+uint64_t getCount(const char** first, const char* last)
+{
+    uint64_t count;
+    if (!binary::get_varint(first, last, &count))
+    {
+        errno = EPROTO;
+        fail("truncated state");
+    }
+    return count;
+}
+
+std::string encode(const upgrade::state& st)
+{
+    std::string out;
+    binary::put_varint(&out, st.sessions.size());
+    for (const upgrade::session_state& s : st.sessions)
+    {
+        putString(&out, s.username);
+        binary::put_varint(&out, s.rooms.size());
+        for (const std::string& room : s.rooms)
+        {
+            putString(&out, room);
+        }
+        putString(&out, s.inbound);
+        putString(&out, s.outbound);
+        out.push_back(s.flowControl ? 1 : 0);
+    }
+
+    binary::put_varint(&out, st.history.size());
+    for (const auto& h : st.history)
+    {
+        putString(&out, h.first);
+        putString(&out, h.second);
+    }
+    return out;
+}
+
+upgrade::state decode(const std::string& in)
+{
+    const char* p = in.data();
+    const char* const last = in.data() + in.size();
+
+    upgrade::state st;
+    st.sessions.resize(getCount(&p, last));
+    for (upgrade::session_state& s : st.sessions)
+    {
+        getString(&p, last, &s.username);
+        s.rooms.resize(getCount(&p, last));
+        for (std::string& room : s.rooms)
+        {
+            getString(&p, last, &room);
+        }
+        getString(&p, last, &s.inbound);
+        getString(&p, last, &s.outbound);
+        if (p == last)
+        {
+            errno = EPROTO;
+            fail("truncated state");
+        }
+        s.flowControl = *p++ != 0;
+    }
+
+    st.history.resize(getCount(&p, last));
+    for (auto& h : st.history)
+    {
+        getString(&p, last, &h.first);
+        getString(&p, last, &h.second);
+    }
+    return st;
+}
+
+} // end anonymous namespace
+
+int upgrade::listen(const std::string& path)
+{
+    const sockaddr_un addr = address(path);
+    const int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        fail("could not create " + path);
+    }
+
+    // a previous server may have left the file behind, it is replaced
+    ::unlink(path.c_str());
+    if (::bind(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(fd, 1) < 0)
+    {
+        ::close(fd);
+        fail("could not listen on " + path);
+    }
+    return fd;
+}
+
+int upgrade::request(const std::string& path)
+{
+    const sockaddr_un addr = address(path);
+    const int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        fail("could not create a channel");
+    }
+
+    setTimeouts(fd);
+    if (::connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        ::close(fd);
+        fail("no server listening on " + path);
+    }
+
+    try
+    {
+        sendMessage(fd, 'U', std::string());
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+    return fd;
+}
+
+int upgrade::accept(const int listener)
+{
+    const int fd = ::accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        fail("could not accept the new process");
+    }
+
+    setTimeouts(fd);
+    try
+    {
+        receiveMessage(fd, 'U');
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+    return fd;
+}
+
+void upgrade::send(const int channel, const int listenFD, const std::vector<int>& sessionFDs, const state& st)
+{
+    const std::string encoded = encode(st);
+
+    std::vector<int> fds;
+    fds.reserve(sessionFDs.size() + 1);
+    fds.push_back(listenFD);
+    fds.insert(fds.end(), sessionFDs.begin(), sessionFDs.end());
+
+    std::string header;
+    binary::put_fixed<uint64_t>(&header, encoded.size());
+    binary::put_fixed<uint32_t>(&header, static_cast<uint32_t>(fds.size()));
+    sendMessage(channel, 'H', header);
+
+    for (size_t i = 0; i < fds.size(); i += MAX_FDS)
+    {
+        sendMessage(channel, 'F', std::string(), fds.data() + i, std::min(MAX_FDS, fds.size() - i));
+    }
+
+    for (size_t i = 0; i < encoded.size(); i += CHUNK_BYTES)
+    {
+        sendMessage(channel, 'S', encoded.substr(i, CHUNK_BYTES));
+    }
+
+    receiveMessage(channel, 'A');
+}
+
+upgrade::state upgrade::receive(const int channel, int* const listenFD, std::vector<int>* const sessionFDs)
+{
+    const std::string header = receiveMessage(channel, 'H');
+    const char* p = header.data();
+    uint64_t stateBytes;
+    uint32_t count;
+    if (!binary::get_fixed(&p, header.data() + header.size(), &stateBytes)
+        || !binary::get_fixed(&p, header.data() + header.size(), &count) || count == 0)
+    {
+        errno = EPROTO;
+        fail("bad header");
+    }
+
+    std::vector<int> fds;
+    std::string encoded;
+    state st;
+    try
+    {
+        while (fds.size() < count)
+        {
+            receiveMessage(channel, 'F', &fds);
+        }
+
+        while (encoded.size() < stateBytes)
+        {
+            encoded.append(receiveMessage(channel, 'S'));
+        }
+
+        st = decode(encoded);
+        if (st.sessions.size() + 1 != fds.size())
+        {
+            errno = EPROTO;
+            fail("descriptors do not match the sessions");
+        }
+
+        sendMessage(channel, 'A', std::string());
+    }
+    catch (...)
+    {
+        std::for_each(fds.begin(), fds.end(), ::close);
+        throw;
+    }
+
+    *listenFD = fds.front();
+    sessionFDs->assign(fds.begin() + 1, fds.end());
+    return st;
+}
@@ -0,0 +1,121 @@
+#include "worker_pool.hpp"
+
+#include <metrics/registry.hpp>
+
+using namespace dzagar;
+
+namespace
+{
+
+using se3313::metrics::registry;
+
+const se3313::metrics::counter g_tasks = registry::makeCounter("worker_pool_tasks_total", "Tasks run by the workers");
+const se3313::metrics::gauge g_pending = registry::makeGauge("worker_pool_pending_tasks", "Tasks submitted and not finished");
+const se3313::metrics::histogram g_batch = registry::makeHistogram("worker_pool_batch_tasks", "Tasks a worker took from its queue at once", 
+                                                                   registry::exponentialBounds(1, 4, 6));
+
+} // end anonymous namespace
+
+worker_pool::worker_pool(const size_t workers)
+    : _pending(0)
+{
+    _workers.reserve(workers);
+    for (size_t i = 0; i < workers; ++i)
+    {
+        _workers.emplace_back(new worker());
+        worker& w = *_workers.back();
+        w.thread = std::thread([this, &w]() { run(w); });
+    }
+}
+
+worker_pool::~worker_pool()
+{
+    for (const std::unique_ptr<worker>& w : _workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(w->mut);
+            w->stop = true;
+        }
+        w->cv.notify_one();
+    }
+    
+    for (const std::unique_ptr<worker>& w : _workers)
+    {
+        w->thread.join();
+    }
+}
+
+void worker_pool::drain(task_t done)
+{
+    if (_workers.empty())
+    {
+        done();
+        return;
+    }
+    
+    // each queue is FIFO, a marker at the end of all of them runs after everything before it
+    const std::shared_ptr<std::atomic<size_t>> left = std::make_shared<std::atomic<size_t>>(_workers.size());
+    const std::shared_ptr<task_t> last = std::make_shared<task_t>(std::move(done));
+    for (size_t i = 0; i < _workers.size(); ++i)
+    {
+        submit(i, [left, last](){
+            if (left->fetch_sub(1) == 1)
+            {
+                (*last)();
+            }
+        });
+    }
+}
+
+void worker_pool::submit(const size_t key, task_t task)
+{
+    if (_workers.empty())
+    {
+        task();
+        return;
+    }
+    
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    g_pending.inc();
+    worker& w = *_workers[key % _workers.size()];
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(w.mut);
+        wake = w.queue.empty();
+        w.queue.push_back(std::move(task));
+    }
+    
+    if (wake)
+    {
+        w.cv.notify_one();
+    }
+}
+
+void worker_pool::run(worker& w)
+{
+    std::deque<task_t> batch;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(w.mut);
+            w.cv.wait(lock, [&w]() { return w.stop || !w.queue.empty(); });
+            if (w.queue.empty())
+            {
+                return;
+            }
+            
+            // take everything queued so submitters only contend once per batch
+            batch.swap(w.queue);
+        }
+        
+        for (const task_t& task : batch)
+        {
+            task();
+            _pending.fetch_sub(1, std::memory_order_relaxed);
+            g_pending.dec();
+        }
+        g_tasks.inc(batch.size());
+        g_batch.observe(static_cast<double>(batch.size()));
+        batch.clear();
+    }
+}
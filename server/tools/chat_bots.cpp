@@ -0,0 +1,249 @@
+/**
+ * Chat bots driven by the asynchronous client library (`networking/chat_client.hpp`), all on one thread.
+ *
+ * Every bot logs in under its own name and moves from the lobby to one of `--rooms` rooms as soon as it
+ * is connected, again after every reconnect, then sends messages at `--rate` per second. The bots' pool
+ * runs on a @c flex_waiter like the server's own loop. Prints the bots connected, responses and
+ * reconnects every second, restarting the server meanwhile shows them backing off and coming back.
+ */
+
+#include <metrics/registry.hpp>
+
+#include <msg/login.hpp>
+#include <msg/message.hpp>
+#include <msg/room.hpp>
+
+#include <networking/chat_client.hpp>
+#include <networking/flex_waiter.hpp>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace msg = se3313::msg;
+namespace net = se3313::networking;
+
+using se3313::metrics::registry;
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady_clock_t;
+
+struct options
+{
+    std::string host = "127.0.0.1";
+    net::port_t port = 0;
+    size_t bots = 100;
+
+    /// Rooms the bots are spread over, 0 keeps them in the lobby
+    size_t rooms = 10;
+
+    /// Messages per second sent by each bot
+    double rate = 1;
+
+    double duration = 10;
+};
+
+const se3313::metrics::counter g_messages = registry::makeCounter("chat_bots_messages_total", "Messages the bots received");
+const se3313::metrics::counter g_errors = registry::makeCounter("chat_bots_errors_total", "Error responses the bots received");
+const se3313::metrics::counter g_sent = registry::makeCounter("chat_bots_sent_total", "Messages the bots sent");
+const se3313::metrics::counter g_reconnects = registry::makeCounter("chat_bots_reconnects_total", "Connections the bots made again");
+const se3313::metrics::gauge g_connected = registry::makeGauge("chat_bots_connected", "Bots connected");
+
+/// A bot, which is its own response visitor and connection listener
+class bot final : public net::chat_client::visitor_t, public net::chat_client::listener
+{
+
+public:
+
+    bot(const std::string& name, const std::string& room)
+        : _name(name)
+        , _room(room)
+    { }
+
+    void onConnected(net::chat_client& client) override
+    {
+        g_connected.inc();
+        if (client.connections() > 1)
+        {
+            g_reconnects.inc();
+        }
+
+        // the server forgot the bot with its last connection
+        client.send(msg::request::login(_name));
+        if (_room != msg::instance::DEFAULT_ROOM)
+        {
+            client.send(msg::request::join(_name, _room));
+            client.send(msg::request::leave(_name, msg::instance::DEFAULT_ROOM));
+        }
+    }
+
+    void onDisconnected(net::chat_client& client, const std::string&, const bool) override
+    {
+        // only a connection that was made counts, not every failed attempt
+        if (_reported < client.connections())
+        {
+            _reported = client.connections();
+            g_connected.dec();
+        }
+    }
+
+    void visitMessage(const msg::response::message&) override
+    {
+        g_messages.inc();
+    }
+
+    void error(const std::string&, const msg::ErrorCode, const std::string&) override
+    {
+        g_errors.inc();
+    }
+
+    /// Sends the bot's next message through @p client.
+    void chat(net::chat_client& client)
+    {
+        if (client.send(msg::request::message(_name, "hello from " + _name, _room)))
+        {
+            g_sent.inc();
+        }
+    }
+
+private:
+
+    const std::string _name;
+    const std::string _room;
+
+    /// Connections whose loss was counted
+    uint64_t _reported = 0;
+};
+
+/// Takes no part, the bots' pool is watched by the waiter on its own
+class idle_visitor final : public net::flex_waiter::activity_visitor
+{
+
+public:
+
+    void onSocket(const net::flex_waiter::socket_ptr_t) override { }
+
+    void onSTDIN(const std::string&) override { }
+};
+
+void usage(const char* const argv0)
+{
+    const options defaults;
+    std::cerr << "Usage: " << argv0 << " --port N [options]" << std::endl
+              << "  --host IP      Server address (default " << defaults.host << ")" << std::endl
+              << "  --bots N       Bots (default " << defaults.bots << ")" << std::endl
+              << "  --rooms N      Rooms the bots are spread over, 0 for the lobby (default " << defaults.rooms << ")" << std::endl
+              << "  --rate F       Messages per second per bot (default " << defaults.rate << ")" << std::endl
+              << "  --duration S   Seconds to run (default " << defaults.duration << ")" << std::endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char* const o = argv[i];
+        const char* const v = argv[i + 1];
+        if (std::strcmp(o, "--host") == 0) opts.host = v;
+        else if (std::strcmp(o, "--port") == 0) opts.port = static_cast<net::port_t>(std::strtoul(v, nullptr, 10));
+        else if (std::strcmp(o, "--bots") == 0) opts.bots = std::strtoul(v, nullptr, 10);
+        else if (std::strcmp(o, "--rooms") == 0) opts.rooms = std::strtoul(v, nullptr, 10);
+        else if (std::strcmp(o, "--rate") == 0) opts.rate = std::strtod(v, nullptr);
+        else if (std::strcmp(o, "--duration") == 0) opts.duration = std::strtod(v, nullptr);
+        else { usage(argv[0]); return EXIT_FAILURE; }
+    }
+    if (opts.port == 0 || argc % 2 == 0 || opts.bots == 0 || opts.rate <= 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // one descriptor per bot
+    rlimit lim;
+    if (::getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    net::flex_waiter waiter;
+    waiter.watchSTDIN(false);
+    net::chat_client::pool pool;
+    pool.attach(waiter);
+
+    std::vector<std::shared_ptr<bot>> bots;
+    std::vector<std::shared_ptr<net::chat_client>> clients;
+    for (size_t i = 0; i < opts.bots; ++i)
+    {
+        const std::string room = opts.rooms > 0 ? "bots-" + std::to_string(i % opts.rooms) : msg::instance::DEFAULT_ROOM;
+        bots.push_back(std::make_shared<bot>("bot-" + std::to_string(::getpid()) + "-" + std::to_string(i), room));
+        clients.push_back(pool.connect(opts.host, opts.port, bots.back(), bots.back()));
+    }
+
+    // when each bot chats next, soonest first
+    typedef std::pair<steady_clock_t::time_point, size_t> due_t;
+    std::priority_queue<due_t, std::vector<due_t>, std::greater<due_t>> due;
+    std::mt19937_64 random(::getpid());
+    std::exponential_distribution<double> gap(opts.rate);
+    const auto seconds = [](const double s){ return std::chrono::duration_cast<steady_clock_t::duration>(std::chrono::duration<double>(s)); };
+
+    const steady_clock_t::time_point start = steady_clock_t::now();
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        due.emplace(start + seconds(gap(random)), i);
+    }
+
+    const std::shared_ptr<idle_visitor> idle = std::make_shared<idle_visitor>();
+    const steady_clock_t::time_point stop = start + seconds(opts.duration);
+    steady_clock_t::time_point report = start + std::chrono::seconds(1);
+    uint64_t lastMessages = 0;
+    for (steady_clock_t::time_point now = start; now < stop; now = steady_clock_t::now())
+    {
+        while (due.top().first <= now)
+        {
+            const size_t i = due.top().second;
+            due.pop();
+            if (clients[i]->status() == net::chat_client::state::CONNECTED)
+            {
+                bots[i]->chat(*clients[i]);
+            }
+            due.emplace(now + seconds(gap(random)), i);
+        }
+
+        if (now >= report)
+        {
+            const uint64_t messages = g_messages.value();
+            std::cout << std::setw(4) << std::chrono::duration_cast<std::chrono::seconds>(now - start).count() << "s  "
+                      << std::setw(8) << g_connected.value() << " connected  " << std::setw(10) << messages - lastMessages
+                      << " messages/s  " << std::setw(6) << g_reconnects.value() << " reconnects" << std::endl;
+            lastMessages = messages;
+            report += std::chrono::seconds(1);
+        }
+
+        const steady_clock_t::time_point next = std::min(due.top().first, report);
+        waiter.wait(idle, std::chrono::duration_cast<std::chrono::milliseconds>(next - now) + std::chrono::milliseconds(1));
+    }
+
+    std::cout << std::endl
+              << "Sent:        " << g_sent.value() << " messages" << std::endl
+              << "Received:    " << g_messages.value() << " messages, " << g_errors.value() << " errors" << std::endl
+              << "Reconnects:  " << g_reconnects.value() << std::endl;
+    pool.detach(waiter);
+    return EXIT_SUCCESS;
+}
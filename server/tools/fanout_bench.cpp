@@ -0,0 +1,416 @@
+/**
+ * Latency of broadcasting one message to every connected client, as the number of clients grows.
+ *
+ * Starts the server in-process on a loopback port, then for each client count connects that many
+ * clients to the lobby. One of them sends a message, which the server writes to every member, and
+ * the round lasts until the last member has received it. Prints p50, p99 and max round time for each
+ * client count, and a chart of p50 and p99 against it, so a regression in how fan-out scales shows
+ * as a change in slope.
+ */
+
+#include "server.hpp"
+
+#include <logging/log.hpp>
+
+#include <msg/json.hpp>
+#include <msg/login.hpp>
+#include <msg/message.hpp>
+
+#include <networking/socket.hpp>
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace msg = se3313::msg;
+namespace net = se3313::networking;
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady_clock_t;
+
+struct options
+{
+    std::vector<size_t> clients = { 10, 100, 1000, 10000 };
+    size_t rounds = 100;
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    /// Longest a round may take before the client count is given up on
+    double roundTimeout = 10;
+
+    /// File the results are also written to as CSV, none if empty
+    std::string csv;
+};
+
+/// Round times of one client count, in microseconds
+struct result
+{
+    size_t clients;
+    double setup;
+    std::vector<double> rounds;
+
+    double percentile(const double q) const
+    {
+        if (rounds.empty())
+        {
+            return 0;
+        }
+        std::vector<double> sorted(rounds);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * static_cast<double>(sorted.size())))];
+    }
+};
+
+/// A connected client
+struct client
+{
+    std::shared_ptr<net::socket> socket;
+
+    /// The end of what was read, so a marker split over two reads is still found
+    std::string tail;
+
+    /// Copies of the current round's message received
+    size_t seen = 0;
+};
+
+/// Asks the kernel for a free loopback port.
+net::port_t freePort()
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd < 0 || ::bind(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 || ::getsockname(fd, (sockaddr*)&addr, &length) < 0)
+    {
+        throw std::runtime_error("Could not find a free port");
+    }
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/// Drives one client count against the server on @p port.
+class round_runner final
+{
+
+public:
+
+    round_runner(const options& opts, const net::port_t port, const size_t count)
+        : _opts(opts)
+        , _port(port)
+        , _epoll(::epoll_create1(EPOLL_CLOEXEC))
+        , _events(1024)
+    {
+        _clients.resize(count);
+    }
+
+    ~round_runner()
+    {
+        for (client& c : _clients)
+        {
+            if (c.socket)
+            {
+                c.socket->close();
+            }
+        }
+        ::close(_epoll);
+    }
+
+    result run()
+    {
+        result res;
+        res.clients = _clients.size();
+
+        const steady_clock_t::time_point connecting = steady_clock_t::now();
+        connect();
+        res.setup = std::chrono::duration<double>(steady_clock_t::now() - connecting).count();
+
+        const std::string sender = name(0);
+        for (size_t r = 0; r < _opts.rounds; ++r)
+        {
+            std::ostringstream marker;
+            marker << "fanout-" << _clients.size() << "-" << r << "#";
+            const std::string frame = msg::json::to(msg::request::message(sender, marker.str()).toJson());
+
+            const steady_clock_t::time_point sent = steady_clock_t::now();
+            if (_clients[0].socket->write(frame.data(), frame.size()) != static_cast<ssize_t>(frame.size()))
+            {
+                throw std::runtime_error("Could not send the broadcast");
+            }
+            if (!receiveAll(marker.str(), sent + std::chrono::duration_cast<steady_clock_t::duration>(std::chrono::duration<double>(_opts.roundTimeout))))
+            {
+                std::cerr << "Round " << r << " with " << _clients.size() << " clients timed out" << std::endl;
+                break;
+            }
+            res.rounds.push_back(std::chrono::duration<double, std::micro>(steady_clock_t::now() - sent).count());
+        }
+        return res;
+    }
+
+private:
+
+    static std::string name(const size_t i)
+    {
+        return "fb-" + std::to_string(::getpid()) + "-" + std::to_string(i);
+    }
+
+    /// Connects and logs every client in, then reads until the login notifications stop.
+    void connect()
+    {
+        for (size_t i = 0; i < _clients.size(); ++i)
+        {
+            client& c = _clients[i];
+            c.socket = std::make_shared<net::socket>("127.0.0.1", _port);
+            c.socket->setBlocking(false);
+
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            ::epoll_ctl(_epoll, EPOLL_CTL_ADD, c.socket->fd(), &ev);
+
+            const std::string login = msg::json::to(msg::request::login(name(i)).toJson());
+            c.socket->write(login.data(), login.size());
+
+            // keeps the notifications of earlier logins from piling up in the kernel meanwhile
+            if (i % 64 == 63)
+            {
+                drain(std::chrono::milliseconds(0));
+            }
+        }
+
+        while (drain(std::chrono::milliseconds(300)) > 0)
+        {
+        }
+    }
+
+    /// Reads whatever arrives within @p quiet. @return Bytes read
+    size_t drain(const std::chrono::milliseconds quiet)
+    {
+        size_t total = 0;
+        std::string data;
+        int n;
+        while ((n = ::epoll_wait(_epoll, _events.data(), static_cast<int>(_events.size()), static_cast<int>(quiet.count()))) > 0)
+        {
+            for (int e = 0; e < n; ++e)
+            {
+                const std::shared_ptr<net::socket>& sock = _clients[_events[e].data.u64].socket;
+                while (sock->read(&data) > 0)
+                {
+                    total += data.size();
+                }
+            }
+        }
+        return total;
+    }
+
+    /// Reads until every client has seen @p marker once. @return `false` if @p deadline passed first
+    bool receiveAll(const std::string& marker, const steady_clock_t::time_point deadline)
+    {
+        for (client& c : _clients)
+        {
+            c.seen = 0;
+            c.tail.clear();
+        }
+
+        size_t remaining = _clients.size();
+        std::string data;
+        while (remaining > 0)
+        {
+            const steady_clock_t::time_point now = steady_clock_t::now();
+            if (now >= deadline)
+            {
+                return false;
+            }
+
+            const int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+            const int n = ::epoll_wait(_epoll, _events.data(), static_cast<int>(_events.size()), timeout);
+            for (int e = 0; e < n; ++e)
+            {
+                client& c = _clients[_events[e].data.u64];
+                while (c.socket->read(&data) > 0)
+                {
+                    c.tail.append(data);
+                    if (c.seen == 0 && c.tail.find(marker) != std::string::npos)
+                    {
+                        c.seen = 1;
+                        --remaining;
+                    }
+                    c.tail.erase(0, c.tail.size() > marker.size() ? c.tail.size() - marker.size() : 0);
+                }
+            }
+        }
+        return true;
+    }
+
+    const options& _opts;
+    const net::port_t _port;
+    const int _epoll;
+    std::vector<epoll_event> _events;
+    std::vector<client> _clients;
+};
+
+std::vector<size_t> parseList(const char* const value)
+{
+    std::vector<size_t> out;
+    std::istringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        out.push_back(std::strtoull(item.c_str(), nullptr, 10));
+    }
+    return out;
+}
+
+void usage(const char* const argv0)
+{
+    const options defaults;
+    std::cerr << "Usage: " << argv0 << " [options]" << std::endl
+              << "  --clients N,N...   Client counts to measure (default 10,100,1000,10000)" << std::endl
+              << "  --rounds N         Broadcasts per client count (default " << defaults.rounds << ")" << std::endl
+              << "  --workers N        Server worker threads (default " << defaults.workers << ")" << std::endl
+              << "  --round-timeout S  Longest a broadcast may take (default " << defaults.roundTimeout << ")" << std::endl
+              << "  --csv PATH         Also write the results as CSV" << std::endl;
+}
+
+/// Draws @p value as a bar on a log scale from 1 us, @p scale characters per decade.
+std::string bar(const double value, const double scale, const char c)
+{
+    return std::string(static_cast<size_t>(std::max(0.0, std::log10(std::max(value, 1.0)) * scale)), c);
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--clients") == 0) opts.clients = parseList(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--rounds") == 0) opts.rounds = std::strtoull(argv[i + 1], nullptr, 10);
+        else if (std::strcmp(argv[i], "--workers") == 0) opts.workers = std::strtoull(argv[i + 1], nullptr, 10);
+        else if (std::strcmp(argv[i], "--round-timeout") == 0) opts.roundTimeout = std::strtod(argv[i + 1], nullptr);
+        else if (std::strcmp(argv[i], "--csv") == 0) opts.csv = argv[i + 1];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc % 2 == 0 || opts.rounds == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // both ends of every connection live in this process
+    const size_t most = *std::max_element(opts.clients.begin(), opts.clients.end());
+    rlimit lim;
+    if (::getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &lim);
+        if (lim.rlim_cur < 2 * most + 64)
+        {
+            std::cerr << "Only " << lim.rlim_cur << " descriptors allowed, " << 2 * most + 64 << " are needed" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    se3313::logging::config diagnostics;
+    diagnostics.threshold = se3313::logging::level::WARN;
+    se3313::logging::configure(diagnostics);
+
+    // the clients read everything, no limit should get in the way of measuring fan-out
+    dzagar::server_config config;
+    config.workers = opts.workers;
+    config.stdinCommands = false;
+    config.egress.highWaterBytes = 64 * 1024 * 1024;
+    config.egress.lowWaterBytes = 32 * 1024 * 1024;
+    config.egress.maxTotalBytes = 4ull * 1024 * 1024 * 1024;
+    config.egress.onSlowConsumer = dzagar::egress_config::policy::DROP;
+    config.backpressure.highPendingRequests = 0;
+    config.backpressure.highEgressBytes = 0;
+
+    const net::port_t port = freePort();
+    const std::shared_ptr<dzagar::server> srv = std::make_shared<dzagar::server>(port, config);
+    std::thread serving([srv](){ srv->start(); });
+
+    // the server is up once it accepts connections
+    for (int attempt = 0; ; ++attempt)
+    {
+        try
+        {
+            net::socket probe("127.0.0.1", port);
+            break;
+        }
+        catch (const std::runtime_error&)
+        {
+            if (attempt == 100)
+            {
+                std::cerr << "The server did not start" << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+
+    std::vector<result> results;
+    for (const size_t n : opts.clients)
+    {
+        std::cout << "Broadcasting to " << n << " clients..." << std::flush;
+        results.push_back(round_runner(opts, port, std::max<size_t>(n, 1)).run());
+        std::cout << " " << results.back().rounds.size() << " rounds, setup " << std::fixed << std::setprecision(1)
+                  << results.back().setup << " s" << std::endl;
+
+        // lets the server close the sessions before the next count connects
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+
+    srv->stop();
+    serving.join();
+
+    std::cout << std::endl << std::setw(8) << "clients" << std::setw(8) << "rounds" << std::setw(12) << "p50 us"
+              << std::setw(12) << "p99 us" << std::setw(12) << "max us" << std::setw(14) << "p50 us/client" << std::endl;
+    for (const result& r : results)
+    {
+        std::cout << std::setw(8) << r.clients << std::setw(8) << r.rounds.size() << std::setprecision(1)
+                  << std::setw(12) << r.percentile(0.5) << std::setw(12) << r.percentile(0.99) << std::setw(12) << r.percentile(1)
+                  << std::setprecision(3) << std::setw(14) << r.percentile(0.5) / static_cast<double>(r.clients) << std::endl;
+    }
+
+    // a log-log chart: equal steps in clients should add equal bar length if fan-out stays linear
+    std::cout << std::endl << "p50 (=) and p99 (#), log scale, 8 characters per decade from 1 us" << std::endl;
+    for (const result& r : results)
+    {
+        std::cout << std::setw(8) << r.clients << " |" << bar(r.percentile(0.5), 8, '=') << std::endl
+                  << std::setw(8) << "" << " |" << bar(r.percentile(0.99), 8, '#') << std::endl;
+    }
+
+    if (!opts.csv.empty())
+    {
+        std::ofstream csv(opts.csv);
+        csv << "clients,rounds,p50_us,p99_us,max_us" << std::endl;
+        for (const result& r : results)
+        {
+            csv << r.clients << "," << r.rounds.size() << "," << r.percentile(0.5) << "," << r.percentile(0.99) << "," << r.percentile(1) << std::endl;
+        }
+    }
+}
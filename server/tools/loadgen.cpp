@@ -0,0 +1,639 @@
+/**
+ * Load generator for the chat server.
+ *
+ * Simulates many clients spread over a few threads, each thread driving its share of the connections
+ * with epoll. The clock starts once every client is connected. Every client logs in under a unique name, joins one of `--rooms` rooms (leaving the lobby,
+ * so logins do not reach every other client) and sends messages of random size at a random rate.
+ *
+ * Each message carries the time it was sent, so every copy the server delivers to a member of the room
+ * gives an end-to-end latency. Messages sent during the warm-up are delivered but not measured. Prints
+ * progress every second and throughput, delivery ratio and latency percentiles at the end.
+ *
+ * With `--error-fraction` that share of the sends are requests the server refuses instead, malformed
+ * frames, messages to rooms the client is not in, direct messages to nobody and second logins, so the
+ * error paths see traffic too (the profile-guided build trains on this, see `tools/pgo.sh`).
+ */
+
+#include <metrics/registry.hpp>
+
+#include <msg/direct.hpp>
+#include <msg/json.hpp>
+#include <msg/login.hpp>
+#include <msg/message.hpp>
+#include <msg/room.hpp>
+#include <msg/visitor.hpp>
+
+#include <networking/socket.hpp>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace msg = se3313::msg;
+namespace net = se3313::networking;
+
+using se3313::metrics::registry;
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady_clock_t;
+
+/// How message sizes are drawn around `options::size`
+enum class size_dist { FIXED, UNIFORM, EXPONENTIAL };
+
+struct options
+{
+    std::string host = "127.0.0.1";
+    net::port_t port = 0;
+    size_t clients = 1000;
+    size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    /// Rooms the clients are spread over, 0 keeps everyone in the lobby
+    size_t rooms = 0;
+
+    /// Messages per second sent by each client, with exponential gaps
+    double rate = 1;
+
+    /// Mean content bytes of a message
+    size_t size = 64;
+    size_dist sizes = size_dist::FIXED;
+
+    double warmup = 2;
+    double duration = 10;
+
+    /// Time left for the last messages to arrive
+    double drain = 2;
+
+    /// Share of the sends that are requests the server answers with an error
+    double errorFraction = 0;
+};
+
+/// Marks content written by this tool, followed by the send time in nanoseconds
+constexpr const char STAMP[] = "lg:";
+
+const se3313::metrics::latency g_latency = registry::makeLatency("loadgen_delivery_seconds", "Time from sending a message to a member receiving it");
+const se3313::metrics::counter g_sent = registry::makeCounter("loadgen_sent_total", "Messages sent");
+const se3313::metrics::counter g_sentBytes = registry::makeCounter("loadgen_sent_bytes_total", "Bytes sent");
+const se3313::metrics::counter g_expected = registry::makeCounter("loadgen_expected_total", "Deliveries expected for the measured messages");
+const se3313::metrics::counter g_delivered = registry::makeCounter("loadgen_delivered_total", "Messages received");
+const se3313::metrics::counter g_measured = registry::makeCounter("loadgen_measured_total", "Measured messages received");
+const se3313::metrics::counter g_receivedBytes = registry::makeCounter("loadgen_received_bytes_total", "Bytes received");
+const se3313::metrics::counter g_refused = registry::makeCounter("loadgen_refused_total", "Requests sent to be refused");
+const se3313::metrics::counter g_errors = registry::makeCounter("loadgen_errors_total", "Error responses received");
+const se3313::metrics::counter g_flowControl = registry::makeCounter("loadgen_flow_control_total", "Flow control responses received");
+const se3313::metrics::counter g_disconnects = registry::makeCounter("loadgen_disconnects_total", "Connections the server closed");
+const se3313::metrics::gauge g_loggedIn = registry::makeGauge("loadgen_logged_in", "Clients whose login was answered");
+
+int64_t nanos(const steady_clock_t::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+/// One simulated client
+struct client
+{
+    std::shared_ptr<net::socket> socket;
+    std::string name;
+    std::string room;
+
+    /// Received bytes not forming a complete line yet
+    std::string inbound;
+
+    /// Output the socket has not taken yet
+    std::string outbound;
+
+    bool loggedIn = false;
+    
+    /// Set while epoll reports when the socket takes output again
+    bool watchingWritable = false;
+};
+
+/// Measures what one client receives
+class receiver final : public msg::response::abstract_message_visitor<>
+{
+
+public:
+
+    receiver(client* const c, const int64_t measureFrom, const int64_t measureUntil)
+        : _client(c)
+        , _measureFrom(measureFrom)
+        , _measureUntil(measureUntil)
+    { }
+
+    void visitLogin(const msg::response::login& resp) override
+    {
+        if (resp.joiningUsername() == _client->name)
+        {
+            loggedIn();
+        }
+    }
+    
+    void visitJoin(const msg::response::join& resp) override
+    {
+        // the lobby may have been left before the login was fanned out, joining the room proves it too
+        if (resp.username() == _client->name)
+        {
+            loggedIn();
+        }
+    }
+
+    void visitMessage(const msg::response::message& resp) override
+    {
+        g_delivered.inc();
+        const std::string content = resp.content();
+        if (content.compare(0, sizeof(STAMP) - 1, STAMP) != 0)
+        {
+            return;
+        }
+
+        const int64_t sent = std::strtoll(content.c_str() + sizeof(STAMP) - 1, nullptr, 10);
+        if (sent >= _measureFrom && sent < _measureUntil)
+        {
+            g_measured.inc();
+            g_latency.record(static_cast<uint64_t>(std::max<int64_t>(0, nanos(steady_clock_t::now()) - sent)));
+        }
+    }
+
+    void visitFlowControl(const msg::response::flow_control&) override
+    {
+        g_flowControl.inc();
+    }
+
+    void error(const std::string&, const msg::ErrorCode, const std::string&) override
+    {
+        g_errors.inc();
+    }
+
+private:
+    
+    void loggedIn()
+    {
+        if (!_client->loggedIn)
+        {
+            _client->loggedIn = true;
+            g_loggedIn.inc();
+        }
+    }
+
+    client* const _client;
+    const int64_t _measureFrom;
+    const int64_t _measureUntil;
+};
+
+/// Drives a share of the clients on one thread
+class driver final
+{
+
+public:
+
+    driver(const options& opts, const std::vector<size_t>& roomSizes, const size_t first, const size_t count)
+        : _opts(opts)
+        , _roomSizes(roomSizes)
+        , _first(first)
+        , _count(count)
+        , _random(first * 7919 + 1)
+    { }
+
+    /**
+     * Connects the clients, then drives them from @p start on.
+     * @param connected Incremented once the clients are connected
+     */
+    void run(std::atomic<size_t>* const connected, std::shared_future<steady_clock_t::time_point> start)
+    {
+        _epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        connect();
+        connected->fetch_add(1);
+        _start = start.get();
+
+        const steady_clock_t::time_point measureFrom = _start + seconds(_opts.warmup);
+        const steady_clock_t::time_point stopSending = measureFrom + seconds(_opts.duration);
+        const steady_clock_t::time_point stop = stopSending + seconds(_opts.drain);
+        std::bernoulli_distribution refused(std::min(_opts.errorFraction, 1.0));
+        _measureFrom = nanos(measureFrom);
+        _measureUntil = nanos(stopSending);
+
+        std::exponential_distribution<double> gap(_opts.rate > 0 ? _opts.rate : 1);
+        if (_opts.rate > 0)
+        {
+            for (size_t i = 0; i < _clients.size(); ++i)
+            {
+                _due.emplace(_start + seconds(gap(_random)), i);
+            }
+        }
+
+        std::vector<epoll_event> events(256);
+        for (steady_clock_t::time_point now = steady_clock_t::now(); now < stop; now = steady_clock_t::now())
+        {
+            while (!_due.empty() && _due.top().first <= now && now < stopSending)
+            {
+                const size_t i = _due.top().second;
+                _due.pop();
+                if (refused(_random))
+                {
+                    sendRefused(i);
+                }
+                else
+                {
+                    send(i, now);
+                }
+                _due.emplace(now + seconds(gap(_random)), i);
+            }
+
+            const steady_clock_t::time_point next = _due.empty() || now >= stopSending ? stop : std::min(_due.top().first, stop);
+            const int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count());
+            const int n = ::epoll_wait(_epoll, events.data(), static_cast<int>(events.size()), std::max(timeout, 0));
+            for (int e = 0; e < n; ++e)
+            {
+                client& c = _clients[events[e].data.u64];
+                if (events[e].events & EPOLLOUT)
+                {
+                    flush(events[e].data.u64);
+                }
+                if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    receive(c);
+                }
+            }
+        }
+
+        for (client& c : _clients)
+        {
+            c.socket->close();
+        }
+        ::close(_epoll);
+    }
+
+private:
+
+    static steady_clock_t::duration seconds(const double s)
+    {
+        return std::chrono::duration_cast<steady_clock_t::duration>(std::chrono::duration<double>(s));
+    }
+
+    /// Connects and logs in every client, each moving from the lobby to its room.
+    void connect()
+    {
+        _clients.resize(_count);
+        for (size_t i = 0; i < _count; ++i)
+        {
+            const size_t id = _first + i;
+            client& c = _clients[i];
+            c.socket = std::make_shared<net::socket>(_opts.host, _opts.port);
+            c.socket->setBlocking(false);
+            c.name = "load-" + std::to_string(::getpid()) + "-" + std::to_string(id);
+            c.room = _opts.rooms > 0 ? "load-" + std::to_string(id % _opts.rooms) : msg::instance::DEFAULT_ROOM;
+
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            ::epoll_ctl(_epoll, EPOLL_CTL_ADD, c.socket->fd(), &ev);
+
+            std::string hello = msg::json::to(msg::request::login(c.name).toJson());
+            if (_opts.rooms > 0)
+            {
+                hello += msg::json::to(msg::request::join(c.name, c.room).toJson());
+                hello += msg::json::to(msg::request::leave(c.name, msg::instance::DEFAULT_ROOM).toJson());
+            }
+            write(i, hello);
+        }
+    }
+
+    /// Sends client @p i's next message, stamped with @p now.
+    void send(const size_t i, const steady_clock_t::time_point now)
+    {
+        client& c = _clients[i];
+        if (!c.socket->isOpen() || !c.outbound.empty())
+        {
+            // a client the server stopped reading from does not pile up more
+            return;
+        }
+
+        std::string content = STAMP + std::to_string(nanos(now)) + " ";
+        content.resize(std::max(content.size(), contentSize()), 'x');
+
+        const std::string frame = msg::json::to(msg::request::message(c.name, content, c.room).toJson());
+        g_sent.inc();
+        g_sentBytes.inc(frame.size());
+        const int64_t sent = nanos(now);
+        if (sent >= _measureFrom && sent < _measureUntil)
+        {
+            g_expected.inc(_opts.rooms > 0 ? _roomSizes[(_first + i) % _opts.rooms] : _roomSizes[0]);
+        }
+        write(i, frame);
+    }
+
+    /// Sends one of the requests the server refuses for client @p i, each kind in turn.
+    void sendRefused(const size_t i)
+    {
+        client& c = _clients[i];
+        if (!c.socket->isOpen() || !c.outbound.empty())
+        {
+            return;
+        }
+
+        std::string frame;
+        switch (_refused++ % 4)
+        {
+            case 0:
+                frame = "{\"type\": \"message\", \"content\": \n";
+                break;
+            case 1:
+                frame = msg::json::to(msg::request::message(c.name, "refused", "load-nowhere").toJson());
+                break;
+            case 2:
+                frame = msg::json::to(msg::request::direct(c.name, "load-nobody", "refused").toJson());
+                break;
+            default:
+                frame = msg::json::to(msg::request::login(c.name).toJson());
+                break;
+        }
+        g_refused.inc();
+        write(i, frame);
+    }
+
+    size_t contentSize()
+    {
+        switch (_opts.sizes)
+        {
+            case size_dist::UNIFORM:
+                return std::uniform_int_distribution<size_t>(1, 2 * _opts.size)(_random);
+            case size_dist::EXPONENTIAL:
+                return static_cast<size_t>(std::exponential_distribution<double>(1.0 / std::max<size_t>(_opts.size, 1))(_random)) + 1;
+            default:
+                return _opts.size;
+        }
+    }
+
+    void write(const size_t i, const std::string& data)
+    {
+        client& c = _clients[i];
+        c.outbound.append(data);
+        flush(i);
+    }
+
+    void flush(const size_t i)
+    {
+        client& c = _clients[i];
+        while (!c.outbound.empty() && c.socket->isOpen())
+        {
+            const ssize_t written = c.socket->write(c.outbound.data(), c.outbound.size());
+            if (written <= 0)
+            {
+                break;
+            }
+            c.outbound.erase(0, static_cast<size_t>(written));
+        }
+
+        if (c.socket->isOpen() && c.watchingWritable == c.outbound.empty())
+        {
+            c.watchingWritable = !c.outbound.empty();
+            epoll_event ev;
+            ev.events = c.watchingWritable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            ev.data.u64 = i;
+            ::epoll_ctl(_epoll, EPOLL_CTL_MOD, c.socket->fd(), &ev);
+        }
+    }
+
+    void receive(client& c)
+    {
+        std::string data;
+        while (c.socket->isOpen())
+        {
+            const ssize_t n = c.socket->read(&data);
+            if (n <= 0)
+            {
+                break;
+            }
+            g_receivedBytes.inc(static_cast<uint64_t>(n));
+            c.inbound.append(data);
+        }
+
+        if (!c.socket->isOpen())
+        {
+            g_disconnects.inc();
+            ::epoll_ctl(_epoll, EPOLL_CTL_DEL, c.socket->fd(), nullptr);
+        }
+
+        receiver visitor(&c, _measureFrom, _measureUntil);
+        size_t start = 0;
+        size_t end;
+        while ((end = c.inbound.find('\n', start)) != std::string::npos)
+        {
+            if (end > start)
+            {
+                try
+                {
+                    boost::property_tree::ptree json = msg::json::from(c.inbound.substr(start, end - start));
+                    visitor.visit(json);
+                }
+                catch (const boost::property_tree::json_parser_error&)
+                {
+                    g_errors.inc();
+                }
+            }
+            start = end + 1;
+        }
+        c.inbound.erase(0, start);
+    }
+
+    const options& _opts;
+    const std::vector<size_t>& _roomSizes;
+    const size_t _first;
+    const size_t _count;
+    steady_clock_t::time_point _start;
+
+    std::mt19937_64 _random;
+    int _epoll;
+    std::vector<client> _clients;
+    int64_t _measureFrom = 0;
+    int64_t _measureUntil = 0;
+    uint64_t _refused = 0;
+
+    /// When each client sends next, soonest first
+    std::priority_queue<std::pair<steady_clock_t::time_point, size_t>, std::vector<std::pair<steady_clock_t::time_point, size_t>>,
+                        std::greater<std::pair<steady_clock_t::time_point, size_t>>> _due;
+};
+
+void usage(const char* const argv0)
+{
+    const options defaults;
+    std::cerr << "Usage: " << argv0 << " --port N [options]" << std::endl
+              << "  --host IP         Server address (default " << defaults.host << ")" << std::endl
+              << "  --clients N       Simulated clients (default " << defaults.clients << ")" << std::endl
+              << "  --threads N       Threads driving them (default " << defaults.threads << ")" << std::endl
+              << "  --rooms N         Rooms the clients are spread over, 0 for the lobby (default " << defaults.rooms << ")" << std::endl
+              << "  --rate F          Messages per second per client (default " << defaults.rate << ")" << std::endl
+              << "  --size N          Mean message content bytes (default " << defaults.size << ")" << std::endl
+              << "  --size-dist D     fixed, uniform or exponential (default fixed)" << std::endl
+              << "  --warmup S        Seconds before measuring (default " << defaults.warmup << ")" << std::endl
+              << "  --duration S      Seconds measured (default " << defaults.duration << ")" << std::endl
+              << "  --drain S         Seconds left for the last deliveries (default " << defaults.drain << ")" << std::endl
+              << "  --error-fraction F  Share of the sends the server refuses (default " << defaults.errorFraction << ")" << std::endl;
+}
+
+double parseNumber(const char* const option, const char* const value)
+{
+    char* end = nullptr;
+    const double v = std::strtod(value, &end);
+    if (!*value || *end || v < 0)
+    {
+        std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+/// Allows as many descriptors as the hard limit does, tens of thousands of clients need them.
+void raiseDescriptorLimit(const size_t wanted)
+{
+    rlimit lim;
+    if (::getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &lim);
+    }
+    if (::getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < wanted)
+    {
+        std::cerr << "Only " << lim.rlim_cur << " descriptors allowed, fewer than the " << wanted << " clients need" << std::endl;
+    }
+}
+
+void printLatency(const char* const label, const uint64_t ns)
+{
+    std::cout << std::setw(8) << label << std::setw(12) << std::fixed << std::setprecision(3) << static_cast<double>(ns) / 1e6 << " ms" << std::endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char* const o = argv[i];
+        const char* const v = argv[i + 1];
+        if (std::strcmp(o, "--host") == 0) opts.host = v;
+        else if (std::strcmp(o, "--port") == 0) opts.port = static_cast<net::port_t>(parseNumber(o, v));
+        else if (std::strcmp(o, "--clients") == 0) opts.clients = static_cast<size_t>(parseNumber(o, v));
+        else if (std::strcmp(o, "--threads") == 0) opts.threads = std::max<size_t>(1, static_cast<size_t>(parseNumber(o, v)));
+        else if (std::strcmp(o, "--rooms") == 0) opts.rooms = static_cast<size_t>(parseNumber(o, v));
+        else if (std::strcmp(o, "--rate") == 0) opts.rate = parseNumber(o, v);
+        else if (std::strcmp(o, "--size") == 0) opts.size = static_cast<size_t>(parseNumber(o, v));
+        else if (std::strcmp(o, "--warmup") == 0) opts.warmup = parseNumber(o, v);
+        else if (std::strcmp(o, "--duration") == 0) opts.duration = parseNumber(o, v);
+        else if (std::strcmp(o, "--drain") == 0) opts.drain = parseNumber(o, v);
+        else if (std::strcmp(o, "--error-fraction") == 0) opts.errorFraction = parseNumber(o, v);
+        else if (std::strcmp(o, "--size-dist") == 0 && std::strcmp(v, "fixed") == 0) opts.sizes = size_dist::FIXED;
+        else if (std::strcmp(o, "--size-dist") == 0 && std::strcmp(v, "uniform") == 0) opts.sizes = size_dist::UNIFORM;
+        else if (std::strcmp(o, "--size-dist") == 0 && std::strcmp(v, "exponential") == 0) opts.sizes = size_dist::EXPONENTIAL;
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (opts.port == 0 || argc % 2 == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    raiseDescriptorLimit(opts.clients + 64);
+    opts.threads = std::min(opts.threads, std::max<size_t>(opts.clients, 1));
+
+    // members of each room, every copy of a measured message is expected to arrive
+    std::vector<size_t> roomSizes(std::max<size_t>(opts.rooms, 1), 0);
+    for (size_t i = 0; i < opts.clients; ++i)
+    {
+        ++roomSizes[opts.rooms > 0 ? i % opts.rooms : 0];
+    }
+
+    std::cout << "Driving " << opts.clients << " clients on " << opts.threads << " threads against "
+              << opts.host << ":" << opts.port << std::endl;
+
+    std::atomic<size_t> connected(0);
+    std::promise<steady_clock_t::time_point> started;
+    const std::shared_future<steady_clock_t::time_point> startFuture = started.get_future().share();
+    
+    const steady_clock_t::time_point connecting = steady_clock_t::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < opts.threads; ++t)
+    {
+        const size_t first = opts.clients * t / opts.threads;
+        const size_t count = opts.clients * (t + 1) / opts.threads - first;
+        threads.emplace_back([&opts, &roomSizes, first, count, &connected, startFuture](){
+            try
+            {
+                driver(opts, roomSizes, first, count).run(&connected, startFuture);
+            }
+            catch (const std::exception& err)
+            {
+                std::cerr << "Driver failed: " << err.what() << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        });
+    }
+
+    while (connected.load() < threads.size())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const steady_clock_t::time_point start = steady_clock_t::now();
+    started.set_value(start);
+    std::cout << "Connected in " << std::chrono::duration_cast<std::chrono::milliseconds>(start - connecting).count() << " ms" << std::endl;
+    
+    const double total = opts.warmup + opts.duration + opts.drain;
+    uint64_t lastSent = 0;
+    uint64_t lastDelivered = 0;
+    for (int s = 1; s <= static_cast<int>(total); ++s)
+    {
+        std::this_thread::sleep_until(start + std::chrono::seconds(s));
+        const uint64_t sent = g_sent.value();
+        const uint64_t delivered = g_delivered.value();
+        std::cout << std::setw(4) << s << "s  " << std::setw(8) << g_loggedIn.value() << " logged in  "
+                  << std::setw(10) << sent - lastSent << " sent/s  " << std::setw(10) << delivered - lastDelivered
+                  << " delivered/s" << std::endl;
+        lastSent = sent;
+        lastDelivered = delivered;
+    }
+
+    for (std::thread& t : threads)
+    {
+        t.join();
+    }
+
+    const se3313::metrics::latency_snapshot lat = g_latency.snapshot();
+    const uint64_t expected = g_expected.value();
+    std::cout << std::endl
+              << "Sent:        " << g_sent.value() << " messages, " << g_sentBytes.value() << " bytes" << std::endl
+              << "Received:    " << g_delivered.value() << " messages, " << g_receivedBytes.value() << " bytes" << std::endl
+              << "Measured:    " << g_measured.value() << " of " << expected << " expected deliveries ("
+              << std::fixed << std::setprecision(2) << (expected ? 100.0 * g_measured.value() / expected : 0.0) << "%)" << std::endl
+              << "Throughput:  " << std::setprecision(1) << g_measured.value() / std::max(opts.duration, 1e-9) << " deliveries/s, "
+              << std::setprecision(2) << g_receivedBytes.value() / total / 1e6 << " MB/s received" << std::endl
+              << "Errors:      " << g_errors.value() << " (" << g_refused.value() << " requests sent to be refused), flow control " << g_flowControl.value()
+              << ", disconnects " << g_disconnects.value() << std::endl
+              << "Latency:" << std::endl;
+    printLatency("mean", lat.mean);
+    printLatency("p50", lat.p50);
+    printLatency("p99", lat.p99);
+    printLatency("p99.9", lat.p999);
+    printLatency("max", lat.max);
+}
@@ -0,0 +1,219 @@
+/**
+ * Microbenchmarks of the message codec layer, run with Google Benchmark.
+ *
+ * Covers parsing and writing JSON (`json::from`, `json::to`), unwrapping the envelope
+ * (`instance::extractFrom`), every message type's `fromJson` and `toJson`, and dispatch through the
+ * request and response visitors. Each runs with small, typical and large free text (content, or the
+ * name for types without any) and reports bytes/s of encoded JSON and allocs/op, counted by hooking
+ * `malloc()` as the server's ALLOC_COUNTING build does, which `operator new` allocates through.
+ */
+
+#include <msg/direct.hpp>
+#include <msg/error.hpp>
+#include <msg/flow.hpp>
+#include <msg/json.hpp>
+#include <msg/login.hpp>
+#include <msg/message.hpp>
+#include <msg/room.hpp>
+#include <msg/visitor.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace msg = se3313::msg;
+namespace pt = boost::property_tree;
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+} // end extern "C"
+
+namespace
+{
+
+/// Allocations so far, the benchmarks run on one thread
+uint64_t g_allocations = 0;
+
+} // end anonymous namespace
+
+extern "C" void* malloc(size_t size)
+{
+    ++g_allocations;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    ++g_allocations;
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+    ++g_allocations;
+    return __libc_realloc(p, size);
+}
+
+namespace
+{
+
+/// Free text lengths: small, typical and large
+#define SE3313_BENCH_SIZES ->Arg(16)->Arg(256)->Arg(16 * 1024)
+
+std::string text(const benchmark::State& state)
+{
+    return std::string(static_cast<size_t>(state.range(0)), 'x');
+}
+
+/// An instance of each type whose free text is @p s
+template <typename T> T sample(const std::string& s);
+
+template <> msg::request::login sample(const std::string& s) { return msg::request::login(s, msg::request::login::CAPABILITY_FLOW_CONTROL); }
+template <> msg::request::message sample(const std::string& s) { return msg::request::message("alice", s, "general"); }
+template <> msg::request::join sample(const std::string& s) { return msg::request::join("alice", s); }
+template <> msg::request::leave sample(const std::string& s) { return msg::request::leave("alice", s); }
+template <> msg::request::direct sample(const std::string& s) { return msg::request::direct("alice", "bob", s); }
+template <> msg::response::login sample(const std::string& s) { return msg::response::login(s); }
+template <> msg::response::message sample(const std::string& s) { return msg::response::message("alice", s, "general"); }
+template <> msg::response::join sample(const std::string& s) { return msg::response::join("alice", s); }
+template <> msg::response::leave sample(const std::string& s) { return msg::response::leave("alice", s); }
+template <> msg::response::direct sample(const std::string& s) { return msg::response::direct("alice", "bob", s); }
+template <> msg::response::flow_control sample(const std::string&) { return msg::response::flow_control(msg::response::flow_control::ACTION_PAUSE); }
+template <> msg::response::error sample(const std::string& s) { return msg::response::error("alice", msg::ErrorCode::MALFORMED_REQUEST_UNKNWN, s); }
+
+/// Measures from where it is created, sets bytes/s and allocs/op when destroyed
+class measure final
+{
+
+public:
+
+    measure(benchmark::State& state, const size_t bytesPerOp)
+        : _state(state)
+        , _bytesPerOp(bytesPerOp)
+        , _first(g_allocations)
+    { }
+
+    ~measure()
+    {
+        _state.SetBytesProcessed(static_cast<int64_t>(_state.iterations() * _bytesPerOp));
+        _state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(g_allocations - _first), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+
+    benchmark::State& _state;
+    const size_t _bytesPerOp;
+    const uint64_t _first;
+};
+
+void BM_JsonFrom(benchmark::State& state)
+{
+    const std::string frame = msg::json::to(sample<msg::request::message>(text(state)).toJson());
+    measure m(state, frame.size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(msg::json::from(frame));
+    }
+}
+BENCHMARK(BM_JsonFrom) SE3313_BENCH_SIZES;
+
+void BM_JsonTo(benchmark::State& state)
+{
+    const pt::ptree json = sample<msg::request::message>(text(state)).toJson();
+    measure m(state, msg::json::to(json).size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(msg::json::to(json));
+    }
+}
+BENCHMARK(BM_JsonTo) SE3313_BENCH_SIZES;
+
+void BM_ExtractFrom(benchmark::State& state)
+{
+    const pt::ptree json = sample<msg::request::message>(text(state)).toJson();
+    measure m(state, msg::json::to(json).size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(msg::instance::extractFrom(json));
+    }
+}
+BENCHMARK(BM_ExtractFrom) SE3313_BENCH_SIZES;
+
+/// Decodes the object of a @c T, the part `extractFrom()` hands to it
+template <typename T>
+void BM_FromJson(benchmark::State& state)
+{
+    const T inst = sample<T>(text(state));
+    const pt::ptree object = msg::instance::extractFrom(inst.toJson())->second;
+    measure m(state, msg::json::to(inst.toJson()).size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(T::fromJson(object));
+    }
+}
+
+template <typename T>
+void BM_ToJson(benchmark::State& state)
+{
+    const T inst = sample<T>(text(state));
+    measure m(state, msg::json::to(inst.toJson()).size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(inst.toJson());
+    }
+}
+
+#define SE3313_BENCH_TYPE(T) \
+    BENCHMARK_TEMPLATE(BM_FromJson, T) SE3313_BENCH_SIZES; \
+    BENCHMARK_TEMPLATE(BM_ToJson, T) SE3313_BENCH_SIZES;
+
+SE3313_BENCH_TYPE(msg::request::login)
+SE3313_BENCH_TYPE(msg::request::message)
+SE3313_BENCH_TYPE(msg::request::join)
+SE3313_BENCH_TYPE(msg::request::leave)
+SE3313_BENCH_TYPE(msg::request::direct)
+SE3313_BENCH_TYPE(msg::response::login)
+SE3313_BENCH_TYPE(msg::response::message)
+SE3313_BENCH_TYPE(msg::response::join)
+SE3313_BENCH_TYPE(msg::response::leave)
+SE3313_BENCH_TYPE(msg::response::direct)
+SE3313_BENCH_TYPE(msg::response::flow_control)
+SE3313_BENCH_TYPE(msg::response::error)
+
+/// Answers nothing, so only the dispatch and decoding are measured
+class request_sink final : public msg::request::abstract_message_visitor<>
+{ };
+
+class response_sink final : public msg::response::abstract_message_visitor<>
+{ };
+
+/// Dispatches a parsed @c T through visitor @c V, including the decoding `visit()` does
+template <typename V, typename T>
+void BM_Visit(benchmark::State& state)
+{
+    V visitor;
+    const T inst = sample<T>(text(state));
+    pt::ptree json = inst.toJson();
+    measure m(state, msg::json::to(json).size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(&visitor);
+        visitor.visit(json);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_Visit, request_sink, msg::request::login) SE3313_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_Visit, request_sink, msg::request::message) SE3313_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_Visit, request_sink, msg::request::direct) SE3313_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_Visit, response_sink, msg::response::message) SE3313_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_Visit, response_sink, msg::response::error) SE3313_BENCH_SIZES;
+
+} // end anonymous namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# Builds the server with profile-guided optimization and reports its throughput against plain builds.
+#
+#   tools/pgo.sh [OUT]        or        cmake --build BUILD --target pgo
+#
+# 1. builds `release` (Release) and `release-lto` (Release with LTO) as the baselines,
+# 2. builds `pgo` instrumented (PGO=GENERATE) and trains it with loadgen: logins fanned out over the
+#    lobby, then room broadcasts, both with a share of requests the server refuses so the error paths
+#    are covered,
+# 3. rebuilds `pgo` from the profile with LTO (PGO=USE),
+# 4. captures an evaluation workload on the `release` server, shaped unlike the training (other client
+#    counts, rooms, rates, message sizes and error share) so the profile is not judged on its own data,
+# 5. replays the evaluation traffic as fast as each build takes it, PGO_RUNS times, and prints the
+#    median requests per second of each.
+#
+# Everything goes to OUT (default _pgo next to the sources). PGO_PORT picks the port (default 9500).
+
+set -e
+
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+OUT=$(mkdir -p "${1:-$SRC/_pgo}" && cd "${1:-$SRC/_pgo}" && pwd)
+PORT=${PGO_PORT:-9500}
+RUNS=${PGO_RUNS:-3}
+JOBS=$(nproc 2>/dev/null || echo 2)
+
+step() {
+    echo "== $*"
+}
+
+# build DIR TARGETS CMAKE_ARGS...
+build() {
+    dir=$1; targets=$2; shift 2
+    if ! cmake -S "$SRC" -B "$OUT/$dir" -DCMAKE_BUILD_TYPE=Release "$@" > "$OUT/$dir.cmake.log" 2>&1; then
+        echo "Configuring $dir failed, see $OUT/$dir.cmake.log" >&2
+        exit 1
+    fi
+    for target in $targets; do
+        if ! cmake --build "$OUT/$dir" -j"$JOBS" --target "$target" >> "$OUT/$dir.cmake.log" 2>&1; then
+            echo "Building $target in $dir failed, see $OUT/$dir.cmake.log" >&2
+            exit 1
+        fi
+    done
+}
+
+# start SERVER ARGS..., the server reads its commands from a fifo held open on descriptor 3
+start() {
+    rm -f "$OUT/stdin"
+    mkfifo "$OUT/stdin"
+    "$@" --port "$PORT" < "$OUT/stdin" > "$OUT/server.log" 2>&1 &
+    SERVER=$!
+    exec 3> "$OUT/stdin"
+    sleep 1
+}
+
+# stop, the server exits normally so an instrumented one writes its profile
+stop() {
+    echo exit >&3
+    exec 3>&-
+    wait "$SERVER"
+}
+
+step "Building the baselines"
+build release "server loadgen replay"
+build release-lto "server" -DLTO=ON
+
+step "Building the instrumented server"
+rm -rf "$OUT/profile"
+build pgo "server" -DPGO=GENERATE -DPGO_PROFILE_DIR="$OUT/profile"
+
+step "Training"
+LOADGEN="$OUT/release/loadgen"
+start "$OUT/pgo/server"
+"$LOADGEN" --port "$PORT" --clients 200 --rate 2 --warmup 1 --duration 4 --drain 1 --error-fraction 0.05 > "$OUT/training-lobby.log"
+"$LOADGEN" --port "$PORT" --clients 400 --rooms 20 --rate 10 --warmup 1 --duration 6 --drain 1 --error-fraction 0.05 > "$OUT/training-rooms.log"
+stop
+if [ -z "$(ls -A "$OUT/profile" 2>/dev/null)" ]; then
+    echo "The instrumented server wrote no profile to $OUT/profile" >&2
+    exit 1
+fi
+
+step "Building the server from the profile"
+build pgo "server" -DPGO=USE -DPGO_PROFILE_DIR="$OUT/profile"
+
+step "Capturing the evaluation workload"
+start "$OUT/release/server" --capture "$OUT/evaluation.cap"
+"$LOADGEN" --port "$PORT" --clients 120 --rate 3 --size 96 --size-dist exponential --warmup 1 --duration 3 --drain 1 --error-fraction 0.02 > "$OUT/evaluation-lobby.log"
+"$LOADGEN" --port "$PORT" --clients 300 --rooms 45 --rate 15 --size 160 --size-dist uniform --warmup 1 --duration 5 --drain 1 --error-fraction 0.02 > "$OUT/evaluation-rooms.log"
+stop
+
+# throughput BUILD, the median of the runs' requests per second
+throughput() {
+    for run in $(seq "$RUNS"); do
+        start "$OUT/$1/server"
+        "$OUT/release/replay" "$OUT/evaluation.cap" --port "$PORT" --speed 0 --drain 1 > "$OUT/replay-$1-$run.log"
+        stop
+        sed -n 's/.*Requests: *[0-9]* ([0-9]* bytes), \([0-9.]*\)\/s/\1/p' "$OUT/replay-$1-$run.log"
+    done | sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+step "Measuring, median of $RUNS replays of $(du -h "$OUT/evaluation.cap" | cut -f1) of evaluation traffic each"
+BASE=$(throughput release)
+LTO=$(throughput release-lto)
+PGO=$(throughput pgo)
+
+echo
+printf "%-14s %14s %10s\n" "build" "requests/s" "change"
+for row in "release $BASE" "release-lto $LTO" "pgo+lto $PGO"; do
+    set -- $row
+    printf "%-14s %14.1f %+9.1f%%\n" "$1" "$2" "$(echo "$2 $BASE" | awk '{ print ($1 / $2 - 1) * 100 }')"
+done
+echo
+echo "The optimized server is $OUT/pgo/server"
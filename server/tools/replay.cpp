@@ -0,0 +1,367 @@
+/**
+ * Replays traffic captured by the server (`--capture PATH` or the `capture PATH` command) against a
+ * server, to reproduce a recorded traffic shape and compare builds under it.
+ *
+ * Every captured connection gets its own client, opened, fed its requests and closed at the captured
+ * times scaled by `--speed`, or as fast as the server takes them with `--speed 0`, which also keeps
+ * every connection open until the end so the answers are not cut off. Responses are read and discarded
+ * so the server never sees a slow consumer. Prints the achieved request rate up to the last response
+ * and how far behind schedule requests went out, which grows once the server can not keep up; the
+ * server's own `latency` and `metrics` commands give the latency of each stage.
+ */
+
+#include "traffic_capture.hpp"
+
+#include <metrics/registry.hpp>
+
+#include <networking/socket.hpp>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace net = se3313::networking;
+
+using dzagar::traffic_capture;
+using se3313::metrics::registry;
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady_clock_t;
+
+const se3313::metrics::latency g_lateness = registry::makeLatency("replay_lateness_seconds", "How far behind schedule requests were sent");
+
+struct options
+{
+    std::string capture;
+    std::string host = "127.0.0.1";
+    net::port_t port = 0;
+
+    /// Multiple of the captured pace, 0 for as fast as possible
+    double speed = 1;
+
+    /// Seconds without a response that end the replay after the last record
+    double drain = 2;
+
+    /// Bytes waiting to be sent over all clients before the replay stops to let the server catch up
+    size_t maxPending = 4 * 1024 * 1024;
+};
+
+/// A replayed connection
+struct client
+{
+    std::shared_ptr<net::socket> socket;
+
+    /// Requests not yet taken by the kernel
+    std::string outbound;
+
+    bool watchingWritable = false;
+
+    /// Close once the outbound requests are sent
+    bool closing = false;
+};
+
+class replayer final
+{
+
+public:
+
+    explicit replayer(const options& opts)
+        : _opts(opts)
+        , _epoll(::epoll_create1(EPOLL_CLOEXEC))
+        , _events(1024)
+        , _pending(0)
+    { }
+
+    ~replayer()
+    {
+        ::close(_epoll);
+    }
+
+    int run()
+    {
+        traffic_capture::reader capture(_opts.capture);
+
+        traffic_capture::record rec;
+        steady_clock_t::time_point began = steady_clock_t::now();
+        std::chrono::nanoseconds captured(0);
+        uint64_t records = 0;
+        while (capture.next(&rec))
+        {
+            const steady_clock_t::time_point due = began + std::chrono::duration_cast<steady_clock_t::duration>(scale(rec.at));
+            poll(due);
+            while (_pending > _opts.maxPending)
+            {
+                poll(steady_clock_t::now() + std::chrono::milliseconds(10));
+            }
+
+            if (rec.type == traffic_capture::kind::OPEN)
+            {
+                open(rec.connection);
+            }
+            else if (rec.type == traffic_capture::kind::FRAME)
+            {
+                const steady_clock_t::time_point now = steady_clock_t::now();
+                g_lateness.record(_opts.speed > 0 && now > due ? static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count()) : 0);
+                send(rec.connection, rec.frame);
+                _sentBytes += rec.frame.size() + 1;
+            }
+            else
+            {
+                close(rec.connection);
+            }
+            captured = rec.at;
+            ++records;
+        }
+
+        // requests still queued go out before the drain starts
+        while (_pending > 0)
+        {
+            poll(steady_clock_t::now() + std::chrono::milliseconds(10));
+        }
+        const steady_clock_t::duration quiet = std::chrono::duration_cast<steady_clock_t::duration>(std::chrono::duration<double>(_opts.drain));
+        _lastResponse = steady_clock_t::now();
+        while (steady_clock_t::now() < _lastResponse + quiet)
+        {
+            poll(_lastResponse + quiet);
+        }
+        const double elapsed = std::chrono::duration<double>(_lastResponse - began).count();
+
+        const se3313::metrics::latency_snapshot late = g_lateness.snapshot();
+        const double capturedSeconds = std::chrono::duration<double>(captured).count();
+        std::cout << std::fixed << std::setprecision(2)
+                  << "Replayed " << records << " records from " << _opts.capture << " in " << elapsed << " s (captured over "
+                  << capturedSeconds << " s)" << std::endl
+                  << "  Connections: " << _opened << " opened, " << _failed << " failed" << std::endl
+                  << "  Requests:    " << late.count << " (" << _sentBytes << " bytes), " << static_cast<double>(late.count) / std::max(elapsed, 1e-9) << "/s" << std::endl
+                  << "  Responses:   " << _responses << " (" << _receivedBytes << " bytes)" << std::endl;
+        if (_opts.speed > 0)
+        {
+            std::cout << std::setprecision(3) << "  Behind schedule (ms): p50 " << late.p50 / 1e6 << ", p99 " << late.p99 / 1e6
+                      << ", p99.9 " << late.p999 / 1e6 << ", max " << late.max / 1e6 << std::endl;
+        }
+        return _failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+private:
+
+    std::chrono::nanoseconds scale(const std::chrono::nanoseconds at) const
+    {
+        return _opts.speed > 0 ? std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(at.count()) / _opts.speed)) : std::chrono::nanoseconds(0);
+    }
+
+    void open(const uint64_t connection)
+    {
+        if (_clients.count(connection) > 0)
+        {
+            drop(connection);
+        }
+        client& c = _clients[connection];
+        try
+        {
+            c.socket = std::make_shared<net::socket>(_opts.host, _opts.port);
+        }
+        catch (const std::runtime_error& err)
+        {
+            // its requests are skipped, the rest of the replay goes on
+            std::cerr << "Connection " << connection << ": " << err.what() << std::endl;
+            _clients.erase(connection);
+            ++_failed;
+            return;
+        }
+        c.socket->setBlocking(false);
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = connection;
+        ::epoll_ctl(_epoll, EPOLL_CTL_ADD, c.socket->fd(), &ev);
+        ++_opened;
+    }
+
+    void send(const uint64_t connection, const std::string& frame)
+    {
+        const auto found = _clients.find(connection);
+        if (found == _clients.end())
+        {
+            return;
+        }
+        client& c = found->second;
+        c.outbound.append(frame).push_back('\n');
+        _pending += frame.size() + 1;
+        flush(connection, c);
+    }
+
+    void close(const uint64_t connection)
+    {
+        const auto found = _clients.find(connection);
+        if (found == _clients.end() || _opts.speed == 0)
+        {
+            return;
+        }
+
+        found->second.closing = true;
+        if (found->second.outbound.empty())
+        {
+            drop(connection);
+        }
+    }
+
+    void drop(const uint64_t connection)
+    {
+        client& c = _clients[connection];
+        _pending -= c.outbound.size();
+        ::epoll_ctl(_epoll, EPOLL_CTL_DEL, c.socket->fd(), nullptr);
+        c.socket->close();
+        _clients.erase(connection);
+    }
+
+    /// Writes what the kernel takes of @p c's requests, watching for room for the rest.
+    void flush(const uint64_t connection, client& c)
+    {
+        while (!c.outbound.empty())
+        {
+            const ssize_t written = c.socket->write(c.outbound.data(), c.outbound.size());
+            if (written <= 0)
+            {
+                break;
+            }
+            c.outbound.erase(0, static_cast<size_t>(written));
+            _pending -= static_cast<size_t>(written);
+        }
+
+        if (!c.socket->isOpen() || (c.closing && c.outbound.empty()))
+        {
+            drop(connection);
+            return;
+        }
+
+        const bool writable = !c.outbound.empty();
+        if (writable != c.watchingWritable)
+        {
+            c.watchingWritable = writable;
+            epoll_event ev;
+            ev.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            ev.data.u64 = connection;
+            ::epoll_ctl(_epoll, EPOLL_CTL_MOD, c.socket->fd(), &ev);
+        }
+    }
+
+    /// Reads responses and sends queued requests until @p until, at least once.
+    void poll(const steady_clock_t::time_point until)
+    {
+        std::string data;
+        do
+        {
+            const steady_clock_t::duration left = until - steady_clock_t::now();
+            const int timeout = left > steady_clock_t::duration::zero()
+                ? static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1 : 0;
+            const int n = ::epoll_wait(_epoll, _events.data(), static_cast<int>(_events.size()), timeout);
+            for (int e = 0; e < n; ++e)
+            {
+                const uint64_t connection = _events[e].data.u64;
+                auto found = _clients.find(connection);
+                if (found == _clients.end())
+                {
+                    continue;
+                }
+
+                ssize_t read;
+                while ((read = found->second.socket->read(&data)) > 0)
+                {
+                    _lastResponse = steady_clock_t::now();
+                    _receivedBytes += data.size();
+                    _responses += static_cast<uint64_t>(std::count(data.begin(), data.end(), '\n'));
+                }
+
+                // the server hung up on it, what is left for it can not be sent
+                if (read == 0 || !found->second.socket->isOpen())
+                {
+                    drop(connection);
+                    continue;
+                }
+                if (_events[e].events & EPOLLOUT)
+                {
+                    flush(connection, found->second);
+                }
+            }
+        } while (steady_clock_t::now() < until);
+    }
+
+    const options& _opts;
+    const int _epoll;
+    std::vector<epoll_event> _events;
+    std::unordered_map<uint64_t, client> _clients;
+    size_t _pending;
+    steady_clock_t::time_point _lastResponse;
+
+    uint64_t _opened = 0;
+    uint64_t _failed = 0;
+    uint64_t _sentBytes = 0;
+    uint64_t _receivedBytes = 0;
+    uint64_t _responses = 0;
+};
+
+void usage(const char* const argv0)
+{
+    const options defaults;
+    std::cerr << "Usage: " << argv0 << " CAPTURE --port N [options]" << std::endl
+              << "  --host ADDR      Server address (default " << defaults.host << ")" << std::endl
+              << "  --port N         Server port" << std::endl
+              << "  --speed X        Multiple of the captured pace, 0 for as fast as possible (default " << defaults.speed << ")" << std::endl
+              << "  --drain S        Seconds without a response that end the replay (default " << defaults.drain << ")" << std::endl
+              << "  --max-pending N  Unsent bytes that hold the replay back (default " << defaults.maxPending << ")" << std::endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-' && opts.capture.empty()) { opts.capture = argv[i]; continue; }
+        if (i + 1 >= argc) { usage(argv[0]); return EXIT_FAILURE; }
+
+        if (std::strcmp(argv[i], "--host") == 0) opts.host = argv[++i];
+        else if (std::strcmp(argv[i], "--port") == 0) opts.port = static_cast<net::port_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--speed") == 0) opts.speed = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--drain") == 0) opts.drain = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--max-pending") == 0) opts.maxPending = std::strtoull(argv[++i], nullptr, 10);
+        else { usage(argv[0]); return EXIT_FAILURE; }
+    }
+    if (opts.capture.empty() || opts.port == 0 || opts.speed < 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // one descriptor per captured connection that is open at once
+    rlimit lim;
+    if (::getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    try
+    {
+        return replayer(opts).run();
+    }
+    catch (const std::runtime_error& err)
+    {
+        std::cerr << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,410 @@
+/**
+ * Soak test of the server's memory and descriptor use under connection churn.
+ *
+ * Runs the server in-process and repeats a cycle of short-lived clients: each connects, logs in under
+ * a name never used before, joins one of a few rooms, sends messages and a direct message, then
+ * disconnects. Some hang up without reading their answers, some send garbage first. Every few cycles
+ * it samples RSS, the heap in use (`mallinfo2()`) and the open descriptors. Once the warm-up is over
+ * the growth per cycle of each is fitted by least squares, and the run fails when one exceeds its
+ * threshold, which is what state kept per name, room or connection and never pruned looks like.
+ */
+
+#include "server.hpp"
+
+#include <logging/log.hpp>
+
+#include <msg/direct.hpp>
+#include <msg/json.hpp>
+#include <msg/login.hpp>
+#include <msg/message.hpp>
+#include <msg/room.hpp>
+
+#include <networking/socket.hpp>
+
+#include <dirent.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace msg = se3313::msg;
+namespace net = se3313::networking;
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady_clock_t;
+
+struct options
+{
+    /// Cycles to run, and how long at most
+    uint64_t cycles = 100000;
+    double duration = 0;
+
+    /// Clients connecting in each cycle
+    size_t clients = 20;
+
+    /// Room messages each client sends
+    size_t messages = 4;
+
+    /// Rooms the clients are spread over
+    size_t rooms = 8;
+
+    /// Cycles between samples, and cycles ignored before fitting the growth
+    uint64_t sampleEvery = 500;
+    uint64_t warmup = 5000;
+
+    /// Largest growth per cycle tolerated
+    double maxRssGrowth = 64;
+    double maxHeapGrowth = 64;
+    double maxFdGrowth = 0.001;
+
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    /// File the samples are also written to as CSV, none if empty
+    std::string csv;
+};
+
+struct sample
+{
+    uint64_t cycle;
+    double seconds;
+    double rss;
+    double heap;
+    double fds;
+};
+
+double residentBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    statm >> size >> resident;
+    return static_cast<double>(resident * static_cast<uint64_t>(::sysconf(_SC_PAGESIZE)));
+}
+
+double heapBytes()
+{
+    const struct mallinfo2 info = ::mallinfo2();
+    return static_cast<double>(info.uordblks + info.hblkhd);
+}
+
+double openDescriptors()
+{
+    size_t n = 0;
+    if (DIR* const dir = ::opendir("/proc/self/fd"))
+    {
+        while (const dirent* const entry = ::readdir(dir))
+        {
+            n += entry->d_name[0] != '.';
+        }
+        ::closedir(dir);
+    }
+
+    // the one used to list them
+    return static_cast<double>(n) - 1;
+}
+
+/// Least squares slope of @p field over the samples taken after the warm-up.
+double growth(const std::vector<sample>& samples, const uint64_t warmup, double sample::* const field)
+{
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const sample& s : samples)
+    {
+        if (s.cycle < warmup)
+        {
+            continue;
+        }
+        const double x = static_cast<double>(s.cycle);
+        const double y = s.*field;
+        n += 1; sx += x; sy += y; sxx += x * x; sxy += x * y;
+    }
+    const double denominator = n * sxx - sx * sx;
+    return n < 3 || denominator == 0 ? 0 : (n * sxy - sx * sy) / denominator;
+}
+
+net::port_t freePort()
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd < 0 || ::bind(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 || ::getsockname(fd, (sockaddr*)&addr, &length) < 0)
+    {
+        throw std::runtime_error("Could not find a free port");
+    }
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/// Runs the cycles of short-lived clients against the server on @p port.
+class churn final
+{
+
+public:
+
+    churn(const options& opts, const net::port_t port)
+        : _opts(opts)
+        , _port(port)
+        , _epoll(::epoll_create1(EPOLL_CLOEXEC))
+        , _events(256)
+    { }
+
+    ~churn()
+    {
+        ::close(_epoll);
+    }
+
+    /// Runs cycle @p cycle. @return `false` if a client never got its answers
+    bool run(const uint64_t cycle)
+    {
+        struct client
+        {
+            std::shared_ptr<net::socket> socket;
+            std::string marker;
+            std::string tail;
+        };
+        std::vector<client> clients(_opts.clients);
+        size_t waiting = 0;
+
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            client& c = clients[i];
+            const std::string name = "soak-" + std::to_string(cycle) + "-" + std::to_string(i);
+            const std::string room = "room-" + std::to_string((cycle + i) % _opts.rooms);
+            const std::string peer = "soak-" + std::to_string(cycle) + "-" + std::to_string((i + 1) % clients.size());
+            c.marker = name + "-done";
+
+            std::string frames;
+            if (i % 4 == 2)
+            {
+                frames += "{\"not\": \"a request\"}\n";
+            }
+            frames += msg::json::to(msg::request::login(name).toJson());
+            frames += msg::json::to(msg::request::join(name, room).toJson());
+            for (size_t m = 0; m < _opts.messages; ++m)
+            {
+                frames += msg::json::to(msg::request::message(name, "message " + std::to_string(m) + " from " + name, room).toJson());
+            }
+            frames += msg::json::to(msg::request::direct(name, peer, "hello from " + name).toJson());
+            frames += msg::json::to(msg::request::message(name, c.marker, room).toJson());
+
+            c.socket = std::make_shared<net::socket>("127.0.0.1", _port);
+            c.socket->write(frames.data(), frames.size());
+
+            // a quarter hang up with their answers still on the way
+            if (i % 4 == 3)
+            {
+                c.socket->close();
+                c.socket.reset();
+                continue;
+            }
+
+            c.socket->setBlocking(false);
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            ::epoll_ctl(_epoll, EPOLL_CTL_ADD, c.socket->fd(), &ev);
+            ++waiting;
+        }
+
+        const steady_clock_t::time_point deadline = steady_clock_t::now() + std::chrono::seconds(10);
+        std::string data;
+        while (waiting > 0 && steady_clock_t::now() < deadline)
+        {
+            const int n = ::epoll_wait(_epoll, _events.data(), static_cast<int>(_events.size()), 100);
+            for (int e = 0; e < n; ++e)
+            {
+                client& c = clients[_events[e].data.u64];
+                while (c.socket && c.socket->read(&data) > 0)
+                {
+                    c.tail.append(data);
+                    if (c.tail.find(c.marker) != std::string::npos)
+                    {
+                        ::epoll_ctl(_epoll, EPOLL_CTL_DEL, c.socket->fd(), nullptr);
+                        c.socket->close();
+                        c.socket.reset();
+                        --waiting;
+                        break;
+                    }
+                    c.tail.erase(0, c.tail.size() > c.marker.size() ? c.tail.size() - c.marker.size() : 0);
+                }
+            }
+        }
+
+        for (client& c : clients)
+        {
+            if (c.socket)
+            {
+                ::epoll_ctl(_epoll, EPOLL_CTL_DEL, c.socket->fd(), nullptr);
+                c.socket->close();
+            }
+        }
+        return waiting == 0;
+    }
+
+private:
+
+    const options& _opts;
+    const net::port_t _port;
+    const int _epoll;
+    std::vector<epoll_event> _events;
+};
+
+void usage(const char* const argv0)
+{
+    const options defaults;
+    std::cerr << "Usage: " << argv0 << " [options]" << std::endl
+              << "  --cycles N            Cycles to run (default " << defaults.cycles << ")" << std::endl
+              << "  --duration S          Stop after this many seconds, 0 for no limit (default 0)" << std::endl
+              << "  --clients N           Clients connecting per cycle (default " << defaults.clients << ")" << std::endl
+              << "  --messages N          Room messages per client (default " << defaults.messages << ")" << std::endl
+              << "  --rooms N             Rooms the clients use (default " << defaults.rooms << ")" << std::endl
+              << "  --sample-every N      Cycles between samples (default " << defaults.sampleEvery << ")" << std::endl
+              << "  --warmup N            Cycles before growth is measured (default " << defaults.warmup << ")" << std::endl
+              << "  --max-rss-growth B    Resident bytes per cycle tolerated (default " << defaults.maxRssGrowth << ")" << std::endl
+              << "  --max-heap-growth B   Heap bytes per cycle tolerated (default " << defaults.maxHeapGrowth << ")" << std::endl
+              << "  --max-fd-growth N     Descriptors per cycle tolerated (default " << defaults.maxFdGrowth << ")" << std::endl
+              << "  --workers N           Server worker threads (default " << defaults.workers << ")" << std::endl
+              << "  --csv PATH            Also write the samples as CSV" << std::endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char* const v = argv[i + 1];
+        if (std::strcmp(argv[i], "--cycles") == 0) opts.cycles = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--duration") == 0) opts.duration = std::strtod(v, nullptr);
+        else if (std::strcmp(argv[i], "--clients") == 0) opts.clients = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--messages") == 0) opts.messages = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--rooms") == 0) opts.rooms = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--sample-every") == 0) opts.sampleEvery = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--warmup") == 0) opts.warmup = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--max-rss-growth") == 0) opts.maxRssGrowth = std::strtod(v, nullptr);
+        else if (std::strcmp(argv[i], "--max-heap-growth") == 0) opts.maxHeapGrowth = std::strtod(v, nullptr);
+        else if (std::strcmp(argv[i], "--max-fd-growth") == 0) opts.maxFdGrowth = std::strtod(v, nullptr);
+        else if (std::strcmp(argv[i], "--workers") == 0) opts.workers = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(argv[i], "--csv") == 0) opts.csv = v;
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc % 2 == 0 || opts.clients < 2 || opts.rooms == 0 || opts.sampleEvery == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    se3313::logging::config diagnostics;
+    diagnostics.threshold = se3313::logging::level::ERROR;
+    se3313::logging::configure(diagnostics);
+
+    dzagar::server_config config;
+    config.workers = opts.workers;
+    config.stdinCommands = false;
+
+    const net::port_t port = freePort();
+    const std::shared_ptr<dzagar::server> srv = std::make_shared<dzagar::server>(port, config);
+    std::thread serving([srv](){ srv->start(); });
+    for (int attempt = 0; ; ++attempt)
+    {
+        try
+        {
+            net::socket probe("127.0.0.1", port);
+            break;
+        }
+        catch (const std::runtime_error&)
+        {
+            if (attempt == 100)
+            {
+                std::cerr << "The server did not start" << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+
+    std::cout << std::setw(10) << "cycle" << std::setw(10) << "seconds" << std::setw(14) << "rss KiB"
+              << std::setw(14) << "heap KiB" << std::setw(8) << "fds" << std::endl;
+
+    churn cycles(opts, port);
+    std::vector<sample> samples;
+    const steady_clock_t::time_point began = steady_clock_t::now();
+    uint64_t stalled = 0;
+    uint64_t cycle = 0;
+    for (; cycle <= opts.cycles; ++cycle)
+    {
+        const double seconds = std::chrono::duration<double>(steady_clock_t::now() - began).count();
+        if (cycle % opts.sampleEvery == 0 || cycle == opts.cycles || (opts.duration > 0 && seconds >= opts.duration))
+        {
+            samples.push_back(sample{ cycle, seconds, residentBytes(), heapBytes(), openDescriptors() });
+            const sample& s = samples.back();
+            std::cout << std::fixed << std::setprecision(1) << std::setw(10) << s.cycle << std::setw(10) << s.seconds
+                      << std::setw(14) << s.rss / 1024 << std::setw(14) << s.heap / 1024 << std::setw(8) << s.fds << std::endl;
+        }
+        if (cycle == opts.cycles || (opts.duration > 0 && seconds >= opts.duration))
+        {
+            break;
+        }
+        stalled += !cycles.run(cycle);
+    }
+
+    srv->stop();
+    serving.join();
+
+    if (!opts.csv.empty())
+    {
+        std::ofstream csv(opts.csv);
+        csv << "cycle,seconds,rss_bytes,heap_bytes,fds" << std::endl;
+        for (const sample& s : samples)
+        {
+            csv << s.cycle << "," << s.seconds << "," << s.rss << "," << s.heap << "," << s.fds << std::endl;
+        }
+    }
+
+    const struct {
+        const char* name;
+        double sample::* field;
+        double limit;
+    } checks[] = {
+        { "RSS", &sample::rss, opts.maxRssGrowth },
+        { "Heap", &sample::heap, opts.maxHeapGrowth },
+        { "Descriptors", &sample::fds, opts.maxFdGrowth },
+    };
+
+    bool passed = stalled == 0;
+    std::cout << std::endl << cycle << " cycles, " << cycle * opts.clients << " clients, " << stalled << " stalled cycles" << std::endl;
+    if (cycle < opts.warmup + 3 * opts.sampleEvery)
+    {
+        std::cout << "Too few cycles after the warm-up to measure growth" << std::endl;
+    }
+    for (const auto& check : checks)
+    {
+        const double g = growth(samples, opts.warmup, check.field);
+        const bool ok = g <= check.limit;
+        passed &= ok;
+        std::cout << std::setprecision(4) << std::setw(12) << check.name << " growth: " << g << " per cycle (limit "
+                  << check.limit << ") " << (ok ? "ok" : "FAILED") << std::endl;
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,46 @@
+# Benchmarks and operational tools, built next to the server but not installed
+
+add_executable(worker_bench tools/worker_bench.cpp 
+                            server/src/worker_pool.cpp 
+                            server/include/worker_pool.hpp)
+target_link_libraries(worker_bench se3313)
+target_include_directories(worker_bench PRIVATE ${CMAKE_CURRENT_LIST_DIR}/../server/include)
+
+add_executable(loadgen tools/loadgen.cpp)
+target_link_libraries(loadgen se3313)
+
+add_executable(chat_bots tools/chat_bots.cpp)
+target_link_libraries(chat_bots se3313)
+
+# Codec microbenchmarks, only where Google Benchmark is installed
+find_package(benchmark QUIET)
+if(benchmark_FOUND)
+    add_executable(msg_bench tools/msg_bench.cpp)
+    target_link_libraries(msg_bench se3313 benchmark::benchmark)
+endif()
+
+# Fan-out latency against an in-process server
+add_executable(fanout_bench tools/fanout_bench.cpp)
+target_link_libraries(fanout_bench server_core)
+
+add_executable(replay tools/replay.cpp 
+                      server/src/traffic_capture.cpp 
+                      server/include/traffic_capture.hpp)
+target_link_libraries(replay se3313)
+target_include_directories(replay PRIVATE ${CMAKE_CURRENT_LIST_DIR}/../server/include)
+
+# Memory and descriptor growth under connection churn, against an in-process server
+add_executable(soak tools/soak.cpp)
+target_link_libraries(soak server_core)
+
+# Profile-guided build of the server, trained with loadgen and compared against plain builds
+if(PGO_UNSUPPORTED)
+    add_custom_target(pgo COMMAND sh -c "echo '${PGO_UNSUPPORTED}' >&2; exit 1")
+else()
+    add_custom_target(pgo COMMAND sh ${CMAKE_CURRENT_LIST_DIR}/pgo.sh ${CMAKE_BINARY_DIR}/pgo USES_TERMINAL)
+endif()
+
+# Hot upgrade check, runs the server binary and takes it over while clients keep sending
+add_executable(upgrade_test tools/upgrade_test.cpp)
+target_link_libraries(upgrade_test se3313)
+add_dependencies(upgrade_test server)
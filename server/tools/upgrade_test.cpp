@@ -0,0 +1,580 @@
+/**
+ * End-to-end check that a hot upgrade drops no client and loses or reorders no message.
+ *
+ * Starts the server binary with `--upgrade-socket`, connects `--clients` clients to the lobby and has
+ * each of them send `--messages` messages at `--rate` per second. Meanwhile it starts `--upgrades` new
+ * server processes with `--takeover`, one after the other, each taking the sockets over from the last.
+ * Every client reads everything the lobby gets, and checks that each sender's messages arrive once and
+ * in the order they were sent. Exits non-zero if any client saw its connection end, a message came out
+ * of order or never arrived, or an old process did not hand over and exit.
+ */
+
+#include <logging/log.hpp>
+
+#include <msg/json.hpp>
+#include <msg/login.hpp>
+#include <msg/message.hpp>
+
+#include <networking/socket.hpp>
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace msg = se3313::msg;
+namespace net = se3313::networking;
+
+namespace
+{
+
+typedef std::chrono::steady_clock steady_clock_t;
+
+struct options
+{
+    /// Server binary, the one built next to this tool by default
+    std::string server;
+
+    size_t clients = 20;
+
+    /// Messages sent by each client
+    size_t messages = 100;
+
+    /// Messages per second sent by each client
+    double rate = 10;
+
+    /// Processes taking over one after the other while the clients send
+    size_t upgrades = 2;
+
+    size_t workers = 2;
+
+    /// Longest an old process may take to hand over and exit
+    double handOffTimeout = 15;
+};
+
+/// Marks the messages of this tool in the frames, followed by `sender:sequence;`
+const char MARKER[] = "ut-seq:";
+
+/// A running server process
+struct process
+{
+    pid_t pid = -1;
+
+    /// Its `stdin`, where `exit` is written to stop it
+    int input = -1;
+
+    std::string log;
+};
+
+/// A connected client
+struct client
+{
+    std::shared_ptr<net::socket> socket;
+
+    /// Received bytes after the last complete frame
+    std::string partial;
+
+    /// Next message expected from each sender
+    std::vector<size_t> expected;
+
+    size_t received = 0;
+    size_t sent = 0;
+};
+
+/// Asks the kernel for a free loopback port.
+net::port_t freePort()
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd < 0 || ::bind(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 || ::getsockname(fd, (sockaddr*)&addr, &length) < 0)
+    {
+        throw std::runtime_error("Could not find a free port");
+    }
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/// The `server` binary in the directory of this one
+std::string defaultServer()
+{
+    char self[PATH_MAX];
+    const ssize_t n = ::readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0)
+    {
+        return "server";
+    }
+    self[n] = '\0';
+    return std::string(::dirname(self)) + "/server";
+}
+
+/// Starts the server with @p args, its output going to @p log.
+process spawn(const std::string& binary, const std::vector<std::string>& args, const std::string& log)
+{
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) < 0)
+    {
+        throw std::runtime_error("Could not create a pipe");
+    }
+
+    process p;
+    p.log = log;
+    p.pid = ::fork();
+    if (p.pid < 0)
+    {
+        throw std::runtime_error("Could not fork");
+    }
+    if (p.pid == 0)
+    {
+        const int out = ::open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ::dup2(fds[0], STDIN_FILENO);
+        ::dup2(out, STDOUT_FILENO);
+        ::dup2(out, STDERR_FILENO);
+
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const std::string& a : args)
+        {
+            argv.push_back(const_cast<char*>(a.c_str()));
+        }
+        argv.push_back(nullptr);
+        ::execv(binary.c_str(), argv.data());
+        ::_exit(127);
+    }
+
+    ::close(fds[0]);
+    p.input = fds[1];
+    return p;
+}
+
+/**
+ * Waits up to @p timeout for @p p to exit.
+ * @return `true` if it exited with status 0
+ */
+bool reap(process& p, const steady_clock_t::duration timeout)
+{
+    const steady_clock_t::time_point deadline = steady_clock_t::now() + timeout;
+    int status = 0;
+    pid_t done;
+    while ((done = ::waitpid(p.pid, &status, WNOHANG)) == 0 && steady_clock_t::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    if (done == 0)
+    {
+        ::kill(p.pid, SIGKILL);
+        ::waitpid(p.pid, &status, 0);
+        status = -1;
+    }
+    ::close(p.input);
+    p.pid = -1;
+    return status == 0;
+}
+
+/// Drives the clients while the server processes hand over to each other.
+class upgrade_run final
+{
+
+public:
+
+    upgrade_run(const options& opts, const net::port_t port)
+        : _opts(opts)
+        , _port(port)
+        , _epoll(::epoll_create1(EPOLL_CLOEXEC))
+        , _events(256)
+        , _clients(opts.clients)
+        , _disconnects(0)
+        , _outOfOrder(0)
+        , _longestGap(0)
+    {
+        for (client& c : _clients)
+        {
+            c.expected.assign(opts.clients, 0);
+        }
+    }
+
+    ~upgrade_run()
+    {
+        disconnect();
+        ::close(_epoll);
+    }
+
+    /// Connects and logs every client in, then reads until the login notifications stop.
+    void connect()
+    {
+        for (size_t i = 0; i < _clients.size(); ++i)
+        {
+            client& c = _clients[i];
+            c.socket = std::make_shared<net::socket>("127.0.0.1", _port);
+            c.socket->setBlocking(false);
+
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            ::epoll_ctl(_epoll, EPOLL_CTL_ADD, c.socket->fd(), &ev);
+
+            send(c, msg::json::to(msg::request::login(name(i)).toJson()));
+        }
+
+        const steady_clock_t::time_point quiet = steady_clock_t::now() + std::chrono::milliseconds(300);
+        poll(quiet);
+        _lastDelivery = steady_clock_t::time_point();
+    }
+
+    /**
+     * Sends every client's next message when it is due and reads until @p until.
+     * @return `false` once every message was sent
+     */
+    bool pump(const steady_clock_t::time_point start, const steady_clock_t::time_point until)
+    {
+        bool sending = false;
+        const steady_clock_t::time_point now = steady_clock_t::now();
+        for (size_t i = 0; i < _clients.size(); ++i)
+        {
+            client& c = _clients[i];
+
+            // spread the senders over the interval so the server sees a steady stream
+            const double offset = static_cast<double>(i) / static_cast<double>(_clients.size());
+            while (c.sent < _opts.messages
+                   && start + seconds((static_cast<double>(c.sent) + offset) / _opts.rate) <= now)
+            {
+                send(c, msg::json::to(msg::request::message(name(i), MARKER + std::to_string(i) + ":" + std::to_string(c.sent) + ";").toJson()));
+                ++c.sent;
+            }
+            sending |= c.sent < _opts.messages;
+        }
+
+        poll(until);
+        return sending;
+    }
+
+    /// Reads until every client received every message or @p deadline passes.
+    void finish(const steady_clock_t::time_point deadline)
+    {
+        while (missing() > 0 && steady_clock_t::now() < deadline)
+        {
+            poll(std::min(deadline, steady_clock_t::now() + std::chrono::milliseconds(50)));
+        }
+    }
+
+    /// Messages not received yet, over all clients
+    size_t missing() const
+    {
+        const size_t total = _opts.messages * _clients.size();
+        size_t missing = 0;
+        for (const client& c : _clients)
+        {
+            missing += total - std::min(total, c.received);
+        }
+        return missing;
+    }
+
+    size_t disconnects() const { return _disconnects; }
+
+    size_t outOfOrder() const { return _outOfOrder; }
+
+    /// Longest time without any delivery to any client while messages were expected
+    steady_clock_t::duration longestGap() const { return _longestGap; }
+
+    /// Closes every client.
+    void disconnect()
+    {
+        for (client& c : _clients)
+        {
+            if (c.socket && c.socket->isOpen())
+            {
+                c.socket->close();
+            }
+        }
+    }
+
+private:
+
+    static std::string name(const size_t i)
+    {
+        return "ut-" + std::to_string(::getpid()) + "-" + std::to_string(i);
+    }
+
+    static steady_clock_t::duration seconds(const double s)
+    {
+        return std::chrono::duration_cast<steady_clock_t::duration>(std::chrono::duration<double>(s));
+    }
+
+    void send(client& c, std::string frame)
+    {
+        // a request is small, the socket buffer of a client that reads everything never fills
+        frame.push_back('\n');
+        if (c.socket->isOpen() && c.socket->write(frame.data(), frame.size()) != static_cast<ssize_t>(frame.size()))
+        {
+            throw std::runtime_error("Could not send a request");
+        }
+    }
+
+    /// Reads what arrives until @p until.
+    void poll(const steady_clock_t::time_point until)
+    {
+        std::string data;
+        for (steady_clock_t::time_point now = steady_clock_t::now(); now < until; now = steady_clock_t::now())
+        {
+            const int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count()) + 1;
+            const int n = ::epoll_wait(_epoll, _events.data(), static_cast<int>(_events.size()), timeout);
+            for (int e = 0; e < n; ++e)
+            {
+                const size_t i = _events[e].data.u64;
+                client& c = _clients[i];
+                ssize_t read;
+                while ((read = c.socket->read(&data)) > 0)
+                {
+                    c.partial.append(data);
+                    frames(i, c);
+                }
+                if (read == 0 || !c.socket->isOpen())
+                {
+                    ++_disconnects;
+                    std::cerr << "Client " << i << " lost its connection" << std::endl;
+                    ::epoll_ctl(_epoll, EPOLL_CTL_DEL, c.socket->fd(), nullptr);
+                    c.socket->close();
+                }
+            }
+        }
+    }
+
+    /// Checks the complete frames received by client @p i.
+    void frames(const size_t i, client& c)
+    {
+        size_t start = 0;
+        size_t end;
+        while ((end = c.partial.find('\n', start)) != std::string::npos)
+        {
+            const size_t mark = c.partial.find(MARKER, start);
+            if (mark < end)
+            {
+                const char* p = c.partial.c_str() + mark + sizeof(MARKER) - 1;
+                char* rest;
+                const size_t sender = std::strtoull(p, &rest, 10);
+                const size_t sequence = std::strtoull(rest + 1, nullptr, 10);
+                if (sender < c.expected.size())
+                {
+                    if (sequence != c.expected[sender] && _outOfOrder++ < 10)
+                    {
+                        std::cerr << "Client " << i << " got message " << sequence << " of client " << sender
+                                  << ", expected " << c.expected[sender] << std::endl;
+                    }
+                    c.expected[sender] = sequence + 1;
+                    ++c.received;
+
+                    const steady_clock_t::time_point now = steady_clock_t::now();
+                    if (_lastDelivery != steady_clock_t::time_point())
+                    {
+                        _longestGap = std::max(_longestGap, now - _lastDelivery);
+                    }
+                    _lastDelivery = now;
+                }
+            }
+            start = end + 1;
+        }
+        c.partial.erase(0, start);
+    }
+
+    const options& _opts;
+    const net::port_t _port;
+    const int _epoll;
+    std::vector<epoll_event> _events;
+    std::vector<client> _clients;
+
+    size_t _disconnects;
+    size_t _outOfOrder;
+    steady_clock_t::time_point _lastDelivery;
+    steady_clock_t::duration _longestGap;
+};
+
+void usage(const char* const argv0)
+{
+    const options defaults;
+    std::cerr << "Usage: " << argv0 << " [options]" << std::endl
+              << "  --server PATH        Server binary (default: the one next to this tool)" << std::endl
+              << "  --clients N          Clients in the lobby (default " << defaults.clients << ")" << std::endl
+              << "  --messages N         Messages sent by each client (default " << defaults.messages << ")" << std::endl
+              << "  --rate F             Messages per second per client (default " << defaults.rate << ")" << std::endl
+              << "  --upgrades N         Takeovers while the clients send (default " << defaults.upgrades << ")" << std::endl
+              << "  --workers N          Server worker threads (default " << defaults.workers << ")" << std::endl
+              << "  --handoff-timeout S  Longest an old process may take to hand over (default " << defaults.handOffTimeout << ")" << std::endl;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    options opts;
+    opts.server = defaultServer();
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char* const o = argv[i];
+        const char* const v = argv[i + 1];
+        if (std::strcmp(o, "--server") == 0) opts.server = v;
+        else if (std::strcmp(o, "--clients") == 0) opts.clients = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(o, "--messages") == 0) opts.messages = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(o, "--rate") == 0) opts.rate = std::strtod(v, nullptr);
+        else if (std::strcmp(o, "--upgrades") == 0) opts.upgrades = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(o, "--workers") == 0) opts.workers = std::strtoull(v, nullptr, 10);
+        else if (std::strcmp(o, "--handoff-timeout") == 0) opts.handOffTimeout = std::strtod(v, nullptr);
+        else { usage(argv[0]); return EXIT_FAILURE; }
+    }
+    if (argc % 2 == 0 || opts.clients == 0 || opts.messages == 0 || opts.rate <= 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    se3313::logging::config diagnostics;
+    diagnostics.threshold = se3313::logging::level::WARN;
+    se3313::logging::configure(diagnostics);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    // the server logs, its upgrade socket and its message log, kept after a failure for a look
+    char dirTemplate[] = "/tmp/upgrade_test.XXXXXX";
+    if (!::mkdtemp(dirTemplate))
+    {
+        std::cerr << "Could not create a directory for the servers" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string dir = dirTemplate;
+    const net::port_t port = freePort();
+    std::vector<std::string> args = {
+        "--port", std::to_string(port),
+        "--upgrade-socket", dir + "/upgrade.sock",
+        "--log-dir", dir + "/log",
+        "--workers", std::to_string(opts.workers)
+    };
+
+    process current = spawn(opts.server, args, dir + "/server-0.log");
+    for (int attempt = 0; ; ++attempt)
+    {
+        try
+        {
+            net::socket probe("127.0.0.1", port);
+            break;
+        }
+        catch (const std::runtime_error&)
+        {
+            if (attempt == 250)
+            {
+                std::cerr << "The server did not start, see " << current.log << std::endl;
+                reap(current, std::chrono::seconds(0));
+                return EXIT_FAILURE;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+
+    upgrade_run run(opts, port);
+    run.connect();
+
+    // the takeovers are spread evenly over the time the clients send
+    const double duration = static_cast<double>(opts.messages) / opts.rate;
+    std::cout << opts.clients << " clients sending " << opts.messages << " messages each over " << std::fixed
+              << std::setprecision(1) << duration << " s, " << opts.upgrades << " upgrades" << std::endl;
+
+    args.push_back("--takeover");
+    args.push_back("1");
+    size_t upgraded = 0;
+    bool handedOff = true;
+    const steady_clock_t::time_point start = steady_clock_t::now();
+    for (size_t u = 1; u <= opts.upgrades && handedOff; ++u)
+    {
+        const steady_clock_t::time_point due = start + std::chrono::duration_cast<steady_clock_t::duration>(
+            std::chrono::duration<double>(duration * static_cast<double>(u) / static_cast<double>(opts.upgrades + 1)));
+        while (steady_clock_t::now() < due)
+        {
+            run.pump(start, std::min(due, steady_clock_t::now() + std::chrono::milliseconds(10)));
+        }
+
+        process next = spawn(opts.server, args, dir + "/server-" + std::to_string(u) + ".log");
+        const steady_clock_t::time_point asked = steady_clock_t::now();
+
+        // the old process exits once the new one holds everything, the clients go on meanwhile
+        const steady_clock_t::time_point deadline = asked + std::chrono::duration_cast<steady_clock_t::duration>(
+            std::chrono::duration<double>(opts.handOffTimeout));
+        int status = 0;
+        pid_t exited = 0;
+        while ((exited = ::waitpid(current.pid, &status, WNOHANG)) == 0 && steady_clock_t::now() < deadline)
+        {
+            run.pump(start, steady_clock_t::now() + std::chrono::milliseconds(5));
+        }
+
+        const double took = std::chrono::duration<double, std::milli>(steady_clock_t::now() - asked).count();
+        if (exited == current.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            ::close(current.input);
+            std::cout << "Upgrade " << u << ": process " << current.pid << " handed over to " << next.pid
+                      << " and exited after " << std::setprecision(1) << took << " ms" << std::endl;
+            ++upgraded;
+        }
+        else
+        {
+            std::cerr << "Upgrade " << u << ": process " << current.pid << " did not hand over, see "
+                      << current.log << " and " << next.log << std::endl;
+            if (exited == 0)
+            {
+                reap(current, std::chrono::seconds(0));
+            }
+            handedOff = false;
+        }
+        current = next;
+    }
+
+    while (run.pump(start, steady_clock_t::now() + std::chrono::milliseconds(10)))
+    {
+    }
+    run.finish(steady_clock_t::now() + std::chrono::seconds(10));
+
+    const size_t missing = run.missing();
+    const size_t total = opts.clients * opts.messages * opts.clients;
+    std::cout << std::endl
+              << "Upgrades:     " << upgraded << " of " << opts.upgrades << std::endl
+              << "Delivered:    " << total - missing << " of " << total << " messages" << std::endl
+              << "Out of order: " << run.outOfOrder() << std::endl
+              << "Disconnects:  " << run.disconnects() << std::endl
+              << "Longest gap:  " << std::setprecision(1)
+              << std::chrono::duration<double, std::milli>(run.longestGap()).count() << " ms without a delivery" << std::endl;
+
+    const bool passed = handedOff && upgraded == opts.upgrades && missing == 0 && run.outOfOrder() == 0 && run.disconnects() == 0;
+
+    // the clients go first, so the server exiting is not taken for a dropped connection
+    run.disconnect();
+    if (::write(current.input, "exit\n", 5) != 5 || !reap(current, std::chrono::seconds(10)))
+    {
+        std::cerr << "The last server did not exit cleanly, see " << current.log << std::endl;
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    if (passed)
+    {
+        std::system(("rm -rf '" + dir + "'").c_str());
+    }
+    else
+    {
+        std::cout << "Server output is in " << dir << std::endl;
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
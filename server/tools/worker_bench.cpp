@@ -0,0 +1,192 @@
+/**
+ * Throughput of the request pipeline as the worker count varies.
+ * 
+ * Frames from a number of simulated senders are pushed through a @c dzagar::worker_pool the way 
+ * `server::process()` handles them: a worker decodes each request, visits it on the one visitor every worker 
+ * shares under one mutex, encodes the response outside the lock, then posts it back to the thread in 
+ * `flex_waiter::wait()`, which counts it. Prints requests per second for each worker count.
+ */
+
+#include "worker_pool.hpp"
+
+#include <msg/json.hpp>
+#include <msg/message.hpp>
+#include <msg/visitor.hpp>
+
+#include <networking/flex_waiter.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace msg = se3313::msg;
+namespace net = se3313::networking;
+
+using dzagar::worker_pool;
+
+namespace
+{
+
+/// Answers every message request like the server does, the state it would touch is behind the caller's lock.
+class echo_visitor final : public msg::request::abstract_message_visitor<>
+{
+    
+public:
+    
+    return_t visitMessage(const msg::request::message& req) override
+    {
+        return std::make_shared<msg::response::message>(req.sender(), req.content(), req.room());
+    }
+    
+    return_t error(const std::string& origSender, const msg::ErrorCode errCode, const std::string& msgStr) override
+    {
+        return std::make_shared<msg::response::error>(origSender, errCode, msgStr);
+    }
+};
+
+/// Counts deliveries on the waiting thread
+class counter final : public net::flex_waiter::activity_visitor
+{
+    
+public:
+    
+    void onSocket(const net::flex_waiter::socket_ptr_t) override {}
+    
+    void onSTDIN(const std::string&) override {}
+    
+    size_t delivered = 0;
+    
+    size_t bytes = 0;
+};
+
+/// Parses a comma separated list of worker counts
+std::vector<size_t> parseList(const char* const value)
+{
+    std::vector<size_t> out;
+    std::istringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        out.push_back(std::strtoull(item.c_str(), nullptr, 10));
+    }
+    
+    return out;
+}
+
+/// Runs @p frames through a pool of @p workers, returning requests per second
+double run(const size_t workers, const std::vector<std::string>& frames, const size_t senders)
+{
+    const std::shared_ptr<net::flex_waiter> waiter = std::make_shared<net::flex_waiter>();
+    const std::shared_ptr<counter> sink = std::make_shared<counter>();
+    
+    const auto start = std::chrono::steady_clock::now();
+    {
+        // one visitor behind one lock, as the server visits every request under _mut_state, both outlive the pool
+        echo_visitor visitor;
+        std::mutex mut_visit;
+        worker_pool pool(workers);
+        
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            const size_t sender = i % senders;
+            const std::string* const frame = &frames[i];
+            pool.submit(sender, [&visitor, &mut_visit, frame, waiter, sink, workers]() {
+                boost::property_tree::ptree json = msg::json::from(*frame);
+                std::shared_ptr<msg::instance> res;
+                {
+                    std::lock_guard<std::mutex> lock(mut_visit);
+                    res = visitor.visit(json);
+                }
+                const std::shared_ptr<std::string> out = std::make_shared<std::string>(msg::json::to(res->toJson()));
+                
+                const auto count = [sink, out]() { ++sink->delivered; sink->bytes += out->size(); };
+                if (workers == 0)
+                {
+                    count();
+                }
+                else
+                {
+                    waiter->post(count);
+                }
+            });
+        }
+        
+        while (sink->delivered < frames.size())
+        {
+            waiter->wait(sink, std::chrono::milliseconds(100));
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    return frames.size() / elapsed.count();
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+    size_t messages = 100000;
+    size_t senders = 64;
+    size_t contentBytes = 64;
+    std::vector<size_t> workerCounts = { 0, 1, 2, 4, 8 };
+    
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--messages") == 0)
+        {
+            messages = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--senders") == 0)
+        {
+            senders = std::max<size_t>(1, std::strtoull(argv[i + 1], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--content-bytes") == 0)
+        {
+            contentBytes = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--workers") == 0)
+        {
+            workerCounts = parseList(argv[i + 1]);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--messages N] [--senders N] [--content-bytes N] [--workers 0,1,2,...]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    std::vector<std::string> frames;
+    frames.reserve(messages);
+    for (size_t i = 0; i < messages; ++i)
+    {
+        const std::string sender = "user" + std::to_string(i % senders);
+        frames.push_back(msg::json::to(msg::request::message(sender, std::string(contentBytes, 'x'), "lobby").toJson()));
+    }
+    
+    std::cout << messages << " requests from " << senders << " senders, " << contentBytes << " content bytes each, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    std::cout << std::setw(8) << "workers" << std::setw(16) << "requests/s" << std::setw(10) << "speedup" << std::endl;
+    
+    double baseline = 0;
+    for (const size_t workers : workerCounts)
+    {
+        const double rate = run(workers, frames, senders);
+        if (baseline == 0)
+        {
+            baseline = rate;
+        }
+        
+        std::cout << std::setw(8) << workers << std::setw(16) << std::fixed << std::setprecision(0) << rate 
+                  << std::setw(9) << std::setprecision(2) << rate / baseline << "x" << std::endl;
+    }
+    
+    return EXIT_SUCCESS;
+}